@@ -4,8 +4,15 @@
 #include "drivers/hal_cnt.hh"
 #include "etna.hh"
 #include "etna_3d.hh"
+#include "etna_bundle.hh"
+#include "etna_damage.hh"
+#include "etna_frame.hh"
+#include "etna_mesh.hh"
+#include "etna_profile.hh"
+#include "etna_swapchain.hh"
 #include "ltdc.hh"
 #include "panel_etml0700z9.hh"
+#include "perfmon.hh"
 #include "print/print.hh"
 #include <algorithm>
 #include <array>
@@ -35,12 +42,18 @@ constexpr float BX = 2.3f, BY = 1.3f;			 // world XY bounce bounds (keep cubes o
 constexpr float PZ_NEAR = -2.0f, PZ_FAR = -9.0f; // depth-drift range (near..far, no clipper)
 
 constexpr uint32_t NCubes = 12;
+constexpr uint32_t NBuffers = 3; // swapchain depth (etna_swapchain.hh): 2 caps at 30 fps
 struct Cube {
 	float px, py, pz;		   // world position (pz negative = into the screen)
 	float vx, vy, vz;		   // world velocity per frame (vz = depth drift)
 	float angle, rate;		   // spin
 	float tilt_amp, tilt_freq; // X-axis wobble
 };
+
+// One frame's DDR traffic over time (perfmon.hh), once the animation is
+// steady: DDRPERFM and the GPU's own byte counters every TracePeriodUs.
+constexpr uint32_t TraceFrame = 240;
+constexpr uint32_t TracePeriodUs = 100;
 } // namespace
 
 void panic()
@@ -62,31 +75,48 @@ int main()
 		print("FAILED: GPU init\n");
 		panic();
 	}
+	perfmon::ddr_init();
 
 	etna::Bo rt = gpu.alloc(RtSize);
 	etna::Bo depth = gpu.alloc(DepthSize);
-	std::array<etna::Bo, 2> fbs = {gpu.alloc(FbSize), gpu.alloc(FbSize)}; // full-screen double buffer
-	std::array<etna::Bo, NCubes> vtxs;									  // per-cube colored geometry
-
-	for (auto &b : vtxs)
-		b = gpu.alloc(sizeof(kCubeVerts));
-
-	etna::Bo vs = gpu.alloc(sizeof(kCubeVs));
+	// Tile status for both (etna_ts.hh): a frame's clears write these ~14 KB
+	// instead of the 3.6 MB of the targets themselves.
+	etna::Bo rt_tsb = gpu.alloc(etna::ts_bytes(RtSize));
+	etna::Bo depth_tsb = gpu.alloc(etna::ts_bytes(DepthSize));
+	etna::TileStatus rt_ts{&rt_tsb}, depth_ts{&depth_tsb};
+	std::array<etna::Bo, NBuffers> fbs;	  // full-screen swapchain buffers
+	std::array<etna::Bo, NBuffers> insts; // per-buffer CubeInstance records
+
+	// Every cube is the same mesh -- grey-shaded faces, unique vertices plus an
+	// index buffer -- drawn once per frame with NCubes instances.
+	static constexpr auto kCubeMesh = etna::dedup_mesh<7>(kCubeVerts);
+	etna::Bo vtx = gpu.alloc(kCubeMesh.vertex_bytes());
+	etna::Bo idx = gpu.alloc(kCubeMesh.index_bytes());
+
+	for (auto &fb : fbs)
+		fb = gpu.alloc(FbSize);
+
+	for (auto &b : insts)
+		b = gpu.alloc(NCubes * sizeof(CubeInstance));
+
+	etna::Bo vs = gpu.alloc(sizeof(kCubeInstancedVs));
 	etna::Bo ps = gpu.alloc(sizeof(kCubeFs));
 
-	if (!rt || !depth || !fbs[0] || !fbs[1] || !vtxs[NCubes - 1] || !vs || !ps) {
+	if (!rt || !depth || !rt_tsb || !depth_tsb || !fbs[NBuffers - 1] || !insts[NBuffers - 1] || !vtx || !idx || !vs ||
+		!ps) {
 		print("FAILED: buffer alloc\n");
 		panic();
 	}
 
-	std::ranges::copy(kCubeVs, vs.span<uint32_t>().begin());
+	std::ranges::copy(kCubeInstancedVs, vs.span<uint32_t>().begin());
 	vs.cpu_fini(etna::RelocWrite);
 
 	std::ranges::copy(kCubeFs, ps.span<uint32_t>().begin());
 	ps.cpu_fini(etna::RelocWrite);
 
-	// Per-cube geometry: each cube a distinct base hue, its 6 faces shaded so the
-	// 3D structure still reads (faces are the same hue at different brightness).
+	// Each cube a distinct base hue (its instance tint), times the mesh's face
+	// shades so the 3D structure still reads (faces are the same hue at
+	// different brightness).
 	static const std::array<std::array<float, 3>, 10> baseColor = {{
 		{1.0f, 0.35f, 0.35f}, // red
 		{0.4f, 0.9f, 0.4f},	  // green
@@ -100,19 +130,22 @@ int main()
 		{0.85f, 0.85f, 0.95f} // white
 	}};
 	static const float faceShade[6] = {1.0f, 0.78f, 0.6f, 0.9f, 0.68f, 0.5f};
-	for (uint32_t i = 0; i < NCubes; i++) {
-		std::array<std::array<float, 4>, 6> fc;
-		for (unsigned f = 0; f < 6; f++)
-			fc[f] = {baseColor[i % 10][0] * faceShade[f],
-					 baseColor[i % 10][1] * faceShade[f],
-					 baseColor[i % 10][2] * faceShade[f],
-					 1.0f};
-		std::ranges::copy(cube_verts(fc), vtxs[i].span<float>().begin());
-		vtxs[i].cpu_fini(etna::RelocWrite);
+	std::array<std::array<float, 4>, 6> fc;
+	for (unsigned f = 0; f < 6; f++)
+		fc[f] = {faceShade[f], faceShade[f], faceShade[f], 1.0f};
+	auto mesh = etna::dedup_mesh<7>(cube_verts(fc));
+	if (mesh.indices != kCubeMesh.indices) { // the faces must differ in shade
+		print("FAILED: the grey cube doesn't match the index buffer\n");
+		panic();
 	}
-
-	// Paint both buffers once so the first render isn't garbage (the whole
-	// RT is resolved every frame, so nothing here leaks into the animation).
+	std::copy_n(mesh.vertices.begin(), mesh.vertex_count * 7, vtx.span<float>().begin());
+	vtx.cpu_fini(etna::RelocWrite);
+	std::ranges::copy(kCubeMesh.indices, idx.span<uint16_t>().begin());
+	idx.cpu_fini(etna::RelocWrite);
+
+	// Paint every buffer once so the first render isn't garbage (each
+	// buffer's first frame resolves the whole RT, so nothing here leaks into
+	// the animation).
 	for (auto &fb : fbs) {
 		std::ranges::fill(fb.span<uint32_t>(), Background);
 		fb.cpu_fini(etna::RelocWrite);
@@ -134,49 +167,102 @@ int main()
 		cubes[i].tilt_freq = 0.6f + 0.18f * float(i % 5); // 0.6 .. 1.32
 	}
 
-	auto cs = gpu.new_cmd_stream(256);	 // clear / resolve
-	auto csd = gpu.new_cmd_stream(1024); // per-cube draw
-
-	// Render the whole scene into `fb`: clear the shared RT+depth, draw every cube
-	// (depth-tested against each other), then resolve the full RT to the fb.
-	auto render_scene = [&](etna::Bo &fb) -> bool {
-		cs.reset();
-		etna::clear(cs, rt, rtpw, rtph, Background);
-		etna::clear(cs, depth, rtpw, DepthSize / (rtpw * 4), 0xFFFFFFFF); // D16 far
-		if (!gpu.submit_and_wait(cs))
-			return false;
-
+	// The frame's draw commands never change -- the cubes' MVPs live in the
+	// instance buffer, not in the stream -- so the fast clears and one
+	// instanced draw of every cube are recorded once per fb through a Frame
+	// (etna_frame.hh) into a bundle (etna_bundle.hh), with PE drains only
+	// where the RS and the 3D pipe hand the render target over. The resolve
+	// into the back fb does change: it covers only the fb's damage rectangles
+	// (etna_damage.hh), so it is a small bundle re-recorded every frame and
+	// chained behind the draws -- still one submission per frame.
+	std::array<etna::Bundle, NBuffers> frame_b;
+	std::array<etna::Bundle, NBuffers> resolve_b;
+	static etna::StateTracker st;
+	etna::Frame::Stats rec{};
+	bool recorded = true;
+	for (uint32_t f = 0; f < NBuffers; f++) {
+		frame_b[f] = etna::Bundle{gpu.new_cmd_stream(2048)};
+		resolve_b[f] = etna::Bundle{gpu.new_cmd_stream(256)};
+		etna::Frame fr{frame_b[f].cs(), &st};
+		fr.begin();
+		fr.fast_clear(rt_ts, Background);
+		fr.fast_clear(depth_ts, etna::ts_depth_clear_value(0xFFFF)); // D16 far
+		fr.draw({
+			.rt = &rt,
+			.rt_stride = RtStride,
+			.vtx = &vtx,
+			.vtx_stride = 28,
+			.vs = &vs,
+			.vs_words = kCubeInstancedVs.size(),
+			.vs_temps = 8,
+			.ps = &ps,
+			.ps_words = kCubeFs.size(),
+			.ps_temps = 2,
+			.ps_out_reg = 1,
+			.width = HActive,
+			.height = VActive,
+			.vertex_count = kCubeMesh.index_count,
+			.depth = &depth,
+			.depth_stride = DepthStride,
+			.index = &idx,
+			.instances = NCubes,
+			.inst = &insts[f],
+			.inst_stride = sizeof(CubeInstance),
+			.inst_vec4s = kCubeInstanceVec4s,
+			.rt_ts = rt_ts,
+			.depth_ts = depth_ts,
+		});
+		fr.end();
+		recorded &= frame_b[f].end();
+		rec = fr.stats();
+	}
+	if (!recorded) {
+		print("FAILED: recording frames\n");
+		panic();
+	}
+	print("Frame: ", rec.ops, " ops, ", rec.drains, " drains, ", rec.dwords, " dwords recorded\n");
+
+	// Render the whole scene into fbs[which]: fast-clear the shared RT+depth, draw
+	// every cube (depth-tested against each other), then resolve into the fb
+	// what it shows of the frame before plus what this one drew (the
+	// DamageTracker): the rest of the fb is background already. Per frame the
+	// CPU rewrites the buffer's instance records and its resolve bundle.
+	// The buffer came from the swapchain, so its previous frame has been shown
+	// and its fence has signalled (the GPU is done reading those records and
+	// that bundle); the wait just retires it (and keeps the ring's event ids
+	// recycling) -- it doesn't block.
+	std::array<etna::Fence, NBuffers> fences{};
+	etna::DamageTracker damage{NBuffers, HActive, VActive};
+	uint32_t resolved_px = 0; // since the last stats line
+	auto render_scene = [&](uint32_t which) -> etna::Fence {
+		if (fences[which] && !gpu.wait(fences[which]))
+			return etna::Fence{};
+		auto recs = insts[which].span<CubeInstance>();
+		etna::DamageRegion drawn = damage.region();
 		for (uint32_t i = 0; i < NCubes; i++) {
 			const Cube &cb = cubes[i];
-			csd.reset();
-			Mat4 m = cube_mvp(cb.angle, cb.tilt_amp * tsin(cb.angle * cb.tilt_freq), Aspect, cb.px, cb.py, cb.pz);
-			etna::MeshDraw d{
-				.rt = &rt,
-				.rt_stride = RtStride,
-				.vtx = &vtxs[i],
-				.vtx_stride = 28,
-				.vs = &vs,
-				.vs_words = kCubeVs.size(),
-				.vs_temps = 4,
-				.ps = &ps,
-				.ps_words = kCubeFs.size(),
-				.ps_temps = 2,
-				.ps_out_reg = 1,
-				.uniforms = m,
-				.width = HActive,
-				.height = VActive,
-				.vertex_count = 36,
-				.depth = &depth,
-				.depth_stride = DepthStride,
-			};
-			etna::emit_mesh(csd, d);
-			if (!gpu.submit_and_wait(csd))
-				return false;
+			recs[i].mvp = cube_mvp(cb.angle, cb.tilt_amp * tsin(cb.angle * cb.tilt_freq), Aspect, cb.px, cb.py, cb.pz);
+			recs[i].tint = {baseColor[i % 10][0], baseColor[i % 10][1], baseColor[i % 10][2], 1.0f};
+			drawn.add(cube_bounds(recs[i].mvp, HActive, VActive));
 		}
-
-		cs.reset();
-		etna::resolve(cs, fb, rt, HActive, VActive, RtStride, FbStride);
-		return gpu.submit_and_wait(cs);
+		insts[which].cpu_fini(etna::RelocWrite);
+
+		const etna::DamageRegion region = damage.update(which, drawn);
+		etna::CmdStream rcs = resolve_b[which].cs();
+		rcs.reset();
+		resolve_b[which] = etna::Bundle{rcs};
+		etna::Frame fr{resolve_b[which].cs()};
+		fr.begin();
+		for (const etna::Rect &r : region.rects())
+			fr.resolve_rect(fbs[which], rt, rt_ts, r, RtStride, FbStride);
+		fr.end();
+		if (!resolve_b[which].end())
+			return etna::Fence{};
+		resolved_px += region.area();
+
+		etna::Bundle *chain[] = {&frame_b[which], &resolve_b[which]};
+		fences[which] = gpu.submit_chain(chain);
+		return fences[which];
 	};
 
 	auto move_cubes = [&] {
@@ -204,38 +290,81 @@ int main()
 	print("Display up: ", NCubes, " cubes\n");
 	print("Spinning...\n");
 
-	uint32_t cur = 1; // fbs[0] is being scanned; render into fbs[1] first
+	// The CPU records frame N+1 while the GPU renders N and the LTDC shows
+	// N-1; the vblank IRQ flips to each frame once its fence has signalled.
+	static_assert(NBuffers == 3, "list every buffer here");
+	static etna::Swapchain sc{{fbs[0].gpu_addr(), fbs[1].gpu_addr(), fbs[2].gpu_addr()}}; // fbs[0] is on screen
+	ltdc_set_callback([&gpu] {
+		if (uint32_t a = sc.vblank([&gpu](etna::Fence f) { return gpu.signaled(f); }))
+			ltdc_set_framebuffer(a); // latches at the next vblank
+	});
+
 	uint32_t frames = 0;
 	auto t0 = read_cntpct();
 	const uint32_t tick_khz = read_cntfreq() / 1000;
 	uint32_t worst_us = 0;
-
-	// Flag for telling us when buffer is ready to swap
-	std::atomic<bool> frame_ready{};
-	ltdc_set_callback([&] { frame_ready.store(true, std::memory_order_release); });
+	uint32_t submits0 = gpu.ring().submitted();
+	etna::Swapchain::Stats s0 = sc.stats();
+	static perfmon::DdrRing ddr_trace;
+	static etna::GpuProfiler prof;
+	bool traced = false;
 
 	while (true) {
-		if (!frame_ready.load(std::memory_order_acquire))
+		int cur = sc.acquire();
+		if (cur < 0) {
+			asm volatile("wfe"); // every buffer queued or on screen: the next vblank frees one
 			continue;
-		frame_ready.store(false, std::memory_order_release);
+		}
+
+		// The traced frame is sampled from its recording until its fence
+		// signals. Waiting for it and printing the trace stalls the loop, so
+		// the stats start over after it.
+		const bool trace = !traced && frames == TraceFrame;
+		if (trace) {
+			prof.start(); // the GPU's byte counters
+			perfmon::ddr_sample_start(ddr_trace, TracePeriodUs, etna::kGpuDdrTaps);
+		}
 
 		auto r0 = read_cntpct();
-		if (!render_scene(fbs[cur])) {
+		etna::Fence f = render_scene(cur);
+		if (!f) {
 			gpu.dump_status("scene");
 			panic();
 		}
+		sc.present(cur, f);
 		worst_us = std::max<uint32_t>(worst_us, (read_cntpct() - r0) * 1000 / tick_khz);
-
-		ltdc_set_framebuffer(fbs[cur].gpu_addr()); // vblank-latched flip
-		cur ^= 1;
 		move_cubes();
 
+		if (trace) {
+			gpu.wait(f);
+			perfmon::ddr_sample_stop();
+			prof.stop();
+			perfmon::ddr_print_trace("render_scene", ddr_trace, etna::kGpuDdrTaps);
+			traced = true;
+			frames = 0;
+			t0 = read_cntpct();
+			worst_us = 0;
+			submits0 = gpu.ring().submitted();
+			resolved_px = 0;
+			s0 = sc.stats();
+			continue;
+		}
+
 		if (++frames % 120 == 0) {
 			auto now = read_cntpct();
-			uint32_t us = (now - t0) * 1000 / 120 / tick_khz;
-			print(us ? 1000000 / us : 0, " fps, worst render ", worst_us, " us\n");
+			auto s = sc.stats();
+			uint32_t flips = s.flips - s0.flips;
+			uint32_t us = flips ? (now - t0) * 1000 / flips / tick_khz : 0;
+			uint32_t submits = gpu.ring().submitted() - submits0; // incl. any ring markers
+			print(us ? 1000000 / us : 0, " fps, worst record+submit ", worst_us, " us, ");
+			print(frame_b[cur].dwords(), " dwords + ", submits / 120, ".", submits * 10 / 120 % 10, " submits/frame, ");
+			print("resolved ", resolved_px / 120 * 100 / (HActive * VActive), "% of the screen, ");
+			print("missed ", s.missed_gpu - s0.missed_gpu, " (GPU late) + ", s.missed_cpu - s0.missed_cpu, " (CPU late)\n");
 			t0 = now;
 			worst_us = 0;
+			submits0 = gpu.ring().submitted();
+			resolved_px = 0;
+			s0 = s;
 		}
 	}
 }
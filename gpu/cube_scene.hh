@@ -1,4 +1,5 @@
 #pragma once
+#include "etna_damage.hh"
 #include <array>
 #include <cstdint>
 
@@ -67,6 +68,52 @@ inline constexpr auto kCubeVs = [] {
 	return c;
 }();
 
+// clip = M * v, with M's columns in the 4 consecutive registers from `m`
+// (u0..u3 for a per-draw uniform matrix, or temps holding per-instance
+// attributes) and v in temp `v` (its w = 1.0 from the NFE vec3 default).
+// MUL + 3x MAD accumulating in temp `acc`; the last MAD writes `dst`, which
+// may be one of the column temps -- they have all been read by then.
+constexpr std::array<std::array<uint32_t, 4>, 4> mat4_transform(uint32_t dst, Src m, uint32_t v, uint32_t acc)
+{
+	constexpr uint32_t bcast[4] = {0x00, 0x55, 0xAA, 0xFF}; // .xxxx .yyyy .zzzz .wwww
+	std::array<std::array<uint32_t, 4>, 4> p{};
+	for (uint32_t col = 0; col < 4; col++) {
+		Src mc = m;
+		mc.reg = m.reg + col;
+		Src vc{.reg = v, .swiz = bcast[col]};
+		p[col] = col == 0 ? alu_inst(0x03, acc, mc, vc, kNoSrc)
+						  : alu_inst(0x02, col == 3 ? dst : acc, mc, vc, Src{.reg = acc});
+	}
+	return p;
+}
+// It must reproduce kCubeVs's hardware-proven transform.
+static_assert([] {
+	auto p = mat4_transform(2, Src{.reg = 0, .rgroup = 2}, 0, 2);
+	for (unsigned i = 0; i < 16; i++)
+		if (p[i / 4][i % 4] != kCubeVs[i])
+			return false;
+	return true;
+}());
+
+// Instanced VS (MeshDraw::instances / inst): the same transform, with the
+// matrix from the per-instance attributes t2..t5 instead of uniforms, and the
+// vertex color t1 multiplied by a per-instance tint t6 (CubeInstance below).
+// Outputs where kCubeVs puts them -- position t2, varying t3, both free once
+// read -- so it links with the same FS. 8 temps.
+inline constexpr uint32_t kCubeInstanceVec4s = 5; // MeshDraw::inst_vec4s
+inline constexpr auto kCubeInstancedVs = [] {
+	std::array<uint32_t, 5 * 4> c{};
+	auto put = [&](unsigned i, std::array<uint32_t, 4> w) {
+		for (unsigned j = 0; j < 4; j++)
+			c[i * 4 + j] = w[j];
+	};
+	auto xf = mat4_transform(2, Src{.reg = 2}, 0, 7); // t7 = t2*t0.x + ..., t2 = ... + t5*t0.w
+	for (unsigned i = 0; i < 4; i++)
+		put(i, xf[i]);
+	put(4, alu_inst(0x03, 3, Src{.reg = 1}, Src{.reg = 6}, kNoSrc)); // MUL t3, t1, t6
+	return c;
+}();
+
 // FS: output the interpolated color varying (arrives in t1); ps_color_out = 1.
 // Built by the same builder; must equal the hardware-proven kPsColorCode.
 inline constexpr auto kCubeFs = alu_inst(0x09, 1, kNoSrc, kNoSrc, Src{.reg = 1});
@@ -108,6 +155,14 @@ inline Mat4 mat_mul(const Mat4 &a, const Mat4 &b)
 	return r;
 }
 
+// One record of kCubeInstancedVs's per-instance stream (MeshDraw::inst,
+// inst_stride = sizeof, inst_vec4s = kCubeInstanceVec4s).
+struct CubeInstance {
+	Mat4 mvp;				  // attributes 2..5 -> t2..t5 (columns)
+	std::array<float, 4> tint; // attribute 6 -> t6, times the vertex color
+};
+static_assert(sizeof(CubeInstance) == kCubeInstanceVec4s * 16);
+
 // Model-view-projection: rotate the cube (Y spin + X tilt), translate it to
 // world (px, py, pz) (default 0,0,-3), project with f = 2 (zn = 1, zf = 10).
 // Cube half-size 0.5. `aspect` = viewport width/height so the cube stays cubic on
@@ -126,6 +181,14 @@ inline Mat4 cube_mvp(float angle, float tilt, float aspect = 1.0f, float px = 0.
 	return mat_mul(proj, mat_mul(tr, mat_mul(rx, ry)));
 }
 
+// The pixels of a width x height viewport a cube drawn with `mvp` can cover
+// (its damage rectangle, etna_damage.hh).
+inline etna::Rect cube_bounds(const Mat4 &mvp, uint32_t width, uint32_t height)
+{
+	constexpr float lo[3] = {-0.5f, -0.5f, -0.5f}, hi[3] = {0.5f, 0.5f, 0.5f};
+	return etna::project_box(mvp, lo, hi, width, height);
+}
+
 // --- cube geometry: 36 verts x (pos vec3 + color vec4), solid color per face --
 inline constexpr std::array<std::array<float, 4>, 6> kFaceColors = {{
 	{1, 0, 0, 1}, // +X red
@@ -1,4 +1,7 @@
 #include "etna.hh"
+#include "etna_bundle.hh"
+#include "etna_timeline.hh"
+#include "etna_trace.hh"
 #include "aarch64/system_reg.hh" // cache ops, read_cntpct/read_cntfreq
 #include "drivers/hal_cnt.hh"	 // udelay
 #include "drivers/rcc.hh"
@@ -8,6 +11,7 @@
 #include "interrupt/interrupt.hh" // InterruptManager (GPU IRQ)
 #include "print/print.hh"
 #include "stm32mp2xx.h"
+#include <algorithm>
 
 // PMIC buck3 fallback (pmic.cc) -- only used if TF-A did not enable VDDGPU.
 bool enable_buck3_on_pmic();
@@ -25,7 +29,13 @@ namespace
 // GPU buffers live in a fixed DDR region starting at 0x9000'0000 (normal, secure, cacheable)
 constexpr uint32_t PoolBase = 0x90000000;
 constexpr uint32_t PoolSize = 64 * 1024 * 1024;
-uint32_t pool_next = PoolBase;
+
+// Static, not a Gpu member: the allocator metadata is ~13 KB and callers keep
+// their Gpu on the stack. There is one GPU, so one pool.
+Heap pool{PoolBase, PoolSize};
+
+// Same reasoning: the shader cache's table lives beside the pool it draws on.
+ShaderCache shader_cache;
 
 // Even with buck3 up, the GPU domain is electrically isolated until software
 // confirms the supply with the PWR voltage monitor and sets "supply valid".
@@ -208,6 +218,12 @@ void Bo::cpu_fini(uint32_t op) const
 		clean_dcache_range(map(), bytes);
 }
 
+void Bo::cpu_fini(uint32_t op, uint32_t offset, uint32_t len) const
+{
+	if ((op & RelocWrite) && cacheable && len)
+		clean_dcache_range(static_cast<uint8_t *>(map()) + offset, len);
+}
+
 // =============================================================================
 //  CmdStream
 // =============================================================================
@@ -218,21 +234,6 @@ void CmdStream::reserve(uint32_t n)
 		print("etna: CmdStream overflow (need ", int(len_ + n), " of ", int(buf_.size()), " dwords)\n");
 }
 
-void CmdStream::emit_reloc(const Reloc &r)
-{
-	// Identity map: the GPU address is just the buffer's physical address.
-	// (Access intent r.flags is recorded conceptually; automatic cache/fence
-	// tracking off the reloc list is a later enhancement.)
-	emit(r.bo->gpu_addr() + r.offset);
-}
-
-void CmdStream::stall(uint32_t from, uint32_t to)
-{
-	set_state(GL_SEMAPHORE_TOKEN, sync_token(from, to));
-	emit(CMD_STALL);
-	emit(sync_token(from, to));
-}
-
 bool gpu_mmu_enable();
 
 // =============================================================================
@@ -338,9 +339,7 @@ bool Gpu::ring_init()
 	ring[3] = ring_base_ + 0; // link back to the WAIT at offset 0
 	dsb_sy();
 
-	ring_tail_ = 0; // the WAIT the FE idles on
-	ring_head_ = 4; // next free dword (qword-aligned)
-	next_event_ = 1;
+	ring_.init(ring_dwords_); // FE idles on the home WAIT; blocks start at dword 4
 	intr_acc_.store(0);
 
 	// AXI cache attributes: AWCACHE(2)|ARCACHE(2) = "modifiable/bufferable" --
@@ -366,9 +365,14 @@ bool Gpu::ring_init()
 	// Shader ALU flip-flop reset ("flop_reset"). The shader cores' ALU
 	// flip-flops come up uninitialized; the vendor runs its dp2x8 kernel once at
 	// GPU init to toggle them into a known state.
-	if (Bo win = alloc(4096), wout = alloc(4096); win && wout)
-		if (Kernel k = make_kernel(*this, ppu::build_dp2x8_shader))
+	Bo win = alloc(4096), wout = alloc(4096);
+	if (win && wout)
+		if (Kernel k = make_kernel(*this, ppu::build_dp2x8_shader)) {
 			compute(*this, k, wout, win, 128, 32);
+			put_shader(k.binary);
+		}
+	free(win);
+	free(wout);
 	return true;
 }
 
@@ -379,81 +383,362 @@ bool Gpu::ring_init()
 void Gpu::on_irq()
 {
 	uint32_t ack = gpu_read(HI_INTR_ACKNOWLEDGE);
-	if (ack)
+	if (ack) {
+		const uint64_t now = read_cntpct();
+		for (uint32_t ev = ack & ((1u << RingTracker::kNumEvents) - 1); ev; ev &= ev - 1)
+			stamps_[__builtin_ctz(ev)] = now;
 		intr_acc_.fetch_or(ack, std::memory_order_release);
+	}
 	asm volatile("sev" ::: "memory");
 }
 
 Bo Gpu::alloc(uint32_t bytes, uint32_t align, bool cacheable)
 {
-	uint32_t base = (pool_next + (align - 1)) & ~(align - 1);
-	uint32_t next = base + ((bytes + 63) & ~63u); // round size up to a cache line
-	if (next > PoolBase + PoolSize) {
-		print("etna: GPU pool exhausted (need ", int(bytes), " bytes)\n");
+	uint32_t base = pool.alloc(bytes, align);
+	if (!base) {
+		auto st = pool.stats();
+		print("etna: GPU pool exhausted (need ", int(bytes), " bytes, largest free ", int(st.largest_free), ")\n");
 		return Bo{}; // null
 	}
-	pool_next = next;
 	return Bo{.phys = base, .bytes = bytes, .cacheable = cacheable};
 }
 
+void Gpu::free(Bo &bo)
+{
+	if (bo && !pool.free(bo.phys))
+		print("etna: free of unallocated Bo 0x", Hex{bo.phys}, "\n");
+	bo = Bo{};
+}
+
 CmdStream Gpu::new_cmd_stream(uint32_t words)
 {
 	Bo bo = alloc(words * 4, 64);
-	return CmdStream{bo, words};
+	return CmdStream{bo, bo ? words : 0};
 }
 
-Fence Gpu::submit(CmdStream &cs)
+void Gpu::free(CmdStream &cs)
+{
+	Bo bo = cs.bo();
+	free(bo);
+	cs = CmdStream{};
+}
+
+Heap::Stats Gpu::pool_stats() const
+{
+	return pool.stats();
+}
+
+namespace
+{
+
+// The shader cache's memory work: code goes into pool Bos, cleaned for the
+// GPU's instruction fetch.
+struct ShaderBackend {
+	Gpu &gpu;
+
+	uint32_t upload(std::span<const uint32_t> words)
+	{
+		Bo bo = gpu.alloc(uint32_t(words.size() * 4));
+		if (!bo)
+			return 0;
+		std::ranges::copy(words, bo.span<uint32_t>().begin());
+		bo.cpu_fini(RelocWrite);
+		return bo.phys;
+	}
+	void release(uint32_t addr)
+	{
+		Bo bo{.phys = addr};
+		gpu.free(bo);
+	}
+	bool matches(uint32_t addr, std::span<const uint32_t> words) const
+	{
+		Bo bo{.phys = addr, .bytes = uint32_t(words.size() * 4)};
+		return std::ranges::equal(bo.span<const uint32_t>(), words);
+	}
+};
+
+} // namespace
+
+Bo Gpu::get_shader(std::span<const uint32_t> words)
+{
+	ShaderBackend b{*this};
+	uint32_t addr = words.empty() ? 0 : shader_cache.get(b, words);
+	return addr ? Bo{.phys = addr, .bytes = uint32_t(words.size() * 4)} : Bo{};
+}
+
+void Gpu::put_shader(Bo &bo)
+{
+	if (bo && !shader_cache.put(bo.phys))
+		free(bo); // uploaded uncached: the cache was full of code in use
+	bo = Bo{};
+}
+
+ShaderCache::Stats Gpu::shader_stats() const
+{
+	return shader_cache.stats();
+}
+
+// Copy `ops` + the completion trailer into the ring at `slot`, then divert
+// the FE to it. Returns the submission's seqno.
+uint32_t Gpu::emit_block(const RingTracker::Slot &slot, const uint32_t *ops, uint32_t op_dwords)
 {
 	auto ring = reinterpret_cast<volatile uint32_t *>(static_cast<uintptr_t>(ring_base_));
+	if (slot.event_id != RingTracker::kNoEvent)
+		intr_acc_.fetch_and(~(1u << slot.event_id)); // drop any stale accumulated bit for this id
+
+	// cs backing is cacheable and CPU-written, so a plain read is coherent;
+	// the ring is non-cacheable, so a dsb is all it needs.
+	write_copy_block(ring, ring_base_, ring_.tail(), slot, ops, op_dwords, dsb_sy);
+	return ring_.commit(slot);
+}
+
+// Place a block of `op_dw` command dwords. The ring only refuses when the
+// un-retired span (the blocks the FE may still read) leaves no contiguous
+// room; then we wait for the GPU to retire something and try again. Event
+// slots never block: with all 30 in flight the block goes out without one.
+RingTracker::Slot Gpu::place_block(uint32_t op_dw)
+{
+	RingTracker::Slot slot = ring_.place(op_dw);
+	if (slot)
+		return slot;
+	if (op_dw + RingTracker::kMarkerDwords * 2 + RingTracker::kHomeDwords > ring_dwords_) {
+		print("etna: command stream of ", int(op_dw), " dwords can never fit the ring\n");
+		return slot;
+	}
+	uint64_t deadline = read_cntpct() + read_cntfreq(); // 1 s
+	while (!(slot = ring_.place(op_dw))) {
+		// Nothing evented in flight means nothing will ever retire: close the
+		// run with a marker so the oldest blocks can complete.
+		if (ring_.needs_marker(ring_.completed() + 1))
+			if (auto m = ring_.place_marker())
+				emit_block(m, nullptr, 0);
+		if (!wait_irq(deadline, "ring full"))
+			break;
+	}
+	return slot;
+}
 
-	// The block we append: the op's work (from cs) + a completion trailer of
-	// EVENT (2 dwords) + WAIT (2) + LINK (2) = 6 dwords.
+Fence Gpu::submit(CmdStream &cs)
+{
+	if (!cs.unlink()) {
+		print("etna: submit: commands recorded after the stream's return LINK; reset() it\n");
+		return Fence{};
+	}
+	cs.align(); // commands are 64-bit aligned; the trailer must start on a qword
 	uint32_t op_dw = cs.offset();
-	uint32_t block_dw = op_dw + 6;
-
-	// Wrap if it won't fit. Safe only because callers wait for completion (the
-	// FE is parked at the current tail, far from offset 0) before reusing the
-	// ring start. A real free-cursor would let us wrap while work is queued.
-	if (ring_head_ + block_dw > ring_dwords_)
-		ring_head_ = 4; // keep the home wait-link at 0..3 intact
-
-	uint32_t start = ring_head_;
-	uint32_t w = start;
-
-	// Copy the op's commands into the ring (cs backing is cacheable and
-	// CPU-written, so a plain read is coherent; the ring is non-cacheable).
-	auto src = cs.bo().span<const uint32_t>();
-	for (uint32_t i = 0; i < op_dw; i++)
-		ring[w++] = src[i];
-
-	// Completion trailer: latch a rolling event id FROM_PE, then a fresh idle
-	// WAIT/LINK that becomes the new tail.
-	uint32_t event_id = next_event_;
-	next_event_ = (next_event_ % 29) + 1;	// 1..29 (avoid bits 30/31 = MMU/AXI error)
-	intr_acc_.fetch_and(~(1u << event_id)); // drop any stale accumulated bit for this id
-	ring[w++] = cmd_load_state(GL_EVENT);
-	ring[w++] = event_id | GL_EVENT_FROM_PE;
-
-	uint32_t new_wait = w;
-	ring[w++] = cmd_wait(200);
-	ring[w++] = 0; // pad
-	ring[w++] = cmd_link(2);
-	ring[w++] = ring_base_ + new_wait * 4; // link back to this WAIT (idle)
-	dsb_sy();							   // the whole block is in DDR before we divert the FE
-
-	// Divert the FE: replace the tail's WAIT with a LINK to `start`. Write the
-	// target first, barrier, then the LINK header -- so the FE (which may fetch
-	// at any instant) never sees a LINK header pointing at a stale address.
-	// (Mirrors etnaviv_buffer_replace_wait.)
-	uint32_t prefetch = block_dw / 2; // qwords
-	ring[ring_tail_ + 1] = ring_base_ + start * 4;
+	RingTracker::Slot slot = place_block(op_dw);
+	if (!slot)
+		return Fence{};
+	uint32_t seqno = emit_block(slot, cs.bo().span<const uint32_t>().data(), op_dw);
+	if (capture_) {
+		const std::span<const uint32_t> ops = cs.bo().span<const uint32_t>().first(op_dw);
+		const CmdStream *src = &cs;
+		capture(seqno, {&ops, 1}, {&src, 1});
+	}
+	return Fence{.event_id = slot.event_id, .seqno = seqno};
+}
+
+Fence Gpu::submit_link(CmdStream &cs)
+{
+	// Submitted before: replace its LINK to the old trailer.
+	if (!cs.unlink()) {
+		print("etna: submit_link: commands recorded after the stream's return LINK; reset() it\n");
+		return Fence{};
+	}
+	cs.align();
+	if (cs.avail() < 2) {
+		print("etna: submit_link needs 2 spare dwords in the stream for the return LINK\n");
+		return Fence{};
+	}
+	RingTracker::Slot slot = place_block(0); // trailer only
+	if (!slot)
+		return Fence{};
+	if (slot.event_id != RingTracker::kNoEvent)
+		intr_acc_.fetch_and(~(1u << slot.event_id));
+
+	// End the stream with a LINK back to its trailer, and push it to DDR: the
+	// FE DMA-reads the Bo itself, which (unlike the ring) is cacheable.
+	const uint32_t op_dw = cs.offset(); // what a capture keeps: the LINK is the ring's
+	auto ret = return_link(ring_base_, slot);
+	cs.end_with_link(ret.header, ret.target);
+	cs.bo().cpu_fini(RelocWrite);
 	dsb_sy();
-	ring[ring_tail_ + 0] = cmd_link(prefetch);
+
+	auto ring = reinterpret_cast<volatile uint32_t *>(static_cast<uintptr_t>(ring_base_));
+	write_link_block(ring, ring_base_, ring_.tail(), slot, cs.bo().gpu_addr(), cs.offset(), dsb_sy);
+	uint32_t seqno = ring_.commit(slot);
+	if (capture_) {
+		const std::span<const uint32_t> ops = cs.bo().span<const uint32_t>().first(op_dw);
+		const CmdStream *src = &cs;
+		capture(seqno, {&ops, 1}, {&src, 1});
+	}
+	return Fence{.event_id = slot.event_id, .seqno = seqno};
+}
+
+Fence Gpu::submit_chain(std::span<Bundle *const> chain)
+{
+	RingTracker::Slot slot = place_block(0); // trailer only
+	if (!slot)
+		return Fence{};
+	if (!link_chain(chain, return_link(ring_base_, slot))) {
+		print("etna: submit_chain needs a non-empty chain of distinct, ended bundles\n");
+		return Fence{}; // the placed slot is just never committed
+	}
+	if (slot.event_id != RingTracker::kNoEvent)
+		intr_acc_.fetch_and(~(1u << slot.event_id));
+
+	// Push the patched dwords and rewritten tails to DDR -- usually a few
+	// cache lines per bundle, not the whole recording.
+	for (Bundle *b : chain) {
+		auto d = b->take_dirty();
+		b->cs().bo().cpu_fini(RelocWrite, d.lo * 4, (d.hi - d.lo) * 4);
+	}
 	dsb_sy();
 
-	ring_tail_ = new_wait;
-	ring_head_ = w;
-	return Fence{.event_id = event_id, .seqno = ++seqno_};
+	auto ring = reinterpret_cast<volatile uint32_t *>(static_cast<uintptr_t>(ring_base_));
+	write_link_block(ring, ring_base_, ring_.tail(), slot, chain[0]->gpu_addr(), chain[0]->dwords(), dsb_sy);
+	uint32_t seqno = ring_.commit(slot);
+	if (capture_) {
+		// The bundles back to back, without their tail LINKs.
+		constexpr uint32_t kMaxChain = 16;
+		std::span<const uint32_t> ops[kMaxChain];
+		const CmdStream *src[kMaxChain];
+		const uint32_t n = std::min<uint32_t>(chain.size(), kMaxChain);
+		if (n < chain.size())
+			print("etna: capture keeps the first ", int(kMaxChain), " bundles of a chain\n");
+		for (uint32_t i = 0; i < n; i++) {
+			ops[i] = chain[i]->cs().bo().span<const uint32_t>().first(chain[i]->dwords() - 2);
+			src[i] = &chain[i]->cs();
+		}
+		capture(seqno, {ops, n}, {src, n});
+	}
+	return Fence{.event_id = slot.event_id, .seqno = seqno};
+}
+
+void Gpu::start_capture(TraceWriter &w)
+{
+	reap(); // completions before the capture are not its business
+	w.set_tick_hz(uint32_t(read_cntfreq()));
+	capture_t0_ = read_cntpct();
+	capture_ = &w;
+}
+
+void Gpu::stop_capture()
+{
+	reap(); // the last completion times
+	capture_ = nullptr;
+}
+
+bool Gpu::start_timeline(Timeline &tl, uint32_t events)
+{
+	reap();
+	if (timeline_ || events == 0 || events > RingTracker::kNumEvents)
+		return false;
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < events; i++) {
+		const uint32_t ev = ring_.take_event();
+		if (ev == RingTracker::kNoEvent)
+			break;
+		mask |= 1u << ev;
+	}
+	if (uint32_t(__builtin_popcount(mask)) < events) {
+		for (; mask; mask &= mask - 1)
+			ring_.put_event(__builtin_ctz(mask));
+		print("etna: start_timeline: fewer than ", int(events), " event ids free\n");
+		return false;
+	}
+	intr_acc_.fetch_and(~mask); // stale bits from the ids' last blocks
+	tl.set_events(mask);
+	timeline_ = &tl;
+	timeline_events_ = mask;
+	return true;
+}
+
+void Gpu::stop_timeline()
+{
+	if (!timeline_)
+		return;
+	reap(); // the last stamps
+	if (uint32_t n = timeline_->in_flight())
+		print("etna: stop_timeline with ", int(n), " marks in flight\n");
+	for (uint32_t m = timeline_events_; m; m &= m - 1)
+		ring_.put_event(__builtin_ctz(m));
+	timeline_events_ = 0;
+	timeline_ = nullptr;
+}
+
+void Gpu::capture(uint32_t seqno,
+				  std::span<const std::span<const uint32_t>> streams,
+				  std::span<const CmdStream *const> sources)
+{
+	const uint32_t now = uint32_t(read_cntpct() - capture_t0_);
+	// The streams' Bo lists merged; the trace reads each Bo's memory through
+	// the identity map.
+	TraceBo bos[TraceWriter::kMaxBos];
+	uint32_t n = 0;
+	bool complete = true;
+	for (const CmdStream *cs : sources) {
+		complete &= cs->bos_complete();
+		for (const CmdStream::BoRef &r : cs->bos()) {
+			uint32_t i = 0;
+			while (i < n && bos[i].addr != r.addr)
+				i++;
+			if (i == n && n == TraceWriter::kMaxBos) {
+				complete = false;
+				continue;
+			}
+			if (i == n)
+				bos[n++] = {r.addr, r.bytes, 0, static_cast<const uint32_t *>(Bo{.phys = r.addr}.map())};
+			bos[i].flags |= r.flags;
+			bos[i].bytes = std::max(bos[i].bytes, r.bytes);
+		}
+	}
+	if (!complete)
+		print("etna: capture of submission ", int(seqno), " is missing Bos (too many referenced)\n");
+	if (capture_->submission(seqno, now, streams, {bos, n}) == TraceWriter::kNoRecord)
+		print("etna: capture buffer full, submission ", int(seqno), " dropped\n");
+}
+
+bool Gpu::reap()
+{
+	uint32_t acc = intr_acc_.load(std::memory_order_acquire);
+	if (acc & (INTR_AXI_BUS_ERROR | INTR_MMU_EXCEPTION)) {
+		print("etna: GPU error interrupt 0x", Hex{acc}, "\n");
+		dump_status("  on submit");
+		return false; // error bits stay latched: later waits fail too
+	}
+	if (uint32_t stamped = acc & timeline_events_) {
+		timeline_->fired(stamped, stamps_);
+		intr_acc_.fetch_and(~stamped);
+		acc &= ~stamped;
+	}
+	if (uint32_t done = ring_.retire(acc)) {
+		completed_.store(ring_.completed(), std::memory_order_release);
+		intr_acc_.fetch_and(~done);
+		if (capture_)
+			capture_->retire(ring_.completed(), uint32_t(read_cntpct() - capture_t0_));
+	}
+	return true;
+}
+
+bool Gpu::wait_irq(uint64_t deadline, const char *what)
+{
+	if (!reap())
+		return false;
+	if (read_cntpct() > deadline) {
+		print("etna: ", what, " timed out (completed ", int(ring_.completed()), " of ", int(ring_.submitted()),
+			  ")\n");
+		dump_status("  timeout");
+		return false;
+	}
+	asm volatile("wfe" ::: "memory"); // woken by the GPU IRQ / the ISR's SEV
+	return reap();
+}
+
+bool Gpu::is_complete(Fence f)
+{
+	reap();
+	return ring_.is_complete(f.seqno);
 }
 
 bool Gpu::wait(Fence f, uint32_t timeout_us)
@@ -461,34 +746,25 @@ bool Gpu::wait(Fence f, uint32_t timeout_us)
 	if (!f)
 		return false;
 
-	// Block until the ISR records f's event bit in intr_acc_. We do NOT read
-	// HI_INTR_ACKNOWLEDGE here -- that would steal bits from the ISR. Sleep on
-	// WFE between checks so the CPU (and the GPU register bus) is idle while
-	// the GPU works; the ISR's SEV/IRQ wakes us.
+	// Advance the completion timeline from the event bits the ISR collects
+	// until it passes f. We do NOT read HI_INTR_ACKNOWLEDGE here -- that would
+	// steal bits from the ISR. Sleep on WFE between checks so the CPU (and the
+	// GPU register bus) is idle while the GPU works; the ISR's SEV/IRQ wakes us.
 	// Caveat: the deadline is only evaluated on wake, so a totally hung GPU
 	// (no interrupt at all) would block. GPU *errors* do interrupt (bits
 	// 30/31), so those are caught. A timer-backstop wake would close the gap.
-	const uint32_t done_bit = 1u << f.event_id;
-	const uint32_t err_bits = INTR_AXI_BUS_ERROR | INTR_MMU_EXCEPTION;
 	uint64_t deadline = read_cntpct() + (uint64_t)timeout_us * (read_cntfreq() / 1'000'000);
-
 	while (true) {
-		uint32_t acc = intr_acc_.load(std::memory_order_acquire);
-		if (acc & err_bits) {
-			print("etna: GPU error interrupt 0x", Hex{acc}, "\n");
-			dump_status("  on submit");
+		if (!reap())
 			return false;
-		}
-		if (acc & done_bit) {
-			intr_acc_.fetch_and(~done_bit); // consume it
+		if (ring_.is_complete(f.seqno))
 			return true;
-		}
-		if (read_cntpct() > deadline) {
-			print("etna: submission timed out (event ", int(f.event_id), ")\n");
-			dump_status("  timeout");
+		// f went out without an event and nothing evented follows it yet.
+		if (ring_.needs_marker(f.seqno))
+			if (auto m = ring_.place_marker())
+				emit_block(m, nullptr, 0);
+		if (!wait_irq(deadline, "submission"))
 			return false;
-		}
-		asm volatile("wfe" ::: "memory"); // woken by the GPU IRQ / the ISR's SEV
 	}
 }
 
@@ -511,16 +787,27 @@ void Gpu::dump_status(const char *msg)
 	print("\n");
 }
 
+void dump_stream(const CmdStream &cs, const char *label)
+{
+	const uint32_t *w = cs.bo().span<const uint32_t>().data();
+	print("cs ", label, ": ", int(cs.offset()), " dwords\n");
+	for (uint32_t i = 0; i < cs.offset(); i++)
+		print(i % 8 ? " " : "cs: ", Hex{w[i]}, i % 8 == 7 || i + 1 == cs.offset() ? "\n" : "");
+}
+
 // =============================================================================
 //  2D operations (RS engine) -- ports of Mesa etnaviv_rs.c onto CmdStream
 // =============================================================================
-void clear(CmdStream &cs, const Bo &dst, uint32_t width, uint32_t height, uint32_t argb)
+void clear(CmdStream &cs, const Bo &dst, uint32_t width, uint32_t height, uint32_t argb, Format fmt, bool drain)
 {
 	cs.reserve(64);
-	// A8R8G8B8, linear. CLEAR_CONTROL enables the fill; FILL_VALUE x4 is the color.
-	cs.set_state(RS_CONFIG, RS_FORMAT_A8R8G8B8 | (RS_FORMAT_A8R8G8B8 << 8));
+	// Linear. CLEAR_CONTROL enables the fill; FILL_VALUE x4 is the color,
+	// packed for the format (a 16-bit pixel twice per dword).
+	const uint32_t fill = rs_clear_value(fmt, argb);
+	cs.set_state(TS_MEM_CONFIG, 0); // a draw or a resolve may have left a TS on
+	cs.set_state(RS_CONFIG, rs_config(fmt, fmt));
 	cs.set_state(RS_SOURCE_STRIDE, 0);
-	cs.set_state(RS_DEST_STRIDE, width * 4);
+	cs.set_state(RS_DEST_STRIDE, format_stride(fmt, width));
 	cs.set_state_reloc(RS_PIPE_SOURCE_ADDR0, {&dst, RelocRead, 0}); // unused, emitted like Mesa
 	cs.set_state_reloc(RS_PIPE_DEST_ADDR0, {&dst, RelocWrite, 0});
 	cs.set_state(RS_PIPE_OFFSET0, 0);
@@ -529,34 +816,66 @@ void clear(CmdStream &cs, const Bo &dst, uint32_t width, uint32_t height, uint32
 	cs.set_state(RS_DITHER0, 0xFFFFFFFF);
 	cs.set_state(RS_DITHER1, 0xFFFFFFFF);
 	cs.set_state(RS_CLEAR_CONTROL, RS_CLEAR_CONTROL_ENABLED1 | 0xFFFF);
-	cs.set_state(RS_FILL_VALUE0 + 0x0, argb);
-	cs.set_state(RS_FILL_VALUE0 + 0x4, argb);
-	cs.set_state(RS_FILL_VALUE0 + 0x8, argb);
-	cs.set_state(RS_FILL_VALUE0 + 0xC, argb);
+	cs.set_state(RS_FILL_VALUE0 + 0x0, fill);
+	cs.set_state(RS_FILL_VALUE0 + 0x4, fill);
+	cs.set_state(RS_FILL_VALUE0 + 0x8, fill);
+	cs.set_state(RS_FILL_VALUE0 + 0xC, fill);
 	cs.set_state(RS_EXTRA_CONFIG, 0);
 	cs.set_state(RS_SINGLE_BUFFER, 1);
 	cs.set_state(RS_KICKER, RS_KICK);
 	cs.set_state(RS_SINGLE_BUFFER, 0);
-	emit_pe_drain(cs);
+	if (drain)
+		emit_pe_drain(cs);
 }
 
-void blit(CmdStream &cs, const Bo &dst, const Bo &src, uint32_t width, uint32_t height, Format fmt, uint32_t flags)
+void blit(CmdStream &cs,
+		  const Bo &dst,
+		  const Bo &src,
+		  uint32_t width,
+		  uint32_t height,
+		  Format fmt,
+		  uint32_t flags,
+		  bool drain)
 {
-	cs.reserve(64);
-	uint32_t config = static_cast<uint32_t>(fmt) | (static_cast<uint32_t>(fmt) << 8);
-	if (flags & BlitSwapRB)
-		config |= RS_CONFIG_SWAP_RB;
-	if (flags & BlitFlipY)
-		config |= RS_CONFIG_FLIP;
-
-	cs.set_state(RS_CONFIG, config);
-	cs.set_state(RS_SOURCE_STRIDE, width * 4);
-	cs.set_state(RS_DEST_STRIDE, width * 4);
-	cs.set_state_reloc(RS_PIPE_SOURCE_ADDR0, {&src, RelocRead, 0});
-	cs.set_state_reloc(RS_PIPE_DEST_ADDR0, {&dst, RelocWrite, 0});
+	blit(cs, dst, fmt, src, fmt, width, height, flags, drain);
+}
+
+namespace
+{
+// The copy sequence blit() and resolve() share; `r` (etna_format.hh) holds
+// what differs between them. With `src_ts` the RS reads the source through
+// its tile status (Mesa's etna_submit_rs_state, source_ts_valid); without,
+// the TS is turned off -- a draw or an earlier resolve may have left it on.
+// A copy starting `src_offset` bytes into the source moves the TS address
+// along (ts_offset()).
+void emit_rs_copy(CmdStream &cs,
+				  const RsCopy &r,
+				  const Bo &dst,
+				  uint32_t dst_offset,
+				  const Bo &src,
+				  uint32_t src_offset,
+				  const TileStatus *src_ts,
+				  bool drain)
+{
+	cs.reserve(80);
+	if (src_ts && *src_ts) {
+		// Write back what the PE left in the TS cache before the RS reads the TS.
+		cs.set_state(TS_FLUSH_CACHE, TS_FLUSH_CACHE_FLUSH);
+		cs.set_state(TS_MEM_CONFIG, ts_mem_config(true, false));
+		cs.set_state_reloc(TS_COLOR_STATUS_BASE, {src_ts->bo, RelocRead, ts_offset(src_offset)});
+		cs.set_state_reloc(TS_COLOR_SURFACE_BASE, {&src, RelocRead, src_offset});
+		cs.set_state(TS_COLOR_CLEAR_VALUE, src_ts->clear_value);
+	} else {
+		cs.set_state(TS_MEM_CONFIG, 0);
+	}
+	cs.set_state(RS_CONFIG, r.config);
+	cs.set_state(RS_SOURCE_STRIDE, r.source_stride);
+	cs.set_state(RS_DEST_STRIDE, r.dest_stride);
+	cs.set_state_reloc(RS_PIPE_SOURCE_ADDR0, {&src, RelocRead, src_offset});
+	cs.set_state_reloc(RS_PIPE_DEST_ADDR0, {&dst, RelocWrite, dst_offset});
 	cs.set_state(RS_PIPE_OFFSET0, 0);
 	cs.set_state(RS_PIPE_OFFSET1, 0);
-	cs.set_state(RS_WINDOW_SIZE, width | (height << 16));
+	cs.set_state(RS_WINDOW_SIZE, r.window);
 	cs.set_state(RS_DITHER0, 0xFFFFFFFF);
 	cs.set_state(RS_DITHER1, 0xFFFFFFFF);
 	cs.set_state(RS_CLEAR_CONTROL, 0); // not a clear: real copy
@@ -564,7 +883,24 @@ void blit(CmdStream &cs, const Bo &dst, const Bo &src, uint32_t width, uint32_t
 	cs.set_state(RS_SINGLE_BUFFER, 1);
 	cs.set_state(RS_KICKER, RS_KICK);
 	cs.set_state(RS_SINGLE_BUFFER, 0);
-	emit_pe_drain(cs);
+	if (drain)
+		emit_pe_drain(cs);
+}
+} // namespace
+
+// The RS converts as it copies: RS_CONFIG names both formats, and each stride
+// is in its own side's bytes per pixel.
+void blit(CmdStream &cs,
+		  const Bo &dst,
+		  Format dst_fmt,
+		  const Bo &src,
+		  Format src_fmt,
+		  uint32_t width,
+		  uint32_t height,
+		  uint32_t flags,
+		  bool drain)
+{
+	emit_rs_copy(cs, rs_blit_state(src_fmt, dst_fmt, width, height, flags), dst, 0, src, 0, nullptr, drain);
 }
 
 // Resolve = untile: copy a (basic-)tiled surface -- what the PE renders -- to a
@@ -572,7 +908,9 @@ void blit(CmdStream &cs, const Bo &dst, const Bo &src, uint32_t width, uint32_t
 // RS engine's namesake job. Same recipe as blit() with two differences (mirrors
 // Mesa etnaviv_rs.c): RS_CONFIG gains SOURCE_TILED, and the source stride
 // register holds the tiled stride << 2 (one RS "source row" = a row of 4x4
-// tiles = 4 pixel rows). Width must be a multiple of 16 (RS alignment).
+// tiles = 4 pixel rows). Width must be a multiple of 16 (RS alignment). A
+// 16-bit dst_fmt converts on the way out, like blit(), and the downsample
+// flags box-filter a high-resolution render down to the destination size.
 void resolve(CmdStream &cs,
 			 const Bo &dst,
 			 const Bo &src,
@@ -580,26 +918,83 @@ void resolve(CmdStream &cs,
 			 uint32_t height,
 			 uint32_t src_tiled_stride,
 			 uint32_t dst_stride,
-			 uint32_t dst_offset)
+			 uint32_t dst_offset,
+			 Format dst_fmt,
+			 uint32_t flags,
+			 bool drain)
 {
-	cs.reserve(64);
-	uint32_t config = RS_FORMAT_A8R8G8B8 | RS_CONFIG_SOURCE_TILED | (RS_FORMAT_A8R8G8B8 << 8);
-	cs.set_state(RS_CONFIG, config);
-	cs.set_state(RS_SOURCE_STRIDE, src_tiled_stride << 2);
-	cs.set_state(RS_DEST_STRIDE, dst_stride);
-	cs.set_state_reloc(RS_PIPE_SOURCE_ADDR0, {&src, RelocRead, 0});
-	cs.set_state_reloc(RS_PIPE_DEST_ADDR0, {&dst, RelocWrite, dst_offset});
-	cs.set_state(RS_PIPE_OFFSET0, 0);
-	cs.set_state(RS_PIPE_OFFSET1, 0);
-	cs.set_state(RS_WINDOW_SIZE, width | (height << 16));
-	cs.set_state(RS_DITHER0, 0xFFFFFFFF);
-	cs.set_state(RS_DITHER1, 0xFFFFFFFF);
-	cs.set_state(RS_CLEAR_CONTROL, 0);
-	cs.set_state(RS_EXTRA_CONFIG, 0);
-	cs.set_state(RS_SINGLE_BUFFER, 1);
-	cs.set_state(RS_KICKER, RS_KICK);
-	cs.set_state(RS_SINGLE_BUFFER, 0);
-	emit_pe_drain(cs);
+	emit_rs_copy(cs,
+				 rs_resolve_state(dst_fmt, width, height, src_tiled_stride, dst_stride, flags),
+				 dst,
+				 dst_offset,
+				 src,
+				 0,
+				 nullptr,
+				 drain);
+}
+
+void resolve(CmdStream &cs,
+			 const Bo &dst,
+			 const Bo &src,
+			 const TileStatus &src_ts,
+			 uint32_t width,
+			 uint32_t height,
+			 uint32_t src_tiled_stride,
+			 uint32_t dst_stride,
+			 uint32_t dst_offset,
+			 Format dst_fmt,
+			 uint32_t flags,
+			 bool drain)
+{
+	emit_rs_copy(cs,
+				 rs_resolve_state(dst_fmt, width, height, src_tiled_stride, dst_stride, flags),
+				 dst,
+				 dst_offset,
+				 src,
+				 0,
+				 &src_ts,
+				 drain);
+}
+
+// A resolve of one rectangle: the same copy with a smaller window, both
+// addresses moved to the rectangle's start (rs_resolve_rect_state()).
+void resolve_rect(CmdStream &cs,
+				  const Bo &dst,
+				  const Bo &src,
+				  const Rect &r,
+				  uint32_t src_tiled_stride,
+				  uint32_t dst_stride,
+				  Format dst_fmt,
+				  bool drain)
+{
+	const RsRect s = rs_resolve_rect_state(dst_fmt, r, src_tiled_stride, dst_stride);
+	emit_rs_copy(cs, s.copy, dst, s.dst_offset, src, s.src_offset, nullptr, drain);
+}
+
+void resolve_rect(CmdStream &cs,
+				  const Bo &dst,
+				  const Bo &src,
+				  const TileStatus &src_ts,
+				  const Rect &r,
+				  uint32_t src_tiled_stride,
+				  uint32_t dst_stride,
+				  Format dst_fmt,
+				  bool drain)
+{
+	const RsRect s = rs_resolve_rect_state(dst_fmt, r, src_tiled_stride, dst_stride);
+	emit_rs_copy(cs, s.copy, dst, s.dst_offset, src, s.src_offset, &src_ts, drain);
+}
+
+// Fast clear (etna_ts.hh): an RS fill of the TS buffer with "every tile
+// cleared". The TS cache is flushed first, or lines the PE still holds could
+// be written back over the fill. (Mesa: etna_blit_clear_color_rs with a TS.)
+void fast_clear(CmdStream &cs, TileStatus &ts, uint32_t value, bool drain)
+{
+	const uint32_t bytes = ts.bo->size() & ~(kTsAlign - 1);
+	cs.reserve(8);
+	cs.set_state(TS_FLUSH_CACHE, TS_FLUSH_CACHE_FLUSH);
+	clear(cs, *ts.bo, kTsFillWidth, ts_fill_height(bytes), kTsCleared, Format::A8R8G8B8, drain);
+	ts.clear_value = value;
 }
 
 // Public wrapper so experiments can retune the GPU AXI/memory clock at runtime.
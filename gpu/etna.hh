@@ -1,10 +1,21 @@
 #pragma once
+#include "etna_damage.hh"
+#include "etna_format.hh"
+#include "etna_heap.hh"
+#include "etna_ring.hh"
+#include "etna_shader_cache.hh"
+#include "etna_ts.hh"
 #include "gpu_regs.hh"
 #include "ppu_asm.hh" // ppu::ShaderInfo / build_*_shader (for Kernel/make_kernel)
 #include <atomic>
 #include <cstdint>
 #include <span>
 
+namespace ppu
+{
+struct Program; // ppu_program.hh
+}
+
 // =============================================================================
 //  etna.hh -- a baremetal GPU API for the STM32MP25 Vivante (GCNanoUltra31)
 // =============================================================================
@@ -111,6 +122,8 @@ struct Bo {
 	// const: they touch the backing memory, not the handle.
 	void cpu_prep(uint32_t op) const; // wait for pending GPU work (once fences exist) + prep
 	void cpu_fini(uint32_t op) const; // finish CPU access: clean if we wrote
+	// Same, for `len` bytes at byte `offset` only (e.g. a few patched dwords).
+	void cpu_fini(uint32_t op, uint32_t offset, uint32_t len) const;
 };
 
 // -----------------------------------------------------------------------------
@@ -122,7 +135,9 @@ struct Bo {
 // ported op code (etnaviv_rs.c) compiles against this unchanged.
 class CmdStream {
 public:
-	// Backed by a Bo of `words` dwords. Gpu::new_cmd_stream() creates one.
+	// Backed by a Bo of `words` dwords. Gpu::new_cmd_stream() creates one; a
+	// default-constructed (or freed) stream is null and has no capacity.
+	CmdStream() = default;
 	CmdStream(Bo backing, uint32_t words)
 		: buf_{backing.span<uint32_t>().first(words)}
 		, bo_{backing}
@@ -153,7 +168,48 @@ public:
 
 	// Emit a Bo's gpu address (+reloc.offset). Records read/write intent for
 	// cache/fence handling. Mirrors etna_cmd_stream_reloc().
-	void emit_reloc(const Reloc &r);
+	void emit_reloc(const Reloc &r)
+	{
+		// Identity map: the GPU address is just the buffer's physical address.
+		// (Automatic cache/fence tracking off the Bo list is a later
+		// enhancement; a capture uses it already.)
+		add_bo(*r.bo, r.flags);
+		emit(r.bo->gpu_addr() + r.offset);
+	}
+
+	// The Bos the stream references, each once with its access intent merged:
+	// the bo list etna_cmd_stream_reloc() builds for the kernel's submit. A
+	// capture (etna_trace.hh) snapshots them. emit_reloc() adds to it;
+	// emitters that write raw addresses (emit_ppu_dispatch()) leave it to the
+	// caller. Past kMaxBos the rest are dropped and bos_complete() is false.
+	static constexpr uint32_t kMaxBos = 16;
+	struct BoRef {
+		uint32_t addr, bytes, flags;
+	};
+
+	void add_bo(const Bo &bo, uint32_t flags)
+	{
+		for (uint32_t i = 0; i < n_bos_; i++)
+			if (bos_[i].addr == bo.gpu_addr()) {
+				bos_[i].flags |= flags;
+				bos_[i].bytes = bo.size() > bos_[i].bytes ? bo.size() : bos_[i].bytes;
+				return;
+			}
+		if (n_bos_ < kMaxBos)
+			bos_[n_bos_++] = {bo.gpu_addr(), bo.size(), flags};
+		else
+			bos_overflow_ = true;
+	}
+
+	std::span<const BoRef> bos() const
+	{
+		return {bos_, n_bos_};
+	}
+
+	bool bos_complete() const
+	{
+		return !bos_overflow_;
+	}
 
 	// --- Mesa-compatible state helpers (mirror etnaviv_emit.h) -------------
 	// LOAD_STATE header + one data word (writes one state register).
@@ -181,7 +237,12 @@ public:
 	// --- Synchronization primitives (mirror etnaviv_buffer.c CMD_* helpers) -
 	// FE waits for `to` engine to reach a matching semaphore. Used to make the
 	// FE block until the PE/RS pipeline drains. (SYNC_RECIPIENT_PE etc.)
-	void stall(uint32_t from, uint32_t to);
+	void stall(uint32_t from, uint32_t to)
+	{
+		set_state(VivanteGpu::GL_SEMAPHORE_TOKEN, VivanteGpu::sync_token(from, to));
+		emit(VivanteGpu::CMD_STALL);
+		emit(VivanteGpu::sync_token(from, to));
+	}
 
 	// Queue an event: latches HI_INTR_ACKNOWLEDGE bit `id` when `engine`
 	// (GL_EVENT_FROM_PE / _FE) processes it. FROM_PE is the true completion
@@ -197,34 +258,73 @@ public:
 		set_state(VivanteGpu::GL_FLUSH_CACHE, bits);
 	}
 
+	// Gpu::submit_link() ends the stream with a LINK back to the ring. Before
+	// the stream is submitted again, unlink() takes that LINK off, so the FE
+	// doesn't follow it to the previous submission's trailer. False if
+	// commands were recorded after it -- the FE never reached them -- and
+	// then only reset() makes the stream usable again.
+	void end_with_link(uint32_t header, uint32_t target)
+	{
+		emit(header);
+		emit(target);
+		link_end_ = len_;
+	}
+	bool linked() const
+	{
+		return link_end_ != 0;
+	}
+	bool unlink()
+	{
+		if (!link_end_)
+			return true;
+		if (link_end_ != len_)
+			return false;
+		len_ -= 2;
+		link_end_ = 0;
+		return true;
+	}
+
 	// Rewind for reuse (single-shot model). TODO: remove this? a ring won't need this.
 	void reset()
 	{
 		len_ = 0;
+		link_end_ = 0;
+		n_bos_ = 0;
+		bos_overflow_ = false;
 	}
 
 private:
 	std::span<uint32_t> buf_;
 	uint32_t len_ = 0;
+	uint32_t link_end_ = 0; // just past submit_link()'s return LINK; 0: none
 	Bo bo_;
+	BoRef bos_[kMaxBos];
+	uint32_t n_bos_ = 0;
+	bool bos_overflow_ = false;
 };
 
 // -----------------------------------------------------------------------------
 //  Fence -- completion token for a submission
 // -----------------------------------------------------------------------------
-// Mirrors the timestamp/pipe_wait fence model of libdrm. A submission
-// completes when its GL_EVENT(FROM_PE) latches HI_INTR_ACKNOWLEDGE bit
-// `event_id`. Each submit gets a distinct rolling event id (1..29), so several
-// submissions can be in flight and waited for independently.
+// Mirrors the timestamp/pipe_wait fence model of libdrm: a fence is the
+// submission's sequence number, and it has completed once the ring's
+// completion timeline (etna_ring.hh) has reached it. The timeline advances
+// when a GL_EVENT(FROM_PE) latches its HI_INTR_ACKNOWLEDGE bit; event ids
+// are recycled, so `event_id` is only diagnostic (RingTracker::kNoEvent if
+// the submission went out without one and completes with a later one).
 struct Fence {
-	uint32_t event_id = 0; // 0 = null; else the HI_INTR_ACKNOWLEDGE bit to poll
-	uint32_t seqno = 0;
+	uint32_t event_id = RingTracker::kNoEvent;
+	uint32_t seqno = 0; // 0 = null
 	explicit operator bool() const
 	{
-		return event_id != 0;
+		return seqno != 0;
 	}
 };
 
+class Bundle;	   // etna_bundle.hh
+class TraceWriter; // etna_trace.hh
+class Timeline;	   // etna_timeline.hh
+
 // -----------------------------------------------------------------------------
 //  Gpu -- device + core + pipe, collapsed (we have exactly one)
 // -----------------------------------------------------------------------------
@@ -252,27 +352,109 @@ public:
 	}
 
 	// Allocate `bytes` of physically-contiguous DDR from the GPU pool, aligned
-	// to `align` (default 64 = cache line). Mirrors etna_bo_new.
-	// The pool is a fixed DDR carve-out; freeing can be done later (bump alloc for now).
+	// to `align` (default 64 = cache line; must be a power of two). Mirrors
+	// etna_bo_new. Small buffers (<= 4 KB) come from size-class slabs, larger
+	// ones from a coalescing best-fit list -- see etna_heap.hh.
 	Bo alloc(uint32_t bytes, uint32_t align = 64, bool cacheable = true);
 
-	// Create a command stream backed by a freshly allocated Bo
+	// Return a Bo to the pool and null the handle. Mirrors etna_bo_del. The
+	// caller must have waited for every submission that references it: there
+	// is no fence tracking per Bo, so freeing in-flight memory lets the next
+	// alloc() hand it out while the GPU is still reading/writing it.
+	void free(Bo &bo);
+
+	// Create a command stream backed by a freshly allocated Bo. Release it with
+	// free(cs) once its last submission has completed.
 	CmdStream new_cmd_stream(uint32_t words = 1024);
+	void free(CmdStream &cs);
+
+	// Pool usage: bytes held/reserved, high-water mark, fragmentation.
+	Heap::Stats pool_stats() const;
+
+	// Resident shader/kernel code (etna_shader_cache.hh): a Bo holding
+	// `words`, uploaded on the first request and shared by every later one
+	// for the same words. get_shader() takes a reference, put_shader() drops
+	// it and nulls the handle; idle code stays resident until the cache needs
+	// the room or the memory. Null Bo if out of memory. As with free(), put
+	// the code only once the GPU is done with it, and never free() it.
+	Bo get_shader(std::span<const uint32_t> words);
+	void put_shader(Bo &bo);
+	ShaderCache::Stats shader_stats() const;
 
 	// Submit a command stream (which must contain an op's work + PE drain, NO
 	// END -- the op helpers emit exactly that). Appends it to the persistent
 	// WAIT/LINK ring plus a completion trailer (event + wait + link), then
 	// diverts the FE by patching its idle WAIT into a LINK to the new block.
 	// The FE is never reset per submit -- it has been running the ring since
-	// init(). Returns a Fence carrying the op's rolling event id.
+	// init(). Only blocks when the ring has no room left for the block, until
+	// enough earlier work retires (null Fence if that times out).
 	Fence submit(CmdStream &cs);
 
-	// Block until `f` completes or timeout. Mirrors etna_pipe_wait. Polls
-	// HI_INTR_ACKNOWLEDGE (accumulating, since the read is destructive) for
-	// f's event bit; returns false on timeout / AXI / MMU error. Several
-	// fences can be outstanding and waited in any order.
+	// Zero-copy submit: instead of copying `cs` into the ring, divert the FE
+	// straight into the stream's own Bo. Only the completion trailer goes into
+	// the ring, and the stream gets a LINK back to it appended (needs 2 spare
+	// dwords). Costs a cache clean of the stream instead of an uncached copy of
+	// every dword. The GPU now executes from cs's buffer, so cs must not be
+	// rewritten (reset/emit) or freed until the fence completes. Submitted
+	// again (once that fence completes), the LINK is replaced, not doubled;
+	// a stream recorded into after its LINK is refused until reset().
+	Fence submit_link(CmdStream &cs);
+
+	// Run pre-recorded bundles (etna_bundle.hh) back to back as one
+	// submission: links each bundle's tail to the next and the last one to
+	// the completion trailer, cleans whatever the CPU patched, and diverts the
+	// FE into the first. Same rules as submit_link(): the bundles must not be
+	// patched or freed until the fence completes.
+	Fence submit_chain(std::span<Bundle *const> chain);
+
+	// Block until `f` completes or timeout. Mirrors etna_pipe_wait. Sleeps on
+	// WFE and advances the completion timeline from the event bits the ISR
+	// collects; returns false on timeout / AXI / MMU error. Several fences can
+	// be outstanding and waited in any order.
 	bool wait(Fence f, uint32_t timeout_us = 1'000'000);
 
+	// Non-blocking: has `f` completed? (Retires whatever the GPU has finished.)
+	bool is_complete(Fence f);
+
+	// Like is_complete() but touches nothing, so it may be called from another
+	// interrupt handler (the LTDC vblank, etna_swapchain.hh) while the main
+	// code is submitting. True once the timeline has passed `f`, or once the
+	// GPU IRQ has delivered f's own event. May answer false for a fence that
+	// went out without an event until a wait()/is_complete() retires it.
+	bool signaled(Fence f) const
+	{
+		if (f.seqno <= completed_.load(std::memory_order_acquire))
+			return true;
+		return f.event_id < RingTracker::kNumEvents &&
+			   (intr_acc_.load(std::memory_order_acquire) & (1u << f.event_id));
+	}
+
+	// Capture (etna_trace.hh): from start_capture() until stop_capture(),
+	// every submit(), submit_link() and submit_chain() is also written to `w`:
+	// its commands, the Bos they reference, when it went in and when it was
+	// seen done. Costs a copy of the commands and a hash of every read-only
+	// Bo per submission, so it is for measuring, not for every frame. `w`
+	// must outlive the capture.
+	void start_capture(TraceWriter &w);
+	void stop_capture();
+
+	// Timestamps (etna_timeline.hh): from start_timeline() until
+	// stop_timeline(), `events` of the completion event ids are lent to `tl`
+	// for the marks it puts in streams, and the fired ones are handed to it
+	// with the read_cntpct() the GPU interrupt took when it saw them. Fewer
+	// ids are left for completions (a block without one completes with the
+	// next evented one). Stop only once the last marked submission has
+	// completed: an id still in flight would be taken by a block. False if
+	// the ring hasn't `events` ids free or a timeline is already running.
+	bool start_timeline(Timeline &tl, uint32_t events = 12);
+	void stop_timeline();
+
+	// Ring occupancy, for diagnostics and tests.
+	const RingTracker &ring() const
+	{
+		return ring_;
+	}
+
 	// Print FE/PE/IAC/RISAF diagnostics -- the instrumentation from bring-up,
 	// for when a submission times out or errors.
 	void dump_status(const char *msg);
@@ -286,24 +468,56 @@ public:
 
 private:
 	// Persistent WAIT/LINK command ring (non-cacheable DDR, FE-coherent). The
-	// FE spins on an idle WAIT/LINK at `ring_tail_`; submit() appends after
-	// `ring_head_` and patches the tail's WAIT into a LINK to the new block.
+	// FE spins on an idle WAIT/LINK at `ring_.tail()`; submit() appends where
+	// ring_ places the block and patches the tail's WAIT into a LINK to it.
 	bool ring_init();
 
+	// Write a placed block (ops + trailer) and divert the FE to it.
+	uint32_t emit_block(const RingTracker::Slot &slot, const uint32_t *ops, uint32_t op_dwords);
+
+	// Ring space for a block of `op_dwords` commands, waiting for the GPU to
+	// retire work if the ring is full. Null slot on timeout.
+	RingTracker::Slot place_block(uint32_t op_dwords);
+
+	// Move fired event bits from intr_acc_ into the completion timeline.
+	// Returns false (with a diagnostic) on a GPU error interrupt.
+	bool reap();
+
+	// Sleep until the GPU signals something (or the deadline passes). Returns
+	// false on error / timeout.
+	bool wait_irq(uint64_t deadline, const char *what);
+
+	// Append submission `seqno` (its `streams`, whose Bo lists are
+	// `sources`') to the capture, if one is running.
+	void capture(uint32_t seqno,
+				 std::span<const std::span<const uint32_t>> streams,
+				 std::span<const CmdStream *const> sources);
+
 	Info info_{};
-	uint32_t seqno_ = 0;	   // monotonic submission counter (diagnostic)
 	uint32_t ring_base_ = 0;   // physical address of the ring (== cpu == gpu)
 	uint32_t ring_dwords_ = 0; // ring capacity
-	uint32_t ring_head_ = 0;   // dword cursor for the next append (qword-aligned)
-	uint32_t ring_tail_ = 0;   // dword offset of the WAIT the FE is idling on
-	uint32_t next_event_ = 1;  // rolling completion event id (1..29)
+	RingTracker ring_;		   // block placement, event slots, completion timeline
 
 	// Completion is delivered by the GPU IRQ (GIC SPI 215): the ISR is the sole
 	// reader of HI_INTR_ACKNOWLEDGE (a read clears it and de-asserts the line)
-	// and ORs the fired event bits into intr_acc_; wait() consumes its bit and
-	// sleeps on WFE in between. Atomic since ISR and wait() touch it concurrently.
+	// and ORs the fired event bits into intr_acc_; reap() drains them into
+	// ring_, and waiters sleep on WFE in between. Atomic since the ISR and the
+	// waiter touch it concurrently.
 	std::atomic<uint32_t> intr_acc_{0};
+	// ring_.completed() as of the last reap(), for signaled(). Published
+	// before reap() clears the consumed event bits, and an event id is only
+	// reused after that, so a set bit always belongs to its current owner.
+	std::atomic<uint32_t> completed_{0};
 	void on_irq(); // the GPU interrupt handler
+
+	TraceWriter *capture_ = nullptr;
+	uint64_t capture_t0_ = 0; // counter at start_capture(): the trace's tick 0
+
+	// read_cntpct() when the ISR saw each event bit, written before the bit
+	// is published in intr_acc_. reap() hands timeline_ its ids' stamps.
+	uint64_t stamps_[RingTracker::kNumEvents] = {};
+	Timeline *timeline_ = nullptr;
+	uint32_t timeline_events_ = 0; // the ids lent to timeline_
 };
 
 // =============================================================================
@@ -315,17 +529,9 @@ private:
 //
 // The MP25 core has no 2D pipe and no BLT engine, so clears/blits go through the
 // RS ("resolve") engine. 3D (alpha blend, rotate, arbitrary geometry) needs the
-// programmable pipe + offline-compiled shaders.
-
-enum class Format : uint32_t {
-	A8R8G8B8 = VivanteGpu::RS_FORMAT_A8R8G8B8, // 32bpp; more added as needed
-};
-
-enum BlitFlags : uint32_t {
-	BlitNone = 0,
-	BlitSwapRB = 1 << 0, // RGBA<->BGRA (VIVS_RS_CONFIG_SWAP_RB)
-	BlitFlipY = 1 << 1,	 // vertical flip (VIVS_RS_CONFIG_FLIP)
-};
+// programmable pipe + offline-compiled shaders. Format, BlitFlags and the
+// per-format tables (bytes per pixel, RS_CONFIG, conversion) are in
+// etna_format.hh.
 
 // =============================================================================
 //  Compute -- the programmable shader cores (PPU / unified shader)
@@ -344,11 +550,15 @@ enum BlitFlags : uint32_t {
 //   - "u8 image" is just bytes: an ARGB8888 W x H framebuffer is a u8 image of
 //     (4*W) x H, and a per-byte kernel then operates independently per channel.
 //   - `width` is in BYTES and must be a multiple of 16 (the EVIS vector width).
+//   - Typed images (u16, s16, f16, f32: an Image below) are the same bytes with
+//     the element type on the kernel's ALU ops (ppu_asm.hh "Element types"):
+//     build one with make_kernel(gpu, ppu::build_*_typed_shader, type).
 //
 //  THE OP TOOLKIT (all hardware-verified per-byte u8 SIMD; see ppu_asm.hh)
 //     ADD, IADDSAT (saturating), IMULLO (low half), IMULHI/mul_hi (high half),
 //     AND, NOT, u32 immediates, and img_load/img_store. New kernels compose these
-//     with the emit_* helpers in ppu_asm.hh.
+//     with the emit_* helpers in ppu_asm.hh, or, past a few instructions, with
+//     ProgramBuilder (ppu_program.hh), which allocates the registers.
 //
 //  USAGE
 //     Kernel add   = make_kernel(gpu, ppu::build_add_shader);       // compile once
@@ -364,6 +574,9 @@ struct Kernel {
 	Bo binary;				  // the shader program in GPU memory
 	uint32_t inst_dwords = 0; // program size in dwords (4 per instruction)
 	uint32_t reg_count = 0;	  // temp registers the program uses
+	uint32_t type = ppu::TYPE_U8; // element type it was built for
+	uint32_t id = 0;			  // program hash: the tuning table's key (etna_tune.hh)
+	ppu::Uniforms uniforms{};	  // constants the dispatch loads (ppu_kernels.hh)
 	explicit operator bool() const
 	{
 		return bool(binary);
@@ -374,14 +587,41 @@ struct Kernel {
 // instructions = 32 dwords) and returns its ShaderInfo.
 using ShaderBuilder = ppu::ShaderInfo (*)(uint32_t *, uint32_t, uint32_t);
 
-// Compile a shader builder into a reusable Kernel (allocates GPU memory for the
-// program and uploads it). Returns an empty Kernel (operator bool == false) on
-// allocation failure.
-Kernel make_kernel(Gpu &gpu, ShaderBuilder build);
+// Compile a shader builder into a reusable Kernel. The program comes from the
+// shader cache (Gpu::get_shader): uploaded once, shared by every Kernel built
+// from the same code, so release one with gpu.put_shader(k.binary), not
+// free(). `type` is passed as the builder's dataType: keep the default for
+// the u8 kernels, pass the element type to a typed one. Returns an empty
+// Kernel (operator bool == false) on allocation failure, or if the builder
+// has nothing for `type`.
+Kernel make_kernel(Gpu &gpu, ShaderBuilder build, uint32_t type = ppu::TYPE_U8);
+
+// Upload a ProgramBuilder program (ppu_program.hh) -- e.g. a convolution,
+// threshold or colour conversion from ppu_kernels.hh -- with its constants.
+// Empty if the Program is.
+Kernel make_kernel(Gpu &gpu, const ppu::Program &prog);
+
+// Upload a program built by hand, e.g. build_and_imm_shader() with its
+// immediate. Empty if `si` is.
+Kernel make_kernel(Gpu &gpu, const uint32_t *inst, ppu::ShaderInfo si, uint32_t type = ppu::TYPE_U8);
+
+// A typed image: `width` x `height` elements of `type` (ppu::TYPE_*), rows
+// packed. Row bytes must be a multiple of 16.
+struct Image {
+	Bo bo;
+	uint32_t width = 0, height = 0;
+	uint32_t type = ppu::TYPE_U8;
+
+	uint32_t row_bytes() const
+	{
+		return width * ppu::elem_bytes(type);
+	}
+};
 
 // Run `k` over its input image(s) -> `out` (all width x height u8, width a
 // multiple of 16). Blocks until the GPU finishes. The three overloads bind 1, 2,
-// or 3 inputs; use the arity that matches the kernel. The caller handles cache
+// or 3 inputs; use the arity that matches the kernel. The launch shape comes
+// from tune_table() (etna_tune.hh), the vendor default if it has none. The caller handles cache
 // bracketing: cpu_fini(RelocWrite) the inputs before, cpu_prep(RelocRead) the
 // output after.
 bool compute(Gpu &gpu, const Kernel &k, const Bo &out, const Bo &in0, uint32_t width, uint32_t height);
@@ -395,6 +635,12 @@ bool compute(Gpu &gpu,
 			 uint32_t width,
 			 uint32_t height);
 
+// Typed: every image must have the kernel's element type and the same size;
+// false (nothing dispatched) if not. Blocks like the u8 overloads.
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0);
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0, const Image &in1);
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0, const Image &in1, const Image &in2);
+
 // Demo/self-test: builds and runs the whole kernel suite (copy, add, blends,
 // multiply, alpha lerp, ...) over gradient data and verifies each on the CPU.
 bool compute_test(Gpu &gpu);
@@ -407,7 +653,37 @@ uint32_t set_gpu_mem_clock(uint32_t target_hz);
 // Solid-color fill of `dst` (width x height, linear). Emits the RS clear
 // sequence + PE drain (stall + cache flush + stall); submit() adds the ring
 // completion trailer. Note: no END -- END would halt the FE's ring loop.
-void clear(CmdStream &cs, const Bo &dst, uint32_t width, uint32_t height, uint32_t argb);
+// drain = false leaves the drain to the caller (a Frame, etna_frame.hh, only
+// drains where a later op depends on the result); likewise for blit/resolve.
+// `argb` is packed for `fmt` (rs_clear_value()); the stride is width * its
+// bytes per pixel.
+void clear(CmdStream &cs,
+		   const Bo &dst,
+		   uint32_t width,
+		   uint32_t height,
+		   uint32_t argb,
+		   Format fmt = Format::A8R8G8B8,
+		   bool drain = true);
+
+// A surface's tile status (etna_ts.hh): its TS buffer, ts_bytes(surface size)
+// long, and the value its cleared tiles read as. fast_clear() sets both up;
+// pass it along to every draw into the surface (MeshDraw::rt_ts / depth_ts)
+// and to the resolve out of it.
+struct TileStatus {
+	const Bo *bo = nullptr;
+	uint32_t clear_value = 0; // TS_*_CLEAR_VALUE
+	explicit operator bool() const
+	{
+		return bo != nullptr;
+	}
+};
+
+// Fast clear: mark every tile of `ts` cleared to `value`, the word a full
+// clear() would fill the surface with (the A8R8G8B8 color; for D16 depth
+// ts_depth_clear_value()). An RS fill of the TS buffer only -- 9.5 KB for a
+// 1024x600 A8R8G8B8 target instead of 2.4 MB. The surface memory is left
+// stale: read it only through `ts` from now on.
+void fast_clear(CmdStream &cs, TileStatus &ts, uint32_t value, bool drain = true);
 
 // Copy `src` -> `dst` (same size, linear) with optional per-pixel transform
 // (R<->B swap, flip), including the completion trailer.
@@ -417,20 +693,85 @@ void blit(CmdStream &cs,
 		  uint32_t width,
 		  uint32_t height,
 		  Format fmt = Format::A8R8G8B8,
-		  uint32_t flags = BlitNone);
+		  uint32_t flags = BlitNone,
+		  bool drain = true);
+
+// The same, converting from `src_fmt` to `dst_fmt` on the way (e.g. an
+// A8R8G8B8 image into an R5G6B5 framebuffer); each side's stride is width *
+// its own bytes per pixel. With BlitDownsampleX/Y the destination is half
+// the source (width x height) in that direction, box-filtered: a mip level or
+// a thumbnail in one pass. rs_blit_reference() is the reference.
+void blit(CmdStream &cs,
+		  const Bo &dst,
+		  Format dst_fmt,
+		  const Bo &src,
+		  Format src_fmt,
+		  uint32_t width,
+		  uint32_t height,
+		  uint32_t flags = BlitNone,
+		  bool drain = true);
 
 // Resolve (untile): copy a tiled surface (what the 3D pipe renders) to a
-// linear one (pixel (x,y) at y*dst_stride + x*4) -- for CPU access or display
-// scanout. src_tiled_stride is the tiled row stride (align(W,16)*4); width
-// must be a multiple of 16. A8R8G8B8 only for now.
+// linear one (pixel (x,y) at y*dst_stride + x*bytes) -- for CPU access or
+// display scanout. src_tiled_stride is the tiled row stride (align(W,16)*4);
+// width must be a multiple of 16. The source is the A8R8G8B8 render target;
+// the destination may be any Format, converted as blit() does. `flags` are
+// BlitFlags: BlitDownsample2x resolves a 2W x 2H render to a W x H
+// destination (width/height are the render's size), box-filtered.
+void resolve(CmdStream &cs,
+			 const Bo &dst,
+			 const Bo &src,
+			 uint32_t width,
+			 uint32_t height,
+			 uint32_t src_tiled_stride,
+			 uint32_t dst_stride,
+			 uint32_t dst_offset = 0, // byte offset into dst (place at y*stride + x*bytes)
+			 Format dst_fmt = Format::A8R8G8B8,
+			 uint32_t flags = BlitNone,
+			 bool drain = true);
+
+// The same out of a fast-cleared render target: the RS reads `src` through
+// its tile status, writing the clear value for the tiles nothing has drawn
+// into instead of reading them.
 void resolve(CmdStream &cs,
 			 const Bo &dst,
 			 const Bo &src,
+			 const TileStatus &src_ts,
 			 uint32_t width,
 			 uint32_t height,
 			 uint32_t src_tiled_stride,
 			 uint32_t dst_stride,
-			 uint32_t dst_offset = 0); // byte offset into dst (place at y*stride + x*4)
+			 uint32_t dst_offset = 0,
+			 Format dst_fmt = Format::A8R8G8B8,
+			 uint32_t flags = BlitNone,
+			 bool drain = true);
+
+// Resolve only rectangle `r` of the render target into the same place of
+// `dst` (etna_damage.hh): the pixels a frame changed. `r` must be RS-aligned
+// (rs_align(): x to 16, y to 4). Optionally through `src`'s tile status; the
+// TS address moves with the source's.
+void resolve_rect(CmdStream &cs,
+				  const Bo &dst,
+				  const Bo &src,
+				  const Rect &r,
+				  uint32_t src_tiled_stride,
+				  uint32_t dst_stride,
+				  Format dst_fmt = Format::A8R8G8B8,
+				  bool drain = true);
+void resolve_rect(CmdStream &cs,
+				  const Bo &dst,
+				  const Bo &src,
+				  const TileStatus &src_ts,
+				  const Rect &r,
+				  uint32_t src_tiled_stride,
+				  uint32_t dst_stride,
+				  Format dst_fmt = Format::A8R8G8B8,
+				  bool drain = true);
+
+// Print the stream's words for tools/cs_decode on the host: a "cs <label>:"
+// line, then "cs: " lines of 8 hex words, so the decoder finds a stream in a
+// console log among everything else.
+void dump_stream(const CmdStream &cs, const char *label);
 
 // =============================================================================
 //  Usage sketch -- how the current tests become API calls
@@ -1,8 +1,10 @@
 #include "etna_3d.hh"
 #include "etna.hh"
+#include "etna_state.hh"
 #include "gpu_regs.hh"
 #include "gpu_regs_3d.hh"
 #include <algorithm>
+#include <array>
 
 // =============================================================================
 //  etna_3d.cc -- minimal 3D draws on the HALTI5 graphics pipe
@@ -140,30 +142,93 @@ void fill_tex_descriptor(std::span<uint32_t> d, uint32_t tex_addr, uint32_t w, u
 	d[33] = 1;									   // 3D_CONFIG: DEPTH(1)
 }
 
+namespace
+{
+// Where emit_mesh_with() sends plain state. DirectState writes every register
+// as it comes (the verified sequence); TrackedState goes through a shadow
+// (etna_state.hh) that drops unchanged registers and coalesces the rest.
+struct DirectState {
+	CmdStream &cs;
+	void set(uint32_t addr, uint32_t value)
+	{
+		cs.set_state(addr, value);
+	}
+	void set_fixp(uint32_t addr, uint32_t value)
+	{
+		set_state_fixp(cs, addr, value);
+	}
+	void set_reloc(uint32_t addr, const Reloc &r)
+	{
+		cs.set_state_reloc(addr, r);
+	}
+	void flush()
+	{}
+	bool program_changed(const std::array<uint32_t, 4> &)
+	{
+		return true;
+	}
+};
+
+struct TrackedState {
+	CmdStream &cs;
+	StateTracker &st;
+	void set(uint32_t addr, uint32_t value)
+	{
+		st.set(cs, addr, value);
+	}
+	void set_fixp(uint32_t addr, uint32_t value)
+	{
+		st.set(cs, addr, value, true);
+	}
+	void set_reloc(uint32_t addr, const Reloc &r)
+	{
+		cs.add_bo(*r.bo, r.flags); // referenced even when the shadow drops the write
+		st.set(cs, addr, r.bo->gpu_addr() + r.offset);
+	}
+	void flush()
+	{
+		st.flush(cs);
+	}
+	bool program_changed(const std::array<uint32_t, 4> &key)
+	{
+		return st.program_changed(key);
+	}
+};
+
 // One-time HALTI5 pipe init (subset of etna_reset_gpu_state). Idempotent state,
-// so we just emit it ahead of the draw.
-static void emit_reset(CmdStream &cs)
+// so we just emit it ahead of the draw. The ICACHE invalidate is an action,
+// never shadowed; tracked draws only issue it along with a shader upload.
+template<typename State>
+void emit_reset_with(State &s, bool invalidate_icache = true)
 {
-	cs.set_state(GL_API_MODE, 0); // OPENGL
-	cs.set_state(PA_W_CLIP_LIMIT, 0x34000001);
-	cs.set_state(PA_FLAGS, 0);
-	cs.set_state(PA_VIEWPORT_UNK00A80, 0x38A01404);
-	cs.set_state(PA_VIEWPORT_UNK00A84, fui(8192.0f));
-	cs.set_state(PA_ZFARCLIPPING, 0);
-	cs.set_state(RA_HDEPTH_CONTROL, 0x7000);
-	cs.set_state(PS_CONTROL_EXT, 0);
-	cs.set_state(VS_HALTI1_UNK00884, 0x808);
-	cs.set_state(PS_HALTI3_UNK0103C, 0x76543210);
-	cs.set_state(PE_HALTI4_UNK014C0, 0);
-	cs.set_state(NTE_DESCRIPTOR_CONTROL, 1); // ENABLE
-	cs.set_state(FE_HALTI5_UNK007D8, 2);
-	cs.set_state(PS_SAMPLER_BASE, 0);
-	cs.set_state(VS_SAMPLER_BASE, 0x20);
-	cs.set_state(SH_CONFIG, SH_CONFIG_RTNE);
-	cs.set_state(RS_SINGLE_BUFFER, 1);
-	cs.set_state(VS_ICACHE_INVALIDATE, 0x1F); // UNK0..UNK4
+	s.set(GL_API_MODE, 0); // OPENGL
+	s.set(PA_W_CLIP_LIMIT, 0x34000001);
+	s.set(PA_FLAGS, 0);
+	s.set(PA_VIEWPORT_UNK00A80, 0x38A01404);
+	s.set(PA_VIEWPORT_UNK00A84, fui(8192.0f));
+	s.set(PA_ZFARCLIPPING, 0);
+	s.set(RA_HDEPTH_CONTROL, 0x7000);
+	s.set(PS_CONTROL_EXT, 0);
+	s.set(VS_HALTI1_UNK00884, 0x808);
+	s.set(PS_HALTI3_UNK0103C, 0x76543210);
+	s.set(PE_HALTI4_UNK014C0, 0);
+	s.set(NTE_DESCRIPTOR_CONTROL, 1); // ENABLE
+	s.set(FE_HALTI5_UNK007D8, 2);
+	s.set(PS_SAMPLER_BASE, 0);
+	s.set(VS_SAMPLER_BASE, 0x20);
+	s.set(SH_CONFIG, SH_CONFIG_RTNE);
+	s.set(RS_SINGLE_BUFFER, 1);
+	if (invalidate_icache)
+		s.cs.set_state(VS_ICACHE_INVALIDATE, 0x1F); // UNK0..UNK4
 }
 
+void emit_reset(CmdStream &cs)
+{
+	DirectState s{cs};
+	emit_reset_with(s);
+}
+} // namespace
+
 // Emit the full per-draw state + shader upload + DRAW for a position-only VS +
 // constant-color FS, one render target, blend/cull off, no varyings. Depth is
 // off unless a `depth` buffer is passed, in which case the depth test is LESS
@@ -267,6 +332,7 @@ void emit_triangle(CmdStream &cs,
 	cs.set_state(PE_DITHER1, 0xFFFFFFFF);
 	cs.set_state(PE_STENCIL_CONFIG_EXT2, 0);
 	cs.set_state(PE_MEM_CONFIG, 0);
+	cs.set_state(TS_MEM_CONFIG, 0); // no fast clear
 
 	// --- HALTI5 shader linkage (no varyings) ---------------------------------
 	cs.set_state(FE_HALTI5_ID_CONFIG, 0);
@@ -436,6 +502,7 @@ void emit_triangle_color(CmdStream &cs,
 	cs.set_state(PE_DITHER1, 0xFFFFFFFF);
 	cs.set_state(PE_STENCIL_CONFIG_EXT2, 0);
 	cs.set_state(PE_MEM_CONFIG, 0);
+	cs.set_state(TS_MEM_CONFIG, 0); // no fast clear
 
 	// --- HALTI5 shader linkage: 1 smooth vec4 varying ------------------------
 	cs.set_state(FE_HALTI5_ID_CONFIG, 0);
@@ -599,6 +666,7 @@ void emit_triangle_tex(CmdStream &cs,
 	cs.set_state(PE_DITHER1, 0xFFFFFFFF);
 	cs.set_state(PE_STENCIL_CONFIG_EXT2, 0);
 	cs.set_state(PE_MEM_CONFIG, 0);
+	cs.set_state(TS_MEM_CONFIG, 0); // no fast clear
 
 	// --- HALTI5 shader linkage: 1 smooth vec4 varying (same as color draw) ----
 	cs.set_state(FE_HALTI5_ID_CONFIG, 0);
@@ -665,150 +733,223 @@ void emit_triangle_tex(CmdStream &cs,
 // uniform upload to the unified bank (VS reads them as u0.. with rgroup=
 // uniform; VS_UNIFORM_BASE = 0). Vertex format is fixed: pos vec3 @0 + vec4
 // attribute @12, one interleaved stream.
-void emit_mesh(CmdStream &cs, const MeshDraw &d)
+namespace
 {
-	emit_reset(cs);
-
-	cs.flush_cache();
-	cs.stall(SYNC_RECIPIENT_RA, SYNC_RECIPIENT_PE);
+template<typename State>
+uint32_t emit_mesh_with(State &s, const MeshDraw &d)
+{
+	CmdStream &cs = s.cs;
+	// Tracked, the shader upload (and the ICACHE invalidate/prefetch that go
+	// with it) is only emitted when the program changes -- as Mesa only does
+	// under ETNA_DIRTY_SHADER.
+	bool upload = s.program_changed({d.vs->gpu_addr(), d.vs_words, d.ps->gpu_addr(), d.ps_words});
+	emit_reset_with(s, upload);
+
+	s.flush();
+	if (d.sync) {
+		cs.flush_cache();
+		cs.stall(SYNC_RECIPIENT_RA, SYNC_RECIPIENT_PE);
+	}
 
 	// --- vertex input (NFE): pos vec3 @0 + vec4 @12, one interleaved stream --
-	cs.set_state(NFE_ATTRIB_CONFIG0_0 + 0, NFE_TYPE_FLOAT | (3u << 12));
-	cs.set_state(NFE_ATTRIB_SCALE0 + 0, fui(1.0f));
-	cs.set_state(NFE_ATTRIB_CONFIG1_0 + 0, 12u);
-	cs.set_state(NFE_ATTRIB_CONFIG0_0 + 4, NFE_TYPE_FLOAT | (4u << 12) | (12u << 16));
-	cs.set_state(NFE_ATTRIB_SCALE0 + 4, fui(1.0f));
-	cs.set_state(NFE_ATTRIB_CONFIG1_0 + 4, 0x800u | 28u);
-	cs.set_state_reloc(NFE_VERTEX_STREAM_BASE0, {d.vtx, RelocRead, 0});
-	cs.set_state(NFE_VERTEX_STREAM_CONTROL0, d.vtx_stride);
-	cs.set_state(NFE_VERTEX_STREAM_DIVISOR0, 0);
+	s.set(NFE_ATTRIB_CONFIG0_0 + 0, NFE_TYPE_FLOAT | (3u << 12));
+	s.set(NFE_ATTRIB_SCALE0 + 0, fui(1.0f));
+	s.set(NFE_ATTRIB_CONFIG1_0 + 0, 12u);
+	s.set(NFE_ATTRIB_CONFIG0_0 + 4, NFE_TYPE_FLOAT | (4u << 12) | (12u << 16));
+	s.set(NFE_ATTRIB_SCALE0 + 4, fui(1.0f));
+	s.set(NFE_ATTRIB_CONFIG1_0 + 4, 0x800u | 28u);
+	s.set_reloc(NFE_VERTEX_STREAM_BASE0, {d.vtx, RelocRead, 0});
+	s.set(NFE_VERTEX_STREAM_CONTROL0, d.vtx_stride);
+	s.set(NFE_VERTEX_STREAM_DIVISOR0, 0);
+	// Per-instance vec4s from stream 1, stepping once per instance.
+	uint32_t inputs = 2;
+	if (d.inst) {
+		uint32_t n = std::min(d.inst_vec4s, 14u);
+		for (uint32_t j = 0; j < n; j++) {
+			uint32_t a = 4 * (2 + j);
+			s.set(NFE_ATTRIB_CONFIG0_0 + a, NFE_TYPE_FLOAT | (4u << 12) | (1u << 8) | ((16 * j) << 16));
+			s.set(NFE_ATTRIB_SCALE0 + a, fui(1.0f));
+			s.set(NFE_ATTRIB_CONFIG1_0 + a, (j + 1 == n ? 0x800u : 0) | (16 * j + 16));
+		}
+		s.set_reloc(NFE_VERTEX_STREAM_BASE0 + 4, {d.inst, RelocRead, 0});
+		s.set(NFE_VERTEX_STREAM_CONTROL0 + 4, d.inst_stride);
+		s.set(NFE_VERTEX_STREAM_DIVISOR0 + 4, 1);
+		inputs += n;
+	}
+	if (d.index) {
+		s.set_reloc(FE_INDEX_STREAM_BASE_ADDR, {d.index, RelocRead, d.index_offset});
+		s.set(FE_INDEX_STREAM_CONTROL, uint32_t(d.index_type));
+	}
 
-	cs.set_state(GL_MULTI_SAMPLE_CONFIG, 0);
+	s.set(GL_MULTI_SAMPLE_CONFIG, 0);
 
-	// --- VS config: 2 inputs, 2 outputs (position + 1 varying) ---------------
-	cs.set_state(VS_OUTPUT_COUNT, 2);
-	cs.set_state(VS_INPUT_COUNT, 0x102);
-	cs.set_state(VS_TEMP_REGISTER_CONTROL, d.vs_temps);
-	cs.set_state(VS_LOAD_BALANCING, 0x0F3F0241);
+	// --- VS config: 2 (+ instance) inputs, 2 outputs (position + 1 varying) ---
+	s.set(VS_OUTPUT_COUNT, 2);
+	s.set(VS_INPUT_COUNT, 0x100 | inputs);
+	s.set(VS_TEMP_REGISTER_CONTROL, d.vs_temps);
+	s.set(VS_LOAD_BALANCING, 0x0F3F0241);
 
 	// --- PA viewport -----------------------------------------------------------
-	set_state_fixp(cs, PA_VIEWPORT_SCALE_X, fixp16(d.width / 2.0f));
-	set_state_fixp(cs, PA_VIEWPORT_SCALE_Y, fixp16(d.height / 2.0f));
-	cs.set_state(PA_VIEWPORT_SCALE_Z, fui(1.0f));
-	set_state_fixp(cs, PA_VIEWPORT_OFFSET_X, fixp16(d.width / 2.0f));
-	set_state_fixp(cs, PA_VIEWPORT_OFFSET_Y, fixp16(d.height / 2.0f));
-	cs.set_state(PA_VIEWPORT_OFFSET_Z, fui(0.0f));
-	cs.set_state(PA_LINE_WIDTH, fui(0.5f));
-	cs.set_state(PA_POINT_SIZE, fui(0.5f));
-	cs.set_state(PA_SYSTEM_MODE, 0x1);
-	cs.set_state(PA_ATTRIBUTE_ELEMENT_COUNT, 1); // 1 varying
-	cs.set_state(PA_CONFIG, PA_CONFIG_TRIANGLE);
-	cs.set_state(PA_WIDE_LINE_WIDTH0, fui(0.5f));
-	cs.set_state(PA_WIDE_LINE_WIDTH1, fui(0.5f));
+	s.set_fixp(PA_VIEWPORT_SCALE_X, fixp16(d.width / 2.0f));
+	s.set_fixp(PA_VIEWPORT_SCALE_Y, fixp16(d.height / 2.0f));
+	s.set(PA_VIEWPORT_SCALE_Z, fui(1.0f));
+	s.set_fixp(PA_VIEWPORT_OFFSET_X, fixp16(d.width / 2.0f));
+	s.set_fixp(PA_VIEWPORT_OFFSET_Y, fixp16(d.height / 2.0f));
+	s.set(PA_VIEWPORT_OFFSET_Z, fui(0.0f));
+	s.set(PA_LINE_WIDTH, fui(0.5f));
+	s.set(PA_POINT_SIZE, fui(0.5f));
+	s.set(PA_SYSTEM_MODE, 0x1);
+	s.set(PA_ATTRIBUTE_ELEMENT_COUNT, 1); // 1 varying
+	s.set(PA_CONFIG, PA_CONFIG_TRIANGLE);
+	s.set(PA_WIDE_LINE_WIDTH0, fui(0.5f));
+	s.set(PA_WIDE_LINE_WIDTH1, fui(0.5f));
 
 	// --- SE scissor + clip ------------------------------------------------------
-	set_state_fixp(cs, SE_SCISSOR_LEFT, 0);
-	set_state_fixp(cs, SE_SCISSOR_TOP, 0);
-	set_state_fixp(cs, SE_SCISSOR_RIGHT, (d.width << 16) + SE_SCISSOR_MARGIN_RIGHT);
-	set_state_fixp(cs, SE_SCISSOR_BOTTOM, (d.height << 16) + SE_SCISSOR_MARGIN_BOTTOM);
-	cs.set_state(SE_DEPTH_SCALE, 0);
-	cs.set_state(SE_DEPTH_BIAS, 0);
-	cs.set_state(SE_CONFIG, 0);
-	set_state_fixp(cs, SE_CLIP_RIGHT, (d.width << 16) + SE_CLIP_MARGIN_RIGHT);
-	set_state_fixp(cs, SE_CLIP_BOTTOM, (d.height << 16) + SE_CLIP_MARGIN_BOTTOM);
+	s.set_fixp(SE_SCISSOR_LEFT, 0);
+	s.set_fixp(SE_SCISSOR_TOP, 0);
+	s.set_fixp(SE_SCISSOR_RIGHT, (d.width << 16) + SE_SCISSOR_MARGIN_RIGHT);
+	s.set_fixp(SE_SCISSOR_BOTTOM, (d.height << 16) + SE_SCISSOR_MARGIN_BOTTOM);
+	s.set(SE_DEPTH_SCALE, 0);
+	s.set(SE_DEPTH_BIAS, 0);
+	s.set(SE_CONFIG, 0);
+	s.set_fixp(SE_CLIP_RIGHT, (d.width << 16) + SE_CLIP_MARGIN_RIGHT);
+	s.set_fixp(SE_CLIP_BOTTOM, (d.height << 16) + SE_CLIP_MARGIN_BOTTOM);
 
 	// --- RA ----------------------------------------------------------------------
-	cs.set_state(RA_CONTROL, 0x1);
-	cs.set_state(RA_EARLY_DEPTH, RA_EARLY_DEPTH_DISABLED);
+	s.set(RA_CONTROL, 0x1);
+	s.set(RA_EARLY_DEPTH, RA_EARLY_DEPTH_DISABLED);
 
 	// --- PS config ----------------------------------------------------------------
-	cs.set_state(PS_OUTPUT_REG, d.ps_out_reg);
-	cs.set_state(PS_INPUT_COUNT, 0x102); // COUNT(2) | UNK8(1)
-	cs.set_state(PS_TEMP_REGISTER_CONTROL, d.ps_temps);
-	cs.set_state(PS_CONTROL, 0x2); // SATURATE_RT0
+	s.set(PS_OUTPUT_REG, d.ps_out_reg);
+	s.set(PS_INPUT_COUNT, 0x102); // COUNT(2) | UNK8(1)
+	s.set(PS_TEMP_REGISTER_CONTROL, d.ps_temps);
+	s.set(PS_CONTROL, 0x2); // SATURATE_RT0
 
 	// --- PE render target + optional depth -----------------------------------
-	cs.set_state(PE_DEPTH_CONFIG, d.depth ? PE_DEPTH_CONFIG_D16_LESS_WRITE : PE_DEPTH_CONFIG_DISABLED);
-	cs.set_state(PE_DEPTH_NEAR, fui(0.0f));
-	cs.set_state(PE_DEPTH_FAR, fui(1.0f));
-	cs.set_state(PE_DEPTH_NORMALIZE, d.depth ? fui(65535.0f) : 0);
-	cs.set_state(PE_DEPTH_STRIDE, d.depth_stride);
+	s.set(PE_DEPTH_CONFIG, d.depth ? PE_DEPTH_CONFIG_D16_LESS_WRITE : PE_DEPTH_CONFIG_DISABLED);
+	s.set(PE_DEPTH_NEAR, fui(0.0f));
+	s.set(PE_DEPTH_FAR, fui(1.0f));
+	s.set(PE_DEPTH_NORMALIZE, d.depth ? fui(65535.0f) : 0);
+	s.set(PE_DEPTH_STRIDE, d.depth_stride);
 	if (d.depth)
-		cs.set_state_reloc(PE_PIPE_DEPTH_ADDR0, {d.depth, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
-	cs.set_state(PE_STENCIL_OP, 0);
-	cs.set_state(PE_STENCIL_CONFIG, 0);
-	cs.set_state(PE_ALPHA_OP, 0);
-	cs.set_state(PE_ALPHA_BLEND_COLOR, 0);
-	cs.set_state(PE_ALPHA_CONFIG, 0);
-	cs.set_state(PE_COLOR_FORMAT, PE_FORMAT_A8R8G8B8 | PE_COLOR_FORMAT_COMPONENTS_ALL | PE_COLOR_FORMAT_OVERWRITE);
-	cs.set_state(PE_COLOR_STRIDE, d.rt_stride);
-	cs.set_state(PE_HDEPTH_CONTROL, 0);
-	cs.set_state_reloc(PE_PIPE_COLOR_ADDR0, {d.rt, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
-	cs.set_state(PE_STENCIL_CONFIG_EXT, 0);
-	cs.set_state(PE_LOGIC_OP, PE_LOGIC_OP_COPY_SINGLEBUF);
-	cs.set_state(PE_DITHER0, 0xFFFFFFFF);
-	cs.set_state(PE_DITHER1, 0xFFFFFFFF);
-	cs.set_state(PE_STENCIL_CONFIG_EXT2, 0);
-	cs.set_state(PE_MEM_CONFIG, 0);
+		s.set_reloc(PE_PIPE_DEPTH_ADDR0, {d.depth, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+	s.set(PE_STENCIL_OP, 0);
+	s.set(PE_STENCIL_CONFIG, 0);
+	s.set(PE_ALPHA_OP, 0);
+	s.set(PE_ALPHA_BLEND_COLOR, 0);
+	s.set(PE_ALPHA_CONFIG, 0);
+	s.set(PE_COLOR_FORMAT, PE_FORMAT_A8R8G8B8 | PE_COLOR_FORMAT_COMPONENTS_ALL | PE_COLOR_FORMAT_OVERWRITE);
+	s.set(PE_COLOR_STRIDE, d.rt_stride);
+	s.set(PE_HDEPTH_CONTROL, 0);
+	s.set_reloc(PE_PIPE_COLOR_ADDR0, {d.rt, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+	s.set(PE_STENCIL_CONFIG_EXT, 0);
+	s.set(PE_LOGIC_OP, PE_LOGIC_OP_COPY_SINGLEBUF);
+	s.set(PE_DITHER0, 0xFFFFFFFF);
+	s.set(PE_DITHER1, 0xFFFFFFFF);
+	s.set(PE_STENCIL_CONFIG_EXT2, 0);
+	s.set(PE_MEM_CONFIG, 0);
+
+	// --- tile status: always programmed, so a TS left on by an earlier pass
+	// never applies to a target without one -------------------------------
+	const bool depth_ts = d.depth && d.depth_ts;
+	s.set(TS_MEM_CONFIG, ts_mem_config(bool(d.rt_ts), depth_ts));
+	if (d.rt_ts) {
+		s.set_reloc(TS_COLOR_STATUS_BASE, {d.rt_ts.bo, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+		s.set_reloc(TS_COLOR_SURFACE_BASE, {d.rt, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+		s.set(TS_COLOR_CLEAR_VALUE, d.rt_ts.clear_value);
+	}
+	if (depth_ts) {
+		s.set_reloc(TS_DEPTH_STATUS_BASE, {d.depth_ts.bo, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+		s.set_reloc(TS_DEPTH_SURFACE_BASE, {d.depth, static_cast<uint32_t>(RelocRead | RelocWrite), 0});
+		s.set(TS_DEPTH_CLEAR_VALUE, d.depth_ts.clear_value);
+	}
 
 	// --- HALTI5 shader linkage: 1 smooth vec4 varying -------------------------
-	cs.set_state(FE_HALTI5_ID_CONFIG, 0);
-	cs.set_state(VS_HALTI5_OUTPUT_COUNT, 0x2002);
-	cs.set_state(VS_HALTI5_UNK008A0, 0x0881000E);
-	cs.set_state(VS_HALTI5_OUTPUT0, 0x0302); // pos=t2, varying=t3
-	cs.set_state(VS_HALTI5_INPUT0, 0x0100);	 // attr0->t0, attr1->t1
-	cs.set_state(PA_VS_OUTPUT_COUNT, 2);
-	cs.set_state(PA_VARYING_NUM_COMPONENTS0, 4);
-	cs.set_state(PA_VARYING_NUM_COMPONENTS1, 0);
-	cs.set_state(PS_VARYING_NUM_COMPONENTS0, 4);
-	cs.set_state(PS_VARYING_NUM_COMPONENTS1, 0);
-	cs.set_state(GL_VARYING_TOTAL_COMPONENTS, 4);
-	cs.set_state(GL_HALTI5_SH_SPECIALS, 0x7F7F7F00);
-	cs.set_state(GL_HALTI5_SHADER_ATTRIBUTES0, 0);
-
-	cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	s.set(FE_HALTI5_ID_CONFIG, 0);
+	s.set(VS_HALTI5_OUTPUT_COUNT, 0x2002);
+	s.set(VS_HALTI5_UNK008A0, 0x0881000E);
+	s.set(VS_HALTI5_OUTPUT0, 0x0302); // pos=t2, varying=t3
+	for (uint32_t r = 0; r < (inputs + 3) / 4; r++) { // attribute i -> t_i, 4 per register
+		uint32_t map = 0;
+		for (uint32_t k = 0; k < 4 && 4 * r + k < inputs; k++)
+			map |= (4 * r + k) << (8 * k);
+		s.set(VS_HALTI5_INPUT0 + 4 * r, map); // 0x0100 for the plain draw
+	}
+	s.set(PA_VS_OUTPUT_COUNT, 2);
+	s.set(PA_VARYING_NUM_COMPONENTS0, 4);
+	s.set(PA_VARYING_NUM_COMPONENTS1, 0);
+	s.set(PS_VARYING_NUM_COMPONENTS0, 4);
+	s.set(PS_VARYING_NUM_COMPONENTS1, 0);
+	s.set(GL_VARYING_TOTAL_COMPONENTS, 4);
+	s.set(GL_HALTI5_SH_SPECIALS, 0x7F7F7F00);
+	s.set(GL_HALTI5_SHADER_ATTRIBUTES0, 0);
+	s.flush();
 
 	// --- shader ICACHE upload (parametric sizes) -------------------------------
-	cs.set_state(VS_NEWRANGE_LOW, 0);
-	cs.set_state(VS_HALTI5_RANGE_HIGH, d.vs_words / 4);
-	cs.set_state_reloc(VS_INST_ADDR, {d.vs, RelocRead, 0});
-	cs.set_state(SH_CONFIG, SH_CONFIG_RTNE);
-	cs.set_state(SH_ICACHE_CONTROL, SH_ICACHE_CONTROL_ENABLE);
-	cs.set_state(VS_ICACHE_COUNT, d.vs_words / 4 - 1);
-	cs.set_state(PS_NEWRANGE_LOW, 0);
-	cs.set_state(PS_HALTI5_RANGE_HIGH, d.ps_words / 4);
-	cs.set_state_reloc(PS_INST_ADDR, {d.ps, RelocRead, 0});
-	cs.set_state(SH_CONFIG, SH_CONFIG_RTNE);
-	cs.set_state(SH_ICACHE_CONTROL, SH_ICACHE_CONTROL_ENABLE);
-	cs.set_state(PS_ICACHE_COUNT, d.ps_words / 4 - 1);
+	if (upload) {
+		cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+		cs.set_state(VS_NEWRANGE_LOW, 0);
+		cs.set_state(VS_HALTI5_RANGE_HIGH, d.vs_words / 4);
+		cs.set_state_reloc(VS_INST_ADDR, {d.vs, RelocRead, 0});
+		cs.set_state(SH_CONFIG, SH_CONFIG_RTNE);
+		cs.set_state(SH_ICACHE_CONTROL, SH_ICACHE_CONTROL_ENABLE);
+		cs.set_state(VS_ICACHE_COUNT, d.vs_words / 4 - 1);
+		cs.set_state(PS_NEWRANGE_LOW, 0);
+		cs.set_state(PS_HALTI5_RANGE_HIGH, d.ps_words / 4);
+		cs.set_state_reloc(PS_INST_ADDR, {d.ps, RelocRead, 0});
+		cs.set_state(SH_CONFIG, SH_CONFIG_RTNE);
+		cs.set_state(SH_ICACHE_CONTROL, SH_ICACHE_CONTROL_ENABLE);
+		cs.set_state(PS_ICACHE_COUNT, d.ps_words / 4 - 1);
+	}
 
 	// --- uniforms into the unified bank (VS u0.. at base 0) --------------------
 	// VS uniforms are written through the MIRROR window (0x34000); 0x36000 is
 	// the PS stage's window (which is why the FS color uniform worked there).
 	// Uploading VS uniforms via the PS window leaves the VS reading zeros ->
 	// degenerate clip positions -> "draw runs clean, zero fragments, no faults".
-	cs.set_state(VS_UNIFORM_BASE, 0);
-	cs.set_state(PS_UNIFORM_BASE, static_cast<uint32_t>(d.uniforms.size() / 4)); // PS u0 after the VS's
+	// The data is always written (never shadowed): it is the patch point.
+	s.set(VS_UNIFORM_BASE, 0);
+	s.set(PS_UNIFORM_BASE, static_cast<uint32_t>(d.uniforms.size() / 4)); // PS u0 after the VS's
+	s.flush();
+	uint32_t uniforms_at = 0;
 	if (!d.uniforms.empty()) {
 		cs.emit(cmd_load_state(SH_HALTI5_UNIFORMS_MIRROR0, static_cast<uint32_t>(d.uniforms.size())));
+		uniforms_at = cs.offset();
 		for (float f : d.uniforms)
 			cs.emit(fui(f));
 		cs.align();
 	}
 
-	cs.set_state(VS_ICACHE_PREFETCH, 0);
-	cs.set_state(PS_ICACHE_PREFETCH, 0);
-	cs.stall(SYNC_RECIPIENT_RA, SYNC_RECIPIENT_PE);
+	if (upload) {
+		cs.set_state(VS_ICACHE_PREFETCH, 0);
+		cs.set_state(PS_ICACHE_PREFETCH, 0);
+	}
+	if (upload || d.sync)
+		cs.stall(SYNC_RECIPIENT_RA, SYNC_RECIPIENT_PE);
 
 	// --- DRAW --------------------------------------------------------------------
-	cs.emit(FE_DRAW_INSTANCED | (PRIM_TRIANGLES << 16) | 1);
-	cs.emit(d.vertex_count & 0x00FFFFFF);
-	cs.emit(0);
-	cs.emit(0);
+	for (uint32_t w : cmd_draw_instanced(PRIM_TRIANGLES, d.vertex_count, d.instances, d.index != nullptr))
+		cs.emit(w);
 
-	cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
-	cs.flush_cache();
-	cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	if (d.sync) {
+		cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+		cs.flush_cache();
+		cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	}
+	return uniforms_at;
+}
+} // namespace
+
+uint32_t emit_mesh(CmdStream &cs, const MeshDraw &d)
+{
+	DirectState s{cs};
+	return emit_mesh_with(s, d);
+}
+
+uint32_t emit_mesh(CmdStream &cs, StateTracker &st, const MeshDraw &d)
+{
+	TrackedState s{cs, st};
+	return emit_mesh_with(s, d);
 }
 
 } // namespace etna
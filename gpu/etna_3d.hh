@@ -1,5 +1,6 @@
 #pragma once
 #include "etna.hh"
+#include "etna_state.hh"
 #include <cstdint>
 #include <span>
 
@@ -45,11 +46,23 @@ void emit_triangle_tex(CmdStream &cs,
 					   uint32_t height,
 					   uint32_t vertex_count);
 
+// Index width of an indexed draw (FE_INDEX_STREAM_CONTROL TYPE).
+enum class IndexType : uint8_t {
+	U16 = 1,
+	U32 = 2,
+};
+
 // Generalized mesh draw: N interleaved vertices of pos-vec3 + one vec4
 // attribute (stride 28), carried to the FS as one smooth vec4 varying;
 // optional float uniforms uploaded to the unified bank (VS u0.., base 0 --
 // e.g. a 4x4 transform as 4 column vec4s); optional D16 LESS depth test with
-// writes. Shader sizes are parametric (dwords; 4 per instruction).
+// writes; optional index buffer (u16/u32), so shared vertices are fetched
+// and shaded once (see etna_mesh.hh for building one); optional instancing
+// with a per-instance vertex stream; optional tile status (fast clear) on
+// the color and depth targets. Shader sizes are parametric (dwords; 4
+// per instruction).
+// emit_mesh() returns the dword offset in `cs` of the uniform data (0 if there
+// are none): the patch point for a recorded draw (see etna_bundle.hh).
 struct MeshDraw {
 	const Bo *rt = nullptr;
 	uint32_t rt_stride = 0;
@@ -65,10 +78,36 @@ struct MeshDraw {
 	std::span<const float> uniforms{}; // empty = none
 	uint32_t width = 0;
 	uint32_t height = 0;
-	uint32_t vertex_count = 0;
+	uint32_t vertex_count = 0; // vertices drawn (= indices read, if indexed)
 	const Bo *depth = nullptr; // optional depth buffer (cleared by caller)
 	uint32_t depth_stride = 0;
+	const Bo *index = nullptr; // optional index buffer: draw vtx[index[i]]
+	IndexType index_type = IndexType::U16;
+	uint32_t index_offset = 0; // byte offset of the first index
+	// Instancing: the draw runs `instances` times. Per-instance data, if any,
+	// is a second vertex stream `inst` advancing once per instance (divisor
+	// 1): `inst_vec4s` float vec4 attributes (up to 14), consecutive in each
+	// `inst_stride`-byte record, which the VS reads as t2, t3, ... after the
+	// two per-vertex inputs (see kCubeInstancedVs in cube_scene.hh).
+	uint32_t instances = 1;
+	const Bo *inst = nullptr;
+	uint32_t inst_stride = 0;
+	uint32_t inst_vec4s = 0;
+	// Tile status of rt / depth, once fast_clear()ed (etna_ts.hh): the PE
+	// reads their cleared tiles as the clear value instead of from memory.
+	TileStatus rt_ts{};
+	TileStatus depth_ts{};
+	// Flush + stall around the draw, so it stands alone in a submission. A
+	// Frame (etna_frame.hh) clears this and drains only on real hazards.
+	bool sync = true;
 };
-void emit_mesh(CmdStream &cs, const MeshDraw &d);
+uint32_t emit_mesh(CmdStream &cs, const MeshDraw &d);
+
+// Same draw through a shadow-state tracker (etna_state.hh): registers the
+// stream already holds are skipped, the rest go out address-sorted with
+// adjacent ones sharing a LOAD_STATE header, and the shader upload is only
+// emitted when the program changes. Consecutive draws sharing one tracker
+// depend on each other's state, so they must run in the order emitted.
+uint32_t emit_mesh(CmdStream &cs, StateTracker &st, const MeshDraw &d);
 
 } // namespace etna
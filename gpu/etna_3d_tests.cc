@@ -3,9 +3,19 @@
 #include "cube_scene.hh"
 #include "etna.hh"
 #include "etna_3d.hh"
+#include "etna_damage.hh"
+#include "etna_mesh.hh"
+#include "etna_profile.hh"
+#include "etna_timeline.hh"
+#include "etna_trace.hh"
+#include "etna_ts.hh"
+#include "gpu_io.hh"
+#include "perfmon.hh"
 #include "print/print.hh"
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <span>
 
 using namespace VivanteGpu;
 using namespace etna;
@@ -556,18 +566,14 @@ bool spinning_cube_test(etna::Gpu &gpu)
 	Bo rt = gpu.alloc(rt_size);
 	Bo depthb = gpu.alloc(depth_size);
 	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
-	Bo vsb = gpu.alloc(sizeof(kCubeVs));
-	Bo psb = gpu.alloc(sizeof(kPsColorCode));
+	Bo vsb = gpu.get_shader(kCubeVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
 	Bo lin = gpu.alloc(W * H * 4);
 	if (!rt || !depthb || !vtx || !vsb || !psb || !lin)
 		return false;
 
 	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
 	vtx.cpu_fini(RelocWrite);
-	std::ranges::copy(kCubeVs, vsb.span<uint32_t>().begin());
-	vsb.cpu_fini(RelocWrite);
-	std::ranges::copy(kPsColorCode, psb.span<uint32_t>().begin());
-	psb.cpu_fini(RelocWrite);
 
 	static std::array<uint32_t, W * H> cpu_img;
 	static std::array<uint8_t, W * H> band;
@@ -669,6 +675,888 @@ bool spinning_cube_test(etna::Gpu &gpu)
 	return true;
 }
 
+// =============================================================================
+//  Indexed cube: same image as the expanded draw, less vertex fetch
+// =============================================================================
+//
+// The cube drawn from dedup_mesh()'s 24 unique vertices + 36 u16 (then u32)
+// indices must resolve to exactly the image of the 36-vertex draw: same
+// triangles, same order. Then DDRPERFM counts the DDR reads of 64 draws of
+// each kind, each draw from its own copy of the vertex (and index) data so
+// no draw is served from the GPU's caches, into a 16x16 target so the vertex
+// fetch dominates.
+bool indexed_cube_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 64, H = 64;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t CLEAR = 0xFF000000;
+	static constexpr auto mesh = dedup_mesh<7>(kCubeVerts);
+	static constexpr auto mesh32 = dedup_mesh<7, uint32_t>(kCubeVerts);
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo ivtx = gpu.alloc(mesh.vertex_bytes());
+	constexpr uint32_t U32At = 128; // byte offset of the u32 copy of the indices
+	Bo ib = gpu.alloc(U32At + mesh32.index_bytes());
+	Bo vsb = gpu.get_shader(kCubeVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo ref = gpu.alloc(W * H * 4);
+	Bo lin = gpu.alloc(W * H * 4);
+	if (!rt || !depthb || !vtx || !ivtx || !ib || !vsb || !psb || !ref || !lin)
+		return false;
+
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+	std::copy_n(mesh.vertices.begin(), mesh.vertex_count * 7, ivtx.span<float>().begin());
+	ivtx.cpu_fini(RelocWrite);
+	std::ranges::copy(mesh.indices, ib.span<uint16_t>().begin());
+	std::ranges::copy(mesh32.indices, ib.span<uint32_t>().begin() + U32At / 4);
+	ib.cpu_fini(RelocWrite);
+
+	Mat4 m = cube_mvp(0.7f, 0.4f);
+	MeshDraw d{
+		.rt = &rt,
+		.rt_stride = stride,
+		.vtx = &vtx,
+		.vs = &vsb,
+		.vs_words = kCubeVs.size(),
+		.vs_temps = 4,
+		.ps = &psb,
+		.ps_words = kPsColorCode.size(),
+		.uniforms = m,
+		.width = W,
+		.height = H,
+		.vertex_count = 36,
+		.depth = &depthb,
+		.depth_stride = dstride,
+	};
+
+	// Draw `dd` and resolve into `out`.
+	auto render = [&](const MeshDraw &dd, const Bo &out) {
+		auto cs = gpu.new_cmd_stream(1024);
+		etna::clear(cs, rt, W, H, CLEAR);
+		etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+		etna::emit_mesh(cs, dd);
+		etna::resolve(cs, out, rt, W, H, stride, W * 4);
+		bool ok = gpu.submit_and_wait(cs);
+		gpu.free(cs);
+		out.cpu_prep(RelocRead);
+		return ok;
+	};
+	if (!render(d, ref)) {
+		gpu.dump_status("expanded cube");
+		return false;
+	}
+
+	MeshDraw di = d;
+	di.vtx = &ivtx;
+	di.index = &ib;
+	for (auto type : {IndexType::U16, IndexType::U32}) {
+		di.index_type = type;
+		di.index_offset = type == IndexType::U16 ? 0 : U32At;
+		if (!render(di, lin)) {
+			gpu.dump_status("indexed cube");
+			return false;
+		}
+		uint32_t diff = 0, drawn = 0;
+		for (uint32_t i = 0; i < W * H; i++) {
+			diff += lin.span<const uint32_t>()[i] != ref.span<const uint32_t>()[i];
+			drawn += ref.span<const uint32_t>()[i] != CLEAR;
+		}
+		print("indexed cube (", type == IndexType::U16 ? "u16" : "u32", "): ", drawn, " px drawn, ", diff,
+			  " px differ from the 36-vertex draw\n");
+		if (diff || drawn == 0) {
+			print("FAILED: indexed draw doesn't match\n");
+			return false;
+		}
+	}
+
+	// DDR reads: 64 draws, each from its own vertex/index copy, no depth.
+	constexpr uint32_t Draws = 64;
+	constexpr uint32_t Slice = 1024; // bytes per copy (>= 1008, cache-line multiple)
+	Bo many = gpu.alloc(Draws * Slice * 2);
+	if (!many)
+		return false;
+	for (uint32_t k = 0; k < Draws; k++) {
+		auto bytes = many.span<uint8_t>().subspan(k * Slice * 2, Slice * 2);
+		std::memcpy(bytes.data(), kCubeVerts.data(), sizeof(kCubeVerts));
+		std::memcpy(bytes.data() + Slice, mesh.vertices.data(), mesh.vertex_bytes());
+		std::memcpy(bytes.data() + Slice + 768, mesh.indices.data(), mesh.index_bytes());
+	}
+	many.cpu_fini(RelocWrite);
+
+	uint32_t reads[2]{};
+	for (uint32_t indexed = 0; indexed < 2; indexed++) {
+		auto cs = gpu.new_cmd_stream(Draws * 128);
+		StateTracker st;
+		for (uint32_t k = 0; k < Draws; k++) {
+			MeshDraw dk = d;
+			dk.width = dk.height = 16;
+			dk.depth = nullptr;
+			dk.sync = k + 1 == Draws; // one drain at the end
+			Bo slice{many.gpu_addr() + k * Slice * 2 + indexed * Slice, Slice};
+			Bo islice{many.gpu_addr() + k * Slice * 2 + Slice + 768, 256};
+			dk.vtx = &slice;
+			if (indexed)
+				dk.index = &islice;
+			etna::emit_mesh(cs, st, dk);
+		}
+		perfmon::ddr_start();
+		bool ok = gpu.submit_and_wait(cs);
+		auto ddr = perfmon::ddr_stop();
+		gpu.free(cs);
+		if (!ok) {
+			gpu.dump_status("fetch probe");
+			gpu.free(many);
+			return false;
+		}
+		reads[indexed] = ddr.reads;
+	}
+	gpu.free(many);
+	print("vertex fetch, ", Draws, " cubes: ", reads[0], " DDR reads expanded, ", reads[1], " indexed (",
+		  reads[0] ? reads[1] * 100 / reads[0] : 0, "%; ", Draws * sizeof(kCubeVerts) / 32, " vs ",
+		  Draws * (mesh.vertex_bytes() + mesh.index_bytes()) / 32, " 32-byte bursts of vertex data)\n");
+
+	for (Bo *b : {&rt, &depthb, &vtx, &ivtx, &ib, &ref, &lin})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	print("Indexed cube matches the expanded draw. \\o/\n");
+	return true;
+}
+
+// =============================================================================
+//  Instanced cubes: one draw, a per-instance stream, the image of N draws
+// =============================================================================
+//
+// Four cubes, each with its own matrix and tint in a CubeInstance record,
+// drawn by kCubeInstancedVs as one draw of 4 instances, must resolve to
+// exactly the image of 4 one-instance draws, each pointed at its own record.
+// Also prints what the instanced draw saves: stream dwords and GPU time.
+bool instanced_cube_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 64, H = 64;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t CLEAR = 0xFF000000;
+	constexpr uint32_t N = 4;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo inst = gpu.alloc(N * sizeof(CubeInstance));
+	Bo vsb = gpu.get_shader(kCubeInstancedVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo ref = gpu.alloc(W * H * 4);
+	Bo lin = gpu.alloc(W * H * 4);
+	if (!rt || !depthb || !vtx || !inst || !vsb || !psb || !ref || !lin)
+		return false;
+
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+	auto recs = inst.span<CubeInstance>();
+	for (uint32_t k = 0; k < N; k++) {
+		float px = k & 1 ? 0.9f : -0.9f, py = k & 2 ? 0.9f : -0.9f;
+		recs[k].mvp = cube_mvp(0.4f + k * 0.8f, 0.3f, 1.0f, px, py, -5.0f);
+		recs[k].tint = {k == 1 ? 0.5f : 1.0f, k == 2 ? 0.5f : 1.0f, k == 3 ? 0.5f : 1.0f, 1.0f};
+	}
+	inst.cpu_fini(RelocWrite);
+
+	MeshDraw d{
+		.rt = &rt,
+		.rt_stride = stride,
+		.vtx = &vtx,
+		.vs = &vsb,
+		.vs_words = kCubeInstancedVs.size(),
+		.vs_temps = 8,
+		.ps = &psb,
+		.ps_words = kPsColorCode.size(),
+		.width = W,
+		.height = H,
+		.vertex_count = 36,
+		.depth = &depthb,
+		.depth_stride = dstride,
+		.inst = &inst,
+		.inst_stride = sizeof(CubeInstance),
+		.inst_vec4s = kCubeInstanceVec4s,
+	};
+
+	// Clear, emit `draws` into one stream, resolve into `out`.
+	uint32_t dwords = 0;
+	uint64_t ticks = 0;
+	auto render = [&](std::span<const MeshDraw> draws, const Bo &out) {
+		auto cs = gpu.new_cmd_stream(4096);
+		etna::clear(cs, rt, W, H, CLEAR);
+		etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+		uint32_t start = cs.offset();
+		StateTracker st;
+		for (auto &dd : draws)
+			etna::emit_mesh(cs, st, dd);
+		dwords = cs.offset() - start;
+		etna::resolve(cs, out, rt, W, H, stride, W * 4);
+		auto t0 = read_cntpct();
+		bool ok = gpu.submit_and_wait(cs);
+		ticks = read_cntpct() - t0;
+		gpu.free(cs);
+		out.cpu_prep(RelocRead);
+		return ok;
+	};
+
+	// Reference: one draw per record.
+	std::array<Bo, N> slices;
+	std::array<MeshDraw, N> singles;
+	for (uint32_t k = 0; k < N; k++) {
+		slices[k] = Bo{inst.gpu_addr() + k * uint32_t(sizeof(CubeInstance)), sizeof(CubeInstance)};
+		singles[k] = d;
+		singles[k].inst = &slices[k];
+		singles[k].sync = k + 1 == N;
+	}
+	if (!render(singles, ref)) {
+		gpu.dump_status("cubes, one draw each");
+		return false;
+	}
+	uint32_t single_dwords = dwords;
+	uint64_t single_ticks = ticks;
+
+	d.instances = N;
+	if (!render({&d, 1}, lin)) {
+		gpu.dump_status("instanced cubes");
+		return false;
+	}
+
+	uint32_t diff = 0, drawn = 0;
+	for (uint32_t i = 0; i < W * H; i++) {
+		diff += lin.span<const uint32_t>()[i] != ref.span<const uint32_t>()[i];
+		drawn += ref.span<const uint32_t>()[i] != CLEAR;
+	}
+	print("instanced cubes: ", drawn, " px drawn, ", diff, " px differ from ", N, " separate draws\n");
+	print("  ", N, " draws: ", single_dwords, " dwords, ", uint32_t(single_ticks), " ticks; 1 draw x ", N,
+		  " instances: ", dwords, " dwords, ", uint32_t(ticks), " ticks\n");
+
+	for (Bo *b : {&rt, &depthb, &vtx, &inst, &ref, &lin})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (diff || drawn == 0) {
+		print("FAILED: instanced draw doesn't match\n");
+		return false;
+	}
+	print("One instanced draw matches ", N, " draws. \\o/\n");
+	return true;
+}
+
+// =============================================================================
+//  Fast clear: the image of a full clear, for a TS buffer's worth of DDR
+// =============================================================================
+//
+// The demo's frame at full size -- 1024x600 A8R8G8B8 + D16, instanced cubes
+// -- rendered twice: with full RS clears of both targets, and with
+// fast_clear() of their tile status, the draw and the resolve reading
+// through it. The resolved images must match exactly. The targets are
+// scribbled on before each frame, so a tile the fast path wrongly fetches
+// from memory shows up as a difference. A fast clear resolved with nothing
+// drawn must be the clear color everywhere. DDRPERFM counts the DDR writes
+// and reads of the clears alone and of the whole frame, both ways.
+bool fast_clear_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 1024, H = 600;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t CLEAR = 0xFF101828;
+	constexpr uint32_t Junk = 0x5A3C96E1;
+	constexpr uint32_t N = 4;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo rt_tsb = gpu.alloc(ts_bytes(stride * H));
+	Bo depth_tsb = gpu.alloc(ts_bytes(dstride * H));
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo inst = gpu.alloc(N * sizeof(CubeInstance));
+	Bo vsb = gpu.get_shader(kCubeInstancedVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo ref = gpu.alloc(W * H * 4);
+	Bo lin = gpu.alloc(W * H * 4);
+	if (!rt || !depthb || !rt_tsb || !depth_tsb || !vtx || !inst || !vsb || !psb || !ref || !lin)
+		return false;
+
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+	auto recs = inst.span<CubeInstance>();
+	for (uint32_t k = 0; k < N; k++) {
+		float px = k & 1 ? 1.2f : -1.2f, py = k & 2 ? 0.7f : -0.7f;
+		recs[k].mvp = cube_mvp(0.4f + k * 0.8f, 0.3f, float(W) / float(H), px, py, -4.0f);
+		recs[k].tint = {k == 1 ? 0.5f : 1.0f, k == 2 ? 0.5f : 1.0f, k == 3 ? 0.5f : 1.0f, 1.0f};
+	}
+	inst.cpu_fini(RelocWrite);
+
+	TileStatus rt_ts{&rt_tsb}, depth_ts{&depth_tsb};
+	MeshDraw d{
+		.rt = &rt,
+		.rt_stride = stride,
+		.vtx = &vtx,
+		.vs = &vsb,
+		.vs_words = kCubeInstancedVs.size(),
+		.vs_temps = 8,
+		.ps = &psb,
+		.ps_words = kPsColorCode.size(),
+		.width = W,
+		.height = H,
+		.vertex_count = 36,
+		.depth = &depthb,
+		.depth_stride = dstride,
+		.instances = N,
+		.inst = &inst,
+		.inst_stride = sizeof(CubeInstance),
+		.inst_vec4s = kCubeInstanceVec4s,
+	};
+
+	// Fill both targets with junk (not counted): whatever the fast path reads
+	// from them instead of the clear value is wrong.
+	auto scribble = [&] {
+		auto cs = gpu.new_cmd_stream(256);
+		etna::clear(cs, rt, W, H, Junk);
+		etna::clear(cs, depthb, W, dstride * H / (W * 4), Junk);
+		bool ok = gpu.submit_and_wait(cs);
+		gpu.free(cs);
+		return ok;
+	};
+	auto clears = [&](CmdStream &cs, bool fast) {
+		if (fast) {
+			etna::fast_clear(cs, rt_ts, CLEAR);
+			etna::fast_clear(cs, depth_ts, ts_depth_clear_value(0xFFFF));
+		} else {
+			etna::clear(cs, rt, W, H, CLEAR);
+			etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+		}
+	};
+	// The clears alone, then the whole frame into `out`: DDR traffic of each.
+	perfmon::DdrSample clear_ddr[2]{}, frame_ddr[2]{};
+	auto render = [&](bool fast, bool draw, const Bo &out) {
+		if (!scribble())
+			return false;
+		auto cs = gpu.new_cmd_stream(1024);
+		clears(cs, fast);
+		perfmon::ddr_start();
+		bool ok = gpu.submit_and_wait(cs);
+		clear_ddr[fast] = perfmon::ddr_stop();
+		ok = ok && scribble();
+		cs.reset();
+		clears(cs, fast);
+		MeshDraw dd = d;
+		if (fast) {
+			dd.rt_ts = rt_ts;
+			dd.depth_ts = depth_ts;
+		}
+		if (draw)
+			etna::emit_mesh(cs, dd);
+		if (fast)
+			etna::resolve(cs, out, rt, rt_ts, W, H, stride, W * 4);
+		else
+			etna::resolve(cs, out, rt, W, H, stride, W * 4);
+		perfmon::ddr_start();
+		ok = ok && gpu.submit_and_wait(cs);
+		frame_ddr[fast] = perfmon::ddr_stop();
+		gpu.free(cs);
+		out.cpu_prep(RelocRead);
+		return ok;
+	};
+
+	if (!render(false, true, ref) || !render(true, true, lin)) {
+		gpu.dump_status("fast clear frame");
+		return false;
+	}
+	uint32_t diff = 0, drawn = 0;
+	for (uint32_t i = 0; i < W * H; i++) {
+		diff += lin.span<const uint32_t>()[i] != ref.span<const uint32_t>()[i];
+		drawn += ref.span<const uint32_t>()[i] != CLEAR;
+	}
+	print("fast clear: ", drawn, " px drawn, ", diff, " px differ from the fully cleared frame\n");
+	auto kb = [](uint32_t bursts) { return bursts * 32 / 1024; };
+	for (uint32_t fast = 0; fast < 2; fast++)
+		print(fast ? "  fast clear: " : "  full clear: ", "clears ", kb(clear_ddr[fast].writes), " KB written, ",
+			  kb(clear_ddr[fast].reads), " KB read; frame ", kb(frame_ddr[fast].writes), " KB written, ",
+			  kb(frame_ddr[fast].reads), " KB read\n");
+
+	// Nothing drawn: the resolve writes the clear value for every tile.
+	if (!render(true, false, lin)) {
+		gpu.dump_status("fast clear only");
+		return false;
+	}
+	uint32_t cleared = 0;
+	for (uint32_t i = 0; i < W * H; i++)
+		cleared += lin.span<const uint32_t>()[i] == CLEAR;
+	print("fast clear, nothing drawn: ", cleared, " of ", W * H, " px are the clear color\n");
+
+	for (Bo *b : {&rt, &depthb, &rt_tsb, &depth_tsb, &vtx, &inst, &ref, &lin})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (diff || drawn == 0 || cleared != W * H) {
+		print("FAILED: fast clear doesn't match the full clear\n");
+		return false;
+	}
+	print("Fast clear matches the full clear. \\o/\n");
+	return true;
+}
+
+// =============================================================================
+//  Damage rectangles: resolve only what changed, buffers stay in sync
+// =============================================================================
+//
+// Four cubes drift across a 1024x600 target over a few frames, rendered into
+// two alternating framebuffers (double buffering) that start out as junk.
+// Each frame resolves only the rectangles its DamageTracker region names --
+// what the buffer showed plus what the frame drew, from cube_bounds() -- and
+// the buffer must then equal a full resolve of the same frame exactly. Both
+// go through the render target's tile status. DDRPERFM counts the writes of
+// the full and the partial resolve.
+bool damage_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 1024, H = 600;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t CLEAR = 0xFF101828;
+	constexpr uint32_t N = 4, Buffers = 2, Frames = 6;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo rt_tsb = gpu.alloc(ts_bytes(stride * H));
+	Bo depth_tsb = gpu.alloc(ts_bytes(dstride * H));
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo inst = gpu.alloc(N * sizeof(CubeInstance));
+	Bo vsb = gpu.get_shader(kCubeInstancedVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo ref = gpu.alloc(W * H * 4);
+	std::array<Bo, Buffers> fb{gpu.alloc(W * H * 4), gpu.alloc(W * H * 4)};
+	if (!rt || !depthb || !rt_tsb || !depth_tsb || !vtx || !inst || !vsb || !psb || !ref || !fb[0] || !fb[1])
+		return false;
+
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+	for (Bo &b : fb) {
+		std::ranges::fill(b.span<uint32_t>(), 0x5A3C96E1); // whatever was in memory
+		b.cpu_fini(RelocWrite);
+	}
+
+	TileStatus rt_ts{&rt_tsb}, depth_ts{&depth_tsb};
+	DamageTracker tracker{Buffers, W, H};
+	bool pass = true;
+	for (uint32_t frame = 0; frame < Frames && pass; frame++) {
+		// Move the cubes; what they cover is the frame's damage.
+		DamageRegion drawn = tracker.region();
+		auto recs = inst.span<CubeInstance>();
+		for (uint32_t k = 0; k < N; k++) {
+			float px = (k & 1 ? 0.4f : -1.6f) + 0.15f * frame, py = k & 2 ? 0.7f : -0.7f;
+			recs[k].mvp = cube_mvp(0.4f + k * 0.8f + 0.1f * frame, 0.3f, float(W) / float(H), px, py, -5.0f);
+			recs[k].tint = {k == 1 ? 0.5f : 1.0f, k == 2 ? 0.5f : 1.0f, k == 3 ? 0.5f : 1.0f, 1.0f};
+			drawn.add(cube_bounds(recs[k].mvp, W, H));
+		}
+		inst.cpu_fini(RelocWrite);
+
+		auto cs = gpu.new_cmd_stream(1024);
+		etna::fast_clear(cs, rt_ts, CLEAR);
+		etna::fast_clear(cs, depth_ts, ts_depth_clear_value(0xFFFF));
+		etna::emit_mesh(cs,
+						{
+							.rt = &rt,
+							.rt_stride = stride,
+							.vtx = &vtx,
+							.vs = &vsb,
+							.vs_words = kCubeInstancedVs.size(),
+							.vs_temps = 8,
+							.ps = &psb,
+							.ps_words = kPsColorCode.size(),
+							.width = W,
+							.height = H,
+							.vertex_count = 36,
+							.depth = &depthb,
+							.depth_stride = dstride,
+							.instances = N,
+							.inst = &inst,
+							.inst_stride = sizeof(CubeInstance),
+							.inst_vec4s = kCubeInstanceVec4s,
+							.rt_ts = rt_ts,
+							.depth_ts = depth_ts,
+						});
+		pass = gpu.submit_and_wait(cs);
+
+		// The full resolve, then the buffer's rectangles.
+		perfmon::DdrSample full{}, part{};
+		if (pass) {
+			cs.reset();
+			etna::resolve(cs, ref, rt, rt_ts, W, H, stride, W * 4);
+			perfmon::ddr_start();
+			pass = gpu.submit_and_wait(cs);
+			full = perfmon::ddr_stop();
+		}
+		const uint32_t b = frame % Buffers;
+		const DamageRegion region = tracker.update(b, drawn);
+		if (pass) {
+			cs.reset();
+			for (const Rect &r : region.rects())
+				etna::resolve_rect(cs, fb[b], rt, rt_ts, r, stride, W * 4, Format::A8R8G8B8, false);
+			cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+			cs.flush_cache();
+			cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+			perfmon::ddr_start();
+			pass = gpu.submit_and_wait(cs);
+			part = perfmon::ddr_stop();
+		}
+		gpu.free(cs);
+		if (!pass) {
+			gpu.dump_status("damage frame");
+			return false;
+		}
+
+		ref.cpu_prep(RelocRead);
+		fb[b].cpu_prep(RelocRead);
+		uint32_t diff = 0;
+		for (uint32_t i = 0; i < W * H; i++)
+			diff += fb[b].span<const uint32_t>()[i] != ref.span<const uint32_t>()[i];
+		print("damage frame ", frame, " -> fb", b, ": ", region.rects().size(), " rects, ",
+			  region.area() * 100 / (W * H), "% of the screen, ", diff, " px differ; DDR writes ",
+			  full.writes * 32 / 1024, " KB full, ", part.writes * 32 / 1024, " KB partial\n");
+		pass = diff == 0;
+	}
+
+	for (Bo *b : {&rt, &depthb, &rt_tsb, &depth_tsb, &vtx, &inst, &ref, &fb[0], &fb[1]})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (!pass) {
+		print("FAILED: partial resolves don't match the full resolve\n");
+		return false;
+	}
+	print("Damage-rect resolves match full resolves. \\o/\n");
+	return true;
+}
+
+// Capture a clear + cube + resolve sequence, wipe every buffer it touches,
+// replay the trace and check it draws the same image. Then replay it a few
+// times for its per-submission GPU times.
+bool capture_replay_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 256, H = 256;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t CLEAR = 0xFF203040;
+	constexpr uint32_t Junk = 0x5A3C96E1;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo vsb = gpu.get_shader(kCubeVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo lin = gpu.alloc(W * H * 4);
+	Bo tbuf = gpu.alloc(64 * 1024);
+	if (!rt || !depthb || !vtx || !vsb || !psb || !lin || !tbuf)
+		return false;
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+
+	const Mat4 mvp = cube_mvp(0.7f, 0.4f);
+	TraceWriter trace{tbuf.span<uint32_t>()};
+	gpu.start_capture(trace);
+	auto cs = gpu.new_cmd_stream(1024);
+	etna::clear(cs, rt, W, H, CLEAR);
+	etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+	bool ok = gpu.submit_and_wait(cs);
+	if (ok) {
+		cs.reset();
+		etna::emit_mesh(cs,
+						{
+							.rt = &rt,
+							.rt_stride = stride,
+							.vtx = &vtx,
+							.vtx_stride = 28,
+							.vs = &vsb,
+							.vs_words = kCubeVs.size(),
+							.vs_temps = 4,
+							.ps = &psb,
+							.ps_words = kPsColorCode.size(),
+							.ps_temps = 2,
+							.ps_out_reg = 1,
+							.uniforms = mvp,
+							.width = W,
+							.height = H,
+							.vertex_count = 36,
+							.depth = &depthb,
+							.depth_stride = dstride,
+						});
+		ok = gpu.submit_and_wait(cs);
+	}
+	if (ok) {
+		cs.reset();
+		etna::resolve(cs, lin, rt, W, H, stride, W * 4);
+		ok = gpu.submit_and_wait(cs);
+	}
+	gpu.stop_capture();
+	gpu.free(cs);
+	if (!ok) {
+		gpu.dump_status("capture");
+		return false;
+	}
+	const TraceWriter::Stats ts = trace.stats();
+	print("capture: ", ts.records, " submissions, ", int(trace.trace().size() * 4), " bytes; ", ts.bo_copies,
+		  " Bo copies (", ts.data_bytes, " bytes), ", ts.bo_skipped, " by reference\n");
+
+	lin.cpu_prep(RelocRead);
+	static std::array<uint32_t, W * H> want;
+	std::ranges::copy(lin.span<const uint32_t>(), want.begin());
+	for (Bo *b : {&rt, &depthb, &lin}) {
+		std::ranges::fill(b->span<uint32_t>(), Junk);
+		b->cpu_fini(RelocWrite);
+	}
+
+	ReplayResult r = replay(gpu, trace.trace());
+	uint32_t diff = 0;
+	if (r.ok) {
+		lin.cpu_prep(RelocRead);
+		for (uint32_t i = 0; i < W * H; i++)
+			diff += lin.span<const uint32_t>()[i] != want[i];
+		print("replay: ", r.submissions, " submissions, ", diff, " px differ from the captured run\n");
+	}
+	if (r.ok && diff == 0) {
+		std::array<uint32_t, 3> best;
+		r = replay(gpu, trace.trace(), 5, best);
+	}
+
+	for (Bo *b : {&rt, &depthb, &vtx, &lin, &tbuf})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (!r.ok || diff || r.submissions != 3 || ts.dropped) {
+		print("FAILED: the replay doesn't reproduce the captured submissions\n");
+		return false;
+	}
+	print("Captured trace replays identically. \\o/\n");
+	return true;
+}
+
+// Profile a few cube frames -- clear, draw, resolve, each its own range
+// inside a "frame" range -- and print where the GPU's time went, with the
+// DDR traffic of each step. The counter layout is etnaviv's, unverified on
+// this core, so the test only insists that every range was measured.
+bool profile_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 256, H = 256;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t Frames = 8;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo vsb = gpu.get_shader(kCubeVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo lin = gpu.alloc(W * H * 4);
+	if (!rt || !depthb || !vtx || !vsb || !psb || !lin)
+		return false;
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+
+	GpuProfiler prof;
+	const uint32_t clock_control = gpu_read(HI_CLOCK_CONTROL);
+	prof.start();
+	auto cs = gpu.new_cmd_stream(1024);
+	bool ok = true;
+	for (uint32_t frame = 0; frame < Frames && ok; frame++) {
+		const Mat4 mvp = cube_mvp(0.3f * float(frame), 0.4f);
+		prof.begin("frame");
+		cs.reset();
+		etna::clear(cs, rt, W, H, 0xFF203040);
+		etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+		ok = profile_submit(gpu, prof, cs, "clear");
+		cs.reset();
+		etna::emit_mesh(cs,
+						{
+							.rt = &rt,
+							.rt_stride = stride,
+							.vtx = &vtx,
+							.vtx_stride = 28,
+							.vs = &vsb,
+							.vs_words = kCubeVs.size(),
+							.vs_temps = 4,
+							.ps = &psb,
+							.ps_words = kPsColorCode.size(),
+							.ps_temps = 2,
+							.ps_out_reg = 1,
+							.uniforms = mvp,
+							.width = W,
+							.height = H,
+							.vertex_count = 36,
+							.depth = &depthb,
+							.depth_stride = dstride,
+						});
+		ok = ok && profile_submit(gpu, prof, cs, "draw");
+		cs.reset();
+		etna::resolve(cs, lin, rt, W, H, stride, W * 4);
+		ok = ok && profile_submit(gpu, prof, cs, "resolve");
+		prof.end();
+	}
+	prof.stop();
+	const bool restored = gpu_read(HI_CLOCK_CONTROL) == clock_control;
+	gpu.free(cs);
+	for (Bo *b : {&rt, &depthb, &vtx, &lin})
+		gpu.free(*b);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (!ok) {
+		gpu.dump_status("profile");
+		return false;
+	}
+	profile_report(prof, "cube 256x256");
+
+	for (const char *label : {"frame", "clear", "draw", "resolve"}) {
+		const ProfileRange *r = prof.range(label);
+		if (!r || r->runs != Frames) {
+			print("FAILED: range \"", label, "\" was not measured ", int(Frames), " times\n");
+			return false;
+		}
+	}
+	if (!restored) {
+		print("FAILED: HI_CLOCK_CONTROL not restored\n");
+		return false;
+	}
+	print("GPU profile measured. \\o/\n");
+	return true;
+}
+
+// Time the passes of cube frames -- clear, two draws, resolve -- from
+// timestamps in the streams, with two frames in flight so the GPU never
+// waits for the CPU. Then the same frame through submit_and_wait() timed by
+// the CPU, for comparison: that includes the submission, the interrupt and
+// the wake-up.
+bool timeline_test(Gpu &gpu)
+{
+	constexpr uint32_t W = 256, H = 256;
+	constexpr uint32_t stride = W * 4;
+	constexpr uint32_t dstride = W * 2;
+	constexpr uint32_t Frames = 8;
+	constexpr uint32_t InFlight = 2;
+
+	Bo rt = gpu.alloc(stride * H);
+	Bo depthb = gpu.alloc(dstride * H);
+	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
+	Bo vsb = gpu.get_shader(kCubeVs);
+	Bo psb = gpu.get_shader(kPsColorCode);
+	Bo lin = gpu.alloc(W * H * 4);
+	if (!rt || !depthb || !vtx || !vsb || !psb || !lin)
+		return false;
+	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
+	vtx.cpu_fini(RelocWrite);
+
+	Mat4 mvp[InFlight][2];
+	auto record = [&](CmdStream &cs, Mat4 (&m)[2], uint32_t frame, Timeline *tl) {
+		cs.reset();
+		if (tl)
+			tl->begin_frame(cs);
+		etna::clear(cs, rt, W, H, 0xFF203040);
+		etna::clear(cs, depthb, W, dstride * H / (W * 4), 0xFFFFFFFF);
+		if (tl)
+			tl->mark(cs, "clear");
+		for (uint32_t i = 0; i < 2; i++) {
+			m[i] = cube_mvp(0.3f * float(frame), 0.4f, 1.0f, i ? 0.6f : -0.6f, 0.0f, -3.0f);
+			etna::emit_mesh(cs,
+							{
+								.rt = &rt,
+								.rt_stride = stride,
+								.vtx = &vtx,
+								.vtx_stride = 28,
+								.vs = &vsb,
+								.vs_words = kCubeVs.size(),
+								.vs_temps = 4,
+								.ps = &psb,
+								.ps_words = kPsColorCode.size(),
+								.ps_temps = 2,
+								.ps_out_reg = 1,
+								.uniforms = m[i],
+								.width = W,
+								.height = H,
+								.vertex_count = 36,
+								.depth = &depthb,
+								.depth_stride = dstride,
+							});
+			if (tl)
+				tl->mark(cs, i ? "draw 2" : "draw 1");
+		}
+		etna::resolve(cs, lin, rt, W, H, stride, W * 4);
+		if (tl) {
+			tl->mark(cs, "resolve");
+			tl->end_frame();
+		}
+	};
+
+	CmdStream cs[InFlight] = {gpu.new_cmd_stream(2048), gpu.new_cmd_stream(2048)};
+	Fence fence[InFlight];
+	static Timeline tl;
+	bool ok = cs[0].avail() && cs[1].avail() && gpu.start_timeline(tl);
+	const bool started = ok;
+	const uint64_t t0 = read_cntpct();
+	Timeline::FrameTimes ft;
+	uint32_t popped = 0, bad = 0;
+	uint64_t gpu_ticks = 0;
+	auto drain = [&] {
+		while (tl.pop(ft)) {
+			print_frame_times(ft, t0);
+			bad += ft.passes != 4 || ft.missed || ft.end() < ft.start;
+			for (uint32_t i = 1; i < ft.passes; i++)
+				bad += ft.pass[i].end < ft.pass[i - 1].end;
+			gpu_ticks += ft.end() - ft.start;
+			popped++;
+		}
+	};
+	for (uint32_t frame = 0; frame < Frames && ok; frame++) {
+		const uint32_t b = frame % InFlight;
+		if (fence[b])
+			ok = gpu.wait(fence[b]);
+		drain();
+		if (!ok)
+			break;
+		record(cs[b], mvp[b], frame, &tl);
+		fence[b] = gpu.submit(cs[b]);
+		ok = bool(fence[b]);
+	}
+	for (uint32_t b = 0; b < InFlight && ok; b++)
+		if (fence[b])
+			ok = gpu.wait(fence[b]);
+	drain();
+	if (started)
+		gpu.stop_timeline();
+
+	// The same frame, timed the old way.
+	uint64_t cpu_ticks = 0;
+	if (ok) {
+		record(cs[0], mvp[0], 0, nullptr);
+		const uint64_t start = read_cntpct();
+		ok = gpu.submit_and_wait(cs[0]);
+		cpu_ticks = read_cntpct() - start;
+	}
+	for (CmdStream &c : cs)
+		gpu.free(c);
+	for (Bo *bo : {&rt, &depthb, &vtx, &lin})
+		gpu.free(*bo);
+	gpu.put_shader(vsb);
+	gpu.put_shader(psb);
+	if (!ok) {
+		gpu.dump_status("timeline");
+		return false;
+	}
+	const uint64_t hz = read_cntfreq();
+	if (popped)
+		print("timeline: ", int(popped), " frames, ", int(gpu_ticks * 1'000'000 / hz / popped),
+			  " us GPU each; submit_and_wait of one: ", int(cpu_ticks * 1'000'000 / hz), " us\n");
+	if (popped != Frames || bad || tl.dropped()) {
+		print("FAILED: ", int(popped), " of ", int(Frames), " frames timed, ", int(bad), " inconsistent, ",
+			  int(tl.dropped()), " dropped\n");
+		return false;
+	}
+	print("Frame timeline from GPU timestamps. \\o/\n");
+	return true;
+}
+
 // This test was made to help diagnose a rendering issue that ended up
 // being a result of the shader ALU not being reset (running a dp2x8 shader on boot
 // fixes it).
@@ -682,8 +1570,8 @@ bool cube_size_sweep_test(Gpu &gpu)
 	Bo depth = gpu.alloc(((MAX + 15) & ~15u) * 2 * MAX);
 	Bo lin = gpu.alloc(MAX * MAX * 4);
 	Bo vtx = gpu.alloc(sizeof(kCubeVerts));
-	Bo vs = gpu.alloc(sizeof(kCubeVs));
-	Bo ps = gpu.alloc(sizeof(kPsColorCode));
+	Bo vs = gpu.get_shader(kCubeVs);
+	Bo ps = gpu.get_shader(kPsColorCode);
 	static std::array<uint32_t, MAX * MAX> cimg;
 	static std::array<uint8_t, MAX * MAX> cband;
 	static std::array<float, MAX * MAX> czbuf;
@@ -691,10 +1579,6 @@ bool cube_size_sweep_test(Gpu &gpu)
 		return false;
 	std::ranges::copy(kCubeVerts, vtx.span<float>().begin());
 	vtx.cpu_fini(RelocWrite);
-	std::ranges::copy(kCubeVs, vs.span<uint32_t>().begin());
-	vs.cpu_fini(RelocWrite);
-	std::ranges::copy(kPsColorCode, ps.span<uint32_t>().begin());
-	ps.cpu_fini(RelocWrite);
 
 	constexpr uint32_t S = 512;
 	uint32_t fails = 0;
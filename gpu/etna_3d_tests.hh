@@ -6,4 +6,11 @@ bool triangle_color_test(etna::Gpu &gpu);
 bool triangle_depth_test(etna::Gpu &gpu);
 bool triangle_texture_test(etna::Gpu &gpu);
 bool spinning_cube_test(etna::Gpu &gpu);
+bool indexed_cube_test(etna::Gpu &gpu);
+bool instanced_cube_test(etna::Gpu &gpu);
+bool fast_clear_test(etna::Gpu &gpu);
+bool damage_test(etna::Gpu &gpu);
+bool capture_replay_test(etna::Gpu &gpu);
+bool profile_test(etna::Gpu &gpu);
+bool timeline_test(etna::Gpu &gpu);
 bool cube_size_sweep_test(etna::Gpu &gpu);
@@ -0,0 +1,214 @@
+#pragma once
+#include "etna.hh"
+#include "gpu_regs.hh"
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// =============================================================================
+//  etna_bundle.hh -- pre-recorded command buffers, patched and chained per frame
+// =============================================================================
+// Most of a frame's commands are the same every frame: the clears, every
+// draw's ~300 dwords of pipeline state, the resolve. Only a few constants
+// (an MVP matrix, a color) change. A Bundle is a command stream recorded ONCE
+// with the ordinary emitters (clear(), emit_mesh(), ...); per frame the CPU
+// just rewrites its patch slots and the GPU runs it in place.
+//
+//  RECORD
+//     Bundle b{gpu.new_cmd_stream(1024)};
+//     uint32_t at = emit_mesh(b.cs(), draw);     // any emitters
+//     Bundle::Slot mvp = b.slot(at, 16);         // the 16 uniform dwords
+//     b.end();                                   // reserves the tail LINK
+//
+//  PER FRAME
+//     b.patch(mvp, new_mvp);                     // CPU writes 16 dwords
+//     gpu.submit_chain(chain);                   // chain = {&clear, &b, ..., &resolve}
+//
+//  CHAINING
+//   Every bundle ends with two dwords reserved at end(): a LINK to the next
+//   bundle of the chain, or for the last one back to the submission's
+//   completion trailer in the ring (a trailer-only slot, as submit_link()).
+//   Gpu::submit_chain() writes those tails and diverts the FE into the first
+//   bundle, so the FE walks the whole chain without a dword being copied.
+//   A tail is only rewritten (and its cache line cleaned) when the chain
+//   order changes, so a fixed frame costs the patched uniforms plus a 2-dword
+//   LINK into the ring trailer.
+//
+//  RULES
+//   - The GPU executes the bundle's own Bo: patch or re-chain a bundle only
+//     once the previous submission that ran it has completed (wait on its
+//     fence), like any Bo the GPU reads.
+//   - A bundle may appear only once per chain: its one tail LINK can only
+//     point at one successor.
+//   - The recorded relocations are baked in, so the buffers a bundle
+//     references must outlive it.
+//
+// Hardware-independent (the Gpu does the cache cleaning), so recording,
+// patching and chaining are host-tested against freshly emitted streams in
+// tools/host_tests.cc.
+
+namespace etna
+{
+
+class Bundle {
+public:
+	// A patchable run of data dwords inside the recorded stream.
+	struct Slot {
+		uint32_t offset = 0; // dword offset in the bundle
+		uint32_t dwords = 0; // 0 = null slot
+		explicit operator bool() const
+		{
+			return dwords != 0;
+		}
+	};
+
+	Bundle() = default;
+	explicit Bundle(CmdStream cs)
+		: cs_{cs}
+	{}
+
+	// Record into this (before end()).
+	CmdStream &cs()
+	{
+		return cs_;
+	}
+	const CmdStream &cs() const
+	{
+		return cs_;
+	}
+
+	// Declare `dwords` data words at `offset` (as emitted so far) patchable.
+	// Null slot if the range is not inside the recording. Patch only data
+	// words: rewriting a command header changes what the FE parses.
+	Slot slot(uint32_t offset, uint32_t dwords) const
+	{
+		if (dwords == 0 || offset + dwords > cs_.offset())
+			return Slot{};
+		return Slot{offset, dwords};
+	}
+
+	// Finish recording: pad to a qword and reserve the two tail dwords (END
+	// until the bundle is chained, so a stray kick halts instead of running
+	// off). False if the stream has no room left for them.
+	bool end()
+	{
+		cs_.align();
+		if (cs_.avail() < 2)
+			return false;
+		cs_.emit(VivanteGpu::CMD_END);
+		cs_.emit(0);
+		ended_ = true;
+		dirty_lo_ = 0;
+		dirty_hi_ = cs_.offset(); // the whole recording has to reach DDR once
+		return true;
+	}
+
+	bool ended() const
+	{
+		return ended_;
+	}
+
+	// Overwrite a slot's dwords (values.size() must match the slot).
+	bool patch(Slot s, std::span<const uint32_t> values)
+	{
+		if (!s || values.size() != s.dwords || s.offset + s.dwords > cs_.offset())
+			return false;
+		std::memcpy(&words()[s.offset], values.data(), s.dwords * 4);
+		touch(s.offset, s.offset + s.dwords);
+		return true;
+	}
+
+	// Float constants (uniforms) go in as their bit patterns, like fui().
+	bool patch(Slot s, std::span<const float> values)
+	{
+		static_assert(sizeof(float) == 4);
+		return patch(s, std::span<const uint32_t>{reinterpret_cast<const uint32_t *>(values.data()), values.size()});
+	}
+
+	// Point the tail at the next stream to run: LINK to `target` and prefetch
+	// `target_dwords` (its full length, tail included).
+	void link_to(uint32_t target, uint32_t target_dwords)
+	{
+		uint32_t t = tail();
+		uint32_t header = VivanteGpu::cmd_link(target_dwords / 2);
+		if (words()[t] == header && words()[t + 1] == target)
+			return; // same successor as last time: nothing to write back
+		words()[t] = header;
+		words()[t + 1] = target;
+		touch(t, t + 2);
+	}
+
+	uint32_t gpu_addr() const
+	{
+		return cs_.bo().gpu_addr();
+	}
+
+	// Length the FE runs, tail LINK included (valid after end()).
+	uint32_t dwords() const
+	{
+		return cs_.offset();
+	}
+
+	// Dword range written by the CPU since the last take_dirty() (empty if
+	// lo == hi): what has to be cleaned to DDR before the GPU runs it.
+	struct Range {
+		uint32_t lo, hi;
+	};
+	Range take_dirty()
+	{
+		Range r{dirty_lo_, dirty_hi_};
+		dirty_lo_ = dirty_hi_ = 0;
+		return r;
+	}
+
+private:
+	uint32_t *words()
+	{
+		return cs_.bo().span<uint32_t>().data();
+	}
+
+	uint32_t tail() const
+	{
+		return cs_.offset() - 2;
+	}
+
+	void touch(uint32_t lo, uint32_t hi)
+	{
+		if (dirty_lo_ == dirty_hi_) {
+			dirty_lo_ = lo;
+			dirty_hi_ = hi;
+			return;
+		}
+		dirty_lo_ = lo < dirty_lo_ ? lo : dirty_lo_;
+		dirty_hi_ = hi > dirty_hi_ ? hi : dirty_hi_;
+	}
+
+	CmdStream cs_;
+	bool ended_ = false;
+	uint32_t dirty_lo_ = 0, dirty_hi_ = 0;
+};
+
+// Write the tail LINKs that run `chain` in order and then return to `ret`
+// (the submission's trailer, from return_link()). False -- with nothing
+// written -- for an empty chain, an unfinished bundle, or a bundle that
+// appears twice.
+inline bool link_chain(std::span<Bundle *const> chain, const ReturnLink &ret)
+{
+	if (chain.empty())
+		return false;
+	for (size_t i = 0; i < chain.size(); i++) {
+		if (!chain[i] || !chain[i]->ended())
+			return false;
+		for (size_t j = 0; j < i; j++)
+			if (chain[j] == chain[i])
+				return false;
+	}
+	for (size_t i = 0; i + 1 < chain.size(); i++)
+		chain[i]->link_to(chain[i + 1]->gpu_addr(), chain[i + 1]->dwords());
+	// The trailer LINK is built by return_link(); its prefetch is the trailer's.
+	Bundle &last = *chain.back();
+	last.link_to(ret.target, (ret.header & 0xFFFF) * 2);
+	return true;
+}
+
+} // namespace etna
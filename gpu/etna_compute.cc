@@ -1,172 +1,54 @@
 #include "aarch64/system_reg.hh"
 #include "etna.hh"
+#include "etna_compute_list.hh"
+#include "etna_tune.hh"
+#include "ppu_dispatch.hh"
 #include "ppu_asm.hh"
+#include "ppu_program.hh"
 #include "print/print.hh"
+#include <algorithm>
+#include <bit>
+#include <cstring>
 
-// Compute (PPU / unified-shader) dispatch, ported from the gcnano vendor
-// driver's flop_reset (_ProgramPPUInstruction + _ProgramPPUCommand, dual
-// MIT/GPL; used under MIT).
-//
-// It runs a shader "OutImage = InImage + InImage" (EVIS img_load x2 -> dp2x8
-// add -> img_store) over a 64x6 u8 image. The dispatch command sequence below
-// was extracted verbatim from _ProgramPPUCommand for OUR exact chip
-// (GCNANOULTRA31_VIP2, model 0x8000 rev 0x6205 customer 0x15), with every
-// parameter resolved (dataType 0x7, NumShaderCores 2, groupSize 1x1, global
-// scale 4x1, groupCount 16x6, RegCount 3, InstCount 16). The three buffer
-// addresses are patched in at runtime (dword offsets 7/13/53). 0xBADABEEB at
-// state 0x0248 is the PPU dispatch "kick" (compute's analog of RS_KICKER).
+// Compute (PPU / unified-shader) dispatch: make_kernel(), the synchronous
+// compute() overloads and the on-target kernel suite. The dispatch sequence
+// itself (the vendor template and its patching) is in ppu_dispatch.hh.
 
 namespace etna
 {
 
-// This is a command stream for the FE that loads and runs a shader over an
-// input image, writing an output image. It is the fixed 64x6 sequence extracted
-// from the vendor's _ProgramPPUCommand; emit_ppu_dispatch() below uses it as a
-// TEMPLATE and patches the size/address/count slots so it works for any shader
-// and image size (the vendor computes the group counts from width/height, so
-// varying size is exactly what the dispatch is built to do).
-
-// clang-format off
-static const uint32_t kPpuDispatchTemplate[118] = {
-	0x08010E13, 0x00000002, 0x08010E02, 0x00000701, 0x48000000, 0x00000701, 0x0804D800, 0x00000000, // [7]=IN
-	0x00000040, 0x00060040, 0x444051F0, 0xFFFFFFFF, 0x0804D804, 0x00000000, 0x00000040, 0x00060040, // [13]=OUT
-	0x444051F0, 0xFFFFFFFF, 0x0810D808, 0x55555555, 0x00000000, 0x01234567, 0x89ABCDEF, 0x55555555,
-	0x01234567, 0x89ABCDEF, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
-	0x00000000, 0x00000000, 0x00000000, 0xFFFFFFFF, 0x08010240, 0x02000002, 0x0801022C, 0x0000001F,
-	0x08010420, 0x00000000, 0x08010403, 0x00000003, 0x08010416, 0x00000000, 0x08010409, 0x00000000,
-	0x0801021F, 0x00000000, 0x08010424, 0x00000004, 0x0801040A, 0x00000000, 0x08015580, 0x00000002, // [53]=INST
-	0x0801021A, 0x00000001, 0x08010425, 0x00000003, 0x08010402, 0x00001F01, 0x08010228, 0x00000000,
-	0x080102AA, 0x00000000, 0x08010E07, 0x00000000, 0x0801040C, 0x00000000, 0x08010201, 0x00000001,
-	0x08010E22, 0x00000000, 0x08010412, 0x00000000, 0x08010240, 0x03000002, 0x08010249, 0x00000000,
-	0x08010247, 0x00000001, 0x0801024B, 0x00000000, 0x0801024D, 0x00000000, 0x0801024F, 0x00000000,
-	0x08010256, 0x00000004, 0x08010257, 0x00000001, 0x08010258, 0x00000000, 0x08060250, 0x0000000F,
-	0x00000005, 0xFFFFFFFF, 0x00000000, 0x00000000, 0x000003FF, 0x00000000, 0x08010248, 0xBADABEEB, // kick
-	0x08010E03, 0x00000C20, 0x08010E02, 0x00000701, 0x48000000, 0x00000701, 0x08010E03, 0x00000C23,
-	0x08010E03, 0x00000C23, 0x08010594, 0x00000001, 0x08010E03, 0x00000C23,
-};
-// clang-format on
-
-// Template patch slots (dword offsets), verified against the extracted sequence.
-enum : unsigned {
-	kInAddr = 7,		// input image base address
-	kInStride = 8,		// input stride (bytes)
-	kInDims = 9,		// (height << 16) | width
-	kOutAddr = 13,		// output image base address
-	kOutStride = 14,	// output stride
-	kOutDims = 15,		// (height << 16) | width
-	kRegCount = 43,		// shader temp register count
-	kInstCount4 = 51,	// InstCount / 4  (== number of instructions)
-	kInstAddr = 53,		// shader binary base address
-	kInstCount4m1 = 59, // InstCount / 4 - 1
-	kThreadAlloc = 81,	// 0x0247: (gsx*gsy + cores*4 - 1)/(cores*4)
-	kGroupCountX = 95,	// groupCountX - 1  (== number of WORKGROUPS in X)
-	kGroupCountY = 96,	// groupCountY - 1
-	kGroupSizeX = 98,	// 0x0253: GroupSizeX - 1 (threads per workgroup, X)
-	kGroupSizeY = 99,	// 0x0254: GroupSizeY - 1
-	// Second input image descriptor -- uniform c2, the first 4 words of the
-	// 0xD808 block (unused by single-input/copy shaders; the dp2x8 coefficients
-	// otherwise). A two-input shader's 2nd img_load reads c2.
-	kInBAddr = 19,	 // input B base address
-	kInBStride = 20, // input B stride
-	kInBDims = 21,	 // input B (height << 16) | width
-	kInBFmt = 22,	 // input B format (same as input A's 0xD803)
-	// Third input image descriptor -- uniform c3, next 4 words of the 0xD808
-	// block (0xD80C..0xD80F). Used by three-input kernels (e.g. alpha blend).
-	kInCAddr = 23,
-	kInCStride = 24,
-	kInCDims = 25,
-	kInCFmt = 26,
-};
-
-constexpr uint32_t kImgFormat = 0x444051F0; // u8 image format word (from the template)
-
-// Emit the PPU dispatch for `shader` over a `width` x `height` u8 image. The
-// group counts are derived from the size the way the vendor's _ProgramPPUCommand
-// does (globalScale 4x1), so this handles any size; everything else (USC config,
-// uniforms, format, kick, drain) is the fixed template.
-static void emit_ppu_dispatch(CmdStream &cs,
-							  uint32_t in_addr,
-							  uint32_t out_addr,
-							  uint32_t shader_addr,
-							  uint32_t inst_dwords,
-							  uint32_t reg_count,
-							  uint32_t width,
-							  uint32_t height,
-							  uint32_t in_b_addr = 0,
-							  uint32_t in_c_addr = 0)
+// Upload a built program, or share the copy already resident (shader cache).
+static Kernel upload(Gpu &gpu, const uint32_t *inst, ppu::ShaderInfo si, uint32_t type)
 {
-	const uint32_t stride = width; // u8: 1 byte per pixel
-	const uint32_t dims = (height << 16) | width;
-	// groupSize stays the vendor's 1x1 (one thread per workgroup, each doing
-	// globalScale=4 pixels), so groupCount == thread count.
-	//
-	// We TRIED packing threads into up-to-8x8 workgroups to cut the 262144
-	// launches (kThreadAlloc/kGroupSizeX/Y are the registers). It verified
-	// correct but ran SLIGHTLY SLOWER: the thread count is unchanged (tiling cuts
-	// launches, not threads), so per-thread DDR latency still dominates; this Nano
-	// core has no cross-thread coalescing to gain; and bigger groups cut occupancy
-	// for register-heavy kernels (blend RegCount 5 -> 11% slower; copy RegCount 2
-	// unchanged). 1x1 maximizes occupancy for latency-hiding, so it wins here.
-	const uint32_t group_x = (width + 3) / 4; // globalScaleX = 4
-	const uint32_t group_y = height;		  // globalScaleY = 1
-
-	for (unsigned i = 0; i < 118; i++) {
-		uint32_t v = kPpuDispatchTemplate[i];
-		// clang-format off
-		switch (i) {
-			case kInAddr:      v = in_addr; break;
-			case kInStride:    v = stride; break;
-			case kInDims:      v = dims; break;
-			case kOutAddr:     v = out_addr; break;
-			case kOutStride:   v = stride; break;
-			case kOutDims:     v = dims; break;
-			case kRegCount:    v = reg_count; break;
-			case kInstCount4:  v = inst_dwords / 4; break;
-			case kInstAddr:    v = shader_addr; break;
-			case kInstCount4m1: v = inst_dwords / 4 - 1; break;
-			case kGroupCountX: v = group_x - 1; break;
-			case kGroupCountY: v = group_y - 1; break;
-		}
-		// clang-format on
-		// Second input image (uniform c2), only for two-input shaders. Patches
-		// the first 4 words of the 0xD808 block into a real image descriptor.
-		if (in_b_addr) {
-			switch (i) {
-			case kInBAddr:   v = in_b_addr; break;
-			case kInBStride: v = stride; break;
-			case kInBDims:   v = dims; break;
-			case kInBFmt:    v = kImgFormat; break;
-			}
-		}
-		// Third input image (uniform c3), only for three-input shaders.
-		if (in_c_addr) {
-			switch (i) {
-			case kInCAddr:   v = in_c_addr; break;
-			case kInCStride: v = stride; break;
-			case kInCDims:   v = dims; break;
-			case kInCFmt:    v = kImgFormat; break;
-			}
-		}
-		cs.emit(v);
-	}
-	// No emit_pe_drain: the template already ends with the vendor's drain;
-	// submit() adds the ring's event + wait + link trailer.
-}
-
-Kernel make_kernel(Gpu &gpu, ShaderBuilder build)
-{
-	uint32_t inst[32];
-	auto si = build(inst, 0x7, 2); // dataType u8, NumShaderCores 2
 	Kernel k;
-	k.binary = gpu.alloc(si.inst_dwords * 4);
+	if (si.inst_dwords == 0)
+		return k; // the builder has no program for this type
+	k.binary = gpu.get_shader({inst, si.inst_dwords});
 	if (!k.binary)
 		return k; // empty
-	auto p = k.binary.span<uint32_t>();
-	for (unsigned i = 0; i < si.inst_dwords; i++)
-		p[i] = inst[i];
-	k.binary.cpu_fini(RelocWrite);
 	k.inst_dwords = si.inst_dwords;
 	k.reg_count = si.reg_count;
+	k.type = type;
+	k.id = ppu_program_id(inst, si.inst_dwords, si.reg_count);
+	return k;
+}
+
+Kernel make_kernel(Gpu &gpu, ShaderBuilder build, uint32_t type)
+{
+	uint32_t inst[32];
+	auto si = build(inst, type, 2); // dataType (u8 unless typed), NumShaderCores 2
+	return upload(gpu, inst, si, type);
+}
+
+Kernel make_kernel(Gpu &gpu, const uint32_t *inst, ppu::ShaderInfo si, uint32_t type)
+{
+	return upload(gpu, inst, si, type);
+}
+
+Kernel make_kernel(Gpu &gpu, const ppu::Program &prog)
+{
+	Kernel k = upload(gpu, prog.inst, prog.info, ppu::TYPE_U8);
+	k.uniforms = prog.uniforms;
 	return k;
 }
 
@@ -176,8 +58,18 @@ static bool run_kernel(Gpu &gpu, const Kernel &k, const Bo &out, const Bo &in0,
 {
 	auto cs = gpu.new_cmd_stream(256);
 	emit_ppu_dispatch(cs, in0.gpu_addr(), out.gpu_addr(), k.binary.gpu_addr(), k.inst_dwords, k.reg_count, width,
-					  height, in1 ? in1->gpu_addr() : 0, in2 ? in2->gpu_addr() : 0);
-	return gpu.submit_and_wait(cs);
+					  height, in1 ? in1->gpu_addr() : 0, in2 ? in2->gpu_addr() : 0,
+					  tuned_launch(k.id, width, height), &k.uniforms);
+	// The dispatch writes raw addresses: declare the Bos for a capture.
+	cs.add_bo(k.binary, RelocRead);
+	for (const Bo *in : {&in0, in1, in2})
+		if (in)
+			cs.add_bo(*in, RelocRead);
+	cs.add_bo(out, RelocWrite);
+	bool ok = gpu.submit_and_wait(cs);
+	if (ok)
+		gpu.free(cs); // a timed-out stream may still be in the FE's hands: leak it rather than reuse it
+	return ok;
 }
 
 bool compute(Gpu &gpu, const Kernel &k, const Bo &out, const Bo &in0, uint32_t width, uint32_t height)
@@ -197,6 +89,34 @@ bool compute(Gpu &gpu, const Kernel &k, const Bo &out, const Bo &in0, const Bo &
 	return run_kernel(gpu, k, out, in0, &in1, &in2, width, height);
 }
 
+// Typed: the same dispatch over the images' bytes, once they agree with the
+// kernel and each other.
+static bool run_typed(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0, const Image *in1,
+					  const Image *in2)
+{
+	for (const Image *im : {&out, &in0, in1, in2})
+		if (im && (im->type != k.type || im->width != out.width || im->height != out.height ||
+				   im->row_bytes() % 16 || im->bo.size() < im->row_bytes() * im->height))
+			return false;
+	return run_kernel(
+		gpu, k, out.bo, in0.bo, in1 ? &in1->bo : nullptr, in2 ? &in2->bo : nullptr, out.row_bytes(), out.height);
+}
+
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0)
+{
+	return run_typed(gpu, k, out, in0, nullptr, nullptr);
+}
+
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0, const Image &in1)
+{
+	return run_typed(gpu, k, out, in0, &in1, nullptr);
+}
+
+bool compute(Gpu &gpu, const Kernel &k, const Image &out, const Image &in0, const Image &in1, const Image &in2)
+{
+	return run_typed(gpu, k, out, in0, &in1, &in2);
+}
+
 // Run an arbitrary kernel over a width x height u8 image: build the shader,
 // fill the input with fill(i), dispatch, and verify each output byte equals
 // expect(i). Dumps the first 16 in/out bytes on the first mismatch so the
@@ -362,6 +282,213 @@ static bool run_test_3(Gpu &gpu, const char *name, uint32_t width, uint32_t heig
 	return true;
 }
 
+// Typed variant of run_test_2: width x height elements of `type`, element i of
+// A/B = fillA(i)/fillB(i) and of the output expect(i), all as bit patterns
+// (low elem_bytes(type) bytes).
+using ElemFn = uint32_t (*)(uint32_t);
+
+static bool run_typed_test(Gpu &gpu, const char *name, uint32_t type, uint32_t width, uint32_t height,
+						   ShaderBuilder build, ElemFn fillA, ElemFn fillB, ElemFn expect)
+{
+	const uint32_t eb = ppu::elem_bytes(type), n = width * height;
+	Image a{gpu.alloc(n * eb), width, height, type}, b{gpu.alloc(n * eb), width, height, type},
+		out{gpu.alloc(n * eb), width, height, type};
+	Kernel k = make_kernel(gpu, build, type);
+	if (!a.bo || !b.bo || !out.bo || !k)
+		return false;
+
+	auto put = [eb](const Bo &bo, uint32_t i, uint32_t v) { std::memcpy(bo.span<uint8_t>().data() + i * eb, &v, eb); };
+	auto get = [eb](const Bo &bo, uint32_t i) {
+		uint32_t v = 0;
+		std::memcpy(&v, bo.span<const uint8_t>().data() + i * eb, eb);
+		return v;
+	};
+	for (uint32_t i = 0; i < n; i++) {
+		put(a.bo, i, fillA(i));
+		put(b.bo, i, fillB(i));
+	}
+	std::fill(out.bo.span<uint8_t>().begin(), out.bo.span<uint8_t>().end(), 0xEE); // poison
+	for (const Bo *bo : {&a.bo, &b.bo, &out.bo})
+		bo->cpu_fini(RelocWrite);
+
+	auto start = read_cntpct();
+	if (!compute(gpu, k, out, a, b))
+		return false;
+	uint32_t ticks = read_cntpct() - start;
+
+	out.bo.cpu_prep(RelocRead);
+	for (uint32_t i = 0; i < n; i++) {
+		if (get(out.bo, i) != expect(i)) {
+			print("ERROR: ", name, " wrong at element ", int(i), ": got 0x", Hex{get(out.bo, i)}, " expected 0x",
+				  Hex{expect(i)}, " (a 0x", Hex{get(a.bo, i)}, ", b 0x", Hex{get(b.bo, i)}, ")\n");
+			return false;
+		}
+	}
+	print("GPU ", name, " over ", int(width), "x", int(height), " (", int(n * eb), " bytes) in ", ticks,
+		  " ticks -- verified. \\o/\n");
+	for (Bo *bo : {&a.bo, &b.bo, &out.bo})
+		gpu.free(*bo);
+	gpu.put_shader(k.binary);
+	return true;
+}
+
+// Element fills for the typed tests: full-range integer patterns, and floats
+// whose sums/products are exact (so the expectation doesn't depend on
+// rounding). f32_bits/f32_of and ppu::f16_* convert values and bit patterns.
+static uint32_t f32_bits(float f)
+{
+	return std::bit_cast<uint32_t>(f);
+}
+static float f32_of(uint32_t u)
+{
+	return std::bit_cast<float>(u);
+}
+static uint32_t u16_a(uint32_t i)
+{
+	return (i * 997) & 0xFFFF;
+}
+static uint32_t u16_b(uint32_t i)
+{
+	return (i * 31337 + 12345) & 0xFFFF;
+}
+static int32_t s16(uint32_t bits)
+{
+	return int16_t(uint16_t(bits));
+}
+static uint32_t f16_a(uint32_t i)
+{
+	return ppu::f16_from_float(float(i % 64) * 0.25f - 8.0f);
+}
+static uint32_t f16_b(uint32_t i)
+{
+	return ppu::f16_from_float(float(i % 7) * 0.5f);
+}
+static uint32_t f32_a(uint32_t i)
+{
+	return f32_bits(float(i % 100) * 0.125f - 6.0f);
+}
+static uint32_t f32_b(uint32_t i)
+{
+	return f32_bits(float(i % 9) * 0.25f);
+}
+
+static bool typed_tests(Gpu &gpu)
+{
+	using namespace ppu;
+	// 16-bit integers: wrap, both saturations, low and high multiply halves.
+	if (!run_typed_test(gpu, "u16 add(A+B, wraps)", TYPE_U16, 64, 32, build_add2_typed_shader, u16_a, u16_b,
+						[](uint32_t i) -> uint32_t { return (u16_a(i) + u16_b(i)) & 0xFFFF; }))
+		return false;
+	if (!run_typed_test(gpu, "u16 addsat(min(A+B,65535))", TYPE_U16, 64, 32, build_addsat2_typed_shader, u16_a,
+						u16_b, [](uint32_t i) -> uint32_t { return std::min(u16_a(i) + u16_b(i), 0xFFFFu); }))
+		return false;
+	if (!run_typed_test(gpu, "s16 addsat(clamp(A+B))", TYPE_S16, 64, 32, build_addsat2_typed_shader, u16_a, u16_b,
+						[](uint32_t i) -> uint32_t {
+							return uint16_t(std::clamp(s16(u16_a(i)) + s16(u16_b(i)), -32768, 32767));
+						}))
+		return false;
+	if (!run_typed_test(gpu, "u16 mul((A*B)&0xFFFF)", TYPE_U16, 64, 32, build_mul2_typed_shader, u16_a, u16_b,
+						[](uint32_t i) -> uint32_t { return (u16_a(i) * u16_b(i)) & 0xFFFF; }))
+		return false;
+	if (!run_typed_test(gpu, "s16 mulhi((A*B)>>16)", TYPE_S16, 64, 32, build_mulhi2_typed_shader, u16_a, u16_b,
+						[](uint32_t i) -> uint32_t { return uint16_t((s16(u16_a(i)) * s16(u16_b(i))) >> 16); }))
+		return false;
+
+	// Floats, on values whose results are exact in the type.
+	if (!run_typed_test(gpu, "f16 add(A+B)", TYPE_F16, 64, 32, build_add2_typed_shader, f16_a, f16_b,
+						[](uint32_t i) -> uint32_t {
+							return f16_from_float(float_from_f16(f16_a(i)) + float_from_f16(f16_b(i)));
+						}))
+		return false;
+	if (!run_typed_test(gpu, "f16 mul(A*B)", TYPE_F16, 64, 32, build_mul2_typed_shader, f16_a, f16_b,
+						[](uint32_t i) -> uint32_t {
+							return f16_from_float(float_from_f16(f16_a(i)) * float_from_f16(f16_b(i)));
+						}))
+		return false;
+	if (!run_typed_test(gpu, "f32 add(A+B)", TYPE_F32, 32, 32, build_add2_typed_shader, f32_a, f32_b,
+						[](uint32_t i) -> uint32_t { return f32_bits(f32_of(f32_a(i)) + f32_of(f32_b(i))); }))
+		return false;
+	if (!run_typed_test(gpu, "f32 mul(A*B)", TYPE_F32, 32, 32, build_mul2_typed_shader, f32_a, f32_b,
+						[](uint32_t i) -> uint32_t { return f32_bits(f32_of(f32_a(i)) * f32_of(f32_b(i))); }))
+		return false;
+	if (!run_typed_test(gpu, "f32 addsat(clamp(A+B,0,1))", TYPE_F32, 32, 32, build_addsat2_typed_shader, f32_a,
+						f32_b, [](uint32_t i) -> uint32_t {
+							return f32_bits(std::clamp(f32_of(f32_a(i)) + f32_of(f32_b(i)), 0.0f, 1.0f));
+						}))
+		return false;
+	return true;
+}
+
+// A three-stage pipeline, t1 = in + in, t2 = ~t1, out = t2 + in (= 255 - in,
+// mod 256), run twice: as three synchronous compute() calls, then recorded
+// into one ComputeList and submitted once, t1/t2 staying GPU-only. Both must
+// match the CPU; prints the time of each.
+static bool run_pipeline_test(Gpu &gpu, uint32_t width, uint32_t height)
+{
+	uint32_t n = width * height;
+	Bo in = gpu.alloc(n), t1 = gpu.alloc(n), t2 = gpu.alloc(n), out = gpu.alloc(n);
+	Kernel add = make_kernel(gpu, ppu::build_add_shader);
+	Kernel inv = make_kernel(gpu, ppu::build_not_shader);
+	Kernel add2 = make_kernel(gpu, ppu::build_add2_shader);
+	auto cs = gpu.new_cmd_stream(ComputeList::dwords_for(3));
+	if (!in || !t1 || !t2 || !out || !add || !inv || !add2 || !cs.bo())
+		return false;
+
+	auto ib = in.span<uint8_t>();
+	for (uint32_t i = 0; i < n; i++)
+		ib[i] = uint8_t(i * 7);
+	in.cpu_fini(RelocWrite);
+
+	auto check = [&](const char *how) {
+		out.cpu_prep(RelocRead);
+		auto ob = out.span<const uint8_t>();
+		for (uint32_t i = 0; i < n; i++) {
+			uint8_t want = uint8_t(uint8_t(~uint8_t(ib[i] * 2)) + ib[i]);
+			if (ob[i] != want) {
+				print("ERROR: pipeline (", how, ") wrong at byte ", int(i), ": got ", int(ob[i]), " expected ",
+					  int(want), "\n");
+				return false;
+			}
+		}
+		std::fill(out.span<uint8_t>().begin(), out.span<uint8_t>().end(), 0xEE); // poison for the next run
+		out.cpu_fini(RelocWrite);
+		return true;
+	};
+	std::fill(out.span<uint8_t>().begin(), out.span<uint8_t>().end(), 0xEE);
+	out.cpu_fini(RelocWrite);
+
+	auto t0 = read_cntpct();
+	bool ok = compute(gpu, add, t1, in, width, height) && compute(gpu, inv, t2, t1, width, height) &&
+			  compute(gpu, add2, out, t2, in, width, height);
+	uint32_t sync_ticks = read_cntpct() - t0;
+	if (!ok || !check("3 x compute"))
+		return false;
+
+	t0 = read_cntpct();
+	ComputeList cl{cs};
+	ok = cl.dispatch(add, t1, in, width, height) && cl.dispatch(inv, t2, t1, width, height) &&
+		 cl.dispatch(add2, out, t2, in, width, height);
+	Fence f = ok ? cl.submit(gpu) : Fence{};
+	uint32_t submit_ticks = read_cntpct() - t0;
+	if (!f || !gpu.wait(f)) {
+		gpu.dump_status("compute list");
+		return false;
+	}
+	uint32_t list_ticks = read_cntpct() - t0;
+	if (!check("ComputeList"))
+		return false;
+
+	print("GPU 3-stage pipeline over ", int(width), "x", int(height), ": 3 x compute() ", sync_ticks,
+		  " ticks, ComputeList ", list_ticks, " ticks (", cl.stats().dwords, " dwords, CPU back after ", submit_ticks,
+		  ") -- verified. \\o/\n");
+	gpu.free(cs);
+	for (Bo *b : {&in, &t1, &t2, &out})
+		gpu.free(*b);
+	for (Bo *b : {&add.binary, &inv.binary, &add2.binary})
+		gpu.put_shader(*b);
+	return true;
+}
+
 // A per-element gradient and its identity expectation, for the copy probe.
 static uint8_t grad(uint32_t i)
 {
@@ -513,6 +640,14 @@ bool compute_test(Gpu &gpu)
 				return (uint8_t)(((a * al) >> 8) + ((b * (255 - al)) >> 8));
 			}))
 		return false;
+
+	// 16-bit and float elements: the same loads/stores, typed ALU ops.
+	if (!typed_tests(gpu))
+		return false;
+
+	// The same kernels chained: one submission instead of three round trips.
+	if (!run_pipeline_test(gpu, 256, 64))
+		return false;
 	return true;
 }
 
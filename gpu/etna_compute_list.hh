@@ -0,0 +1,133 @@
+#pragma once
+#include "etna.hh"
+#include "etna_tune.hh"
+#include "ppu_dispatch.hh"
+#include <cstdint>
+
+// =============================================================================
+//  etna_compute_list.hh -- record several PPU dispatches, submit them once
+// =============================================================================
+// compute() is synchronous: every call allocates a stream, submits one
+// dispatch and sleeps until the GPU is done. A pipeline of kernels (blur ->
+// threshold -> blend) pays a full CPU<->GPU round trip per stage, with the
+// shader cores idle while the CPU wakes up, frees, allocates and submits the
+// next stage. A ComputeList records the stages back to back into one stream
+// instead, so the whole pipeline is one submission and one fence:
+//
+//   CmdStream cs = gpu.new_cmd_stream(ComputeList::dwords_for(3));
+//   ComputeList cl{cs};
+//   cl.dispatch(blur,  tmp1, src, W, H);          // tmp1, tmp2: GPU-only images
+//   cl.dispatch(thr,   tmp2, tmp1, W, H);
+//   cl.dispatch(blend, dst, src, tmp2, alpha, W, H);
+//   Fence f = cl.submit(gpu);                      // returns at once
+//   ... CPU work ...
+//   gpu.wait(f); dst.cpu_prep(RelocRead); gpu.free(cs);
+//
+// Ordering: every dispatch (the vendor template, ppu_dispatch.hh) starts
+// with an FE<-PE semaphore + stall and ends with a cache flush and another
+// one, so a stage only starts once the previous one's stores have landed:
+// each dispatch is its own barrier, and a stage may read what the one before
+// it wrote.
+//
+// Each dispatch uses the launch tuned for its kernel and size, as compute()
+// does (etna_tune.hh).
+//
+// Intermediate images never leave the GPU: the CPU neither writes nor reads
+// them, so they need no cpu_fini()/cpu_prep() -- only the pipeline's inputs
+// (before submit) and its outputs (after the fence) do.
+//
+// Submitted zero-copy (Gpu::submit_link()): the FE runs the stream in place,
+// so a list is not limited by the ring size, and the stream (and every image
+// it references) must not be rewritten or freed until the fence completes.
+
+namespace etna
+{
+
+class ComputeList {
+public:
+	struct Stats {
+		uint32_t dispatches = 0;
+		uint32_t dwords = 0; // recorded, excluding submit_link()'s return LINK
+	};
+
+	// Stream size (dwords) for `n` dispatches plus the return LINK.
+	static constexpr uint32_t dwords_for(uint32_t n)
+	{
+		return n * kPpuDispatchDwords + 2;
+	}
+
+	// Records into `cs`, appending.
+	explicit ComputeList(CmdStream &cs)
+		: cs_{cs}
+		, start_{cs.offset()}
+	{}
+
+	// Append `k` over its 1, 2 or 3 input images -> `out` (width x height u8,
+	// as compute()). False, with nothing recorded, if the stream has no room
+	// for the dispatch and the return LINK, or if it was submitted already
+	// (the dispatch would land after its return LINK): reset() it first.
+	bool dispatch(const Kernel &k, const Bo &out, const Bo &in0, uint32_t width, uint32_t height)
+	{
+		return record(k, out, in0.gpu_addr(), 0, 0, width, height);
+	}
+	bool dispatch(const Kernel &k, const Bo &out, const Bo &in0, const Bo &in1, uint32_t width, uint32_t height)
+	{
+		return record(k, out, in0.gpu_addr(), in1.gpu_addr(), 0, width, height);
+	}
+	bool dispatch(const Kernel &k,
+				  const Bo &out,
+				  const Bo &in0,
+				  const Bo &in1,
+				  const Bo &in2,
+				  uint32_t width,
+				  uint32_t height)
+	{
+		return record(k, out, in0.gpu_addr(), in1.gpu_addr(), in2.gpu_addr(), width, height);
+	}
+
+	// Submit everything recorded so far as one submission. Again once its
+	// fence has completed, to rerun the same list.
+	Fence submit(Gpu &gpu)
+	{
+		return gpu.submit_link(cs_);
+	}
+
+	const Stats &stats() const
+	{
+		return stats_;
+	}
+
+private:
+	bool record(const Kernel &k,
+				const Bo &out,
+				uint32_t in0,
+				uint32_t in1,
+				uint32_t in2,
+				uint32_t width,
+				uint32_t height)
+	{
+		if (cs_.linked() || cs_.avail() < dwords_for(1))
+			return false;
+		emit_ppu_dispatch(cs_,
+						  in0,
+						  out.gpu_addr(),
+						  k.binary.gpu_addr(),
+						  k.inst_dwords,
+						  k.reg_count,
+						  width,
+						  height,
+						  in1,
+						  in2,
+						  tuned_launch(k.id, width, height),
+						  &k.uniforms);
+		stats_.dispatches++;
+		stats_.dwords = cs_.offset() - start_;
+		return true;
+	}
+
+	CmdStream &cs_;
+	uint32_t start_;
+	Stats stats_{};
+};
+
+} // namespace etna
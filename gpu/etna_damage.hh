@@ -0,0 +1,295 @@
+#pragma once
+#include "etna_format.hh"
+#include <algorithm>
+#include <cstdint>
+#include <span>
+
+// =============================================================================
+//  etna_damage.hh -- damage rectangles: resolve only what changed
+// =============================================================================
+// A full resolve of the demo's 1024x600 render target writes 2.4 MB into the
+// framebuffer every frame, although a few cubes cover a fraction of it. Each
+// buffer only needs the pixels where its old frame and the new one differ,
+// and both are background outside what they drew. So:
+//
+//   project_box()     the screen rectangle a draw can touch: its bounding box
+//                     through the MVP (cube_bounds() in cube_scene.hh);
+//   DamageRegion      a few disjoint rectangles covering what a frame drew,
+//                     each rounded out to the RS's 16x4 pixel alignment;
+//   DamageTracker     per swapchain buffer, what it shows now. A frame into
+//                     buffer b resolves what b shows plus what the frame
+//                     drew, and that becomes what b shows. A buffer never
+//                     rendered into is taken as entirely stale.
+//
+// resolve_rect() (etna.hh) resolves one rectangle; rs_resolve_rect_state()
+// is what it programs: the same copy as a full resolve with a smaller window,
+// the source address moved to the rectangle's first tile and the destination
+// to its first pixel.
+//
+// Pure arithmetic, no hardware access; tools/host_tests.cc checks it.
+
+namespace etna
+{
+
+// Pixels [x0, x1) x [y0, y1).
+struct Rect {
+	uint32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+	constexpr bool empty() const
+	{
+		return x0 >= x1 || y0 >= y1;
+	}
+	constexpr uint32_t width() const
+	{
+		return empty() ? 0 : x1 - x0;
+	}
+	constexpr uint32_t height() const
+	{
+		return empty() ? 0 : y1 - y0;
+	}
+	constexpr uint32_t area() const
+	{
+		return width() * height();
+	}
+	constexpr bool contains(uint32_t x, uint32_t y) const
+	{
+		return x >= x0 && x < x1 && y >= y0 && y < y1;
+	}
+	constexpr bool operator==(const Rect &) const = default;
+};
+
+// The smallest rectangle covering both (an empty one counts as nothing).
+constexpr Rect rect_union(const Rect &a, const Rect &b)
+{
+	if (a.empty())
+		return b;
+	if (b.empty())
+		return a;
+	return {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+}
+
+constexpr bool rect_overlaps(const Rect &a, const Rect &b)
+{
+	return !a.empty() && !b.empty() && a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+// An RS resolve works on whole rows of 16 pixels and groups of 4 rows (one
+// tile row): round `r` out to that, within a width x height target (both
+// multiples of 16 and 4, as a resolve requires anyway).
+inline constexpr uint32_t kRsAlignX = 16;
+inline constexpr uint32_t kRsAlignY = 4;
+
+constexpr Rect rs_align(const Rect &r, uint32_t width, uint32_t height)
+{
+	if (r.empty())
+		return {};
+	const Rect a{r.x0 & ~(kRsAlignX - 1),
+				 r.y0 & ~(kRsAlignY - 1),
+				 (r.x1 + kRsAlignX - 1) & ~(kRsAlignX - 1),
+				 (r.y1 + kRsAlignY - 1) & ~(kRsAlignY - 1)};
+	return {std::min(a.x0, width), std::min(a.y0, height), std::min(a.x1, width), std::min(a.y1, height)};
+}
+
+// The pixels an object can cover: its model-space box [lo, hi] through the
+// column-major MVP `m` to a width x height viewport (x = w/2 + w/2 * ndc.x,
+// rows likewise, as the PA viewport is programmed), rounded out by a pixel
+// for the rasterizer's fixed point and clipped to the viewport. A corner
+// behind the eye (w <= 0) has no sensible projection: the whole viewport.
+constexpr Rect project_box(std::span<const float, 16> m,
+						   const float (&lo)[3],
+						   const float (&hi)[3],
+						   uint32_t width,
+						   uint32_t height)
+{
+	float x_min = 0, x_max = 0, y_min = 0, y_max = 0;
+	for (unsigned c = 0; c < 8; c++) {
+		const float p[3] = {c & 1 ? hi[0] : lo[0], c & 2 ? hi[1] : lo[1], c & 4 ? hi[2] : lo[2]};
+		const float cx = m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12];
+		const float cy = m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13];
+		const float cw = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+		if (!(cw > 1e-6f))
+			return {0, 0, width, height};
+		const float x = width / 2.0f + width / 2.0f * (cx / cw);
+		const float y = height / 2.0f + height / 2.0f * (cy / cw);
+		x_min = c ? std::min(x_min, x) : x;
+		x_max = c ? std::max(x_max, x) : x;
+		y_min = c ? std::min(y_min, y) : y;
+		y_max = c ? std::max(y_max, y) : y;
+	}
+	auto lo_px = [](float v, uint32_t limit) {
+		return v <= 1.0f ? 0u : v - 1.0f >= float(limit) ? limit : uint32_t(v - 1.0f);
+	};
+	auto hi_px = [](float v, uint32_t limit) {
+		return v < -2.0f ? 0u : v + 2.0f >= float(limit) ? limit : uint32_t(v + 2.0f);
+	};
+	return {lo_px(x_min, width), lo_px(y_min, height), hi_px(x_max, width), hi_px(y_max, height)};
+}
+
+// Up to kMaxRects disjoint, RS-aligned rectangles. add() merges a rectangle
+// with every one it overlaps; past kMaxRects the pair whose union adds the
+// fewest pixels is merged. Few rectangles keep the resolves few, and
+// neighbouring objects usually merge at little cost.
+class DamageRegion {
+public:
+	static constexpr uint32_t kMaxRects = 4;
+
+	DamageRegion() = default;
+	DamageRegion(uint32_t width, uint32_t height)
+		: width_{width}
+		, height_{height}
+	{}
+
+	void add(const Rect &r)
+	{
+		Rect a = rs_align(r, width_, height_);
+		if (a.empty())
+			return;
+		// Absorb everything it overlaps; the union may reach further rects.
+		for (bool merged = true; merged;) {
+			merged = false;
+			for (uint32_t i = 0; i < n_; i++)
+				if (rect_overlaps(a, rects_[i])) {
+					a = rect_union(a, rects_[i]);
+					rects_[i] = rects_[--n_];
+					merged = true;
+					break;
+				}
+		}
+		if (n_ < kMaxRects) {
+			rects_[n_++] = a;
+			return;
+		}
+		// Full: merge the cheapest pair among the kept ones and the new one.
+		Rect all[kMaxRects + 1];
+		std::copy_n(rects_, n_, all);
+		all[n_] = a;
+		uint32_t bi = 0, bj = 1, best = ~0u;
+		for (uint32_t i = 0; i <= n_; i++)
+			for (uint32_t j = i + 1; j <= n_; j++) {
+				const uint32_t cost = rect_union(all[i], all[j]).area() - all[i].area() - all[j].area();
+				if (cost < best) {
+					best = cost;
+					bi = i;
+					bj = j;
+				}
+			}
+		const Rect u = rect_union(all[bi], all[bj]);
+		all[bj] = all[n_];
+		all[bi] = u;
+		n_ = 0;
+		for (uint32_t i = 0; i < kMaxRects; i++)
+			if (i != bi)
+				rects_[n_++] = all[i];
+		add(u); // may overlap others now
+	}
+
+	void add(const DamageRegion &o)
+	{
+		for (const Rect &r : o.rects())
+			add(r);
+	}
+
+	// The whole target.
+	void fill()
+	{
+		n_ = 0;
+		add(Rect{0, 0, width_, height_});
+	}
+
+	void clear()
+	{
+		n_ = 0;
+	}
+
+	std::span<const Rect> rects() const
+	{
+		return {rects_, n_};
+	}
+
+	bool empty() const
+	{
+		return n_ == 0;
+	}
+
+	// Pixels covered (the rectangles are disjoint).
+	uint32_t area() const
+	{
+		uint32_t a = 0;
+		for (uint32_t i = 0; i < n_; i++)
+			a += rects_[i].area();
+		return a;
+	}
+
+private:
+	Rect rects_[kMaxRects];
+	uint32_t n_ = 0;
+	uint32_t width_ = 0, height_ = 0;
+};
+
+// What each swapchain buffer shows, so every frame resolves only what its
+// buffer needs to catch up.
+class DamageTracker {
+public:
+	static constexpr uint32_t kMaxBuffers = 4;
+
+	DamageTracker(uint32_t buffers, uint32_t width, uint32_t height)
+		: buffers_{std::min(buffers, kMaxBuffers)}
+		, width_{width}
+		, height_{height}
+	{
+		invalidate();
+	}
+
+	// Rendering a frame that drew `drawn` into `buffer`: the region to
+	// resolve into it. `drawn` is now what the buffer shows.
+	DamageRegion update(uint32_t buffer, const DamageRegion &drawn)
+	{
+		DamageRegion r = shows_[buffer];
+		r.add(drawn);
+		shows_[buffer] = drawn;
+		return r;
+	}
+
+	// Every buffer's content unknown (first frame, a full repaint, a buffer
+	// written behind the tracker's back): the next frame into each resolves
+	// everything.
+	void invalidate()
+	{
+		for (uint32_t b = 0; b < buffers_; b++) {
+			shows_[b] = DamageRegion{width_, height_};
+			shows_[b].fill();
+		}
+	}
+
+	// A region to add a frame's draws to.
+	DamageRegion region() const
+	{
+		return DamageRegion{width_, height_};
+	}
+
+private:
+	DamageRegion shows_[kMaxBuffers];
+	uint32_t buffers_;
+	uint32_t width_, height_;
+};
+
+// The registers of a resolve of rectangle `r` (RS-aligned) out of the
+// A8R8G8B8 tiled render target into the same place of a linear `dst`
+// surface, and the byte offsets the source and destination addresses move
+// by. A 4x4 tile is 64 bytes and a tile row src_tiled_stride * 4.
+struct RsRect {
+	RsCopy copy;
+	uint32_t src_offset;
+	uint32_t dst_offset;
+
+	constexpr bool operator==(const RsRect &) const = default;
+};
+
+constexpr RsRect rs_resolve_rect_state(Format dst, const Rect &r, uint32_t src_tiled_stride, uint32_t dst_stride)
+{
+	return {rs_resolve_state(dst, r.width(), r.height(), src_tiled_stride, dst_stride),
+			(r.y0 / 4) * (src_tiled_stride * 4) + r.x0 * 16,
+			r.y0 * dst_stride + r.x0 * format_bytes(dst)};
+}
+
+} // namespace etna
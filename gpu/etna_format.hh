@@ -0,0 +1,240 @@
+#pragma once
+#include "gpu_regs.hh"
+#include <cstdint>
+
+// =============================================================================
+//  etna_format.hh -- RS engine pixel formats: sizes, RS_CONFIG, conversion
+// =============================================================================
+// The RS engine reads and writes seven formats, 16 and 32 bpp, and converts
+// between any two of them as it copies: RS_CONFIG holds the source format in
+// bits [4:0] and the destination's in [12:8] (rs_config()). A 16-bit surface
+// halves the DDR traffic of every clear, blit and resolve into it -- a
+// 1024x600 R5G6B5 framebuffer is 1.2 MB per frame instead of 2.4.
+//
+// convert_pixel() is the reference the on-target test (test_blit_formats,
+// main.cc) checks the hardware against:
+//   narrowing  keeps the top bits of each channel (dithering is off: the
+//              emitters write RS_DITHER0/1 = 0xFFFFFFFF, as Mesa does);
+//   widening   replicates the top bits into the low ones (5 bits ABCDE ->
+//              ABCDEABC), so 0 and full scale stay 0x00 and 0xFF;
+//   X formats  have no alpha: they read as opaque and are written with the X
+//              bits 0. What the RS puts in the X bits is not specified, so
+//              compare pixels under format_mask().
+//
+// A 16-bit clear value is the packed pixel twice over (Mesa's
+// etna_clear_blit_pack_rgba): rs_clear_value().
+//
+// Downsampling (BlitDownsampleX/Y): the RS halves a copy in X, Y or both,
+// averaging the source pixels under each destination pixel -- a 2x2 box
+// filter in one pass, no shader. The width/height of the op stay the SOURCE
+// size; the destination is (width >> dx) x (height >> dy). rs_blit_reference()
+// is the filter's reference: each channel the mean of its 2 or 4 samples,
+// rounded to nearest, in 8-bit precision.
+//
+// rs_blit_state() / rs_resolve_state() are the register values an RS copy
+// programs, so the encoding is checked off-target; etna.cc emits them.
+//
+// Pure arithmetic, no hardware access; tools/host_tests.cc checks it.
+
+namespace etna
+{
+
+enum class Format : uint32_t {
+	X4R4G4B4 = VivanteGpu::RS_FORMAT_X4R4G4B4, // 16bpp
+	A4R4G4B4 = VivanteGpu::RS_FORMAT_A4R4G4B4,
+	X1R5G5B5 = VivanteGpu::RS_FORMAT_X1R5G5B5,
+	A1R5G5B5 = VivanteGpu::RS_FORMAT_A1R5G5B5,
+	R5G6B5 = VivanteGpu::RS_FORMAT_R5G6B5,
+	X8R8G8B8 = VivanteGpu::RS_FORMAT_X8R8G8B8, // 32bpp
+	A8R8G8B8 = VivanteGpu::RS_FORMAT_A8R8G8B8,
+};
+inline constexpr uint32_t kFormats = 7; // the values are 0 .. kFormats-1
+
+enum BlitFlags : uint32_t {
+	BlitNone = 0,
+	BlitSwapRB = 1 << 0, // RGBA<->BGRA (VIVS_RS_CONFIG_SWAP_RB)
+	BlitFlipY = 1 << 1,	 // vertical flip (VIVS_RS_CONFIG_FLIP)
+	BlitDownsampleX = 1 << 2, // halve the width: 2x1 box filter
+	BlitDownsampleY = 1 << 3, // halve the height: 1x2 box filter
+	BlitDownsample2x = BlitDownsampleX | BlitDownsampleY,
+};
+
+// Channel widths in bits, packed top to bottom X/A, R, G, B.
+struct FormatInfo {
+	uint8_t bytes; // per pixel
+	uint8_t x;	   // padding bits above R (no alpha)
+	uint8_t a, r, g, b;
+};
+
+constexpr FormatInfo format_info(Format f)
+{
+	switch (f) {
+	case Format::X4R4G4B4: return {2, 4, 0, 4, 4, 4};
+	case Format::A4R4G4B4: return {2, 0, 4, 4, 4, 4};
+	case Format::X1R5G5B5: return {2, 1, 0, 5, 5, 5};
+	case Format::A1R5G5B5: return {2, 0, 1, 5, 5, 5};
+	case Format::R5G6B5: return {2, 0, 0, 5, 6, 5};
+	case Format::X8R8G8B8: return {4, 8, 0, 8, 8, 8};
+	case Format::A8R8G8B8: return {4, 0, 8, 8, 8, 8};
+	}
+	return {4, 0, 8, 8, 8, 8};
+}
+
+constexpr uint32_t format_bytes(Format f)
+{
+	return format_info(f).bytes;
+}
+
+// Row pitch of a linear, tightly packed surface.
+constexpr uint32_t format_stride(Format f, uint32_t width)
+{
+	return width * format_bytes(f);
+}
+
+// The pixel bits that carry a channel (all of them but the X bits).
+constexpr uint32_t format_mask(Format f)
+{
+	const FormatInfo i = format_info(f);
+	const uint32_t bits = i.a + i.r + i.g + i.b;
+	return bits == 32 ? ~0u : (1u << bits) - 1;
+}
+
+// RS_CONFIG for a copy from `src` to `dst` with BlitFlags; `src_tiled` for a
+// resolve out of a (basic-)tiled render target.
+constexpr uint32_t rs_config(Format src, Format dst, uint32_t flags = BlitNone, bool src_tiled = false)
+{
+	using namespace VivanteGpu;
+	return uint32_t(src) | (uint32_t(dst) << 8) | (flags & BlitSwapRB ? RS_CONFIG_SWAP_RB : 0) |
+		   (flags & BlitFlipY ? RS_CONFIG_FLIP : 0) | (flags & BlitDownsampleX ? RS_CONFIG_DOWNSAMPLE_X : 0) |
+		   (flags & BlitDownsampleY ? RS_CONFIG_DOWNSAMPLE_Y : 0) | (src_tiled ? RS_CONFIG_SOURCE_TILED : 0);
+}
+
+// The destination size of an op over a width x height source.
+constexpr uint32_t rs_dest_width(uint32_t width, uint32_t flags)
+{
+	return flags & BlitDownsampleX ? width / 2 : width;
+}
+
+constexpr uint32_t rs_dest_height(uint32_t height, uint32_t flags)
+{
+	return flags & BlitDownsampleY ? height / 2 : height;
+}
+
+// The registers that differ between RS copies (the rest of the sequence is
+// fixed; see blit() in etna.cc).
+struct RsCopy {
+	uint32_t config;
+	uint32_t source_stride; // RS_SOURCE_STRIDE
+	uint32_t dest_stride;	// RS_DEST_STRIDE
+	uint32_t window;		// RS_WINDOW_SIZE: the source size, width | height << 16
+
+	constexpr bool operator==(const RsCopy &) const = default;
+};
+
+// A linear -> linear copy of a width x height `src` surface, both tightly
+// packed.
+constexpr RsCopy rs_blit_state(Format src, Format dst, uint32_t width, uint32_t height, uint32_t flags = BlitNone)
+{
+	return {rs_config(src, dst, flags),
+			format_stride(src, width),
+			format_stride(dst, rs_dest_width(width, flags)),
+			width | (height << 16)};
+}
+
+// A resolve out of the A8R8G8B8 (basic-)tiled render target: one RS source
+// row is a row of 4x4 tiles, so the source stride register is the tiled
+// stride << 2.
+constexpr RsCopy rs_resolve_state(Format dst,
+								  uint32_t width,
+								  uint32_t height,
+								  uint32_t src_tiled_stride,
+								  uint32_t dst_stride,
+								  uint32_t flags = BlitNone)
+{
+	return {rs_config(Format::A8R8G8B8, dst, flags, true), src_tiled_stride << 2, dst_stride, width | (height << 16)};
+}
+
+// An 8-bit channel cut to its top `bits`, and a `bits`-wide channel widened
+// back to 8 by replicating its top bits. A channel of 0 bits is absent: it
+// packs to nothing and unpacks as full scale (an X format's opaque alpha).
+constexpr uint32_t narrow_channel(uint32_t c8, unsigned bits)
+{
+	return bits ? c8 >> (8 - bits) : 0;
+}
+
+constexpr uint32_t widen_channel(uint32_t c, unsigned bits)
+{
+	if (!bits)
+		return 0xFF;
+	uint32_t v = c << (8 - bits);
+	for (unsigned s = bits; s < 8; s *= 2)
+		v |= v >> s;
+	return v & 0xFF;
+}
+
+// A8R8G8B8 -> `f`, and back. Packing an X format writes the X bits 0;
+// unpacking one gives alpha 0xFF.
+constexpr uint32_t pack_pixel(Format f, uint32_t argb)
+{
+	const FormatInfo i = format_info(f);
+	return (narrow_channel(argb >> 24, i.a) << (i.r + i.g + i.b)) |
+		   (narrow_channel((argb >> 16) & 0xFF, i.r) << (i.g + i.b)) |
+		   (narrow_channel((argb >> 8) & 0xFF, i.g) << i.b) | narrow_channel(argb & 0xFF, i.b);
+}
+
+constexpr uint32_t unpack_pixel(Format f, uint32_t px)
+{
+	const FormatInfo i = format_info(f);
+	auto field = [px](unsigned shift, unsigned bits) { return (px >> shift) & ((1u << bits) - 1); };
+	const uint32_t a = widen_channel(field(i.r + i.g + i.b, i.a), i.a);
+	const uint32_t r = widen_channel(field(i.g + i.b, i.r), i.r);
+	const uint32_t g = widen_channel(field(i.b, i.g), i.g);
+	const uint32_t b = widen_channel(field(0, i.b), i.b);
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// One pixel through an RS copy from `src` to `dst` (BlitSwapRB applies;
+// BlitFlipY moves rows, not bits).
+constexpr uint32_t convert_pixel(Format src, Format dst, uint32_t px, uint32_t flags = BlitNone)
+{
+	uint32_t argb = unpack_pixel(src, px);
+	if (flags & BlitSwapRB)
+		argb = (argb & 0xFF00FF00u) | ((argb >> 16) & 0xFFu) | ((argb & 0xFFu) << 16);
+	return pack_pixel(dst, argb);
+}
+
+// Reference for a linear RS copy: a width x height `src` of src_fmt pixels
+// (uint16_t for a 2-byte format, uint32_t for a 4-byte one) into `dst`,
+// rs_dest_width() x rs_dest_height() of dst_fmt, with every BlitFlags.
+template<typename S, typename D>
+constexpr void rs_blit_reference(
+	D *dst, Format dst_fmt, const S *src, Format src_fmt, uint32_t width, uint32_t height, uint32_t flags = BlitNone)
+{
+	const uint32_t sx = flags & BlitDownsampleX ? 2 : 1, sy = flags & BlitDownsampleY ? 2 : 1;
+	const uint32_t dw = rs_dest_width(width, flags), dh = rs_dest_height(height, flags);
+	for (uint32_t y = 0; y < dh; y++)
+		for (uint32_t x = 0; x < dw; x++) {
+			uint32_t sum[4] = {};
+			for (uint32_t j = 0; j < sy; j++)
+				for (uint32_t i = 0; i < sx; i++) {
+					const uint32_t argb = unpack_pixel(src_fmt, src[(y * sy + j) * width + x * sx + i]);
+					for (unsigned c = 0; c < 4; c++)
+						sum[c] += (argb >> (c * 8)) & 0xFF;
+				}
+			const uint32_t n = sx * sy;
+			uint32_t argb = 0;
+			for (unsigned c = 0; c < 4; c++)
+				argb |= ((sum[c] + n / 2) / n) << (c * 8);
+			const uint32_t row = flags & BlitFlipY ? dh - 1 - y : y;
+			dst[row * dw + x] = D(convert_pixel(Format::A8R8G8B8, dst_fmt, argb, flags));
+		}
+}
+
+// RS_FILL_VALUE for clearing a `f` surface to `argb`.
+constexpr uint32_t rs_clear_value(Format f, uint32_t argb)
+{
+	const uint32_t px = pack_pixel(f, argb);
+	return format_bytes(f) == 2 ? px | (px << 16) : px;
+}
+
+} // namespace etna
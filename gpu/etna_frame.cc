@@ -0,0 +1,141 @@
+#include "etna_frame.hh"
+#include "gpu_regs.hh"
+
+// =============================================================================
+//  etna_frame.cc -- Frame: one stream per frame, drains only on hazards
+// =============================================================================
+// See etna_frame.hh. The ops are the ordinary emitters with their built-in
+// drain turned off (drain = false / MeshDraw::sync = false).
+
+namespace etna
+{
+using namespace VivanteGpu;
+
+void Frame::begin()
+{
+	hz_.drained(); // whatever ran before this stream was drained by its own end
+	if (st_)
+		st_->invalidate();
+	start_ = cs_.offset();
+	stats_ = {};
+}
+
+void Frame::clear(const Bo &dst, uint32_t width, uint32_t height, uint32_t argb, Format fmt)
+{
+	access(Engine::RS, {}, {dst.gpu_addr()});
+	etna::clear(cs_, dst, width, height, argb, fmt, false);
+	if (st_)
+		st_->invalidate();
+}
+
+void Frame::fast_clear(TileStatus &ts, uint32_t value)
+{
+	access(Engine::RS, {}, {ts.bo->gpu_addr()});
+	etna::fast_clear(cs_, ts, value, false);
+	if (st_)
+		st_->invalidate();
+}
+
+uint32_t Frame::draw(const MeshDraw &d)
+{
+	access(Engine::PE,
+		   {d.vtx->gpu_addr(),
+			d.vs->gpu_addr(),
+			d.ps->gpu_addr(),
+			d.index ? d.index->gpu_addr() : 0,
+			d.inst ? d.inst->gpu_addr() : 0},
+		   {d.rt->gpu_addr(),
+			d.depth ? d.depth->gpu_addr() : 0,
+			d.rt_ts ? d.rt_ts.bo->gpu_addr() : 0,
+			d.depth && d.depth_ts ? d.depth_ts.bo->gpu_addr() : 0});
+	MeshDraw u = d;
+	u.sync = false;
+	stats_.draws++;
+	return st_ ? emit_mesh(cs_, *st_, u) : emit_mesh(cs_, u);
+}
+
+void Frame::resolve(const Bo &dst,
+					const Bo &src,
+					uint32_t width,
+					uint32_t height,
+					uint32_t src_tiled_stride,
+					uint32_t dst_stride,
+					uint32_t dst_offset,
+					Format dst_fmt,
+					uint32_t flags)
+{
+	access(Engine::RS, {src.gpu_addr()}, {dst.gpu_addr()});
+	etna::resolve(cs_, dst, src, width, height, src_tiled_stride, dst_stride, dst_offset, dst_fmt, flags, false);
+	if (st_)
+		st_->invalidate();
+}
+
+void Frame::resolve(const Bo &dst,
+					const Bo &src,
+					const TileStatus &src_ts,
+					uint32_t width,
+					uint32_t height,
+					uint32_t src_tiled_stride,
+					uint32_t dst_stride,
+					uint32_t dst_offset,
+					Format dst_fmt,
+					uint32_t flags)
+{
+	access(Engine::RS, {src.gpu_addr(), src_ts.bo->gpu_addr()}, {dst.gpu_addr()});
+	etna::resolve(
+		cs_, dst, src, src_ts, width, height, src_tiled_stride, dst_stride, dst_offset, dst_fmt, flags, false);
+	if (st_)
+		st_->invalidate();
+}
+
+void Frame::resolve_rect(
+	const Bo &dst, const Bo &src, const Rect &r, uint32_t src_tiled_stride, uint32_t dst_stride, Format dst_fmt)
+{
+	access(Engine::RS, {src.gpu_addr()}, {dst.gpu_addr()});
+	etna::resolve_rect(cs_, dst, src, r, src_tiled_stride, dst_stride, dst_fmt, false);
+	if (st_)
+		st_->invalidate();
+}
+
+void Frame::resolve_rect(const Bo &dst,
+						 const Bo &src,
+						 const TileStatus &src_ts,
+						 const Rect &r,
+						 uint32_t src_tiled_stride,
+						 uint32_t dst_stride,
+						 Format dst_fmt)
+{
+	access(Engine::RS, {src.gpu_addr(), src_ts.bo->gpu_addr()}, {dst.gpu_addr()});
+	etna::resolve_rect(cs_, dst, src, src_ts, r, src_tiled_stride, dst_stride, dst_fmt, false);
+	if (st_)
+		st_->invalidate();
+}
+
+void Frame::end()
+{
+	drain();
+	stats_.dwords = cs_.offset() - start_;
+}
+
+void Frame::access(Engine e, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes)
+{
+	stats_.ops++;
+	if (hz_.conflicts(e, reads, writes))
+		drain();
+	if (!hz_.record(e, reads, writes)) {
+		drain();
+		hz_.record(e, reads, writes);
+	}
+}
+
+// The same drain every op emits on its own (etna.cc emit_pe_drain).
+void Frame::drain()
+{
+	cs_.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	cs_.flush_cache();
+	cs_.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	hz_.drained();
+	stats_.drains++;
+}
+
+} // namespace etna
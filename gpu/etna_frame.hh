@@ -0,0 +1,216 @@
+#pragma once
+#include "etna.hh"
+#include "etna_3d.hh"
+#include "etna_state.hh"
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+
+// =============================================================================
+//  etna_frame.hh -- record a whole frame (clears, draws, resolve) as one stream
+// =============================================================================
+// Every op emitter ends in a PE drain (stall FE<-PE, flush caches, stall) so
+// that it can be submitted and waited on alone. A frame made of such ops pays
+// for a drain -- and, submitted op by op, a ring round trip and a CPU wait --
+// between every pair of draws, although draws into the same target are
+// ordered by the pipe anyway. A Frame records the ops undrained into one
+// stream and drains only where one op needs the result of another engine:
+//
+//   RS clear rt   -> draw into rt     drain (PE must see the cleared pixels)
+//   draw          -> draw             none  (same engine, in order)
+//   draw into rt  -> RS resolve rt    drain (RS reads what the PE wrote)
+//   RS clear rt   -> RS clear depth   none  (same engine, other buffer)
+//
+// A fast clear (etna_ts.hh) is an RS write of the TS buffer, which the draws
+// and the resolve then read, so it hands over the same way.
+//
+// plus one final drain, so the stream submits like any single op: one
+// submission, one fence. (Mesa tracks the same thing per resource:
+// etna_resource::seqno / resource_written() / etna_flush_*.)
+//
+//   Frame f{cs, &st};                       // st optional (etna_state.hh)
+//   f.begin();
+//   f.clear(rt, ...); f.clear(depth, ...);
+//   for (auto &d : draws) f.draw(d);
+//   f.resolve(fb, rt, ...);
+//   f.end();
+//   gpu.submit_and_wait(cs);                // or record into a Bundle once
+//
+// The hazard bookkeeping (HazardTracker) is hardware-independent and host
+// tested; Frame itself is in etna_frame.cc.
+
+namespace etna
+{
+
+// Which engine an op runs on. The RS sits behind the PE, but it reads and
+// writes memory on its own schedule: handing a buffer between the two needs
+// a drain.
+enum class Engine : uint8_t {
+	RS = 1 << 0,
+	PE = 1 << 1, // the 3D pipe
+};
+
+// Buffers (by GPU address) that engines have touched since the last drain.
+class HazardTracker {
+public:
+	static constexpr uint32_t kMaxBuffers = 16;
+
+	// Would an op on `e` reading `reads` and writing `writes` race with an
+	// earlier op on another engine? (RAW, WAW or WAR across engines.)
+	bool conflicts(Engine e, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes) const
+	{
+		uint8_t other = uint8_t(~uint8_t(e));
+		for (uint32_t a : reads)
+			if (const Entry *x = find(a); x && (x->written & other))
+				return true;
+		for (uint32_t a : writes)
+			if (const Entry *x = find(a); x && ((x->written | x->read) & other))
+				return true;
+		return false;
+	}
+
+	// Note the op's accesses. False (and nothing recorded) if the table has no
+	// room: drain, then record again.
+	bool record(Engine e, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes)
+	{
+		uint32_t fresh = 0;
+		for (auto list : {reads, writes})
+			for (uint32_t a : list)
+				fresh += a && !find(a);
+		if (n_ + fresh > kMaxBuffers)
+			return false;
+		for (uint32_t a : reads)
+			if (a)
+				get(a).read |= uint8_t(e);
+		for (uint32_t a : writes)
+			if (a)
+				get(a).written |= uint8_t(e);
+		return true;
+	}
+
+	// The pipeline drained: nothing is outstanding any more.
+	void drained()
+	{
+		n_ = 0;
+	}
+
+	uint32_t tracked() const
+	{
+		return n_;
+	}
+
+private:
+	struct Entry {
+		uint32_t addr;
+		uint8_t read, written; // Engine bits
+	};
+
+	const Entry *find(uint32_t addr) const
+	{
+		for (uint32_t i = 0; i < n_; i++)
+			if (buf_[i].addr == addr)
+				return &buf_[i];
+		return nullptr;
+	}
+
+	Entry &get(uint32_t addr)
+	{
+		for (uint32_t i = 0; i < n_; i++)
+			if (buf_[i].addr == addr)
+				return buf_[i];
+		buf_[n_] = Entry{addr, 0, 0};
+		return buf_[n_++];
+	}
+
+	std::array<Entry, kMaxBuffers> buf_{};
+	uint32_t n_ = 0;
+};
+
+class Frame {
+public:
+	struct Stats {
+		uint32_t ops = 0;	 // clears + draws + resolves
+		uint32_t draws = 0;	 // mesh draws
+		uint32_t drains = 0; // PE drains emitted (hazards + the final one)
+		uint32_t dwords = 0; // stream length begin() .. end()
+	};
+
+	// Records into `cs`, appending. With a StateTracker the draws go through
+	// it (emit_mesh(cs, st, d)); it is invalidated at begin() and after every
+	// RS op, which writes state behind its back.
+	explicit Frame(CmdStream &cs, StateTracker *st = nullptr)
+		: cs_{cs}
+		, st_{st}
+	{}
+
+	void begin();
+
+	void clear(const Bo &dst, uint32_t width, uint32_t height, uint32_t argb, Format fmt = Format::A8R8G8B8);
+
+	// fast_clear() (etna.hh): an RS write of the TS buffer only.
+	void fast_clear(TileStatus &ts, uint32_t value);
+
+	// Returns the dword offset of the draw's uniform data (the Bundle patch
+	// point), as emit_mesh() does. `d.sync` is ignored: the Frame syncs.
+	uint32_t draw(const MeshDraw &d);
+
+	void resolve(const Bo &dst,
+				 const Bo &src,
+				 uint32_t width,
+				 uint32_t height,
+				 uint32_t src_tiled_stride,
+				 uint32_t dst_stride,
+				 uint32_t dst_offset = 0,
+				 Format dst_fmt = Format::A8R8G8B8,
+				 uint32_t flags = BlitNone);
+
+	// The same through `src`'s tile status.
+	void resolve(const Bo &dst,
+				 const Bo &src,
+				 const TileStatus &src_ts,
+				 uint32_t width,
+				 uint32_t height,
+				 uint32_t src_tiled_stride,
+				 uint32_t dst_stride,
+				 uint32_t dst_offset = 0,
+				 Format dst_fmt = Format::A8R8G8B8,
+				 uint32_t flags = BlitNone);
+
+	// resolve_rect() (etna.hh): one rectangle of `src`, e.g. each of a
+	// DamageRegion's.
+	void resolve_rect(const Bo &dst,
+					  const Bo &src,
+					  const Rect &r,
+					  uint32_t src_tiled_stride,
+					  uint32_t dst_stride,
+					  Format dst_fmt = Format::A8R8G8B8);
+	void resolve_rect(const Bo &dst,
+					  const Bo &src,
+					  const TileStatus &src_ts,
+					  const Rect &r,
+					  uint32_t src_tiled_stride,
+					  uint32_t dst_stride,
+					  Format dst_fmt = Format::A8R8G8B8);
+
+	// Final drain: the stream is now complete, ready to submit.
+	void end();
+
+	const Stats &stats() const
+	{
+		return stats_;
+	}
+
+private:
+	// Drain first if the op conflicts with outstanding work (or the hazard
+	// table is full), then record it.
+	void access(Engine e, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes);
+	void drain();
+
+	CmdStream &cs_;
+	StateTracker *st_;
+	HazardTracker hz_;
+	uint32_t start_ = 0;
+	Stats stats_{};
+};
+
+} // namespace etna
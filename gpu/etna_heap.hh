@@ -0,0 +1,370 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// =============================================================================
+//  etna_heap.hh -- the GPU DDR pool allocator behind Gpu::alloc / Gpu::free
+// =============================================================================
+// Pure address arithmetic over a plain [base, base + size) range: it never
+// touches the memory it hands out, so all bookkeeping lives out-of-band in
+// fixed arrays (no malloc, no in-band headers in DDR the GPU might overwrite).
+// That also makes it host-compilable and testable (see tools/host_tests.cc).
+//
+//  TWO TIERS
+//   - Small (<= 4 KB, the command streams, vertex buffers, shader binaries and
+//     descriptors): power-of-two size classes 64 B .. 4 KB, each served from
+//     64 KB slabs with a used-slot bitmap. A slot is naturally aligned to its
+//     class size because slabs are 64 KB-aligned. alloc/free are a bitmap scan.
+//   - Large (render targets, depth buffers, images): a sorted block list
+//     covering the whole pool, best-fit with split on alloc and coalescing
+//     with both neighbours on free. Slabs themselves are large blocks.
+//   An empty slab goes back to the large tier, except the last slab of its
+//     class, which is kept warm so a per-frame alloc/free pair does not thrash.
+//
+//  STATS
+//   `used` is what callers hold (rounded to the class / 64 B), `reserved` is
+//   what has been taken from the pool (large blocks + whole slabs), `peak` is
+//   the high-water mark of `reserved`. External fragmentation is reported as
+//   the share of free space NOT in the largest free block.
+
+namespace etna
+{
+
+class Heap {
+public:
+	static constexpr uint32_t kMinClassLog2 = 6; // 64 B = one cache line
+	static constexpr uint32_t kNumClasses = 7;	 // 64 B .. 4 KB
+	static constexpr uint32_t kMaxSmall = 1u << (kMinClassLog2 + kNumClasses - 1);
+	static constexpr uint32_t kSlabBytes = 64 * 1024;
+	static constexpr uint32_t kMaxSlabs = 32;
+	static constexpr uint32_t kMaxBlocks = 512; // large-tier list entries (used + free)
+
+	struct Stats {
+		uint32_t used = 0;		   // bytes held by callers
+		uint32_t reserved = 0;	   // bytes taken from the pool (large blocks + slabs)
+		uint32_t peak = 0;		   // high-water mark of `reserved`
+		uint32_t free = 0;		   // bytes in free large blocks
+		uint32_t largest_free = 0; // biggest single allocation that can still succeed
+		uint32_t free_blocks = 0;
+		uint32_t live = 0;	 // outstanding allocations
+		uint32_t slabs = 0;	 // slabs currently carved out
+		uint32_t failed = 0; // allocations refused (out of space or metadata)
+
+		// 0 = all free space is one block; 100 = hopelessly shattered.
+		uint32_t fragmentation_pct() const
+		{
+			return free ? 100 - uint32_t(uint64_t(largest_free) * 100 / free) : 0;
+		}
+	};
+
+	Heap() = default;
+	Heap(uint32_t base, uint32_t size)
+	{
+		init(base, size);
+	}
+
+	// (Re)start with the whole range free. `base` must be non-zero (0 is the
+	// failure return) and 64-aligned; `size` a multiple of 64.
+	void init(uint32_t base, uint32_t size)
+	{
+		base_ = base;
+		size_ = size;
+		nblocks_ = 1;
+		blocks_[0] = Block{base, size, false};
+		slabs_ = {};
+		for (auto &n : class_slabs_)
+			n = 0;
+		used_ = reserved_ = peak_ = live_ = failed_ = 0;
+	}
+
+	// Returns the address, or 0 if the request cannot be met. `align` must be a
+	// power of two; anything below 64 is raised to 64.
+	uint32_t alloc(uint32_t bytes, uint32_t align = 64)
+	{
+		// More than the pool can never fit, and above 0xFFFFFFC0 round64()
+		// would wrap to 0: refuse before rounding.
+		if (bytes == 0 || bytes > size_ || (align & (align - 1)))
+			return fail();
+		if (align < (1u << kMinClassLog2))
+			align = 1u << kMinClassLog2;
+
+		uint32_t need = bytes > align ? bytes : align;
+		uint32_t addr = 0;
+		if (need <= kMaxSmall)
+			addr = alloc_small(class_of(need));
+		else if ((addr = alloc_large(round64(bytes), align)))
+			used_ += round64(bytes);
+		if (!addr)
+			return fail();
+		live_++;
+		return addr;
+	}
+
+	// Release an address returned by alloc(). Returns false (and changes
+	// nothing) for an address that is not currently allocated -- a double free
+	// or a stray pointer.
+	bool free(uint32_t addr)
+	{
+		if (!addr)
+			return false;
+		bool ok = false;
+		if (Slab *s = slab_of(addr))
+			ok = free_small(*s, addr);
+		else if (int i = find_block(addr); i >= 0 && blocks_[i].used) {
+			used_ -= blocks_[i].size;
+			free_large(uint32_t(i));
+			ok = true;
+		}
+		if (ok)
+			live_--;
+		return ok;
+	}
+
+	// The space alloc(bytes, align) really occupies: its size class, or the
+	// 64 B-rounded size for large blocks.
+	static uint32_t footprint(uint32_t bytes, uint32_t align = 64)
+	{
+		uint32_t need = bytes > align ? bytes : align;
+		return need <= kMaxSmall ? class_bytes(class_of(need)) : round64(bytes);
+	}
+
+	Stats stats() const
+	{
+		Stats st;
+		st.used = used_;
+		st.reserved = reserved_;
+		st.peak = peak_;
+		st.live = live_;
+		st.failed = failed_;
+		for (uint32_t i = 0; i < nblocks_; i++) {
+			if (blocks_[i].used)
+				continue;
+			st.free += blocks_[i].size;
+			st.free_blocks++;
+			if (blocks_[i].size > st.largest_free)
+				st.largest_free = blocks_[i].size;
+		}
+		for (auto &s : slabs_)
+			st.slabs += s.addr ? 1 : 0;
+		return st;
+	}
+
+	uint32_t base() const
+	{
+		return base_;
+	}
+	uint32_t size() const
+	{
+		return size_;
+	}
+
+private:
+	struct Block {
+		uint32_t addr;
+		uint32_t size;
+		bool used;
+	};
+
+	struct Slab {
+		uint32_t addr = 0; // 0 = unused entry
+		uint16_t cls = 0;
+		uint16_t nfree = 0;
+		std::array<uint32_t, kSlabBytes / (1u << kMinClassLog2) / 32> bits{}; // 1 = slot in use
+	};
+
+	static uint32_t round64(uint32_t bytes)
+	{
+		return (bytes + 63) & ~63u;
+	}
+
+	static uint32_t class_of(uint32_t bytes)
+	{
+		uint32_t c = 0;
+		while (class_bytes(c) < bytes)
+			c++;
+		return c;
+	}
+
+	static uint32_t class_bytes(uint32_t cls)
+	{
+		return 1u << (kMinClassLog2 + cls);
+	}
+
+	static uint32_t slots_per_slab(uint32_t cls)
+	{
+		return kSlabBytes / class_bytes(cls);
+	}
+
+	uint32_t fail()
+	{
+		failed_++;
+		return 0;
+	}
+
+	void take(uint32_t bytes)
+	{
+		reserved_ += bytes;
+		if (reserved_ > peak_)
+			peak_ = reserved_;
+	}
+
+	// --- small tier ----------------------------------------------------------
+	uint32_t alloc_small(uint32_t cls)
+	{
+		Slab *s = nullptr;
+		for (auto &c : slabs_)
+			if (c.addr && c.cls == cls && c.nfree) {
+				s = &c;
+				break;
+			}
+		if (!s) {
+			for (auto &c : slabs_)
+				if (!c.addr) {
+					s = &c;
+					break;
+				}
+			if (!s)
+				return 0;
+			uint32_t addr = alloc_large(kSlabBytes, kSlabBytes);
+			if (!addr)
+				return 0;
+			*s = Slab{.addr = addr, .cls = uint16_t(cls), .nfree = uint16_t(slots_per_slab(cls))};
+			class_slabs_[cls]++;
+		}
+
+		uint32_t n = slots_per_slab(cls);
+		for (uint32_t w = 0; w * 32 < n; w++) {
+			if (s->bits[w] == 0xFFFFFFFF)
+				continue;
+			uint32_t bit = __builtin_ctz(~s->bits[w]);
+			s->bits[w] |= 1u << bit;
+			s->nfree--;
+			used_ += class_bytes(cls);
+			return s->addr + (w * 32 + bit) * class_bytes(cls);
+		}
+		return 0; // unreachable: nfree said there was a slot
+	}
+
+	bool free_small(Slab &s, uint32_t addr)
+	{
+		uint32_t off = addr - s.addr;
+		if (off & (class_bytes(s.cls) - 1))
+			return false;
+		uint32_t slot = off / class_bytes(s.cls);
+		uint32_t &word = s.bits[slot / 32];
+		uint32_t mask = 1u << (slot % 32);
+		if (!(word & mask))
+			return false;
+		word &= ~mask;
+		s.nfree++;
+		used_ -= class_bytes(s.cls);
+
+		// Empty slab: return it to the large tier unless it's the class's last.
+		if (s.nfree == slots_per_slab(s.cls) && class_slabs_[s.cls] > 1) {
+			class_slabs_[s.cls]--;
+			uint32_t slab_addr = s.addr;
+			s = Slab{};
+			free_large(uint32_t(find_block(slab_addr)));
+		}
+		return true;
+	}
+
+	Slab *slab_of(uint32_t addr)
+	{
+		for (auto &s : slabs_)
+			if (s.addr && addr >= s.addr && addr < s.addr + kSlabBytes)
+				return &s;
+		return nullptr;
+	}
+
+	// --- large tier ----------------------------------------------------------
+	uint32_t alloc_large(uint32_t size, uint32_t align)
+	{
+		int best = -1;
+		for (uint32_t i = 0; i < nblocks_; i++) {
+			const Block &b = blocks_[i];
+			if (b.used)
+				continue;
+			uint32_t pad = ((b.addr + align - 1) & ~(align - 1)) - b.addr;
+			if (uint64_t(pad) + size > b.size)
+				continue;
+			if (best < 0 || b.size < blocks_[best].size)
+				best = int(i);
+		}
+		if (best < 0)
+			return 0;
+
+		Block b = blocks_[best];
+		uint32_t start = (b.addr + align - 1) & ~(align - 1);
+		uint32_t pad = start - b.addr;
+		uint32_t tail = b.size - pad - size;
+		if (nblocks_ + (pad ? 1 : 0) + (tail ? 1 : 0) > kMaxBlocks)
+			return 0; // out of metadata: refuse rather than lose track of space
+
+		uint32_t i = uint32_t(best);
+		if (pad) {
+			blocks_[i].size = pad;
+			insert(++i, Block{start, size, true});
+		} else
+			blocks_[i] = Block{start, size, true};
+		if (tail)
+			insert(i + 1, Block{start + size, tail, false});
+
+		take(size);
+		return start;
+	}
+
+	// Free block i and merge it with free neighbours.
+	void free_large(uint32_t i)
+	{
+		reserved_ -= blocks_[i].size;
+		blocks_[i].used = false;
+		if (i + 1 < nblocks_ && !blocks_[i + 1].used) {
+			blocks_[i].size += blocks_[i + 1].size;
+			erase(i + 1);
+		}
+		if (i > 0 && !blocks_[i - 1].used) {
+			blocks_[i - 1].size += blocks_[i].size;
+			erase(i);
+		}
+	}
+
+	// Binary search for the block starting exactly at `addr`; -1 if none.
+	int find_block(uint32_t addr) const
+	{
+		uint32_t lo = 0, hi = nblocks_;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			if (blocks_[mid].addr < addr)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo < nblocks_ && blocks_[lo].addr == addr ? int(lo) : -1;
+	}
+
+	void insert(uint32_t at, Block b)
+	{
+		for (uint32_t j = nblocks_; j > at; j--)
+			blocks_[j] = blocks_[j - 1];
+		blocks_[at] = b;
+		nblocks_++;
+	}
+
+	void erase(uint32_t at)
+	{
+		for (uint32_t j = at; j + 1 < nblocks_; j++)
+			blocks_[j] = blocks_[j + 1];
+		nblocks_--;
+	}
+
+	uint32_t base_ = 0;
+	uint32_t size_ = 0;
+	uint32_t nblocks_ = 0;
+	std::array<Block, kMaxBlocks> blocks_{};
+	std::array<Slab, kMaxSlabs> slabs_{};
+	std::array<uint16_t, kNumClasses> class_slabs_{};
+	uint32_t used_ = 0, reserved_ = 0, peak_ = 0, live_ = 0, failed_ = 0;
+};
+
+} // namespace etna
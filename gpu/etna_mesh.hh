@@ -0,0 +1,87 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// =============================================================================
+//  etna_mesh.hh -- indexed meshes: deduplicate an expanded vertex list
+// =============================================================================
+// A non-indexed draw fetches (and vertex-shades) every corner of every
+// triangle: the cube is 36 vertices of 28 bytes, although it only has 24
+// distinct ones (8 corners x 3 face colors; 8 with per-corner colors).
+// dedup_mesh() turns such an expanded list into unique vertices plus an index
+// list -- byte-identical vertices merge -- ready for MeshDraw::index:
+//
+//   static constexpr auto cube = dedup_mesh<7>(kCubeVerts); // 7 floats/vertex
+//   copy cube.vertices (cube.vertex_bytes()) into the vertex Bo,
+//        cube.indices (cube.index_bytes()) into the index Bo;
+//   d.index = &ib; d.index_type = IndexType::U16; d.vertex_count = cube.index_count;
+//
+// constexpr, so a fixed mesh is built at compile time; at run time it is one
+// hash-table pass, with no allocation. Triangle order is kept, so the
+// rasterized result is the same as the expanded draw.
+
+namespace etna
+{
+
+template<uint32_t Stride, uint32_t N, typename Index = uint16_t>
+struct IndexedMesh {
+	static_assert(sizeof(Index) == 2 || sizeof(Index) == 4, "u16 or u32 indices");
+	static constexpr uint32_t index_count = N;
+
+	std::array<float, N * Stride> vertices{}; // the first vertex_count are used
+	std::array<Index, N> indices{};
+	uint32_t vertex_count = 0;
+
+	constexpr uint32_t vertex_bytes() const
+	{
+		return vertex_count * Stride * 4;
+	}
+	static constexpr uint32_t index_bytes()
+	{
+		return N * sizeof(Index);
+	}
+};
+
+// `expanded`: N vertices of `Stride` floats, three per triangle.
+template<uint32_t Stride, typename Index = uint16_t, size_t Len>
+constexpr IndexedMesh<Stride, Len / Stride, Index> dedup_mesh(const std::array<float, Len> &expanded)
+{
+	static_assert(Len % Stride == 0, "whole vertices");
+	constexpr uint32_t N = Len / Stride;
+	static_assert(N <= (sizeof(Index) == 2 ? 0x10000u : 0xFFFFFFFFu), "too many vertices for the index type");
+
+	// Open addressing over (at least) twice as many slots as vertices.
+	constexpr uint32_t kSlots = std::bit_ceil(2 * N);
+	std::array<uint32_t, kSlots> slot{}; // unique vertex + 1, 0 = empty
+
+	IndexedMesh<Stride, N, Index> m;
+	for (uint32_t v = 0; v < N; v++) {
+		const float *src = &expanded[v * Stride];
+		uint32_t h = 2166136261u; // FNV-1a over the bit patterns
+		for (uint32_t k = 0; k < Stride; k++)
+			h = (h ^ std::bit_cast<uint32_t>(src[k])) * 16777619u;
+
+		for (uint32_t i = h & (kSlots - 1);; i = (i + 1) & (kSlots - 1)) {
+			if (slot[i] == 0) {
+				for (uint32_t k = 0; k < Stride; k++)
+					m.vertices[m.vertex_count * Stride + k] = src[k];
+				slot[i] = ++m.vertex_count;
+				m.indices[v] = Index(m.vertex_count - 1);
+				break;
+			}
+			const float *u = &m.vertices[(slot[i] - 1) * Stride];
+			bool same = true;
+			for (uint32_t k = 0; k < Stride && same; k++)
+				same = std::bit_cast<uint32_t>(u[k]) == std::bit_cast<uint32_t>(src[k]);
+			if (same) {
+				m.indices[v] = Index(slot[i] - 1);
+				break;
+			}
+		}
+	}
+	return m;
+}
+
+} // namespace etna
@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdint>
+
+// =============================================================================
+//  etna_offload.hh -- CPU or GPU per call: the cost model
+// =============================================================================
+// A compute() call pays a fixed cost however small the image: recording the
+// dispatch, cleaning the inputs out of the D-cache, the FE round trip and the
+// interrupt, invalidating the output. After that the GPU is far cheaper per
+// byte than the CPU (test_image_blend: ~7x a scalar loop at 1 MB), but for a
+// few KB the fixed cost dominates and the CPU's NEON unit finishes first.
+// Which side wins depends on the op and the size, so it is measured rather
+// than picked by hand:
+//
+//   Each side's time for an op is a line, fixed + per_mb * MB. ppu_offload.cc
+//   times both sides at two sizes on target and fits the lines (fit()).
+//   use_gpu() compares them at the call's size; crossover() is the size
+//   where the answer changes, for printing.
+//
+// Until an op is calibrated it goes to the GPU, as compute() would. So does
+// an op whose NEON version isn't known to match the GPU on every input
+// (cpu_exact()): the model picks a side for speed only, never for a
+// different result. Nothing here touches the hardware; tools/host_tests.cc
+// checks it.
+
+namespace etna
+{
+
+// The ppu_asm.hh kernels Offload (ppu_offload.hh) runs on either side.
+enum class OffloadOp : uint8_t {
+	Copy,
+	Add,
+	AddSat,
+	Not,
+	AndImm,
+	Add2,
+	AddSat2,
+	Mul2,
+	MulHi2,
+	BlendLerp,
+	Dp2x8,
+};
+inline constexpr uint32_t kOffloadOps = 11;
+
+// The NEON version gives the GPU's result on any input. dp2x8's "2*in^2"
+// (neon_kernels.hh) is only confirmed on the constant images the flop reset
+// feeds it, so it stays on the GPU until it is checked on general input.
+constexpr bool cpu_exact(OffloadOp op)
+{
+	return op != OffloadOp::Dp2x8;
+}
+
+// Input images the op reads.
+constexpr uint32_t offload_inputs(OffloadOp op)
+{
+	return op == OffloadOp::BlendLerp ? 3 : op >= OffloadOp::Add2 && op <= OffloadOp::MulHi2 ? 2 : 1;
+}
+
+// Ticks as a line in the image size.
+struct LinearCost {
+	uint32_t fixed = 0;	 // ticks
+	uint32_t per_mb = 0; // ticks per MB (2^20 bytes)
+
+	constexpr uint64_t at(uint32_t bytes) const
+	{
+		return fixed + ((uint64_t(per_mb) * bytes) >> 20);
+	}
+
+	// The line through two timings, bytes0 < bytes1. Timing noise can put
+	// the points the wrong way round: the slope and the intercept then clamp
+	// at 0 rather than go negative.
+	static constexpr LinearCost fit(uint32_t bytes0, uint64_t ticks0, uint32_t bytes1, uint64_t ticks1)
+	{
+		if (bytes1 <= bytes0)
+			return {uint32_t(ticks0 < ticks1 ? ticks0 : ticks1), 0};
+		const uint64_t slope = ticks1 > ticks0 ? ((ticks1 - ticks0) << 20) / (bytes1 - bytes0) : 0;
+		const uint64_t below = (slope * bytes0) >> 20;
+		const uint64_t fixed = ticks0 > below ? ticks0 - below : 0;
+		return {uint32_t(fixed > ~0u ? ~0u : fixed), uint32_t(slope > ~0u ? ~0u : slope)};
+	}
+};
+
+class OffloadModel {
+public:
+	struct Entry {
+		LinearCost cpu, gpu;
+		bool calibrated = false;
+	};
+
+	void set(OffloadOp op, LinearCost cpu, LinearCost gpu)
+	{
+		ops_[unsigned(op)] = Entry{cpu, gpu, true};
+	}
+	const Entry &operator[](OffloadOp op) const
+	{
+		return ops_[unsigned(op)];
+	}
+
+	// Run `op` over `bytes` on the GPU? Ties go to the GPU: it leaves the CPU
+	// free. Always, for an op that isn't cpu_exact().
+	bool use_gpu(OffloadOp op, uint32_t bytes) const
+	{
+		const Entry &e = ops_[unsigned(op)];
+		return !cpu_exact(op) || !e.calibrated || e.gpu.at(bytes) <= e.cpu.at(bytes);
+	}
+
+	// The size where use_gpu() changes its answer for `op`: 0 if it is the
+	// GPU at every size, ~0u if the CPU. The lines cross once at most, so
+	// below it the answer is use_gpu(op, 0) and from it on the other side
+	// (to a tick of rounding either way). Normally the CPU takes the small
+	// images; the GPU only does if its line starts lower and climbs faster.
+	uint32_t crossover(OffloadOp op) const
+	{
+		const bool small = use_gpu(op, 0);
+		if (use_gpu(op, ~0u) == small)
+			return small ? 0 : ~0u;
+		uint32_t lo = 0, hi = ~0u; // small's side at lo, the other at hi
+		while (hi - lo > 1) {
+			const uint32_t mid = lo + (hi - lo) / 2;
+			(use_gpu(op, mid) == small ? lo : hi) = mid;
+		}
+		return hi;
+	}
+
+	void clear()
+	{
+		for (Entry &e : ops_)
+			e = Entry{};
+	}
+
+private:
+	Entry ops_[kOffloadOps] = {};
+};
+
+} // namespace etna
@@ -0,0 +1,114 @@
+#include "etna_profile.hh"
+#include "aarch64/system_reg.hh" // read_cntpct/read_cntfreq
+#include "gpu_io.hh"
+#include "perfmon.hh"
+#include "print/print.hh"
+
+// =============================================================================
+//  etna_profile.cc -- the profiler's hardware backend, and its report
+// =============================================================================
+// See etna_profile.hh.
+
+namespace etna
+{
+
+uint32_t HwProfileIo::read(uint32_t offset)
+{
+	return gpu_read(offset);
+}
+
+void HwProfileIo::write(uint32_t offset, uint32_t value)
+{
+	gpu_write(offset, value);
+}
+
+uint64_t HwProfileIo::now()
+{
+	return read_cntpct();
+}
+
+ProfileDdr HwProfileIo::ddr()
+{
+	const perfmon::DdrSample s = perfmon::ddr_read();
+	return {.reads = s.reads, .writes = s.writes, .tcnt = s.tcnt};
+}
+
+void HwProfileIo::ddr_start()
+{
+	perfmon::ddr_start();
+}
+
+const perfmon::DdrTap kGpuDdrTaps[2] = {
+	{"gpu rd", [] { return gpu_read(VivanteGpu::HI_PROFILE_READ_BYTES8); }, 8},
+	{"gpu wr", [] { return gpu_read(VivanteGpu::HI_PROFILE_WRITE_BYTES8); }, 8},
+};
+
+bool profile_submit(Gpu &gpu, GpuProfiler &prof, CmdStream &cs, const char *label, uint32_t timeout_us)
+{
+	const uint64_t hz = read_cntfreq();
+	const uint64_t deadline = read_cntpct() + uint64_t(timeout_us) * hz / 1'000'000;
+	prof.begin(label);
+	const Fence f = gpu.submit(cs);
+	bool done = false;
+	// One without an event of its own only completes through wait()'s marker.
+	if (f.event_id != RingTracker::kNoEvent)
+		while (!(done = gpu.is_complete(f)) && read_cntpct() < deadline)
+			prof.poll();
+	if (f && !done) {
+		const uint64_t now = read_cntpct();
+		done = gpu.wait(f, now < deadline ? uint32_t((deadline - now) * 1'000'000 / hz) : 0);
+	}
+	prof.end();
+	return done;
+}
+
+namespace
+{
+
+// A count in at most 6 digits: 123456, 1234k, 1234M.
+void print_count(uint64_t v)
+{
+	if (v < 1'000'000)
+		print(int(v));
+	else if (v < 1'000'000'000)
+		print(int(v / 1000), "k");
+	else
+		print(int(v / 1'000'000), "M");
+}
+
+} // namespace
+
+void profile_report(const GpuProfiler &prof, const char *title)
+{
+	const uint64_t hz = read_cntfreq();
+	print("profile ", title, ": per run");
+	if (!prof.available())
+		print(" (GPU counters unavailable: HI_TOTAL_CYCLES does not advance)");
+	print("\n");
+	for (const ProfileRange &r : prof.ranges()) {
+		if (!r.runs)
+			continue;
+		print("  ", r.label, " x", int(r.runs), ": ", int(r.ticks * 1'000'000 / hz / r.runs), " us");
+		if (r.polls) {
+			print(", busy");
+			for (uint32_t u = 0; u < kNumGpuUnits; u++)
+				print(" ", kGpuUnits[u].name, " ", int(r.busy_pct(u)), "%");
+			print(" (", int(r.polls), " polls)");
+		}
+		print("\n    DDR read ", int(r.ddr_reads * perfmon::BYTES_PER_EVENT / 1024 / r.runs), " KB, write ",
+			  int(r.ddr_writes * perfmon::BYTES_PER_EVENT / 1024 / r.runs), " KB");
+		if (r.ddr_tcnt)
+			print(", busy ", int((r.ddr_reads + r.ddr_writes) * 100 / r.ddr_tcnt), "%");
+		print("\n");
+		if (!prof.available())
+			continue;
+		const auto ids = prof.counters();
+		for (uint32_t i = 0; i < ids.size(); i++) {
+			print(i % 4 ? "  " : "    ", kGpuCounters[ids[i]].name, " ");
+			print_count(r.counters[i] / r.runs);
+			print(i % 4 == 3 || i + 1 == ids.size() ? "\n" : "");
+		}
+	}
+}
+
+} // namespace etna
@@ -0,0 +1,422 @@
+#pragma once
+#include "etna.hh"
+#include "gpu_regs.hh"
+#include "perfmon.hh"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <string_view>
+
+// =============================================================================
+//  etna_profile.hh -- GPU profile counters and per-unit busy time
+// =============================================================================
+// perfmon.hh sees the DDR side only. This reads the core's own profile
+// counters (gpu_regs.hh) -- cycles, shader instructions, pixels, quads,
+// texels, bytes -- around each submission or around ranges the caller marks,
+// and while a submission runs polls HI_IDLE_STATE to tell which units (FE,
+// PE, SH, PA, SE, RA, TX) were busy. DDRPERFM's read/write commands are
+// sampled at the same points, so a range's GPU work and its DDR traffic are
+// reported side by side.
+//
+// As in etnaviv's perfmon (etnaviv_perfmon.c), a counter is a register to
+// read, plus for the per-unit ones a select written into the unit's field of
+// MC_PROFILE_CONFIGn first. The counters are free-running 32-bit: a range
+// adds up wrapping deltas, so only a range longer than 2^32 of something
+// (5 s of cycles at 800 MHz) reads short.
+//
+//   etna::GpuProfiler prof;
+//   prof.start();                                    // debug registers on, DDRPERFM started
+//   for (each frame) {
+//       prof.begin("frame");
+//       etna::profile_submit(gpu, prof, cs, "draw"); // its own range, polls HI_IDLE_STATE
+//       ...
+//       prof.end();
+//   }
+//   etna::profile_report(prof, "cube");              // per-run averages of each range
+//   prof.stop();
+//
+// Everything touches the hardware through an `Io` backend:
+//
+//   uint32_t read(uint32_t offset); void write(uint32_t offset, uint32_t v);
+//   uint64_t now();                 a timer, in ticks
+//   ProfileDdr ddr(); void ddr_start();   DDRPERFM's counters, starting them
+//
+// so the counter map and the accumulation run against a mock register file
+// on the host (tools/host_tests.cc). The target's backend and the printing
+// are in etna_profile.cc.
+
+namespace etna
+{
+
+// A profile counter: read `reg`, after writing `select` into `config`
+// unless `config` is 0 (a register of its own).
+struct GpuCounter {
+	const char *name;
+	uint32_t reg;
+	uint32_t config;
+	uint32_t select;
+};
+
+// The counters etnaviv exposes for the 3D core (doms_3d in
+// etnaviv_perfmon.c), by unit. The per-pixel-pipe selection of the PE
+// counters (HI_CLOCK_CONTROL.DEBUG_PIXEL_PIPE) is left alone: one pipe here.
+inline constexpr auto kGpuCounters = [] {
+	using namespace VivanteGpu;
+	return std::to_array<GpuCounter>({
+		{"HI.TOTAL_CYCLES", HI_TOTAL_CYCLES, 0, 0},
+		{"HI.IDLE_CYCLES", HI_TOTAL_IDLE_CYCLES, 0, 0},
+		{"HI.READ_BYTES8", HI_PROFILE_READ_BYTES8, 0, 0},
+		{"HI.WRITE_BYTES8", HI_PROFILE_WRITE_BYTES8, 0, 0},
+		{"HI.AXI_READ_STALLED", MC_PROFILE_HI_READ, MC_PROFILE_CONFIG2, PROFILE_HI(0)},
+		{"HI.AXI_WRITE_STALLED", MC_PROFILE_HI_READ, MC_PROFILE_CONFIG2, PROFILE_HI(1)},
+		{"HI.AXI_WRITE_DATA_STALLED", MC_PROFILE_HI_READ, MC_PROFILE_CONFIG2, PROFILE_HI(2)},
+		{"PE.KILLED_BY_COLOR", MC_PROFILE_PE_READ, MC_PROFILE_CONFIG0, PROFILE_PE(0)},
+		{"PE.KILLED_BY_DEPTH", MC_PROFILE_PE_READ, MC_PROFILE_CONFIG0, PROFILE_PE(1)},
+		{"PE.DRAWN_BY_COLOR", MC_PROFILE_PE_READ, MC_PROFILE_CONFIG0, PROFILE_PE(2)},
+		{"PE.DRAWN_BY_DEPTH", MC_PROFILE_PE_READ, MC_PROFILE_CONFIG0, PROFILE_PE(3)},
+		{"SH.SHADER_CYCLES", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(4)},
+		{"SH.PS_INST", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(7)},
+		{"SH.RENDERED_PIXELS", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(8)},
+		{"SH.VS_INST", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(9)},
+		{"SH.RENDERED_VERTICES", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(10)},
+		{"SH.VTX_BRANCH", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(11)},
+		{"SH.VTX_TEXLD", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(12)},
+		{"SH.PXL_BRANCH", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(13)},
+		{"SH.PXL_TEXLD", MC_PROFILE_SH_READ, MC_PROFILE_CONFIG0, PROFILE_SH(14)},
+		{"PA.INPUT_VTX", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(3)},
+		{"PA.INPUT_PRIM", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(4)},
+		{"PA.OUTPUT_PRIM", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(5)},
+		{"PA.DEPTH_CLIPPED", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(6)},
+		{"PA.TRIVIAL_REJECTED", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(7)},
+		{"PA.CULLED", MC_PROFILE_PA_READ, MC_PROFILE_CONFIG1, PROFILE_PA(8)},
+		{"SE.CULLED_TRIANGLES", MC_PROFILE_SE_READ, MC_PROFILE_CONFIG1, PROFILE_SE(0)},
+		{"SE.CULLED_LINES", MC_PROFILE_SE_READ, MC_PROFILE_CONFIG1, PROFILE_SE(1)},
+		{"RA.VALID_PIXELS", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(0)},
+		{"RA.TOTAL_QUADS", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(1)},
+		{"RA.VALID_QUADS_AFTER_EARLY_Z", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(2)},
+		{"RA.TOTAL_PRIMITIVES", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(3)},
+		{"RA.PIPE_CACHE_MISS", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(9)},
+		{"RA.PREFETCH_CACHE_MISS", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(10)},
+		{"RA.CULLED_QUADS", MC_PROFILE_RA_READ, MC_PROFILE_CONFIG1, PROFILE_RA(11)},
+		{"TX.BILINEAR_REQUESTS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(0)},
+		{"TX.TRILINEAR_REQUESTS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(1)},
+		{"TX.DISCARDED_REQUESTS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(2)},
+		{"TX.TOTAL_REQUESTS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(3)},
+		{"TX.MEM_READ_COUNT", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(5)},
+		{"TX.MEM_READ_IN_8B", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(6)},
+		{"TX.CACHE_MISS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(7)},
+		{"TX.CACHE_HIT_TEXELS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(8)},
+		{"TX.CACHE_MISS_TEXELS", MC_PROFILE_TX_READ, MC_PROFILE_CONFIG1, PROFILE_TX(9)},
+		{"MC.READ_REQ_8B_PIPELINE", MC_PROFILE_MC_READ, MC_PROFILE_CONFIG2, PROFILE_MC(1)},
+		{"MC.READ_REQ_8B_IP", MC_PROFILE_MC_READ, MC_PROFILE_CONFIG2, PROFILE_MC(2)},
+		{"MC.WRITE_REQ_8B_PIPELINE", MC_PROFILE_MC_READ, MC_PROFILE_CONFIG2, PROFILE_MC(3)},
+	});
+}();
+
+inline constexpr uint32_t kNoCounter = ~0u;
+
+// Index of the counter called `name` in kGpuCounters, or kNoCounter.
+constexpr uint32_t find_gpu_counter(std::string_view name)
+{
+	for (uint32_t i = 0; i < std::size(kGpuCounters); i++)
+		if (name == kGpuCounters[i].name)
+			return i;
+	return kNoCounter;
+}
+
+// The units whose busy time the profiler samples, by HI_IDLE_STATE bit.
+// The FE is never idle here: it spins on the ring's WAIT/LINK between
+// submissions (etna.hh), so it reads 100% busy whatever the load.
+struct GpuUnit {
+	const char *name;
+	uint32_t idle_bit;
+};
+
+inline constexpr GpuUnit kGpuUnits[] = {
+	{"FE", VivanteGpu::IDLE_FE},
+	{"PE", VivanteGpu::IDLE_PE},
+	{"SH", VivanteGpu::IDLE_SH},
+	{"PA", VivanteGpu::IDLE_PA},
+	{"SE", VivanteGpu::IDLE_SE},
+	{"RA", VivanteGpu::IDLE_RA},
+	{"TX", VivanteGpu::IDLE_TX},
+};
+inline constexpr uint32_t kNumGpuUnits = std::size(kGpuUnits);
+
+// DDRPERFM's BL8 read and write commands and its time counter, as an Io
+// backend samples them (perfmon::ddr_read() on the target).
+struct ProfileDdr {
+	uint32_t reads = 0;
+	uint32_t writes = 0;
+	uint32_t tcnt = 0;
+};
+
+inline constexpr uint32_t kMaxProfileCounters = 16;
+
+// Everything measured inside one label's ranges, summed over its runs.
+struct ProfileRange {
+	const char *label = nullptr;
+	uint32_t runs = 0;	// begin()/end() pairs completed
+	uint64_t ticks = 0; // Io::now() ticks inside them
+	uint64_t counters[kMaxProfileCounters] = {}; // by position in Profiler::counters()
+	uint32_t polls = 0;							 // HI_IDLE_STATE samples inside them
+	uint32_t busy[kNumGpuUnits] = {};			 // of which the unit was busy, by kGpuUnits
+	uint64_t ddr_reads = 0;						 // BL8 commands
+	uint64_t ddr_writes = 0;
+	uint64_t ddr_tcnt = 0;
+
+	// Percentage of the polls that found kGpuUnits[unit] busy.
+	uint32_t busy_pct(uint32_t unit) const
+	{
+		return polls ? uint32_t(uint64_t(busy[unit]) * 100 / polls) : 0;
+	}
+};
+
+template<typename Io>
+class Profiler {
+public:
+	static constexpr uint32_t kMaxRanges = 16; // distinct labels
+	static constexpr uint32_t kMaxDepth = 4;   // ranges open at once
+
+	// The default counters: where the cycles go, what the shader and the
+	// pixel pipe did, and the bytes moved.
+	static constexpr const char *kDefaultCounters[] = {
+		"HI.TOTAL_CYCLES",
+		"HI.IDLE_CYCLES",
+		"HI.READ_BYTES8",
+		"HI.WRITE_BYTES8",
+		"SH.SHADER_CYCLES",
+		"SH.VS_INST",
+		"SH.PS_INST",
+		"SH.RENDERED_PIXELS",
+		"PA.INPUT_PRIM",
+		"PA.CULLED",
+		"RA.VALID_PIXELS",
+		"RA.TOTAL_QUADS",
+		"PE.DRAWN_BY_COLOR",
+		"PE.KILLED_BY_DEPTH",
+		"TX.TOTAL_REQUESTS",
+		"TX.CACHE_MISS",
+	};
+
+	explicit Profiler(Io io = {})
+		: io_{io}
+	{
+		select(kDefaultCounters);
+	}
+
+	// Count `names` (kGpuCounters) from now on. False, changing nothing, if
+	// one is unknown or there are more than kMaxProfileCounters. Forgets the
+	// ranges measured so far: their counters were different ones. Not while
+	// a range is open.
+	bool select(std::span<const char *const> names)
+	{
+		if (names.size() > kMaxProfileCounters || depth_)
+			return false;
+		uint32_t ids[kMaxProfileCounters];
+		for (uint32_t i = 0; i < names.size(); i++)
+			if ((ids[i] = find_gpu_counter(names[i])) == kNoCounter)
+				return false;
+		std::copy_n(ids, names.size(), ids_);
+		num_ids_ = uint32_t(names.size());
+		reset();
+		return true;
+	}
+
+	// The selected counters, as indices into kGpuCounters.
+	std::span<const uint32_t> counters() const
+	{
+		return {ids_, num_ids_};
+	}
+
+	// Enable the debug registers and start DDRPERFM. Returns (and
+	// available() answers) whether the counters are live: a core that keeps
+	// them gated reads HI_TOTAL_CYCLES stuck, and then only the busy polls
+	// and the DDR side mean anything.
+	bool start()
+	{
+		using namespace VivanteGpu;
+		if (!started_) {
+			clock_control_ = io_.read(HI_CLOCK_CONTROL);
+			io_.write(HI_CLOCK_CONTROL, clock_control_ & ~CLK_DISABLE_DEBUG_REGISTERS);
+			io_.ddr_start();
+			started_ = true;
+		}
+		const uint32_t c0 = io_.read(HI_TOTAL_CYCLES);
+		available_ = false;
+		for (uint32_t i = 0; i < 16 && !available_; i++)
+			available_ = io_.read(HI_TOTAL_CYCLES) != c0;
+		return available_;
+	}
+
+	// Put DISABLE_DEBUG_REGISTERS back as start() found it.
+	void stop()
+	{
+		using namespace VivanteGpu;
+		if (started_)
+			io_.write(HI_CLOCK_CONTROL, (io_.read(HI_CLOCK_CONTROL) & ~CLK_DISABLE_DEBUG_REGISTERS) |
+											(clock_control_ & CLK_DISABLE_DEBUG_REGISTERS));
+		started_ = false;
+	}
+
+	bool available() const
+	{
+		return available_;
+	}
+
+	// Open a range: what happens until the matching end() is added to the
+	// label's totals. Ranges nest (a frame around its submissions), up to
+	// kMaxDepth; deeper ones, and labels beyond kMaxRanges, go uncounted
+	// but still pair with their end().
+	void begin(const char *label)
+	{
+		if (depth_++ >= kMaxDepth)
+			return;
+		Open &o = open_[depth_ - 1];
+		o.range = find_range(label);
+		o.t0 = io_.now();
+		o.ddr0 = io_.ddr();
+		read_counters(o.c0);
+	}
+
+	// Close the innermost open range.
+	void end()
+	{
+		if (!depth_ || depth_-- > kMaxDepth)
+			return;
+		const Open &o = open_[depth_];
+		uint32_t c[kMaxProfileCounters];
+		read_counters(c);
+		const ProfileDdr ddr = io_.ddr();
+		const uint64_t t = io_.now();
+		if (o.range == kNoRange)
+			return;
+		ProfileRange &r = ranges_[o.range];
+		r.runs++;
+		r.ticks += t - o.t0;
+		for (uint32_t i = 0; i < num_ids_; i++)
+			r.counters[i] += uint32_t(c[i] - o.c0[i]);
+		r.ddr_reads += uint32_t(ddr.reads - o.ddr0.reads);
+		r.ddr_writes += uint32_t(ddr.writes - o.ddr0.writes);
+		r.ddr_tcnt += uint32_t(ddr.tcnt - o.ddr0.tcnt);
+	}
+
+	// Sample HI_IDLE_STATE once, for every open range. Call it while the
+	// GPU works (profile_submit() does, until the submission completes).
+	void poll()
+	{
+		const uint32_t idle = io_.read(VivanteGpu::HI_IDLE_STATE);
+		for (uint32_t d = 0; d < std::min(depth_, kMaxDepth); d++) {
+			if (open_[d].range == kNoRange)
+				continue;
+			ProfileRange &r = ranges_[open_[d].range];
+			r.polls++;
+			for (uint32_t u = 0; u < kNumGpuUnits; u++)
+				r.busy[u] += !(idle & kGpuUnits[u].idle_bit);
+		}
+	}
+
+	// One entry per label, in the order they were first begun.
+	std::span<const ProfileRange> ranges() const
+	{
+		return {ranges_, num_ranges_};
+	}
+
+	const ProfileRange *range(std::string_view label) const
+	{
+		for (uint32_t i = 0; i < num_ranges_; i++)
+			if (label == ranges_[i].label)
+				return &ranges_[i];
+		return nullptr;
+	}
+
+	// Forget the totals (ranges still open keep counting, from zero).
+	void reset()
+	{
+		for (uint32_t d = 0; d < std::min(depth_, kMaxDepth); d++)
+			open_[d].range = kNoRange;
+		num_ranges_ = 0;
+	}
+
+	Io &io()
+	{
+		return io_;
+	}
+
+private:
+	static constexpr uint32_t kNoRange = ~0u;
+
+	struct Open {
+		uint32_t range;
+		uint64_t t0;
+		ProfileDdr ddr0;
+		uint32_t c0[kMaxProfileCounters];
+	};
+
+	void read_counters(uint32_t *out)
+	{
+		for (uint32_t i = 0; i < num_ids_; i++) {
+			const GpuCounter &c = kGpuCounters[ids_[i]];
+			if (c.config)
+				io_.write(c.config, c.select);
+			out[i] = io_.read(c.reg);
+		}
+	}
+
+	uint32_t find_range(const char *label)
+	{
+		for (uint32_t i = 0; i < num_ranges_; i++)
+			if (std::string_view{label} == ranges_[i].label)
+				return i;
+		if (num_ranges_ == kMaxRanges)
+			return kNoRange;
+		ranges_[num_ranges_] = ProfileRange{.label = label};
+		return num_ranges_++;
+	}
+
+	Io io_;
+	uint32_t ids_[kMaxProfileCounters] = {};
+	uint32_t num_ids_ = 0;
+	ProfileRange ranges_[kMaxRanges];
+	uint32_t num_ranges_ = 0;
+	Open open_[kMaxDepth] = {};
+	uint32_t depth_ = 0;
+	uint32_t clock_control_ = 0;
+	bool started_ = false;
+	bool available_ = false;
+};
+
+// -----------------------------------------------------------------------------
+//  On the target (etna_profile.cc)
+// -----------------------------------------------------------------------------
+
+// The GPU's registers (gpu_io.hh), the CPU's counter (read_cntpct()) and
+// DDRPERFM (perfmon.hh, which ddr_init() must have set up).
+struct HwProfileIo {
+	uint32_t read(uint32_t offset);
+	void write(uint32_t offset, uint32_t value);
+	uint64_t now();
+	ProfileDdr ddr();
+	void ddr_start();
+};
+
+using GpuProfiler = Profiler<HwProfileIo>;
+
+// Submit `cs` as a range called `label` and poll HI_IDLE_STATE until it
+// completes. For profiling only: the CPU spins instead of sleeping in
+// wait(), and nothing else is in flight to blur the busy time. False on
+// timeout.
+bool profile_submit(Gpu &gpu, GpuProfiler &prof, CmdStream &cs, const char *label, uint32_t timeout_us = 1'000'000);
+
+// Print each range per run: time, busy % per unit, DDR traffic, then the
+// counters (omitted if !prof.available()).
+void profile_report(const GpuProfiler &prof, const char *title);
+
+// The GPU's bus reads and writes (HI_PROFILE_*_BYTES8) as perfmon taps, to
+// tell its share of a DDR trace from the CPU's and the LTDC's. They only
+// count while a GpuProfiler is started (the debug registers are on).
+extern const perfmon::DdrTap kGpuDdrTaps[2];
+
+} // namespace etna
@@ -0,0 +1,340 @@
+#pragma once
+#include "gpu_regs.hh"
+#include <array>
+#include <cstdint>
+
+// =============================================================================
+//  etna_ring.hh -- bookkeeping for the FE command ring (space + event slots)
+// =============================================================================
+// Gpu::submit() appends blocks to a circular WAIT/LINK ring the FE runs
+// forever. This class decides WHERE a block may go and WHICH completion event
+// it carries, and learns from fired events how far the FE has got -- without
+// touching the ring memory or any register, so the wrap/overflow logic is
+// host-testable against a simulated GPU (see tools/host_tests.cc).
+//
+//  RING LAYOUT (dwords)
+//     [0..3]        home WAIT/LINK (permanent; the FE idles here after init)
+//     [4..size)     blocks: op commands, [EVENT], WAIT, LINK
+//  Every block ends in a WAIT/LINK pair (its last 4 dwords) that the FE idles
+//  on until the next block is patched in. Blocks are contiguous; one that
+//  does not fit before the end wraps back to dword 4.
+//
+//  WHAT THE CPU KNOWS ABOUT THE FE
+//  A block's EVENT is raised FROM_PE, so when it fires the FE has long since
+//  consumed everything before it. Retiring block i therefore frees the ring
+//  up to its trailing WAIT/LINK -- which stays reserved (the FE may still be
+//  parked on it, or about to take its LINK) until a LATER block retires. The
+//  busy span is [busy_start, head), circular; head != busy_start always.
+//
+//  EVENT SLOTS
+//  HI_INTR_ACKNOWLEDGE has 30 event bits (0..29; 30/31 are MMU/AXI errors).
+//  A block takes a free id; the id returns to the pool when the block retires.
+//  The FE is in-order, so one fired id retires every older block too -- which
+//  is what lets a block go out with NO event when all 30 are in flight:
+//  its completion is implied by the next evented block. If nothing evented
+//  follows it, the waiter appends a 6-dword marker (EVENT + WAIT + LINK); the
+//  space for one is always held back, so a marker can never find the ring
+//  full.
+//
+//  Ids lent out with take_event() are not in the pool; with fewer left, more
+//  blocks go out without one.
+//
+//  Fences are plain sequence numbers against this completion timeline, so a
+//  fence stays valid after its event id has been recycled.
+//
+//  RING WORDS
+//  The free functions at the bottom write the words themselves (trailer, the
+//  WAIT->LINK divert), over any memory + barrier, so the exact sequences the
+//  GPU sees are host-checked too. Two ways to submit a stream:
+//   - copy: the block is [ops..., EVENT, WAIT, LINK] in the ring.
+//   - link: the block is only [EVENT, WAIT, LINK]; the old tail LINKs straight
+//     into the stream's own Bo, which ends with return_link() back to it.
+
+namespace etna
+{
+
+class RingTracker {
+public:
+	static constexpr uint32_t kNumEvents = 30;
+	static constexpr uint32_t kNoEvent = 0xFF;
+	static constexpr uint32_t kFull = 0xFFFFFFFF;
+	static constexpr uint32_t kHomeDwords = 4;	  // WAIT, pad, LINK, addr
+	static constexpr uint32_t kIdleDwords = 4;	  // every block's trailing WAIT/LINK
+	static constexpr uint32_t kEventDwords = 2;	  // LOAD_STATE(GL_EVENT) + value
+	static constexpr uint32_t kMarkerDwords = kEventDwords + kIdleDwords;
+	static constexpr uint32_t kMaxPending = 256; // in-flight blocks tracked
+
+	// Where a block goes. `dwords` includes the trailer; `event_id` may be kNoEvent.
+	struct Slot {
+		uint32_t start = kFull;
+		uint32_t dwords = 0;
+		uint32_t event_id = kNoEvent;
+		explicit operator bool() const
+		{
+			return start != kFull;
+		}
+	};
+
+	void init(uint32_t ring_dwords)
+	{
+		size_ = ring_dwords;
+		head_ = kHomeDwords;
+		busy_start_ = 0; // the FE idles on the home WAIT
+		tail_ = 0;
+		events_free_ = (1u << kNumEvents) - 1;
+		npending_ = first_ = 0;
+		submitted_ = completed_ = 0;
+	}
+
+	// Plan a block carrying `op_dwords` (even) of commands. Takes an event id
+	// if one is free. Returns a null Slot if the ring (or the pending table)
+	// is full -- retire() something and retry.
+	Slot place(uint32_t op_dwords) const
+	{
+		uint32_t ev = events_free_ ? uint32_t(__builtin_ctz(events_free_)) : kNoEvent;
+		uint32_t dw = op_dwords + (ev != kNoEvent ? kEventDwords : 0) + kIdleDwords;
+		uint32_t start = find_space(dw + kMarkerDwords); // always leave room for a marker
+		if (start == kFull || npending_ + 2 > kMaxPending) // + 2: keep a pending entry for the marker too
+			return Slot{};
+		return Slot{start, dw, ev};
+	}
+
+	// Plan an empty evented block (the completion marker). Needs a free event.
+	Slot place_marker() const
+	{
+		if (!events_free_ || npending_ == kMaxPending)
+			return Slot{};
+		uint32_t start = find_space(kMarkerDwords);
+		if (start == kFull)
+			return Slot{};
+		return Slot{start, kMarkerDwords, uint32_t(__builtin_ctz(events_free_))};
+	}
+
+	// Lend a free event id to the caller for its own events (timestamps,
+	// etna_timeline.hh). No block carries it and retire() never matches it,
+	// until put_event() gives it back. kNoEvent if none is free.
+	uint32_t take_event()
+	{
+		if (!events_free_)
+			return kNoEvent;
+		const uint32_t ev = uint32_t(__builtin_ctz(events_free_));
+		events_free_ &= ~(1u << ev);
+		return ev;
+	}
+
+	// Return an id from take_event(), once no event with it is in flight.
+	void put_event(uint32_t ev)
+	{
+		if (ev < kNumEvents)
+			events_free_ |= 1u << ev;
+	}
+
+	// Record a placed block as submitted; returns its seqno (fence). The
+	// caller has written the block and patched the old tail WAIT (tail()
+	// BEFORE this call) into a LINK to slot.start.
+	uint32_t commit(const Slot &s)
+	{
+		if (s.event_id != kNoEvent)
+			events_free_ &= ~(1u << s.event_id);
+		pending_[(first_ + npending_) % kMaxPending] = Pending{uint16_t(s.start), uint16_t(s.dwords), uint8_t(s.event_id)};
+		npending_++;
+		head_ = s.start + s.dwords;
+		tail_ = head_ - kIdleDwords;
+		return ++submitted_;
+	}
+
+	// Feed fired HI_INTR_ACKNOWLEDGE event bits. Retires every pending block up
+	// to the newest one whose event fired (the FE is in-order). Returns the
+	// event bits that were consumed; bits for ids not in flight are ignored.
+	uint32_t retire(uint32_t fired)
+	{
+		fired &= ~events_free_ & ((1u << kNumEvents) - 1);
+		if (!fired)
+			return 0;
+		uint32_t last = kFull;
+		for (uint32_t i = 0; i < npending_; i++) {
+			uint32_t ev = at(i).event_id;
+			if (ev != kNoEvent && (fired & (1u << ev)))
+				last = i;
+		}
+		if (last == kFull) // only lent ids (take_event()) fired
+			return 0;
+		uint32_t consumed = 0;
+		for (uint32_t i = 0; i <= last; i++) {
+			const Pending &p = at(0);
+			if (p.event_id != kNoEvent) {
+				events_free_ |= 1u << p.event_id;
+				consumed |= 1u << p.event_id;
+			}
+			busy_start_ = p.start + p.dwords - kIdleDwords;
+			first_ = (first_ + 1) % kMaxPending;
+			npending_--;
+			completed_++;
+		}
+		return consumed;
+	}
+
+	bool is_complete(uint32_t seqno) const
+	{
+		return seqno <= completed_;
+	}
+
+	// True if `seqno` is pending and no evented block at or after it is in
+	// flight -- nothing will ever signal it, so the waiter must add a marker.
+	bool needs_marker(uint32_t seqno) const
+	{
+		if (is_complete(seqno) || seqno > submitted_)
+			return false;
+		for (uint32_t i = seqno - completed_ - 1; i < npending_; i++)
+			if (at(i).event_id != kNoEvent)
+				return false;
+		return true;
+	}
+
+	uint32_t tail() const
+	{
+		return tail_;
+	} // dword offset of the WAIT the FE idles on at the end of the ring
+	uint32_t head() const
+	{
+		return head_;
+	}
+	uint32_t submitted() const
+	{
+		return submitted_;
+	}
+	uint32_t completed() const
+	{
+		return completed_;
+	}
+	uint32_t pending() const
+	{
+		return npending_;
+	}
+	uint32_t events_in_flight() const
+	{
+		return uint32_t(__builtin_popcount(~events_free_ & ((1u << kNumEvents) - 1)));
+	}
+
+	// Dwords from busy_start to head (circular) -- the part the FE may still read.
+	uint32_t busy_dwords() const
+	{
+		return head_ > busy_start_ ? head_ - busy_start_ : size_ - busy_start_ + head_ - kHomeDwords;
+	}
+
+private:
+	struct Pending {
+		uint16_t start;
+		uint16_t dwords;
+		uint8_t event_id;
+	};
+
+	const Pending &at(uint32_t i) const
+	{
+		return pending_[(first_ + i) % kMaxPending];
+	}
+
+	// First offset with `n` free contiguous dwords after head (wrapping to the
+	// start of the block area), or kFull. Never lets head catch busy_start.
+	uint32_t find_space(uint32_t n) const
+	{
+		if (head_ > busy_start_) {
+			if (head_ + n <= size_)
+				return head_;
+			return kHomeDwords + n < busy_start_ ? kHomeDwords : kFull;
+		}
+		return head_ + n < busy_start_ ? head_ : kFull;
+	}
+
+	uint32_t size_ = 0;
+	uint32_t head_ = 0;		  // next free dword
+	uint32_t busy_start_ = 0; // oldest dword the FE may still read
+	uint32_t tail_ = 0;		  // idle WAIT of the newest block
+	uint32_t events_free_ = 0;
+	std::array<Pending, kMaxPending> pending_{};
+	uint32_t npending_ = 0, first_ = 0;
+	uint32_t submitted_ = 0, completed_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+//  Ring words
+// -----------------------------------------------------------------------------
+// `ring` is the ring's dword array (volatile: the FE reads it concurrently),
+// `ring_base` its GPU address. `barrier` is a full memory barrier (dsb sy).
+
+// Write `slot`'s completion trailer at dword `at`: [EVENT(FROM_PE)], then the
+// idle WAIT/LINK that loops on itself until the next submission is patched in.
+inline void write_trailer(volatile uint32_t *ring, uint32_t ring_base, const RingTracker::Slot &slot, uint32_t at)
+{
+	using namespace VivanteGpu;
+	if (slot.event_id != RingTracker::kNoEvent) {
+		ring[at++] = cmd_load_state(GL_EVENT);
+		ring[at++] = slot.event_id | GL_EVENT_FROM_PE;
+	}
+	uint32_t wait = at;
+	ring[at++] = cmd_wait(200);
+	ring[at++] = 0; // pad
+	ring[at++] = cmd_link(2);
+	ring[at++] = ring_base + wait * 4; // link back to this WAIT (idle)
+}
+
+// Divert the FE: replace the idle WAIT at dword `tail` with a LINK to `target`.
+// Write the target first, barrier, then the LINK header -- so the FE (which
+// may fetch at any instant) never sees a LINK header pointing at a stale
+// address. (Mirrors etnaviv_buffer_replace_wait.)
+template<typename Barrier>
+void divert_wait(volatile uint32_t *ring, uint32_t tail, uint32_t target, uint32_t prefetch_qwords, Barrier barrier)
+{
+	ring[tail + 1] = target;
+	barrier();
+	ring[tail + 0] = VivanteGpu::cmd_link(prefetch_qwords);
+	barrier();
+}
+
+// Copy-submit: `ops` (even length) + trailer into the ring at `slot`, then
+// divert the FE from `tail` to it.
+template<typename Barrier>
+void write_copy_block(volatile uint32_t *ring,
+					  uint32_t ring_base,
+					  uint32_t tail,
+					  const RingTracker::Slot &slot,
+					  const uint32_t *ops,
+					  uint32_t op_dwords,
+					  Barrier barrier)
+{
+	uint32_t w = slot.start;
+	for (uint32_t i = 0; i < op_dwords; i++)
+		ring[w++] = ops[i];
+	write_trailer(ring, ring_base, slot, w);
+	barrier(); // the whole block is in memory before we divert the FE
+	divert_wait(ring, tail, ring_base + slot.start * 4, slot.dwords / 2, barrier);
+}
+
+// The two dwords a linked stream must end with: LINK back to its trailer in
+// the ring (a trailer-only slot from place(0)).
+struct ReturnLink {
+	uint32_t header, target;
+};
+inline ReturnLink return_link(uint32_t ring_base, const RingTracker::Slot &slot)
+{
+	return {VivanteGpu::cmd_link(slot.dwords / 2), ring_base + slot.start * 4};
+}
+
+// Link-submit: the stream at `stream_addr` (`stream_dwords` including its
+// return_link(), already visible to the GPU) runs in place. Only the trailer
+// goes into the ring; the FE is diverted straight into the stream.
+template<typename Barrier>
+void write_link_block(volatile uint32_t *ring,
+					  uint32_t ring_base,
+					  uint32_t tail,
+					  const RingTracker::Slot &slot,
+					  uint32_t stream_addr,
+					  uint32_t stream_dwords,
+					  Barrier barrier)
+{
+	write_trailer(ring, ring_base, slot, slot.start);
+	barrier();
+	divert_wait(ring, tail, stream_addr, stream_dwords / 2, barrier);
+}
+
+} // namespace etna
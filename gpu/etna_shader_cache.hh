@@ -0,0 +1,164 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+// =============================================================================
+//  etna_shader_cache.hh -- resident shader/kernel code, keyed by its words
+// =============================================================================
+// make_kernel() used to allocate a Bo and copy the instruction words in on
+// every call, and every 3D test uploaded its own copy of the same VS and PS.
+// The cache keeps one uploaded copy per distinct program and hands the same
+// address to everyone who asks for those words:
+//
+//   get(words) -> the resident copy's address, with a reference taken. A
+//                 miss uploads (through the backend) and records it.
+//   put(addr)  -> drops the reference. The code stays resident while idle,
+//                 so the next get() of the same words is a hit.
+//
+// Content-addressed: the key is an FNV-1a hash of the words plus their
+// length, and a hit is confirmed against the resident words (the backend's
+// matches()), so a hash collision is a miss, never wrong code.
+//
+// Eviction: with every slot taken, a miss evicts the least recently used idle
+// entry. Code that is still referenced is never evicted -- a Kernel or a
+// MeshDraw may point at it. If every entry is referenced the upload goes
+// ahead uncached and put() reports it for freeing. An upload that fails for
+// lack of memory evicts idle entries one at a time and retries.
+//
+// Like etna_heap.hh it is only bookkeeping over addresses, so it is
+// host-tested (tools/host_tests.cc). The backend does the memory work:
+//   uint32_t upload(span<const uint32_t> words)  -> address, 0 = no memory
+//   void     release(uint32_t addr)              -> free it
+//   bool     matches(uint32_t addr, span<const uint32_t> words)
+
+namespace etna
+{
+
+class ShaderCache {
+public:
+	static constexpr uint32_t kCapacity = 32;
+
+	struct Stats {
+		uint32_t hits = 0;
+		uint32_t misses = 0;	// uploads, cached or not
+		uint32_t evictions = 0; // idle entries dropped for room or memory
+		uint32_t uncached = 0;	// misses with every entry referenced
+		uint32_t resident = 0;	// entries now
+		uint32_t bytes = 0;		// their code size
+	};
+
+	// FNV-1a over the words.
+	static constexpr uint32_t hash(std::span<const uint32_t> words)
+	{
+		uint32_t h = 2166136261u;
+		for (uint32_t w : words)
+			for (unsigned i = 0; i < 4; i++) {
+				h ^= (w >> (i * 8)) & 0xFF;
+				h *= 16777619u;
+			}
+		return h;
+	}
+
+	// The address of a resident copy of `words`, with a reference taken; 0 if
+	// it could not be uploaded.
+	template<typename Backend>
+	uint32_t get(Backend &b, std::span<const uint32_t> words)
+	{
+		const uint32_t h = hash(words), n = uint32_t(words.size());
+		tick_++;
+		for (uint32_t i = 0; i < count_; i++) {
+			Entry &e = entries_[i];
+			if (e.hash == h && e.dwords == n && b.matches(e.addr, words)) {
+				e.refs++;
+				e.used = tick_;
+				stats_.hits++;
+				return e.addr;
+			}
+		}
+
+		stats_.misses++;
+		uint32_t addr = b.upload(words);
+		while (!addr && evict(b))
+			addr = b.upload(words);
+		if (!addr)
+			return 0;
+		if (count_ == kCapacity && !evict(b)) {
+			stats_.uncached++;
+			return addr;
+		}
+		entries_[count_++] = Entry{addr, h, n, 1, tick_};
+		return addr;
+	}
+
+	// Drop a reference. False if `addr` is not in the cache (an uncached
+	// upload): the caller frees it.
+	bool put(uint32_t addr)
+	{
+		for (uint32_t i = 0; i < count_; i++)
+			if (entries_[i].addr == addr) {
+				if (entries_[i].refs)
+					entries_[i].refs--;
+				return true;
+			}
+		return false;
+	}
+
+	// Release every idle entry; referenced ones stay.
+	template<typename Backend>
+	void trim(Backend &b)
+	{
+		while (evict(b)) {
+		}
+	}
+
+	Stats stats() const
+	{
+		Stats s = stats_;
+		s.resident = count_;
+		s.bytes = 0;
+		for (uint32_t i = 0; i < count_; i++)
+			s.bytes += entries_[i].dwords * 4;
+		return s;
+	}
+
+	// References held on `addr` (0 if idle or not cached).
+	uint32_t refs(uint32_t addr) const
+	{
+		for (uint32_t i = 0; i < count_; i++)
+			if (entries_[i].addr == addr)
+				return entries_[i].refs;
+		return 0;
+	}
+
+private:
+	struct Entry {
+		uint32_t addr = 0;
+		uint32_t hash = 0;
+		uint32_t dwords = 0;
+		uint32_t refs = 0;
+		uint32_t used = 0; // tick_ of the last get()
+	};
+
+	// Release the least recently used idle entry. False if there is none.
+	template<typename Backend>
+	bool evict(Backend &b)
+	{
+		uint32_t victim = count_;
+		for (uint32_t i = 0; i < count_; i++)
+			if (!entries_[i].refs && (victim == count_ || entries_[i].used < entries_[victim].used))
+				victim = i;
+		if (victim == count_)
+			return false;
+		b.release(entries_[victim].addr);
+		entries_[victim] = entries_[--count_];
+		stats_.evictions++;
+		return true;
+	}
+
+	Entry entries_[kCapacity];
+	uint32_t count_ = 0;
+	uint32_t tick_ = 0;
+	Stats stats_{};
+};
+
+} // namespace etna
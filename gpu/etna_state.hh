@@ -0,0 +1,197 @@
+#pragma once
+#include "etna.hh"
+#include "gpu_regs.hh"
+#include <array>
+#include <cstdint>
+
+// =============================================================================
+//  etna_state.hh -- shadow state: emit only changed registers, coalesced
+// =============================================================================
+// Mesa's etna_emit_state() writes only the state groups whose ETNA_DIRTY_*
+// bit is set, in address order, so that adjacent registers share one
+// LOAD_STATE header (etnaviv_emit.c, originally generated by
+// gen_merge_state.py; coalescing is etnaviv_coalesce.h). emit_mesh() does
+// neither: every draw re-emits ~110 registers, one header each. This is the
+// same idea keyed by register address instead of by state group:
+//
+//   - set() stages a value. If the stream already left the register at that
+//     value (the shadow), nothing is staged.
+//   - flush() writes the staged registers sorted by address, merging every
+//     run of consecutive addresses into one LOAD_STATE(count), then pads to
+//     a qword. Call it before anything whose order matters: a STALL, a
+//     cache flush, an event, a draw, a shader upload.
+//
+// Only for plain state, whose order within a flush doesn't matter (the same
+// assumption Mesa's sorted emit makes). Registers that act when written
+// (GL_FLUSH_CACHE, GL_SEMAPHORE_TOKEN, GL_EVENT, SH_ICACHE_CONTROL,
+// *_ICACHE_PREFETCH, RS_KICKER, ...) go straight into the stream.
+//
+// The shadow describes the GPU's state at the current end of the stream it
+// was built for, so its scope is one stream (or one fixed chain of bundles):
+// invalidate() it at the start of each, and after any emitter that writes
+// state behind its back (clear()/blit()/resolve(), compute dispatches).
+//
+// Hardware-independent; tested on the host against the uncached emitters.
+
+namespace etna
+{
+
+class StateTracker {
+public:
+	static constexpr uint32_t kMaxStates = 256; // table slots; up to 3/4 of them are used
+	static constexpr uint32_t kFixp = 0x04000000u; // LOAD_STATE header FIXP bit
+
+	struct Stats {
+		uint32_t staged = 0;  // set() calls
+		uint32_t skipped = 0; // ... whose value the register already held
+		uint32_t written = 0; // registers actually emitted
+		uint32_t headers = 0; // LOAD_STATE headers they needed
+	};
+
+	// Forget everything: the next flush() writes every register set().
+	void invalidate()
+	{
+		for (auto &e : entries_)
+			e.known = e.dirty = e.listed = false;
+		ndirty_ = 0;
+		program_valid_ = false;
+	}
+
+	// Stage `value` for the register at byte address `addr`; `fixp` = written
+	// with the FIXP header bit (16.16 data, converted by the FE). If the table
+	// is full the register is simply written through to `cs`, untracked.
+	void set(CmdStream &cs, uint32_t addr, uint32_t value, bool fixp = false)
+	{
+		stats_.staged++;
+		Entry *e = find(addr);
+		if (!e) {
+			cs.emit(VivanteGpu::cmd_load_state(addr) | (fixp ? kFixp : 0));
+			cs.emit(value);
+			stats_.written++;
+			stats_.headers++;
+			return;
+		}
+		if (e->known && e->value == value && e->fixp == fixp) {
+			e->dirty = false; // a staged change reverted before flush()
+			stats_.skipped++;
+			return;
+		}
+		e->pending = value;
+		e->pending_fixp = fixp;
+		if (!e->dirty) {
+			e->dirty = true;
+			if (!e->listed) {
+				e->listed = true;
+				dirty_[ndirty_++] = uint16_t(e - entries_.data());
+			}
+		}
+	}
+
+	// Write the staged registers: address-sorted, one header per run of
+	// consecutive addresses with the same FIXP flag. Returns dwords emitted.
+	uint32_t flush(CmdStream &cs)
+	{
+		// Insertion sort: a flush is at most a few dozen registers.
+		for (uint32_t i = 1; i < ndirty_; i++) {
+			uint16_t k = dirty_[i];
+			uint32_t j = i;
+			for (; j > 0 && entries_[dirty_[j - 1]].addr > entries_[k].addr; j--)
+				dirty_[j] = dirty_[j - 1];
+			dirty_[j] = k;
+		}
+
+		uint32_t start = cs.offset();
+		uint32_t i = 0;
+		while (i < ndirty_) {
+			Entry &first = entries_[dirty_[i]];
+			first.listed = false;
+			if (!first.dirty) {
+				i++;
+				continue;
+			}
+			// Extend the run while the next dirty register is adjacent.
+			uint32_t n = 1;
+			while (i + n < ndirty_ && n < 1024) {
+				const Entry &next = entries_[dirty_[i + n]];
+				if (!next.dirty || next.addr != first.addr + 4 * n || next.pending_fixp != first.pending_fixp)
+					break;
+				n++;
+			}
+			cs.emit(VivanteGpu::cmd_load_state(first.addr, n & 0x3FF) | (first.pending_fixp ? kFixp : 0));
+			for (uint32_t k = 0; k < n; k++) {
+				Entry &e = entries_[dirty_[i + k]];
+				cs.emit(e.pending);
+				e.value = e.pending;
+				e.fixp = e.pending_fixp;
+				e.known = true;
+				e.dirty = e.listed = false;
+			}
+			cs.align();
+			stats_.written += n;
+			stats_.headers++;
+			i += n;
+		}
+		ndirty_ = 0;
+		return cs.offset() - start;
+	}
+
+	// Shader programs are uploaded as a unit (ICACHE setup + prefetch), not as
+	// plain state: true -- and remembered -- if `key` (e.g. the VS/PS
+	// addresses and sizes) differs from the last program bound.
+	bool program_changed(const std::array<uint32_t, 4> &key)
+	{
+		if (program_valid_ && key == program_)
+			return false;
+		program_ = key;
+		program_valid_ = true;
+		return true;
+	}
+
+	const Stats &stats() const
+	{
+		return stats_;
+	}
+
+private:
+	struct Entry {
+		uint32_t addr = 0;
+		uint32_t value = 0;	  // what the stream leaves in the register (if known)
+		uint32_t pending = 0; // staged, not yet emitted (if dirty)
+		bool known = false, fixp = false;
+		bool dirty = false, pending_fixp = false;
+		bool listed = false; // in dirty_[] (a reverted entry stays listed)
+	};
+
+	// Open addressing on the register index; null when the table is full.
+	Entry *find(uint32_t addr)
+	{
+		uint32_t h = (addr >> 2) * 2654435761u;
+		for (uint32_t probe = 0; probe < kMaxStates; probe++) {
+			Entry &e = entries_[(h + probe) % kMaxStates];
+			if (used_[(h + probe) % kMaxStates]) {
+				if (e.addr == addr)
+					return &e;
+				continue;
+			}
+			if (nentries_ * 4 >= kMaxStates * 3)
+				return nullptr; // keep probes short: 75% load at most
+			used_[(h + probe) % kMaxStates] = true;
+			nentries_++;
+			e = Entry{};
+			e.addr = addr;
+			return &e;
+		}
+		return nullptr;
+	}
+
+	std::array<Entry, kMaxStates> entries_{};
+	std::array<bool, kMaxStates> used_{};
+	uint32_t nentries_ = 0;
+	std::array<uint16_t, kMaxStates> dirty_{};
+	uint32_t ndirty_ = 0;
+	std::array<uint32_t, 4> program_{};
+	bool program_valid_ = false;
+	Stats stats_{};
+};
+
+} // namespace etna
@@ -0,0 +1,171 @@
+#pragma once
+#include "etna.hh"
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+
+// =============================================================================
+//  etna_swapchain.hh -- N-buffered frame pacing: flip from vblank on the fence
+// =============================================================================
+// Waiting for each frame's fence before building the next one serializes the
+// CPU and the GPU: the CPU idles while the GPU renders, the GPU idles while
+// the CPU records, and a frame that misses the vblank by a little costs a
+// whole refresh. A Swapchain lets the CPU record frame N+1 while the GPU
+// renders N and the LTDC scans out N-1, and moves the flip to the vblank
+// interrupt, which latches a frame only once its fence has signalled:
+//
+//     main loop                                 vblank IRQ (ltdc_set_callback)
+//     i = sc.acquire();  (-1: all busy, WFE)    if (uint32_t a = sc.vblank(
+//     record into buffer i                              [&](Fence f) { return gpu.signaled(f); }))
+//     sc.present(i, gpu.submit_chain(...));         ltdc_set_framebuffer(a);
+//
+// Each buffer goes
+//
+//   Free -> Recording -> Queued -> Latching -> Scanning -> Free
+//        acquire()   present()  vblank():     next       vblank after
+//                               fence done    vblank     the next flip
+//
+// The LTDC LINE interrupt fires on the first blanking line, where the VBR
+// reload has just happened, so a flip armed in it (ltdc_set_framebuffer())
+// latches at the NEXT vblank, and the buffer it replaces is scanned out until
+// then. With 2 buffers that caps the rate at every other refresh (the CPU
+// gets its buffer back one vblank before the one it must flip at); with 3 a
+// new frame can go up at every vblank, the CPU recording one frame ahead.
+// Frames are shown in present() order (FIFO): none is ever skipped.
+//
+// Every vblank that arms no flip is a missed frame (the next refresh repeats
+// the current one), counted by cause: a frame was queued but the GPU hadn't
+// finished it, or nothing was queued (the CPU was still recording, or
+// waiting for a buffer). Counting starts at the first present().
+//
+// acquire()/present() run on the main code, vblank() in the LTDC interrupt;
+// each buffer's state is an atomic, and each side only makes the transitions
+// drawn above on its side of the diagram. Hardware-independent (the fence test
+// is passed in): tools/host_tests.cc runs it against a discrete-event model
+// of the panel, the CPU and the GPU.
+
+namespace etna
+{
+
+class Swapchain {
+public:
+	static constexpr uint32_t kMaxBuffers = 3;
+
+	struct Stats {
+		uint32_t presented = 0;	 // present() calls
+		uint32_t flips = 0;		 // flips armed: vblanks = flips + missed_*
+		uint32_t missed_gpu = 0; // vblanks that found the next frame still rendering
+		uint32_t missed_cpu = 0; // vblanks that found nothing queued
+		uint32_t vblanks = 0;	 // since the first present()
+	};
+
+	// `fb_addrs`: the buffers' scan-out addresses (2 or 3 of them). Buffer
+	// `scanning` is the one the LTDC shows now (ltdc_init()'s).
+	Swapchain(std::initializer_list<uint32_t> fb_addrs, uint32_t scanning = 0)
+	{
+		for (uint32_t a : fb_addrs)
+			if (n_ < kMaxBuffers)
+				buf_[n_++].addr = a;
+		if (scanning < n_)
+			buf_[scanning].state.store(Scanning, std::memory_order_relaxed);
+	}
+
+	uint32_t size() const
+	{
+		return n_;
+	}
+
+	// A buffer to record the next frame into, or -1 if every buffer is queued
+	// or on screen (a buffer frees up at a vblank: WFE and retry). The
+	// buffer's previous frame has been displayed, so its fence has signalled
+	// and anything that frame's commands used can be rewritten.
+	int acquire()
+	{
+		for (uint32_t i = 0; i < n_; i++) {
+			uint8_t s = Free;
+			if (buf_[i].state.compare_exchange_strong(s, Recording, std::memory_order_acquire))
+				return int(i);
+		}
+		return -1;
+	}
+
+	// Queue acquired buffer `i` for display once `f` signals.
+	void present(uint32_t i, Fence f)
+	{
+		if (i >= n_ || buf_[i].state.load(std::memory_order_relaxed) != Recording)
+			return;
+		buf_[i].fence = f;
+		buf_[i].order = presented_.load(std::memory_order_relaxed) + 1;
+		stats_.presented = buf_[i].order;
+		buf_[i].state.store(Queued, std::memory_order_release);
+		presented_.store(buf_[i].order, std::memory_order_relaxed);
+	}
+
+	// Call at every vblank. Retires the flip armed at the previous vblank,
+	// then arms the oldest queued frame if `signaled(fence)`. Returns the
+	// address to hand to ltdc_set_framebuffer(), or 0 for no flip (a missed
+	// frame: the next refresh repeats the current one).
+	template<typename Signaled>
+	uint32_t vblank(Signaled &&signaled)
+	{
+		if (int latched = find(Latching); latched >= 0) {
+			if (int old = find(Scanning); old >= 0)
+				buf_[old].state.store(Free, std::memory_order_release);
+			buf_[latched].state.store(Scanning, std::memory_order_relaxed);
+		}
+
+		// Oldest queued frame
+		int next = -1;
+		for (uint32_t i = 0; i < n_; i++)
+			if (buf_[i].state.load(std::memory_order_acquire) == Queued &&
+				(next < 0 || buf_[i].order < buf_[next].order))
+				next = int(i);
+
+		if (presented_.load(std::memory_order_relaxed) == 0)
+			return 0; // not started: nothing to count yet
+		stats_.vblanks++;
+		if (next >= 0 && signaled(buf_[next].fence)) {
+			buf_[next].state.store(Latching, std::memory_order_relaxed);
+			stats_.flips++;
+			return buf_[next].addr;
+		}
+		// No flip: the frame on screen stays for another refresh.
+		if (next >= 0)
+			stats_.missed_gpu++;
+		else
+			stats_.missed_cpu++;
+		return 0;
+	}
+
+	// Read from the main code while the IRQ counts: a snapshot, each field
+	// individually up to date.
+	Stats stats() const
+	{
+		return stats_;
+	}
+
+private:
+	enum : uint8_t { Free, Recording, Queued, Latching, Scanning };
+
+	struct Buffer {
+		uint32_t addr = 0;
+		std::atomic<uint8_t> state{Free};
+		Fence fence{};
+		uint32_t order = 0; // present() sequence number
+	};
+
+	int find(uint8_t state) const
+	{
+		for (uint32_t i = 0; i < n_; i++)
+			if (buf_[i].state.load(std::memory_order_acquire) == state)
+				return int(i);
+		return -1;
+	}
+
+	Buffer buf_[kMaxBuffers];
+	uint32_t n_ = 0;
+	std::atomic<uint32_t> presented_{0};
+	Stats stats_{};
+};
+
+} // namespace etna
@@ -0,0 +1,35 @@
+#include "etna_timeline.hh"
+#include "aarch64/system_reg.hh" // read_cntfreq
+#include "print/print.hh"
+
+// =============================================================================
+//  etna_timeline.cc -- printing a frame's pass times
+// =============================================================================
+// See etna_timeline.hh. The stamps are the Gpu's (etna.cc): its interrupt
+// takes them.
+
+namespace etna
+{
+
+namespace
+{
+
+uint32_t to_us(uint64_t ticks)
+{
+	return uint32_t(ticks * 1'000'000 / read_cntfreq());
+}
+
+} // namespace
+
+void print_frame_times(const Timeline::FrameTimes &f, uint64_t t0)
+{
+	print("frame ", int(f.frame), " @ ", int(to_us(f.start - t0)), " us:");
+	for (uint32_t i = 0; i < f.passes; i++)
+		print(i ? ", " : " ", f.pass[i].label, " ", int(to_us(f.ticks(i))));
+	print(" = ", int(to_us(f.end() - f.start)), " us");
+	if (f.missed)
+		print(" (", int(f.missed), " marks missed)");
+	print("\n");
+}
+
+} // namespace etna
@@ -0,0 +1,236 @@
+#pragma once
+#include "etna.hh"
+#include <cstdint>
+
+// =============================================================================
+//  etna_timeline.hh -- per-pass GPU timestamps from events in the stream
+// =============================================================================
+// read_cntpct() around submit_and_wait() times a pass plus the CPU's wake-up
+// and the IRQ latency, and only if every pass is submitted and waited alone,
+// which serializes the CPU and the GPU. A Timeline instead puts an EVENT
+// (FROM_PE) into the stream after each pass. It fires once the PE has
+// finished everything before it, the GPU interrupt stamps read_cntpct() for
+// every event bit it reads (Gpu::start_timeline(), etna.cc), and the
+// Timeline ties the stamps back to the passes' labels. The submissions stay
+// pipelined: a stamp is taken when the GPU gets there, whoever waits for what.
+//
+//   Timeline tl;
+//   gpu.start_timeline(tl);
+//   tl.begin_frame(cs);                           // the GPU starts on the frame
+//   etna::clear(cs, ...);    tl.mark(cs, "clear");
+//   etna::emit_mesh(cs, d);  tl.mark(cs, "draw");
+//   etna::resolve(cs, ...);  tl.mark(cs, "resolve");
+//   tl.end_frame();
+//   gpu.submit(cs);
+//   ...
+//   Timeline::FrameTimes ft;
+//   while (tl.pop(ft))                            // finished frames, oldest first
+//       print_frame_times(ft, t0);
+//   gpu.stop_timeline();                          // after the last one completed
+//
+// A pass lasts from the mark before it to its own. Every stamp is late by the
+// interrupt latency, about the same each time, so it cancels out of the
+// differences; events the ISR reads at once share one stamp, so a pass
+// shorter than an interrupt entry reads 0. The RS runs behind the PE on its
+// own schedule: an RS pass is over at the PE drain the op emitters end with,
+// but a Frame (etna_frame.hh) drains only before the op that needs it, so
+// there an RS pass's time lands in the pass after it.
+//
+// The Timeline only does the bookkeeping -- which event id carries which
+// mark, which frame is complete -- over ids the Gpu lends it, so it is host
+// tested (tools/host_tests.cc) against fired bits and stamps.
+
+namespace etna
+{
+
+class Timeline {
+public:
+	static constexpr uint32_t kMaxPasses = 16; // marks per frame, after begin_frame()'s
+	static constexpr uint32_t kMaxFrames = 4;  // frames begun and not yet pop()ed
+
+	struct FrameTimes {
+		struct Pass {
+			const char *label;
+			uint64_t end; // stamp
+		};
+		uint32_t frame = 0;	 // which begin_frame(), from 0
+		uint64_t start = 0;	 // stamp of begin_frame()'s mark
+		uint32_t passes = 0; // marked
+		uint32_t missed = 0; // marks that found no free id: in the next pass's time
+		Pass pass[kMaxPasses];
+
+		uint64_t end() const
+		{
+			return passes ? pass[passes - 1].end : start;
+		}
+		// Ticks of pass `i`.
+		uint64_t ticks(uint32_t i) const
+		{
+			return pass[i].end - (i ? pass[i - 1].end : start);
+		}
+	};
+
+	// The event ids the marks may use (the Gpu's start_timeline() lends them).
+	// Forgets every frame: only with no mark in flight.
+	void set_events(uint32_t mask)
+	{
+		reset();
+		events_ = free_ = mask;
+	}
+	uint32_t events() const
+	{
+		return events_;
+	}
+
+	// Open a frame: its first mark, when the PE has finished what came before
+	// (the previous frame, or nothing if the GPU is idle). Closes the frame
+	// before, if end_frame() wasn't called. A frame is not recorded (and its
+	// marks emit nothing) while kMaxFrames are waiting to be popped, or if no
+	// id is free for its first mark; dropped() counts those.
+	void begin_frame(CmdStream &cs)
+	{
+		end_frame();
+		frames_begun_++;
+		uint32_t ev;
+		if (nframes_ == kMaxFrames || (ev = take()) == kNoId) {
+			dropped_++;
+			return;
+		}
+		Open &f = frames_[(first_ + nframes_++) % kMaxFrames];
+		f = Open{};
+		f.t.frame = frames_begun_ - 1;
+		f.open = true;
+		emit(cs, f, kStartMark, ev);
+	}
+
+	// Mark the end of a pass, named `label` (not copied: a literal). False
+	// (nothing emitted) if no id is free or the frame has kMaxPasses marks:
+	// that pass's time then counts to the next one's.
+	bool mark(CmdStream &cs, const char *label)
+	{
+		Open *f = current();
+		if (!f)
+			return false;
+		uint32_t ev;
+		if (f->t.passes == kMaxPasses || (ev = take()) == kNoId) {
+			f->t.missed++;
+			return false;
+		}
+		f->t.pass[f->t.passes] = {label, 0};
+		emit(cs, *f, f->t.passes++, ev);
+		return true;
+	}
+
+	// Close the frame: pop() returns it once its marks have fired.
+	void end_frame()
+	{
+		if (Open *f = current())
+			f->open = false;
+	}
+
+	// Event bits that fired (only events()' are looked at) and the stamps the
+	// interrupt took, by event id.
+	void fired(uint32_t bits, const uint64_t *stamps)
+	{
+		bits &= events_ & ~free_;
+		for (; bits; bits &= bits - 1) {
+			const uint32_t ev = uint32_t(__builtin_ctz(bits));
+			const Owner o = owner_[ev];
+			Open &f = frames_[o.frame];
+			if (o.mark == kStartMark)
+				f.t.start = stamps[ev];
+			else
+				f.t.pass[o.mark].end = stamps[ev];
+			f.pending--;
+			free_ |= 1u << ev;
+		}
+	}
+
+	// The oldest frame, once it is closed and all its marks have fired.
+	bool pop(FrameTimes &out)
+	{
+		if (!nframes_)
+			return false;
+		const Open &f = frames_[first_];
+		if (f.open || f.pending)
+			return false;
+		out = f.t;
+		first_ = (first_ + 1) % kMaxFrames;
+		nframes_--;
+		return true;
+	}
+
+	// Marks emitted and not fired yet.
+	uint32_t in_flight() const
+	{
+		return uint32_t(__builtin_popcount(events_ & ~free_));
+	}
+	uint32_t dropped() const
+	{
+		return dropped_;
+	}
+
+	// Forget every frame; the ids count as free again.
+	void reset()
+	{
+		free_ = events_;
+		nframes_ = first_ = 0;
+		frames_begun_ = dropped_ = 0;
+	}
+
+private:
+	static constexpr uint32_t kNoId = ~0u;
+	static constexpr uint8_t kStartMark = 0xFF;
+
+	struct Open {
+		FrameTimes t;
+		uint32_t pending = 0; // marks in flight
+		bool open = false;	  // still taking marks
+	};
+	struct Owner {
+		uint8_t frame; // index into frames_
+		uint8_t mark;  // into its passes, or kStartMark
+	};
+
+	uint32_t take()
+	{
+		if (!free_)
+			return kNoId;
+		const uint32_t ev = uint32_t(__builtin_ctz(free_));
+		free_ &= ~(1u << ev);
+		return ev;
+	}
+
+	Open *current()
+	{
+		if (!nframes_)
+			return nullptr;
+		Open &f = frames_[(first_ + nframes_ - 1) % kMaxFrames];
+		return f.open ? &f : nullptr;
+	}
+
+	void emit(CmdStream &cs, Open &f, uint8_t mark, uint32_t ev)
+	{
+		owner_[ev] = {uint8_t(&f - frames_), mark};
+		f.pending++;
+		cs.event(ev, VivanteGpu::GL_EVENT_FROM_PE);
+	}
+
+	uint32_t events_ = 0;
+	uint32_t free_ = 0;
+	Owner owner_[32] = {};
+	Open frames_[kMaxFrames];
+	uint32_t nframes_ = 0, first_ = 0;
+	uint32_t frames_begun_ = 0;
+	uint32_t dropped_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+//  On the target (etna_timeline.cc)
+// -----------------------------------------------------------------------------
+
+// One line per frame: its start (us after `t0`, a read_cntpct() value), each
+// pass's time and the total.
+void print_frame_times(const Timeline::FrameTimes &f, uint64_t t0);
+
+} // namespace etna
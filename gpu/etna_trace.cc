@@ -0,0 +1,130 @@
+#include "etna_trace.hh"
+#include "aarch64/system_reg.hh" // read_cntpct/read_cntfreq
+#include "print/print.hh"
+#include <algorithm>
+
+// =============================================================================
+//  etna_trace.cc -- replaying a captured trace, dumping it over the UART
+// =============================================================================
+// See etna_trace.hh. Capturing is Gpu's (etna.cc): it has the submissions.
+
+namespace etna
+{
+
+namespace
+{
+
+bool overlaps(uint32_t a, uint32_t a_bytes, uint32_t b, uint32_t b_bytes)
+{
+	return a < b + b_bytes && b < a + a_bytes;
+}
+
+// Does any Bo of the trace overlap [addr, addr + bytes)? The GPU would write
+// a written one and the replay a restored one over it.
+bool trace_overlaps(TraceReader &rd, uint32_t addr, uint32_t bytes)
+{
+	rd.rewind();
+	TraceReader::Record r;
+	while (rd.next(r))
+		for (uint32_t i = 0; i < r.bo_count; i++)
+			if (TraceBo b = r.bo(i); overlaps(b.addr, b.bytes, addr, bytes))
+				return true;
+	return false;
+}
+
+uint32_t to_us(uint64_t ticks, uint32_t hz)
+{
+	return hz ? uint32_t(ticks * 1'000'000 / hz) : 0;
+}
+
+} // namespace
+
+ReplayResult replay(Gpu &gpu, std::span<const uint32_t> trace, uint32_t runs, std::span<uint32_t> ticks)
+{
+	ReplayResult res;
+	TraceReader rd{trace};
+	TraceReader::Record r;
+	uint32_t max_dw = 0;
+	while (rd.next(r)) {
+		max_dw = std::max<uint32_t>(max_dw, r.stream.size());
+		res.submissions++;
+	}
+	if (!rd.valid()) {
+		print("replay: not a valid trace\n");
+		return res;
+	}
+	const auto trace_addr = uint32_t(reinterpret_cast<uintptr_t>(trace.data()));
+	if (trace_overlaps(rd, trace_addr, uint32_t(trace.size_bytes()))) {
+		print("replay: the trace lies where its own Bos go\n");
+		return res;
+	}
+	auto cs = gpu.new_cmd_stream(max_dw + 2); // + submit()'s alignment NOP
+	if (!cs.avail()) {
+		print("replay: no memory for a ", int(max_dw), " dword stream\n");
+		return res;
+	}
+	if (trace_overlaps(rd, cs.bo().gpu_addr(), cs.bo().size())) {
+		print("replay: the replay stream lies where the trace's Bos go (allocate them again, or replay "
+			  "from a fresh pool)\n");
+		gpu.free(cs);
+		return res;
+	}
+
+	const uint32_t hz = rd.tick_hz() ? rd.tick_hz() : uint32_t(read_cntfreq());
+	const uint32_t n = std::min<uint32_t>(res.submissions, ticks.size());
+	std::fill_n(ticks.begin(), n, ~0u);
+	res.ok = true;
+	for (uint32_t run = 0; run < std::max(runs, 1u) && res.ok; run++) {
+		rd.rewind();
+		res.ticks = 0;
+		for (uint32_t i = 0; res.ok && rd.next(r); i++) {
+			// Restore what the commands read, then run them.
+			uint32_t restored = 0;
+			for (uint32_t b = 0; b < r.bo_count; b++) {
+				TraceBo bo = r.bo(b);
+				if (!bo.data)
+					continue;
+				Bo dst{.phys = bo.addr, .bytes = bo.bytes};
+				std::copy_n(reinterpret_cast<const uint8_t *>(bo.data), bo.bytes, dst.span<uint8_t>().begin());
+				dst.cpu_fini(RelocWrite);
+				restored += bo.bytes;
+			}
+			cs.reset();
+			for (uint32_t w : r.stream)
+				cs.emit(w);
+
+			const uint64_t start = read_cntpct();
+			res.ok = gpu.submit_and_wait(cs);
+			const uint64_t t = read_cntpct() - start;
+			res.ticks += t;
+			if (i < n)
+				ticks[i] = std::min<uint32_t>(ticks[i], uint32_t(t));
+			if (run + 1 < runs && res.ok)
+				continue;
+			print("replay ", int(i), " (seqno ", int(r.seqno), "): ", int(r.stream.size()), " dwords, ",
+				  int(restored / 1024), " KB restored: ");
+			if (!res.ok)
+				print("FAILED\n");
+			else {
+				print(int(to_us(i < n ? ticks[i] : t, hz)), " us", runs > 1 && i < n ? " best" : "");
+				if (r.gpu_ticks != kTraceNoTicks)
+					print(", captured ", int(to_us(r.gpu_ticks, hz)), " us");
+				print("\n");
+			}
+		}
+	}
+	if (!res.ok)
+		gpu.dump_status("replay");
+	else
+		gpu.free(cs); // a timed-out stream may still be in the FE's hands: leak it rather than reuse it
+	return res;
+}
+
+void dump_trace(std::span<const uint32_t> trace)
+{
+	print("trace: ", int(trace.size()), " dwords\n");
+	for (uint32_t i = 0; i < trace.size(); i++)
+		print(i % 8 ? " " : "tr: ", Hex{trace[i]}, i % 8 == 7 || i + 1 == trace.size() ? "\n" : "");
+}
+
+} // namespace etna
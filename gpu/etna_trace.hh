@@ -0,0 +1,412 @@
+#pragma once
+#include "etna.hh"
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// =============================================================================
+//  etna_trace.hh -- command stream capture: the trace format
+// =============================================================================
+// To measure a change to the emitters or the submission path on the same
+// work, before and after, Gpu::start_capture() (etna.hh) records every
+// submission into a trace in RAM, and replay() (etna_trace.cc) runs a trace
+// again and times each submission. The trace is a flat array of little-endian
+// dwords, so it can be kept in a Bo, dumped over the UART (dump_trace()) and
+// read back on the host (tools/cs_decode.cc decodes it):
+//
+//   header   kTraceMagic, kTraceVersion, tick_hz, 0
+//   record   kTraceSubmit, seqno, submit_tick, gpu_ticks, stream_dwords, bo_count
+//            bo_count x { addr, bytes, flags }
+//            the data of each Bo with kTraceBoData in its flags, in order,
+//            bytes rounded up to whole dwords
+//            stream_dwords of commands
+//   ...
+//   kTraceEnd
+//
+// Ticks are the counter's (tick_hz), from the start of the capture.
+// gpu_ticks is submission to observed completion: the Gpu only learns that a
+// submission is done when it reaps the completion events (wait(),
+// is_complete()), so it is an upper bound; kTraceNoTicks if never observed.
+//
+// The Bos of a record are the ones its stream references (CmdStream::bos()),
+// with their access flags (RelocRead/RelocWrite). The trace is kept compact
+// by storing a Bo's contents only when a replay needs them to be there:
+//
+//   read only    (vertices, textures, shader code) whenever they differ from
+//                the last copy in the trace, compared by a hash;
+//   written      (render targets, depth) never: the GPU produces them, and a
+//                replay of the records before reproduces them. That holds
+//                for later records reading them too (a resolve of a render
+//                target): a Bo some record wrote is taken as the GPU's from
+//                then on. A capture with `outputs` stores their contents the
+//                first time each is seen, for work that reads what it writes
+//                (blending, depth test against a preloaded buffer).
+//
+// The commands are stored as submitted, addresses and all: a replay puts
+// each Bo's contents back at the address it was captured at.
+//
+// Hardware-independent (the Gpu passes its Bos' memory in); the writer and
+// the reader round-trip in tools/host_tests.cc.
+
+namespace etna
+{
+
+inline constexpr uint32_t kTraceMagic = 0x43525445; // "ETRC"
+inline constexpr uint32_t kTraceVersion = 1;
+inline constexpr uint32_t kTraceSubmit = 0x4D425553; // "SUBM"
+inline constexpr uint32_t kTraceEnd = 0x444E4545;	 // "EEND"
+inline constexpr uint32_t kTraceNoTicks = 0xFFFFFFFF;
+inline constexpr uint32_t kTraceBoData = 1 << 8; // Bo flags: contents follow
+inline constexpr uint32_t kTraceHeaderDwords = 4;
+inline constexpr uint32_t kTraceRecordDwords = 6;
+inline constexpr uint32_t kTraceBoDwords = 3;
+
+// A Bo as the trace sees it: where, how big, how the stream uses it
+// (RelocRead | RelocWrite, plus kTraceBoData in a trace), and for the writer
+// its current contents.
+struct TraceBo {
+	uint32_t addr = 0;
+	uint32_t bytes = 0;
+	uint32_t flags = 0;
+	const uint32_t *data = nullptr; // bytes / 4 dwords, rounded up
+};
+
+constexpr uint32_t trace_data_dwords(uint32_t bytes)
+{
+	return (bytes + 3) / 4;
+}
+
+// FNV-1a over dwords: whether a Bo changed since its last copy.
+inline uint32_t trace_hash(const uint32_t *data, uint32_t dwords)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < dwords; i++)
+		h = (h ^ data[i]) * 16777619u;
+	return h;
+}
+
+class TraceWriter {
+public:
+	static constexpr uint32_t kMaxTracked = 64; // Bos whose last copy is remembered
+	static constexpr uint32_t kMaxPending = 32; // submissions awaiting their completion time
+	static constexpr uint32_t kMaxBos = 48;		// per record: a few streams' CmdStream::kMaxBos
+	static constexpr uint32_t kNoRecord = 0xFFFFFFFF;
+
+	struct Stats {
+		uint32_t records = 0;
+		uint32_t dropped = 0;	 // submissions that did not fit the buffer
+		uint32_t bo_copies = 0;	 // Bo contents stored
+		uint32_t bo_skipped = 0; // Bos stored by reference only
+		uint32_t data_bytes = 0; // of Bo contents
+	};
+
+	// Write into `buf`. `outputs`: also store written Bos' first contents.
+	explicit TraceWriter(std::span<uint32_t> buf, uint32_t tick_hz = 0, bool outputs = false)
+		: buf_{buf}
+		, outputs_{outputs}
+	{
+		if (buf_.size() < kTraceHeaderDwords + 1) {
+			buf_ = {};
+			return;
+		}
+		buf_[0] = kTraceMagic;
+		buf_[1] = kTraceVersion;
+		buf_[2] = tick_hz;
+		buf_[3] = 0;
+		len_ = kTraceHeaderDwords;
+		buf_[len_] = kTraceEnd; // a valid (empty) trace at every point
+	}
+
+	// The counter frequency, if it was not known at construction.
+	void set_tick_hz(uint32_t hz)
+	{
+		if (buf_.data())
+			buf_[2] = hz;
+	}
+
+	// Append one submission: its command streams (one, or a chain's bundles,
+	// stored back to back) and the Bos they reference. Returns the record's
+	// dword offset, or kNoRecord if it does not fit (counted in dropped).
+	uint32_t submission(uint32_t seqno,
+						uint32_t submit_tick,
+						std::span<const std::span<const uint32_t>> streams,
+						std::span<const TraceBo> bos)
+	{
+		uint32_t stream_dw = 0;
+		for (auto s : streams)
+			stream_dw += uint32_t(s.size());
+		// Decide what to copy before writing anything, so a record that
+		// does not fit leaves the trace and the hash table as they were.
+		if (bos.size() > kMaxBos) {
+			stats_.dropped++;
+			return kNoRecord;
+		}
+		const uint32_t n = uint32_t(bos.size());
+		uint32_t dw = kTraceRecordDwords + stream_dw + n * kTraceBoDwords;
+		bool copy[kMaxBos];
+		uint32_t hash[kMaxBos];
+		for (uint32_t i = 0; i < n; i++) {
+			copy[i] = wants_copy(bos[i], hash[i]);
+			dw += copy[i] ? trace_data_dwords(bos[i].bytes) : 0;
+		}
+		if (!buf_.data() || len_ + dw + 1 > buf_.size()) {
+			stats_.dropped++;
+			return kNoRecord;
+		}
+
+		const uint32_t at = len_;
+		uint32_t *w = &buf_[at];
+		*w++ = kTraceSubmit;
+		*w++ = seqno;
+		*w++ = submit_tick;
+		*w++ = kTraceNoTicks;
+		*w++ = stream_dw;
+		*w++ = n;
+		for (uint32_t i = 0; i < n; i++) {
+			*w++ = bos[i].addr;
+			*w++ = bos[i].bytes;
+			*w++ = (bos[i].flags & ~kTraceBoData) | (copy[i] ? kTraceBoData : 0);
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			remember(bos[i], hash[i]);
+			if (!copy[i]) {
+				stats_.bo_skipped++;
+				continue;
+			}
+			const uint32_t d = trace_data_dwords(bos[i].bytes);
+			std::memcpy(w, bos[i].data, bos[i].bytes);
+			if (bos[i].bytes % 4) // the last dword's tail: zeros, not whatever was there
+				std::memset(reinterpret_cast<uint8_t *>(w) + bos[i].bytes, 0, d * 4 - bos[i].bytes);
+			w += d;
+			stats_.bo_copies++;
+			stats_.data_bytes += bos[i].bytes;
+		}
+		for (auto s : streams) {
+			if (!s.empty()) // memcpy from a null span is UB even for 0 bytes
+				std::memcpy(w, s.data(), s.size() * 4);
+			w += s.size();
+		}
+		len_ = at + dw;
+		buf_[len_] = kTraceEnd;
+		stats_.records++;
+
+		// Completion times come in later, through retire().
+		if (pending_n_ == kMaxPending) { // the oldest never completes in this trace
+			pending_head_ = (pending_head_ + 1) % kMaxPending;
+			pending_n_--;
+		}
+		pending_[(pending_head_ + pending_n_++) % kMaxPending] = {seqno, at, submit_tick};
+		return at;
+	}
+
+	uint32_t submission(uint32_t seqno,
+						uint32_t submit_tick,
+						std::span<const uint32_t> stream,
+						std::span<const TraceBo> bos)
+	{
+		return submission(seqno, submit_tick, std::span<const std::span<const uint32_t>>{&stream, 1}, bos);
+	}
+
+	// Everything up to `completed_seqno` has been seen done at `now`: fill in
+	// the gpu_ticks of those records.
+	void retire(uint32_t completed_seqno, uint32_t now)
+	{
+		while (pending_n_ && int32_t(completed_seqno - pending_[pending_head_].seqno) >= 0) {
+			const Pending &p = pending_[pending_head_];
+			buf_[p.offset + 3] = now - p.submit_tick;
+			pending_head_ = (pending_head_ + 1) % kMaxPending;
+			pending_n_--;
+		}
+	}
+
+	// The trace so far, kTraceEnd included (empty if the buffer was too small).
+	std::span<const uint32_t> trace() const
+	{
+		return buf_.data() ? std::span<const uint32_t>{buf_.data(), len_ + 1} : std::span<const uint32_t>{};
+	}
+
+	const Stats &stats() const
+	{
+		return stats_;
+	}
+
+private:
+	struct Tracked {
+		uint32_t addr, bytes, hash;
+		bool written; // by an earlier record: the GPU's from then on
+	};
+	struct Pending {
+		uint32_t seqno, offset, submit_tick;
+	};
+
+	// Does `bo` need its contents in this record? `hash` is what to
+	// remember() if so.
+	bool wants_copy(const TraceBo &bo, uint32_t &hash) const
+	{
+		hash = 0;
+		if (!bo.data || !bo.bytes)
+			return false;
+		const Tracked *t = find(bo.addr);
+		const bool seen = t && t->bytes == bo.bytes;
+		if (bo.flags & RelocWrite)
+			return outputs_ && !seen;
+		if (seen && t->written)
+			return false;
+		hash = trace_hash(bo.data, bo.bytes / 4);
+		return !seen || t->hash != hash;
+	}
+
+	// Note `bo` as of this record (its hash, if copied).
+	void remember(const TraceBo &bo, uint32_t hash)
+	{
+		Tracked *t = find(bo.addr);
+		bool written = bo.flags & RelocWrite;
+		if (t)
+			written |= t->bytes == bo.bytes && t->written;
+		else if (n_tracked_ < kMaxTracked) // else: untracked, copied every time
+			t = &tracked_[n_tracked_++];
+		if (t)
+			*t = {bo.addr, bo.bytes, hash, written};
+	}
+
+	const Tracked *find(uint32_t addr) const
+	{
+		for (uint32_t i = 0; i < n_tracked_; i++)
+			if (tracked_[i].addr == addr)
+				return &tracked_[i];
+		return nullptr;
+	}
+	Tracked *find(uint32_t addr)
+	{
+		return const_cast<Tracked *>(static_cast<const TraceWriter *>(this)->find(addr));
+	}
+
+	std::span<uint32_t> buf_;
+	uint32_t len_ = 0; // dwords written, not counting the kTraceEnd after them
+	bool outputs_;
+	Stats stats_{};
+	Tracked tracked_[kMaxTracked];
+	uint32_t n_tracked_ = 0;
+	Pending pending_[kMaxPending];
+	uint32_t pending_head_ = 0, pending_n_ = 0;
+};
+
+// Walks a trace, checking every length against the buffer.
+class TraceReader {
+public:
+	struct Record {
+		uint32_t offset = 0; // of the record in the trace
+		uint32_t seqno = 0;
+		uint32_t submit_tick = 0;
+		uint32_t gpu_ticks = kTraceNoTicks;
+		std::span<const uint32_t> stream;
+		uint32_t bo_count = 0;
+
+		// Bo `i` (< bo_count); data is null unless its flags have kTraceBoData.
+		TraceBo bo(uint32_t i) const
+		{
+			const uint32_t *e = descs_ + i * kTraceBoDwords;
+			TraceBo b{e[0], e[1], e[2], nullptr};
+			if (b.flags & kTraceBoData) {
+				const uint32_t *d = descs_ + bo_count * kTraceBoDwords;
+				for (uint32_t j = 0; j < i; j++)
+					if (descs_[j * kTraceBoDwords + 2] & kTraceBoData)
+						d += trace_data_dwords(descs_[j * kTraceBoDwords + 1]);
+				b.data = d;
+			}
+			return b;
+		}
+
+	private:
+		friend class TraceReader;
+		const uint32_t *descs_ = nullptr;
+	};
+
+	// False if `trace` does not start with a trace header of this version.
+	explicit TraceReader(std::span<const uint32_t> trace)
+		: t_{trace}
+	{
+		ok_ = t_.size() > kTraceHeaderDwords && t_[0] == kTraceMagic && t_[1] == kTraceVersion;
+		pos_ = ok_ ? kTraceHeaderDwords : 0;
+	}
+
+	bool valid() const
+	{
+		return ok_;
+	}
+
+	uint32_t tick_hz() const
+	{
+		return ok_ ? t_[2] : 0;
+	}
+
+	// The next record; false at kTraceEnd, or (and valid() turns false) on a
+	// malformed one.
+	bool next(Record &r)
+	{
+		if (!ok_ || pos_ >= t_.size() || t_[pos_] == kTraceEnd)
+			return false;
+		if (t_[pos_] != kTraceSubmit || t_.size() - pos_ < kTraceRecordDwords)
+			return fail();
+		const uint32_t *h = &t_[pos_];
+		r = Record{};
+		r.offset = pos_;
+		r.seqno = h[1];
+		r.submit_tick = h[2];
+		r.gpu_ticks = h[3];
+		r.bo_count = h[5];
+		uint64_t end = uint64_t(pos_) + kTraceRecordDwords + uint64_t(r.bo_count) * kTraceBoDwords;
+		if (r.bo_count > TraceWriter::kMaxBos || end > t_.size())
+			return fail();
+		r.descs_ = h + kTraceRecordDwords;
+		for (uint32_t i = 0; i < r.bo_count; i++)
+			if (r.descs_[i * kTraceBoDwords + 2] & kTraceBoData)
+				end += trace_data_dwords(r.descs_[i * kTraceBoDwords + 1]);
+		if (end + h[4] > t_.size())
+			return fail();
+		r.stream = t_.subspan(size_t(end), h[4]);
+		pos_ = uint32_t(end + h[4]);
+		return true;
+	}
+
+	// Start over from the first record.
+	void rewind()
+	{
+		pos_ = ok_ ? kTraceHeaderDwords : 0;
+	}
+
+private:
+	bool fail()
+	{
+		ok_ = false;
+		return false;
+	}
+
+	std::span<const uint32_t> t_;
+	uint32_t pos_ = 0;
+	bool ok_ = false;
+};
+
+// -----------------------------------------------------------------------------
+//  On the target (etna_trace.cc)
+// -----------------------------------------------------------------------------
+// Run every record of `trace` again, in order, `runs` times: put back the Bo
+// contents the record carries, copy its commands into a stream, submit and
+// wait. Each submission runs alone on an idle GPU, so its time is the GPU's
+// for those commands plus a ring round trip, the same for both sides of a
+// comparison. Prints each submission's best time next to the captured one,
+// and stores it in `ticks` (as many as fit). The captured addresses must be
+// free for the replay to write: it refuses a trace whose Bos overlap the
+// trace itself or the replay's own stream.
+struct ReplayResult {
+	uint32_t submissions = 0;
+	uint64_t ticks = 0; // every submission, the last run
+	bool ok = false;
+};
+ReplayResult replay(Gpu &gpu, std::span<const uint32_t> trace, uint32_t runs = 1, std::span<uint32_t> ticks = {});
+
+// Print `trace` as hex dwords ("tr: " lines, after a "trace: <n> dwords"
+// line) for tools/cs_decode.cc to read back from a UART log.
+void dump_trace(std::span<const uint32_t> trace);
+
+} // namespace etna
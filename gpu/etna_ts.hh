@@ -0,0 +1,82 @@
+#pragma once
+#include "gpu_regs.hh"
+#include <cstdint>
+
+// =============================================================================
+//  etna_ts.hh -- tile status: fast clear sizing and state
+// =============================================================================
+// A full clear() of a 1024x600 A8R8G8B8 render target writes 2.4 MB of DDR,
+// and the D16 depth buffer another 1.2 MB, before a frame draws anything. A
+// tile status (TS) buffer holds 2 bits for every 64-byte tile of a surface;
+// fast_clear() (etna.hh) writes only that -- 9.5 KB for the render target --
+// marking every tile "cleared" and recording the clear value. From then on:
+//
+//   the PE     reads a cleared tile as the clear value without fetching it,
+//              and marks the tile dirty once it writes it back;
+//   the RS     resolving the surface through its TS writes the clear value
+//              for the tiles still cleared, and never reads them.
+//
+// So the surface memory of the cleared tiles is stale: read it only through
+// the TS (a draw with MeshDraw::rt_ts / depth_ts, resolve() with a
+// TileStatus), or full-clear() it first.
+//
+// Sizing is Mesa's (etna_resource_alloc_ts): one TS byte covers 4 tiles,
+// 256 bytes of surface, and the buffer is a multiple of 0x100 bytes per pixel
+// pipe (this core has one). The tile is 64 bytes since the core lacks the
+// CACHE128B256BPERLINE feature.
+//
+// Pure arithmetic, no hardware access; tools/host_tests.cc checks it.
+
+namespace etna
+{
+
+inline constexpr uint32_t kTsTileBytes = 64;  // surface bytes per TS entry
+inline constexpr uint32_t kTsBitsPerTile = 2; // 2BITPERTILE
+inline constexpr uint32_t kTsAlign = 0x100;	  // x pixel pipes (1)
+// Every entry 01: the tile is cleared (Mesa fills TS with 0x55 to clear).
+inline constexpr uint32_t kTsCleared = 0x55555555;
+
+// Bytes of TS for a `surface_bytes` surface.
+constexpr uint32_t ts_bytes(uint32_t surface_bytes)
+{
+	constexpr uint32_t covered = kTsTileBytes * 8 / kTsBitsPerTile; // surface bytes per TS byte
+	const uint32_t bytes = (surface_bytes + covered - 1) / covered;
+	return (bytes + kTsAlign - 1) & ~(kTsAlign - 1);
+}
+
+// The TS byte covering the surface byte at `surface_offset` (a multiple of
+// 256: the TS has no finer address). A resolve of part of a surface moves
+// the TS address along with the source's (resolve_rect(), etna.hh).
+constexpr uint32_t ts_offset(uint32_t surface_offset)
+{
+	return surface_offset / (kTsTileBytes * 8 / kTsBitsPerTile);
+}
+
+// fast_clear() fills the TS buffer with kTsCleared as an RS clear of a linear
+// A8R8G8B8 surface 16 pixels (64 bytes) wide: the RS's width alignment, and
+// the kTsAlign rounding keeps the height a multiple of 4.
+inline constexpr uint32_t kTsFillWidth = 16;
+
+constexpr uint32_t ts_fill_height(uint32_t ts_bytes)
+{
+	return ts_bytes / (kTsFillWidth * 4);
+}
+
+// TS_MEM_CONFIG for a pass that reads the color and/or the D16 depth target
+// through its TS; 0 turns the TS off.
+constexpr uint32_t ts_mem_config(bool color, bool depth)
+{
+	using namespace VivanteGpu;
+	return (color ? TS_MEM_CONFIG_COLOR_FAST_CLEAR : 0) |
+		   (depth ? TS_MEM_CONFIG_DEPTH_FAST_CLEAR | TS_MEM_CONFIG_DEPTH_16BPP : 0);
+}
+
+// TS_*_CLEAR_VALUE: what a cleared tile reads as. It is the fill word a full
+// clear() writes: the A8R8G8B8 color, and for D16 the 16-bit depth twice over
+// (0xFFFFFFFF = far).
+constexpr uint32_t ts_depth_clear_value(uint16_t depth)
+{
+	return depth | (uint32_t(depth) << 16);
+}
+
+} // namespace etna
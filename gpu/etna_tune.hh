@@ -0,0 +1,269 @@
+#pragma once
+#include "ppu_dispatch.hh"
+#include <array>
+#include <cstdint>
+#include <span>
+
+// =============================================================================
+//  etna_tune.hh -- PPU launch autotuning: the search and the tuning table
+// =============================================================================
+// The dispatch template (ppu_dispatch.hh) runs every kernel with the vendor's
+// 1x1 workgroups and 4x1 global scale. That measured best for the kernels we
+// had, but the best shape depends on the kernel (its register count sets the
+// occupancy) and on the image size, so it is measured rather than assumed:
+//
+//   autotune() times each candidate PpuLaunch through a caller-supplied
+//   measure(launch) -> ticks, and picks the fastest. On target the measure
+//   is a real dispatch timed with read_cntpct and checked against the default
+//   launch's output (ppu_autotune.cc); on the host it is a fake cost model
+//   (tools/host_tests.cc). Nothing here touches the GPU.
+//
+//   TuneTable maps (kernel, width, height) -> launch. compute() and
+//   ComputeList look every dispatch up in tune_table() and fall back to the
+//   default launch on a miss, so an empty table changes nothing.
+//
+// Persisting: the table saves to / loads from a dword blob (magic, version,
+// entries, checksum). ppu_autotune() prints it; paste it into the firmware
+// and tune_table().load() it at boot to skip the sweep. load() checks
+// everything and leaves the table untouched on a bad blob, so a stale or
+// truncated one just means default launches.
+
+namespace etna
+{
+
+// Identifies a kernel program in the table: FNV-1a over its words and
+// register count. make_kernel() stores it in Kernel::id.
+constexpr uint32_t ppu_program_id(const uint32_t *inst, uint32_t inst_dwords, uint32_t reg_count)
+{
+	uint32_t h = 2166136261u;
+	auto mix = [&h](uint32_t w) {
+		for (unsigned i = 0; i < 4; i++) {
+			h ^= (w >> (i * 8)) & 0xFF;
+			h *= 16777619u;
+		}
+	};
+	for (uint32_t i = 0; i < inst_dwords; i++)
+		mix(inst[i]);
+	mix(reg_count);
+	return h;
+}
+
+// -----------------------------------------------------------------------------
+//  Search
+// -----------------------------------------------------------------------------
+
+// Workgroup shapes x global scales. The default launch is first: it is the
+// baseline every other candidate has to beat.
+inline constexpr auto kTuneCandidates = [] {
+	constexpr uint8_t groups[][2] = {{1, 1}, {2, 1}, {4, 1}, {8, 1}, {16, 1}, {2, 2}, {4, 2}, {4, 4}, {8, 8}};
+	constexpr uint8_t scales[][2] = {{4, 1}, {8, 1}, {16, 1}, {4, 2}};
+	std::array<PpuLaunch, std::size(groups) * std::size(scales)> c{};
+	unsigned n = 0;
+	for (auto &s : scales)
+		for (auto &g : groups)
+			c[n++] = PpuLaunch{g[0], g[1], s[0], s[1]};
+	return c;
+}();
+static_assert(kTuneCandidates[0] == PpuLaunch{});
+
+// measure() returns this when the GPU stopped responding: the sweep ends.
+inline constexpr uint64_t kTuneAbort = ~0ull;
+
+struct TuneResult {
+	PpuLaunch best{};
+	uint64_t best_ticks = 0;	// 0: the default launch failed, nothing was tuned
+	uint64_t default_ticks = 0;
+	uint32_t measured = 0;		// candidates timed (including the default)
+	uint32_t rejected = 0;		// ... that failed or gave the wrong output
+	uint32_t skipped = 0;		// candidates that don't tile the image
+	bool aborted = false;
+};
+
+// Time every candidate that fits a width x height image: measure(launch)
+// returns the ticks for one run, or 0 if the run failed or its output was
+// wrong (the candidate is then dropped). Each candidate is the best of
+// `reps` runs. A candidate replaces the default only if it is faster by more
+// than `margin_pct` percent, so timer noise does not pick a shape that is no
+// better.
+template<typename Measure>
+TuneResult autotune(uint32_t width, uint32_t height, Measure &&measure, uint32_t reps = 3, uint32_t margin_pct = 3)
+{
+	TuneResult r;
+	for (const PpuLaunch &l : kTuneCandidates) {
+		if (!l.fits(width, height)) {
+			r.skipped++;
+			continue;
+		}
+		uint64_t t = 0;
+		for (uint32_t i = 0; i < reps; i++) {
+			uint64_t ti = measure(l);
+			if (ti == kTuneAbort) {
+				r.aborted = true;
+				return r;
+			}
+			if (ti == 0) {
+				t = 0;
+				break;
+			}
+			if (t == 0 || ti < t)
+				t = ti;
+		}
+		r.measured++;
+		if (t == 0) {
+			r.rejected++;
+			if (l == PpuLaunch{})
+				return r; // no baseline to compare against
+			continue;
+		}
+		if (l == PpuLaunch{}) {
+			r.default_ticks = r.best_ticks = t;
+		} else if (t < r.best_ticks && t * 100 < r.default_ticks * (100 - margin_pct)) {
+			r.best = l;
+			r.best_ticks = t;
+		}
+	}
+	return r;
+}
+
+// -----------------------------------------------------------------------------
+//  Tuning table
+// -----------------------------------------------------------------------------
+
+struct TuneEntry {
+	uint32_t kernel = 0; // Kernel::id
+	uint32_t width = 0;	 // bytes, as passed to the dispatch
+	uint32_t height = 0;
+	PpuLaunch launch{};
+	uint32_t ticks = 0; // measured time, for reporting
+};
+
+class TuneTable {
+public:
+	static constexpr uint32_t kCapacity = 32;
+	static constexpr uint32_t kMagic = 0x54555050; // "PPUT"
+	static constexpr uint32_t kVersion = 1;
+
+	// Blob size (dwords) for n entries: magic, version, count, 5 per entry,
+	// checksum.
+	static constexpr uint32_t blob_dwords(uint32_t n)
+	{
+		return 3 + n * 5 + 1;
+	}
+
+	// The launch tuned for this kernel and size, or null.
+	const PpuLaunch *find(uint32_t kernel, uint32_t width, uint32_t height) const
+	{
+		for (uint32_t i = 0; i < count_; i++)
+			if (entries_[i].kernel == kernel && entries_[i].width == width && entries_[i].height == height)
+				return &entries_[i].launch;
+		return nullptr;
+	}
+
+	// Insert, or replace the entry for the same kernel and size. False if the
+	// launch is invalid or the table is full.
+	bool set(const TuneEntry &e)
+	{
+		if (!e.launch.valid())
+			return false;
+		for (uint32_t i = 0; i < count_; i++)
+			if (entries_[i].kernel == e.kernel && entries_[i].width == e.width && entries_[i].height == e.height) {
+				entries_[i] = e;
+				return true;
+			}
+		if (count_ == kCapacity)
+			return false;
+		entries_[count_++] = e;
+		return true;
+	}
+
+	uint32_t size() const
+	{
+		return count_;
+	}
+	const TuneEntry &operator[](uint32_t i) const
+	{
+		return entries_[i];
+	}
+	void clear()
+	{
+		count_ = 0;
+	}
+
+	// Write the blob; returns its size in dwords, or 0 if `out` is too small.
+	uint32_t save(std::span<uint32_t> out) const
+	{
+		const uint32_t n = blob_dwords(count_);
+		if (out.size() < n)
+			return 0;
+		uint32_t w = 0;
+		out[w++] = kMagic;
+		out[w++] = kVersion;
+		out[w++] = count_;
+		for (uint32_t i = 0; i < count_; i++) {
+			const TuneEntry &e = entries_[i];
+			out[w++] = e.kernel;
+			out[w++] = e.width;
+			out[w++] = e.height;
+			out[w++] = pack(e.launch);
+			out[w++] = e.ticks;
+		}
+		out[w] = checksum(out.first(w));
+		return n;
+	}
+
+	// Replace the table with a saved blob. False, with the table unchanged, if
+	// the blob is truncated, corrupt, from another version or holds an invalid
+	// launch.
+	bool load(std::span<const uint32_t> in)
+	{
+		if (in.size() < blob_dwords(0) || in[0] != kMagic || in[1] != kVersion || in[2] > kCapacity)
+			return false;
+		const uint32_t n = in[2];
+		if (in.size() < blob_dwords(n) || in[blob_dwords(n) - 1] != checksum(in.first(blob_dwords(n) - 1)))
+			return false;
+		std::array<TuneEntry, kCapacity> e{};
+		for (uint32_t i = 0; i < n; i++) {
+			const uint32_t *p = &in[3 + i * 5];
+			e[i] = TuneEntry{p[0], p[1], p[2], unpack(p[3]), p[4]};
+			if (!e[i].launch.valid())
+				return false;
+		}
+		entries_ = e;
+		count_ = n;
+		return true;
+	}
+
+private:
+	static uint32_t pack(const PpuLaunch &l)
+	{
+		return l.group_x | (l.group_y << 8) | (l.scale_x << 16) | (uint32_t(l.scale_y) << 24);
+	}
+	static PpuLaunch unpack(uint32_t v)
+	{
+		return PpuLaunch{uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)};
+	}
+	static uint32_t checksum(std::span<const uint32_t> words)
+	{
+		return ppu_program_id(words.data(), words.size(), 0);
+	}
+
+	std::array<TuneEntry, kCapacity> entries_{};
+	uint32_t count_ = 0;
+};
+
+// The table compute() and ComputeList consult.
+inline TuneTable &tune_table()
+{
+	static TuneTable t;
+	return t;
+}
+
+// The launch to use for `kernel` over width x height: the tuned one, or the
+// default.
+inline PpuLaunch tuned_launch(uint32_t kernel, uint32_t width, uint32_t height)
+{
+	const PpuLaunch *l = tune_table().find(kernel, width, height);
+	return l ? *l : PpuLaunch{};
+}
+
+} // namespace etna
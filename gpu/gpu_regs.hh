@@ -60,10 +60,18 @@ constexpr uint32_t CLK_IDLE_3D = 1 << 16;
 constexpr uint32_t CLK_IDLE_2D = 1 << 17;
 constexpr uint32_t CLK_ISOLATE_GPU = 1 << 19;
 
-// HI_IDLE_STATE bits (1 = idle). More exist; these are the interesting ones.
+// HI_IDLE_STATE bits (1 = idle), one per pipeline unit (etnaviv state_hi.xml.h).
 constexpr uint32_t IDLE_FE = 1 << 0;
+constexpr uint32_t IDLE_DE = 1 << 1;
 constexpr uint32_t IDLE_PE = 1 << 2;
+constexpr uint32_t IDLE_SH = 1 << 3;
+constexpr uint32_t IDLE_PA = 1 << 4;
+constexpr uint32_t IDLE_SE = 1 << 5;
+constexpr uint32_t IDLE_RA = 1 << 6;
+constexpr uint32_t IDLE_TX = 1 << 7;
+constexpr uint32_t IDLE_TS = 1 << 11;
 constexpr uint32_t IDLE_BLT = 1 << 12;
+constexpr uint32_t IDLE_MC = 1 << 14;
 
 // HI_INTR_ACKNOWLEDGE bits
 constexpr uint32_t INTR_FROM_PE = 1u << 2;
@@ -76,6 +84,71 @@ constexpr uint32_t INTR_AXI_BUS_ERROR = 1u << 31;
 constexpr uint32_t AXI_STATUS_DET_WR_ERR = 1 << 8;
 constexpr uint32_t AXI_STATUS_DET_RD_ERR = 1 << 9;
 
+// ------------------- Profile (debug) counters -------------------
+// Layout from etnaviv (state_hi.xml.h, etnaviv_perfmon.c), not verified on this
+// core. Readable only while HI_CLOCK_CONTROL.DISABLE_DEBUG_REGISTERS is clear.
+// Each MC_PROFILE_*_READ returns the counter its unit's field of
+// MC_PROFILE_CONFIGn selects; all are free-running 32-bit (take wrapping
+// deltas). HI_TOTAL_CYCLES / HI_TOTAL_IDLE_CYCLES above are in this group.
+constexpr uint32_t HI_PROFILE_READ_BYTES8 = 0x0040;	 // 8-byte units read by the GPU
+constexpr uint32_t HI_PROFILE_WRITE_BYTES8 = 0x0044; // 8-byte units written by the GPU
+constexpr uint32_t MC_PROFILE_RA_READ = 0x0448;
+constexpr uint32_t MC_PROFILE_TX_READ = 0x044C;
+constexpr uint32_t MC_PROFILE_FE_READ = 0x0450;
+constexpr uint32_t MC_PROFILE_PE_READ = 0x0454;
+constexpr uint32_t MC_PROFILE_DE_READ = 0x0458;
+constexpr uint32_t MC_PROFILE_SH_READ = 0x045C;
+constexpr uint32_t MC_PROFILE_PA_READ = 0x0460;
+constexpr uint32_t MC_PROFILE_SE_READ = 0x0464;
+constexpr uint32_t MC_PROFILE_MC_READ = 0x0468;
+constexpr uint32_t MC_PROFILE_HI_READ = 0x046C;
+constexpr uint32_t MC_PROFILE_CONFIG0 = 0x0470; // FE [3:0], DE [11:8], PE [19:16], SH [27:24]
+constexpr uint32_t MC_PROFILE_CONFIG1 = 0x0474; // PA [3:0], SE [11:8], RA [19:16], TX [27:24]
+constexpr uint32_t MC_PROFILE_CONFIG2 = 0x0478; // MC [7:0], HI [15:8]
+constexpr uint32_t MC_PROFILE_CONFIG3 = 0x047C;
+
+// MC_PROFILE_CONFIGn fields: a counter select shifted into its unit's place.
+constexpr uint32_t PROFILE_FE(uint32_t sel)
+{
+	return sel & 0xF;
+}
+constexpr uint32_t PROFILE_DE(uint32_t sel)
+{
+	return (sel & 0xF) << 8;
+}
+constexpr uint32_t PROFILE_PE(uint32_t sel)
+{
+	return (sel & 0xF) << 16;
+}
+constexpr uint32_t PROFILE_SH(uint32_t sel)
+{
+	return (sel & 0xF) << 24;
+}
+constexpr uint32_t PROFILE_PA(uint32_t sel)
+{
+	return sel & 0xF;
+}
+constexpr uint32_t PROFILE_SE(uint32_t sel)
+{
+	return (sel & 0xF) << 8;
+}
+constexpr uint32_t PROFILE_RA(uint32_t sel)
+{
+	return (sel & 0xF) << 16;
+}
+constexpr uint32_t PROFILE_TX(uint32_t sel)
+{
+	return (sel & 0xF) << 24;
+}
+constexpr uint32_t PROFILE_MC(uint32_t sel)
+{
+	return sel & 0xFF;
+}
+constexpr uint32_t PROFILE_HI(uint32_t sel)
+{
+	return (sel & 0xFF) << 8;
+}
+
 // ------------------- FE (command stream front end) registers -------------------
 
 constexpr uint32_t FE_COMMAND_ADDRESS = 0x0654;
@@ -201,6 +274,14 @@ constexpr uint32_t RS_PIPE_DEST_ADDR0 = 0x16E0;
 constexpr uint32_t RS_PIPE_OFFSET0 = 0x1700; // x | y << 16
 constexpr uint32_t RS_PIPE_OFFSET1 = 0x1704;
 
+// RS_CONFIG source/dest formats (VIVS_RS_FORMAT_* in state.xml.h). The RS
+// converts between any two of them as it copies.
+constexpr uint32_t RS_FORMAT_X4R4G4B4 = 0;
+constexpr uint32_t RS_FORMAT_A4R4G4B4 = 1;
+constexpr uint32_t RS_FORMAT_X1R5G5B5 = 2;
+constexpr uint32_t RS_FORMAT_A1R5G5B5 = 3;
+constexpr uint32_t RS_FORMAT_R5G6B5 = 4;
+constexpr uint32_t RS_FORMAT_X8R8G8B8 = 5;
 constexpr uint32_t RS_FORMAT_A8R8G8B8 = 6;
 constexpr uint32_t RS_CLEAR_CONTROL_ENABLED1 = 1 << 16;
 constexpr uint32_t RS_KICK = 0xBEEBBEEB;
@@ -214,6 +295,37 @@ constexpr uint32_t RS_CONFIG_FLIP = 0x40000000;
 // Pair with RS_SOURCE_STRIDE = tiled_stride << 2 (a tile row = 4 pixel rows).
 // The 0x80000000 stride TILING bit is only for SUPER-tiled sources -- not us.
 constexpr uint32_t RS_CONFIG_SOURCE_TILED = 0x00000080;
+// Halve the copy in X and/or Y: each destination pixel is the box-filtered
+// 2x2 (2x1, 1x2) source pixels under it. RS_WINDOW_SIZE stays the SOURCE
+// size. Mesa sets these for MSAA resolves (VIVS_RS_CONFIG_DOWNSAMPLE_X/_Y).
+constexpr uint32_t RS_CONFIG_DOWNSAMPLE_X = 0x00000020;
+constexpr uint32_t RS_CONFIG_DOWNSAMPLE_Y = 0x00000040;
+
+// Compute dispatch ("CL", VIVS_CL_* in Mesa's state.xml.h). The PPU dispatch
+// template (ppu_dispatch.hh) writes these as raw words; the kick is its last
+// state before the drain.
+constexpr uint32_t CL_CONFIG = 0x0900;
+constexpr uint32_t CL_THREAD_ALLOCATION = 0x091C;
+constexpr uint32_t CL_KICKER = 0x0920; // write CL_KICK to start
+constexpr uint32_t CL_KICK = 0xBADABEEB;
+
+// Tile status (TS): a side buffer of 2 bits per 64-byte tile of a render
+// target. A tile marked cleared is never read from memory -- the PE and the
+// RS use the CLEAR_VALUE register instead -- so a clear only has to write
+// the TS buffer (etna_ts.hh). FAST_CLEAR is feature bit 0 and 2BITPERTILE
+// minor feature 0 bit 10; this core has both.
+constexpr uint32_t TS_FLUSH_CACHE = 0x1650; // write TS_FLUSH_CACHE_FLUSH
+constexpr uint32_t TS_MEM_CONFIG = 0x1654;
+constexpr uint32_t TS_COLOR_STATUS_BASE = 0x1658;  // the color TS buffer
+constexpr uint32_t TS_COLOR_SURFACE_BASE = 0x165C; // the surface it covers
+constexpr uint32_t TS_COLOR_CLEAR_VALUE = 0x1660;
+constexpr uint32_t TS_DEPTH_STATUS_BASE = 0x1664;
+constexpr uint32_t TS_DEPTH_SURFACE_BASE = 0x1668;
+constexpr uint32_t TS_DEPTH_CLEAR_VALUE = 0x166C;
+constexpr uint32_t TS_FLUSH_CACHE_FLUSH = 1;
+constexpr uint32_t TS_MEM_CONFIG_DEPTH_FAST_CLEAR = 1 << 0;
+constexpr uint32_t TS_MEM_CONFIG_COLOR_FAST_CLEAR = 1 << 1;
+constexpr uint32_t TS_MEM_CONFIG_DEPTH_16BPP = 1 << 3;
 
 // GL_FLUSH_CACHE bits for finishing RS/PE work
 constexpr uint32_t GL_FLUSH_CACHE_COLOR = 1 << 1;
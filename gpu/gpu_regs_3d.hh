@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <cstdint>
 
 // =============================================================================
@@ -30,9 +31,33 @@ namespace VivanteGpu
 // ((instanceCount>>16)<<24) | (vertexCount & 0xffffff); word2 = startIndex;
 // word3 = 0 (pad).
 constexpr uint32_t FE_DRAW_INSTANCED = 0x60000000;
+constexpr uint32_t FE_DRAW_INSTANCED_INDEXED = 0x00100000; // vertices come through the index stream
 constexpr uint32_t PRIM_TRIANGLES = 4; // PRIMITIVE_TYPE_TRIANGLES
 constexpr uint32_t PRIM_TRIANGLE_STRIP = 5;
 
+// The four DRAW_INSTANCED words (etna_draw_instanced() in Mesa's
+// etnaviv_emit.h). `count` is vertices, or indices when `indexed`; `start`
+// is the first vertex (non-indexed) or the index bias added to every index.
+constexpr std::array<uint32_t, 4>
+cmd_draw_instanced(uint32_t prim, uint32_t count, uint32_t instances = 1, bool indexed = false, uint32_t start = 0)
+{
+	return {FE_DRAW_INSTANCED | (indexed ? FE_DRAW_INSTANCED_INDEXED : 0) | ((prim & 0xF) << 16) | (instances & 0xFFFF),
+			((instances >> 16) << 24) | (count & 0x00FFFFFF),
+			start,
+			0};
+}
+
+// ---- FE index stream (indexed draws) ----------------------------------------
+// The FE fetches the draw's indices from BASE_ADDR and hands each one to the
+// NFE as the vertex number. (Mesa: ctx->index_buffer, ETNA_DIRTY_INDEX_BUFFER.)
+constexpr uint32_t FE_INDEX_STREAM_BASE_ADDR = 0x0644; // reloc: index buffer (+ byte offset)
+constexpr uint32_t FE_INDEX_STREAM_CONTROL = 0x0648;   // TYPE in [1:0], PRIMITIVE_RESTART
+constexpr uint32_t FE_PRIMITIVE_RESTART_INDEX = 0x0674;
+constexpr uint32_t FE_INDEX_TYPE_U8 = 0;
+constexpr uint32_t FE_INDEX_TYPE_U16 = 1;
+constexpr uint32_t FE_INDEX_TYPE_U32 = 2; // needs the 32_BIT_INDICES feature (HALTI5 has it)
+constexpr uint32_t FE_INDEX_STREAM_CONTROL_PRIMITIVE_RESTART = 0x100;
+
 // Sync recipient for the RA (rasterizer) stage; FE/PE are in gpu_regs.hh
 // (SYNC_RECIPIENT_FE/PE). Used with GL_SEMAPHORE_TOKEN / the STALL command.
 constexpr uint32_t SYNC_RECIPIENT_RA = 5;
@@ -4,12 +4,19 @@
 #include "drivers/rcc_pll.hh"	 // get_pll_settings / PLLSettings::calc_freq
 #include "etna.hh"
 #include "etna_3d_tests.hh"
+#include "etna_bundle.hh"
 #include "fscale_sweep.hh"
 #include "memclock_sweep.hh"
+#include "neon_kernels.hh"
 #include "perfmon.hh"
+#include "ppu_autotune.hh"
+#include "ppu_kernels_tests.hh"
+#include "ppu_offload.hh"
 #include "print/print.hh"
 #include "stm32mp2xx.h" // RCC (clock diagnostics)
+#include <array>
 #include <cstdint>
+#include <cstring>
 
 // GPU example, now built on the etna API (see etna.hh / etna.cc).
 //
@@ -30,14 +37,18 @@ constexpr uint32_t swap_rb(uint32_t px)
 	return (px & 0xFF00FF00u) | ((px >> 16) & 0xFFu) | ((px & 0xFFu) << 16);
 }
 
-// Exercise the WAIT/LINK ring: run N small clears two ways and compare.
+// Exercise the WAIT/LINK ring: run N small clears three ways and compare.
 //  - sequential: submit + wait for each (one op in flight at a time)
 //  - pipelined:  submit all N, then wait only for the last
+//  - linked:     the same, but submit_link(): the ring LINKs into each
+//                stream's own buffer instead of copying it
 // The FE is never reset between ops (it has been running the ring since
 // init()); pipelining lets it run them back-to-back with no host round-trip.
+// For the two pipelined runs the CPU time spent inside submit() is reported
+// separately: that is the cost the zero-copy path removes.
 bool test_throughput(etna::Gpu &gpu)
 {
-	constexpr int N = 16;	   // <= 29 so the rolling event ids stay distinct
+	constexpr int N = 16;
 	constexpr uint32_t W = 64; // small: per-op overhead, not RS bandwidth, dominates
 	constexpr uint32_t H = 64;
 
@@ -51,22 +62,185 @@ bool test_throughput(etna::Gpu &gpu)
 		etna::clear(cs, buf, W, H, 0x11223300u | i);
 		if (!gpu.submit_and_wait(cs))
 			return false;
+		gpu.free(cs);
 	}
 	auto seq = (uint32_t)(read_cntpct() - t0);
 
-	auto t1 = read_cntpct();
-	etna::Fence last;
+	std::array<etna::CmdStream, N> css; // each stays live until the batch is done
 	for (int i = 0; i < N; i++) {
-		auto cs = gpu.new_cmd_stream();
-		etna::clear(cs, buf, W, H, 0x22334400u | i);
-		last = gpu.submit(cs); // queue without waiting
+		css[i] = gpu.new_cmd_stream();
+		etna::clear(css[i], buf, W, H, 0x22334400u | i);
 	}
-	if (!gpu.wait(last)) // one wait for the whole batch (FIFO -> last is last)
+
+	// Time a pipelined batch: total, and the CPU's share spent submitting.
+	auto run_batch = [&](auto submit, uint32_t &total, uint32_t &cpu) {
+		etna::Fence last;
+		cpu = 0;
+		auto t = read_cntpct();
+		for (auto &cs : css) {
+			auto s = read_cntpct();
+			last = submit(cs); // queue without waiting
+			cpu += (uint32_t)(read_cntpct() - s);
+		}
+		bool ok = gpu.wait(last); // one wait for the whole batch (FIFO -> last is last)
+		total = (uint32_t)(read_cntpct() - t);
+		return ok;
+	};
+	uint32_t pipe, pipe_cpu, link, link_cpu;
+	if (!run_batch([&](etna::CmdStream &cs) { return gpu.submit(cs); }, pipe, pipe_cpu))
 		return false;
-	auto pipe = (uint32_t)(read_cntpct() - t1);
+	buf.span<uint32_t>()[0] = 0; // so the linked batch has to rewrite it
+	buf.cpu_fini(etna::RelocWrite);
+	if (!run_batch([&](etna::CmdStream &cs) { return gpu.submit_link(cs); }, link, link_cpu))
+		return false;
+
+	buf.cpu_prep(etna::RelocRead);
+	uint32_t px = buf.span<uint32_t>()[0];
+	for (auto &cs : css)
+		gpu.free(cs);
+	gpu.free(buf);
 
 	print("Ring throughput (", int(N), " x ", int(W), "x", int(H), " clears): ");
-	print("sequential ", seq, " ticks, pipelined ", pipe, " ticks\n");
+	print("sequential ", seq, " ticks, pipelined ", pipe, " ticks (", pipe_cpu, " submitting), ");
+	print("linked ", link, " ticks (", link_cpu, " submitting)\n");
+	if (px != (0x22334400u | (N - 1))) {
+		print("ERROR: linked batch left 0x", Hex{px}, "\n");
+		return false;
+	}
+	return true;
+}
+
+// Queue far more submissions than there are event slots (30) without any CPU
+// wait in between, then wait once. The ring keeps placing blocks while it has
+// room, sends the overflow out without events, and wraps as the GPU retires
+// work. Every fence must be complete afterwards, and the buffer must hold the
+// last clear color (the FE is in-order).
+bool test_ring_queue(etna::Gpu &gpu)
+{
+	constexpr int N = 300;
+	constexpr uint32_t W = 16, H = 16;
+	auto buf = gpu.alloc(W * H * 4);
+	auto cs = gpu.new_cmd_stream(128);
+	if (!buf || !cs.bo())
+		return false;
+
+	std::array<etna::Fence, N> fences;
+	int no_event = 0;
+	auto t0 = read_cntpct();
+	for (int i = 0; i < N; i++) {
+		cs.reset(); // submit() copies the stream, so one buffer serves them all
+		etna::clear(cs, buf, W, H, 0xFF000000u | i);
+		fences[i] = gpu.submit(cs);
+		if (!fences[i])
+			return false;
+		no_event += fences[i].event_id == etna::RingTracker::kNoEvent;
+	}
+	if (!gpu.wait(fences[N - 1]))
+		return false;
+	auto dt = (uint32_t)(read_cntpct() - t0);
+
+	for (auto &f : fences)
+		if (!gpu.is_complete(f)) {
+			print("ERROR: fence ", f.seqno, " not complete after the last one\n");
+			return false;
+		}
+	buf.cpu_prep(etna::RelocRead);
+	if (uint32_t px = buf.span<uint32_t>()[0]; px != (0xFF000000u | (N - 1))) {
+		print("ERROR: ring queue left 0x", Hex{px}, "\n");
+		return false;
+	}
+	print("Ring queue: ", N, " submits (", no_event, " without an event) in ", dt, " ticks -- verified. \\o/\n");
+	gpu.free(cs);
+	gpu.free(buf);
+	return true;
+}
+
+// Record two clears once as bundles, then re-run them as chained submissions
+// with only the fill color patched (and the chain order swapped) each time.
+// The clear's four RS_FILL_VALUE data dwords are its patch slots.
+bool test_bundles(etna::Gpu &gpu)
+{
+	constexpr int N = 50;
+	constexpr uint32_t W = 16, H = 16;
+	std::array<etna::Bo, 2> bufs = {gpu.alloc(W * H * 4), gpu.alloc(W * H * 4)};
+	std::array<etna::Bundle, 2> b;
+	std::array<std::array<etna::Bundle::Slot, 4>, 2> fill;
+	for (uint32_t i = 0; i < 2; i++) {
+		b[i] = etna::Bundle{gpu.new_cmd_stream(128)};
+		if (!bufs[i] || !b[i].cs().bo())
+			return false;
+		etna::clear(b[i].cs(), bufs[i], W, H, 0);
+		auto words = b[i].cs().bo().span<const uint32_t>();
+		for (uint32_t k = 0, at = 0; at < b[i].cs().offset() && k < 4; at += 2)
+			if (words[at] == VivanteGpu::cmd_load_state(VivanteGpu::RS_FILL_VALUE0 + 4 * k))
+				fill[i][k++] = b[i].slot(at + 1, 1);
+		if (!fill[i][3] || !b[i].end())
+			return false;
+	}
+
+	auto t0 = read_cntpct();
+	for (int n = 0; n < N; n++) {
+		std::array<uint32_t, 2> color = {0xFF000000u | n, 0xFF800000u | n};
+		for (uint32_t i = 0; i < 2; i++)
+			for (auto &s : fill[i])
+				b[i].patch(s, std::span<const uint32_t>{&color[i], 1});
+		std::array<etna::Bundle *, 2> chain = {&b[n & 1], &b[~n & 1]};
+		etna::Fence f = gpu.submit_chain(chain);
+		if (!f || !gpu.wait(f))
+			return false;
+		for (uint32_t i = 0; i < 2; i++) {
+			bufs[i].cpu_prep(etna::RelocRead);
+			if (uint32_t px = bufs[i].span<uint32_t>()[W * H - 1]; px != color[i]) {
+				print("ERROR: bundle ", i, " frame ", n, " left 0x", Hex{px}, " (want 0x", Hex{color[i]}, ")\n");
+				return false;
+			}
+		}
+	}
+	auto dt = (uint32_t)(read_cntpct() - t0);
+
+	print("Bundles: ", N, " chained submits of 2 recorded clears (", b[0].dwords(), " dwords each, 4 patched) in ",
+		  dt, " ticks -- verified. \\o/\n");
+	for (uint32_t i = 0; i < 2; i++) {
+		gpu.free(b[i].cs());
+		gpu.free(bufs[i]);
+	}
+	return true;
+}
+
+// Per-frame transient buffers must not cost pool space: allocate and free a
+// frame's worth (a command stream, a vertex buffer, a 1 MB scratch target) many
+// times over, and check the pool comes back to exactly where it started with
+// the high-water mark raised by at most one frame.
+bool test_pool_reuse(etna::Gpu &gpu)
+{
+	constexpr int Frames = 1000;
+	auto before = gpu.pool_stats();
+	uint32_t frame_bytes = 0;
+
+	for (int i = 0; i < Frames; i++) {
+		auto cs = gpu.new_cmd_stream(256 + (i % 7) * 64); // vary sizes across classes
+		auto vtx = gpu.alloc(36 * 7 * 4);
+		auto rt = gpu.alloc(1024 * 1024);
+		if (!cs.bo() || !vtx || !rt) {
+			print("ERROR: pool reuse alloc failed at frame ", i, "\n");
+			return false;
+		}
+		if (i == 0)
+			frame_bytes = gpu.pool_stats().reserved - before.reserved;
+		gpu.free(rt);
+		gpu.free(vtx);
+		gpu.free(cs);
+	}
+
+	auto after = gpu.pool_stats();
+	print("Pool reuse (", Frames, " frames): used ", after.used, " B, peak ", after.peak, " B, frag ",
+		  after.fragmentation_pct(), "%");
+	if (after.used != before.used || after.live != before.live || after.peak > before.peak + frame_bytes) {
+		print("\nERROR: pool grew (used ", before.used, " -> ", after.used, ", peak ", before.peak, " -> ",
+			  after.peak, ")\n");
+		return false;
+	}
+	print("   -- verified. \\o/\n");
 	return true;
 }
 
@@ -167,6 +341,204 @@ bool test_blit_convert(etna::Gpu &gpu, const etna::Bo &dst, const etna::Bo &src)
 	return true;
 }
 
+// The 16-bit RS formats: clear to R5G6B5, blit the A8R8G8B8 gradient into each
+// 16-bit format and back out, and check every pixel against the conversion
+// reference (etna_format.hh). Uses dst as the 16-bit surface, then src as the
+// widened copy.
+bool test_blit_formats(etna::Gpu &gpu, const etna::Bo &dst, const etna::Bo &src)
+{
+	using etna::Format;
+	constexpr uint32_t N = ImgWidth * ImgHeight;
+	auto s = src.span<uint32_t>();
+	auto d = dst.span<uint16_t>();
+	auto cs = gpu.new_cmd_stream();
+
+	// Clear: half the bytes of test_fill.
+	for (uint32_t i = 0; i < N; i++)
+		d[i] = 0xBEEF;
+	dst.cpu_fini(etna::RelocWrite);
+	etna::clear(cs, dst, ImgWidth, ImgHeight, ClearColor, Format::R5G6B5);
+	auto start = read_cntpct();
+	if (!gpu.submit_and_wait(cs))
+		return false;
+	auto end = read_cntpct();
+	print("RS fill R5G6B5 (", ImgWidth, "x", ImgHeight, ") in ", (end - start), " ticks");
+	dst.cpu_prep(etna::RelocRead);
+	const uint32_t fill = etna::pack_pixel(Format::R5G6B5, ClearColor);
+	for (uint32_t i = 0; i < N; i++) {
+		if (d[i] != fill) {
+			print("\nERROR: 16-bit fill wrong at [", i, "] = 0x", Hex{d[i]}, " expected 0x", Hex{fill}, "\n");
+			return false;
+		}
+	}
+	print("   -- verified. \\o/\n");
+
+	// Narrowing blits, alpha varying so the A formats have something to keep.
+	for (uint32_t y = 0; y < ImgHeight; y++)
+		for (uint32_t x = 0; x < ImgWidth; x++)
+			s[y * ImgWidth + x] =
+				(((x ^ y) & 0xFFu) << 24) | ((x & 0xFFu) << 16) | ((y & 0xFFu) << 8) | ((x + y) & 0xFFu);
+	src.cpu_fini(etna::RelocWrite);
+
+	constexpr Format narrow[] = {
+		Format::R5G6B5, Format::A1R5G5B5, Format::X1R5G5B5, Format::A4R4G4B4, Format::X4R4G4B4};
+	for (Format f : narrow) {
+		const uint32_t mask = etna::format_mask(f);
+		for (uint32_t i = 0; i < N; i++)
+			d[i] = 0xBEEF;
+		dst.cpu_fini(etna::RelocWrite);
+		cs.reset();
+		etna::blit(cs, dst, f, src, Format::A8R8G8B8, ImgWidth, ImgHeight);
+		start = read_cntpct();
+		if (!gpu.submit_and_wait(cs))
+			return false;
+		end = read_cntpct();
+		dst.cpu_prep(etna::RelocRead);
+		for (uint32_t i = 0; i < N; i++) {
+			const uint32_t expect = etna::convert_pixel(Format::A8R8G8B8, f, s[i]);
+			if ((d[i] & mask) != expect) {
+				print("ERROR: blit to format ", uint32_t(f), " wrong at [", i, "] src 0x", Hex{s[i]});
+				print(" expected 0x", Hex{expect}, " got 0x", Hex{d[i]}, "\n");
+				return false;
+			}
+		}
+		print("RS blit A8R8G8B8 -> format ", uint32_t(f), " in ", (end - start), " ticks -- verified. \\o/\n");
+	}
+
+	// Widening: the last blit left X4R4G4B4 in dst; redo R5G6B5 and expand it
+	// back into src. Narrowing the result again must give the same pixels.
+	// How the RS fills the low bits is undocumented; the reference replicates
+	// the top bits, and any disagreement is reported rather than failed.
+	cs.reset();
+	etna::blit(cs, dst, Format::R5G6B5, src, Format::A8R8G8B8, ImgWidth, ImgHeight, etna::BlitNone, false);
+	etna::blit(cs, src, Format::A8R8G8B8, dst, Format::R5G6B5, ImgWidth, ImgHeight);
+	if (!gpu.submit_and_wait(cs))
+		return false;
+	src.cpu_prep(etna::RelocRead);
+	dst.cpu_prep(etna::RelocRead);
+	uint32_t not_replicated = 0;
+	for (uint32_t i = 0; i < N; i++) {
+		if (etna::pack_pixel(Format::R5G6B5, s[i]) != d[i]) {
+			print("ERROR: R5G6B5 -> A8R8G8B8 lost bits at [", i, "] 0x", Hex{d[i]}, " -> 0x", Hex{s[i]}, "\n");
+			return false;
+		}
+		if (s[i] != etna::convert_pixel(Format::R5G6B5, Format::A8R8G8B8, d[i]))
+			not_replicated++;
+	}
+	print("RS blit R5G6B5 -> A8R8G8B8 round trip -- verified. \\o/");
+	if (not_replicated)
+		print(" (", not_replicated, " pixels not bit-replicated)");
+	print("\n");
+	gpu.free(cs);
+	return true;
+}
+
+// Every channel of a and b within 1 -- the box filter's rounding is not
+// documented, so the reference's round-to-nearest is checked to +-1 and the
+// exact matches are counted.
+constexpr bool near_argb(uint32_t a, uint32_t b)
+{
+	for (unsigned c = 0; c < 32; c += 8) {
+		const int d = int((a >> c) & 0xFF) - int((b >> c) & 0xFF);
+		if (d > 1 || d < -1)
+			return false;
+	}
+	return true;
+}
+
+// RS 2x downsampling: a three-level mip chain (1024 -> 512 -> 256 -> 128) in
+// one stream, each level checked against the box-filter reference of the
+// level above it; then a downsampled resolve out of a CPU-written tiled image.
+bool test_downsample(etna::Gpu &gpu, const etna::Bo &dst, const etna::Bo &src)
+{
+	using etna::Format;
+	constexpr uint32_t S = ImgWidth; // square source
+	auto l2 = gpu.alloc(S / 4 * S / 4 * 4);
+	auto l3 = gpu.alloc(S / 8 * S / 8 * 4);
+	auto expect = gpu.alloc(S / 2 * S / 2 * 4);
+	auto tiled = gpu.alloc(S / 4 * S / 4 * 4);
+	if (!l2 || !l3 || !expect || !tiled)
+		return false;
+
+	// A pattern with detail at every scale, so each average means something.
+	auto pattern = [](uint32_t x, uint32_t y) {
+		uint32_t h = x * 0x9E3779B1u ^ y * 0x85EBCA77u;
+		return h ^ (h >> 15);
+	};
+	auto s = src.span<uint32_t>();
+	for (uint32_t y = 0; y < S; y++)
+		for (uint32_t x = 0; x < S; x++)
+			s[y * S + x] = pattern(x, y);
+	src.cpu_fini(etna::RelocWrite);
+
+	const etna::Bo *level[] = {&src, &dst, &l2, &l3};
+	auto cs = gpu.new_cmd_stream();
+	for (uint32_t i = 0; i < 3; i++) { // each level reads the last: the default drain orders them
+		etna::blit(cs,
+				   *level[i + 1],
+				   Format::A8R8G8B8,
+				   *level[i],
+				   Format::A8R8G8B8,
+				   S >> i,
+				   S >> i,
+				   etna::BlitDownsample2x);
+	}
+	auto start = read_cntpct();
+	if (!gpu.submit_and_wait(cs))
+		return false;
+	auto end = read_cntpct();
+	print("RS 2x downsample, 3-level mip chain from ", S, "x", S, " in ", (end - start), " ticks\n");
+
+	auto e = expect.span<uint32_t>();
+	for (uint32_t i = 0; i < 3; i++) {
+		const uint32_t w = S >> i, n = (w / 2) * (w / 2);
+		level[i + 1]->cpu_prep(etna::RelocRead);
+		const uint32_t *above = level[i]->span<uint32_t>().data();
+		etna::rs_blit_reference(e.data(), Format::A8R8G8B8, above, Format::A8R8G8B8, w, w, etna::BlitDownsample2x);
+		auto d = level[i + 1]->span<uint32_t>();
+		uint32_t exact = 0;
+		for (uint32_t k = 0; k < n; k++) {
+			if (!near_argb(d[k], e[k])) {
+				print("ERROR: mip level ", i + 1, " wrong at [", k, "]");
+				print(" expected 0x", Hex{e[k]}, " got 0x", Hex{d[k]}, "\n");
+				return false;
+			}
+			exact += d[k] == e[k];
+		}
+		print("  level ", i + 1, " (", w / 2, "x", w / 2, "): ", exact, " of ", n, " pixels exact -- verified. \\o/\n");
+	}
+
+	// Resolve: a 256x256 render (written tiled by the CPU) to 128x128.
+	constexpr uint32_t R = S / 4;
+	auto t = tiled.span<uint32_t>();
+	for (uint32_t y = 0; y < R; y++)
+		for (uint32_t x = 0; x < R; x++) {
+			t[(y / 4) * (R * 4) + (y % 4) * 4 + (x / 4) * 16 + (x % 4)] = pattern(x, y); // 4x4 basic tiles
+			s[y * R + x] = pattern(x, y); // the same image, linear, for the reference
+		}
+	tiled.cpu_fini(etna::RelocWrite);
+	cs.reset();
+	etna::resolve(cs, l3, tiled, R, R, R * 4, R / 2 * 4, 0, Format::A8R8G8B8, etna::BlitDownsample2x);
+	if (!gpu.submit_and_wait(cs))
+		return false;
+	l3.cpu_prep(etna::RelocRead);
+	etna::rs_blit_reference(e.data(), Format::A8R8G8B8, s.data(), Format::A8R8G8B8, R, R, etna::BlitDownsample2x);
+	auto d = l3.span<uint32_t>();
+	for (uint32_t k = 0; k < R / 2 * R / 2; k++)
+		if (!near_argb(d[k], e[k])) {
+			print("ERROR: downsampled resolve wrong at [", k, "] expected 0x", Hex{e[k]}, " got 0x", Hex{d[k]}, "\n");
+			return false;
+		}
+	print("RS 2x downsampled resolve (", R, "x", R, " tiled -> ", R / 2, "x", R / 2, ") -- verified. \\o/\n");
+
+	gpu.free(cs);
+	gpu.free(tiled);
+	gpu.free(expect);
+	gpu.free(l3);
+	gpu.free(l2);
+	return true;
+}
+
 // Real-image integration: alpha-blend two ARGB8888 images with a per-pixel
 // alpha, on the programmable shader cores via the compute API. An ARGB W x H
 // image is just a u8 image of (4*W) x H, so the per-byte alpha-lerp kernel
@@ -257,6 +629,22 @@ bool test_image_blend(etna::Gpu &gpu)
 			return false;
 		}
 
+	// And with NEON, the CPU side etna::Offload (ppu_offload.hh) picks when
+	// its model says the GPU would be slower.
+	auto nstart = read_cntpct();
+	neon::blend_lerp(ap.data(), bp.data(), lp.data(), cp.data(), BW * H);
+	auto neon_ticks = read_cntpct() - nstart;
+	print("Same blend on NEON in ", neon_ticks, " ticks");
+	if (gpu_ticks) {
+		int ratio = (neon_ticks * 10 + 5) / gpu_ticks;
+		print(" (NEON / GPU = ", ratio / 10, ".", ratio % 10, "x)");
+	}
+	print("\n");
+	if (std::memcmp(cp.data(), op.data(), BW * H)) {
+		print("ERROR: NEON/GPU blend mismatch\n");
+		return false;
+	}
+
 	return true;
 }
 
@@ -290,8 +678,18 @@ int main()
 		ok = test_cpu_fill(fb); // A/B: same buffer, CPU-filled, same DDRPERFM probe
 	if (ok)
 		ok = test_blit_convert(gpu, fb, src);
+	if (ok)
+		ok = test_blit_formats(gpu, fb, src);
+	if (ok)
+		ok = test_downsample(gpu, fb, src);
 	if (ok)
 		ok = test_throughput(gpu);
+	if (ok)
+		ok = test_ring_queue(gpu);
+	if (ok)
+		ok = test_bundles(gpu);
+	if (ok)
+		ok = test_pool_reuse(gpu);
 
 	// Not needed, but interesting test:
 	// if (ok)
@@ -307,6 +705,14 @@ int main()
 		ok = etna::compute_test(gpu);
 	if (ok)
 		ok = test_image_blend(gpu);
+	if (ok)
+		ok = image_kernels_test(gpu);
+	if (ok)
+		ok = offload_test(gpu);
+
+	// Not needed, but interesting test:
+	// if (ok)
+	// 	ppu_autotune(gpu); // tune PPU workgroup size / global scale per kernel and size
 
 	print("\n3D tests:\n");
 	if (ok)
@@ -319,11 +725,29 @@ int main()
 		ok = triangle_texture_test(gpu);
 	if (ok)
 		ok = spinning_cube_test(gpu);
+	if (ok)
+		ok = indexed_cube_test(gpu);
+	if (ok)
+		ok = instanced_cube_test(gpu);
+	if (ok)
+		ok = fast_clear_test(gpu);
+	if (ok)
+		ok = damage_test(gpu);
+	if (ok)
+		ok = capture_replay_test(gpu);
+	if (ok)
+		ok = profile_test(gpu);
+	if (ok)
+		ok = timeline_test(gpu);
 
 	// Not needed, but interesting test
 	// if (ok)
 	// 	ok = cube_size_sweep_test(gpu);
 
+	auto sc = gpu.shader_stats();
+	print("\nShader cache: ", sc.hits, " hits, ", sc.misses, " uploads, ", sc.evictions, " evictions; ", sc.resident,
+		  " programs (", sc.bytes, " bytes) resident\n");
+
 	print(ok ? "\nSUCCESS\n" : "\nFAILED (see above)\n");
 
 	while (true)
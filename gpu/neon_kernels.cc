@@ -0,0 +1,266 @@
+#include "neon_kernels.hh"
+#include <arm_neon.h>
+#include <cstring>
+
+namespace neon
+{
+namespace
+{
+// floor(p * w / 256) per byte: the GPU's mul_hi.
+inline uint8x16_t mulhi(uint8x16_t p, uint8x8_t w)
+{
+	uint16x8_t lo = vmull_u8(vget_low_u8(p), w);
+	uint16x8_t hi = vmull_u8(vget_high_u8(p), w);
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+// The reference over one row's pixels [x0, x1), for the ragged end.
+void conv_tail(const ppu::ConvSpec &s, const uint8_t *in, uint8_t *out, uint32_t w, uint32_t y, uint32_t x0, uint32_t x1)
+{
+	const int rx = int(s.rx), ry = int(s.ry);
+	for (uint32_t x = x0; x < x1; x++) {
+		uint32_t sum = 0;
+		for (int dy = -ry; dy <= ry; dy++)
+			for (int dx = -rx; dx <= rx; dx++)
+				sum += ppu::ref::mulhi(in[(int(y) + dy) * int(w) + int(x) + dx], s.w[(dy + ry) * (2 * rx + 1) + dx + rx]);
+		out[y * w + x] = uint8_t(sum > 255 ? 255 : sum);
+	}
+}
+
+// out[i] = f(vectors at i), 16 bytes a step; the last n % 16 through g(i).
+template<typename F, typename G>
+inline void each16(uint32_t n, uint8_t *out, F f, G g)
+{
+	uint32_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		vst1q_u8(out + i, f(i));
+	for (; i < n; i++)
+		out[i] = g(i);
+}
+
+// The same with a weight per byte.
+inline uint8x16_t mulhiq(uint8x16_t a, uint8x16_t b)
+{
+	uint16x8_t lo = vmull_u8(vget_low_u8(a), vget_low_u8(b));
+	uint16x8_t hi = vmull_u8(vget_high_u8(a), vget_high_u8(b));
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+} // namespace
+
+void conv(const ppu::ConvSpec &s, const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h)
+{
+	const int rx = int(s.rx), ry = int(s.ry);
+	if (w <= 2 * s.rx || h <= 2 * s.ry) {
+		ppu::ref::conv(s, in, out, w, h);
+		return;
+	}
+	// The non-zero taps: offset from the output pixel, and weight.
+	int off[49];
+	uint8x8_t wt[49];
+	uint32_t taps = 0;
+	for (int dy = -ry; dy <= ry; dy++)
+		for (int dx = -rx; dx <= rx; dx++)
+			if (uint8_t v = s.w[(dy + ry) * (2 * rx + 1) + dx + rx]) {
+				off[taps] = dy * int(w) + dx;
+				wt[taps++] = vdup_n_u8(v);
+			}
+
+	std::memset(out, 0, s.ry * w);
+	std::memset(out + (h - s.ry) * w, 0, s.ry * w);
+	for (uint32_t y = s.ry; y < h - s.ry; y++) {
+		uint8_t *o = out + y * w;
+		const uint8_t *p = in + y * w;
+		std::memset(o, 0, s.rx);
+		std::memset(o + w - s.rx, 0, s.rx);
+		uint32_t x = s.rx;
+		for (; x + 16 <= w - s.rx; x += 16) {
+			uint8x16_t acc = vdupq_n_u8(0);
+			for (uint32_t t = 0; t < taps; t++)
+				acc = vqaddq_u8(acc, mulhi(vld1q_u8(p + x + off[t]), wt[t]));
+			vst1q_u8(o + x, acc);
+		}
+		conv_tail(s, in, out, w, y, x, w - s.rx);
+	}
+}
+
+void sobel(const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h)
+{
+	if (w <= 2 || h <= 2) {
+		ppu::ref::sobel(in, out, w, h);
+		return;
+	}
+	const uint8x8_t q = vdup_n_u8(64), half = vdup_n_u8(128);
+	std::memset(out, 0, w);
+	std::memset(out + (h - 1) * w, 0, w);
+	for (uint32_t y = 1; y < h - 1; y++) {
+		const uint8_t *a = in + (y - 1) * w, *b = in + y * w, *c = in + (y + 1) * w;
+		uint8_t *o = out + y * w;
+		o[0] = o[w - 1] = 0;
+		uint32_t x = 1;
+		for (; x + 16 <= w - 1; x += 16) {
+			uint8x16_t tl = mulhi(vld1q_u8(a + x - 1), q), t = mulhi(vld1q_u8(a + x), half);
+			uint8x16_t tr = mulhi(vld1q_u8(a + x + 1), q), l = mulhi(vld1q_u8(b + x - 1), half);
+			uint8x16_t r = mulhi(vld1q_u8(b + x + 1), half), bl = mulhi(vld1q_u8(c + x - 1), q);
+			uint8x16_t bm = mulhi(vld1q_u8(c + x), half), br = mulhi(vld1q_u8(c + x + 1), q);
+			// Each side sums to at most 253: plain adds, as the reference
+			uint8x16_t L = vaddq_u8(vaddq_u8(tl, l), bl), R = vaddq_u8(vaddq_u8(tr, r), br);
+			uint8x16_t T = vaddq_u8(vaddq_u8(tl, t), tr), B = vaddq_u8(vaddq_u8(bl, bm), br);
+			vst1q_u8(o + x, vqaddq_u8(vabdq_u8(R, L), vabdq_u8(B, T)));
+		}
+		if (x < w - 1) {
+			// The ragged end: the reference over the last three rows, then
+			// copy back just those pixels.
+			uint8_t tmp[3 * 32], res[3 * 32];
+			const uint32_t x0 = x - 1, n = w - x0; // < 18 columns, with the apron
+			for (uint32_t k = 0; k < 3; k++)
+				std::memcpy(tmp + k * n, in + (y - 1 + k) * w + x0, n);
+			ppu::ref::sobel(tmp, res, n, 3);
+			std::memcpy(o + x, res + n + 1, n - 2);
+		}
+	}
+}
+
+void threshold(const ppu::ThresholdSpec &s, const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	const uint8x16_t t = vdupq_n_u8(s.t);
+	uint32_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t m = vcgtq_u8(vld1q_u8(in + i), t);
+		vst1q_u8(out + i, s.invert ? vmvnq_u8(m) : m);
+	}
+	ppu::ref::threshold(s, in + i, out + i, n - i);
+}
+
+void linear(const ppu::LinearSpec &s, const uint8_t *const in[3], uint8_t *out, uint32_t n)
+{
+	uint32_t order[3];
+	const uint32_t count = ppu::linear_order(s, order);
+	const uint8x16_t bias = vdupq_n_u8(uint8_t(s.bias > 0 ? s.bias : -s.bias));
+	uint32_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t p = vdupq_n_u8(0), m = vdupq_n_u8(0);
+		for (uint32_t k = 0; k < count; k++) {
+			const auto &t = s.term[order[k]];
+			const uint32_t a = uint32_t(t.coef < 0 ? -t.coef : t.coef);
+			const uint8x8_t frac = vdup_n_u8(uint8_t(a));
+			const uint8x16_t v = vld1q_u8(in[order[k]] + i), c = vdupq_n_u8(t.center);
+			const uint8x16_t up = vqsubq_u8(v, c), down = vqsubq_u8(c, v);
+			uint8x16_t &pos = t.coef > 0 ? p : m, &neg = t.coef > 0 ? m : p;
+			for (uint32_t j = 0; j < (a >> 8); j++) {
+				pos = vqaddq_u8(pos, up);
+				neg = vqaddq_u8(neg, down);
+			}
+			pos = vqaddq_u8(pos, mulhi(up, frac));
+			neg = vqaddq_u8(neg, mulhi(down, frac));
+			const uint8x16_t np = vqsubq_u8(p, m);
+			m = vqsubq_u8(m, p);
+			p = np;
+		}
+		if (s.bias > 0)
+			p = vqaddq_u8(p, bias);
+		else
+			m = vqaddq_u8(m, bias);
+		vst1q_u8(out + i, vqsubq_u8(p, m));
+	}
+	const uint8_t *const rest[3] = {in[0] + i, s.inputs > 1 ? in[1] + i : nullptr, s.inputs > 2 ? in[2] + i : nullptr};
+	ppu::ref::linear(s, rest, out + i, n - i);
+}
+
+// -----------------------------------------------------------------------------
+//  The ppu_asm.hh kernels
+// -----------------------------------------------------------------------------
+
+void copy(const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	std::memcpy(out, in, n);
+}
+
+void add(const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out,
+		[&](uint32_t i) {
+			uint8x16_t v = vld1q_u8(in + i);
+			return vaddq_u8(v, v);
+		},
+		[&](uint32_t i) { return uint8_t(in[i] * 2); });
+}
+
+void addsat(const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out,
+		[&](uint32_t i) {
+			uint8x16_t v = vld1q_u8(in + i);
+			return vqaddq_u8(v, v);
+		},
+		[&](uint32_t i) { return uint8_t(in[i] > 127 ? 255 : in[i] * 2); });
+}
+
+void not_(const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out, [&](uint32_t i) { return vmvnq_u8(vld1q_u8(in + i)); }, [&](uint32_t i) { return uint8_t(~in[i]); });
+}
+
+void and_imm(uint32_t imm, const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	imm &= 0xFFFFF; // the 20 bits an immediate carries
+	const uint8x16_t m = vreinterpretq_u8_u32(vdupq_n_u32(imm));
+	each16(
+		n, out, [&](uint32_t i) { return vandq_u8(vld1q_u8(in + i), m); },
+		[&](uint32_t i) { return uint8_t(in[i] & (imm >> (8 * (i % 4)))); });
+}
+
+void add2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out, [&](uint32_t i) { return vaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)); },
+		[&](uint32_t i) { return uint8_t(a[i] + b[i]); });
+}
+
+void addsat2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out, [&](uint32_t i) { return vqaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)); },
+		[&](uint32_t i) { return uint8_t(a[i] + b[i] > 255 ? 255 : a[i] + b[i]); });
+}
+
+void mul2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out, [&](uint32_t i) { return vmulq_u8(vld1q_u8(a + i), vld1q_u8(b + i)); },
+		[&](uint32_t i) { return uint8_t(a[i] * b[i]); });
+}
+
+void mulhi2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out, [&](uint32_t i) { return mulhiq(vld1q_u8(a + i), vld1q_u8(b + i)); },
+		[&](uint32_t i) { return ppu::ref::mulhi(a[i], b[i]); });
+}
+
+void blend_lerp(const uint8_t *a, const uint8_t *b, const uint8_t *alpha, uint8_t *out, uint32_t n)
+{
+	// Both terms <= 254 and so is their sum: a plain add, as the kernel.
+	each16(
+		n, out,
+		[&](uint32_t i) {
+			uint8x16_t al = vld1q_u8(alpha + i);
+			return vaddq_u8(mulhiq(vld1q_u8(a + i), al), mulhiq(vld1q_u8(b + i), vmvnq_u8(al)));
+		},
+		[&](uint32_t i) { return uint8_t(ppu::ref::mulhi(a[i], alpha[i]) + ppu::ref::mulhi(b[i], 255 - alpha[i])); });
+}
+
+void dp2x8(const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	each16(
+		n, out,
+		[&](uint32_t i) {
+			uint8x16_t sq = vmulq_u8(vld1q_u8(in + i), vld1q_u8(in + i));
+			return vaddq_u8(sq, sq);
+		},
+		[&](uint32_t i) { return uint8_t(2 * in[i] * in[i]); });
+}
+
+} // namespace neon
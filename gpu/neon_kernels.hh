@@ -0,0 +1,42 @@
+#pragma once
+#include "ppu_kernels.hh"
+#include <cstdint>
+
+// The ppu_kernels.hh image kernels on the Cortex-A35's NEON unit: the CPU
+// side of the GPU-vs-CPU benchmarks (ppu_kernels_tests.cc). Same specs, and
+// bit-exact with ppu::ref -- including the zeroed border -- so a result can
+// be checked byte for byte. 16 pixels per step, the ragged end of a row
+// through the reference.
+//
+// The host tests build this file too (tools/ppu_asm_test.cc, with
+// tools/neon_emu standing in for <arm_neon.h> off Arm).
+namespace neon
+{
+void conv(const ppu::ConvSpec &s, const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h);
+void sobel(const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h);
+void threshold(const ppu::ThresholdSpec &s, const uint8_t *in, uint8_t *out, uint32_t n);
+void linear(const ppu::LinearSpec &s, const uint8_t *const in[3], uint8_t *out, uint32_t n);
+
+// The ppu_asm.hh kernels over `n` bytes, with the per-byte meaning their
+// builders document (and the model in tools/ppu_asm_test.cc runs): what the
+// CPU runs when the offload model (ppu_offload.hh) says the GPU would be
+// slower. Bit-exact with the GPU, so either result will do.
+void copy(const uint8_t *in, uint8_t *out, uint32_t n);
+void add(const uint8_t *in, uint8_t *out, uint32_t n);	  // in + in, wraps
+void addsat(const uint8_t *in, uint8_t *out, uint32_t n); // min(2 in, 255)
+void not_(const uint8_t *in, uint8_t *out, uint32_t n);	  // 255 - in
+// in & imm, with the GPU's immediate: 20 bits to each 32-bit component, so
+// byte i is masked by byte i%4 of imm (i counted from the image start).
+void and_imm(uint32_t imm, const uint8_t *in, uint8_t *out, uint32_t n);
+void add2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n);	// a + b, wraps
+void addsat2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n); // min(a + b, 255)
+void mul2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n);	// (a b) & 0xFF
+void mulhi2(const uint8_t *a, const uint8_t *b, uint8_t *out, uint32_t n);	// (a b) >> 8
+// mul_hi(a, alpha) + mul_hi(b, 255 - alpha)
+void blend_lerp(const uint8_t *a, const uint8_t *b, const uint8_t *alpha, uint8_t *out, uint32_t n);
+// The vendor flop-reset kernel: both loads read `in`, so each output is a
+// sum of two squares, 2 in^2 (wrapping) for the pair of equal bytes it sees.
+// Only the constant images the flop reset feeds it are confirmed on the GPU
+// (ppu_asm.hh: the coefficient layout is not decoded).
+void dp2x8(const uint8_t *in, uint8_t *out, uint32_t n);
+} // namespace neon
@@ -1,6 +1,9 @@
 #include "perfmon.hh"
+#include "aarch64/system_reg.hh" // read_cntpct/read_cntfreq, CNTP
+#include "interrupt/interrupt.hh" // InterruptManager (CNTP PPI)
 #include "print/print.hh"
 #include "stm32mp2xx.h"
+#include <algorithm>
 
 namespace perfmon
 {
@@ -17,42 +20,66 @@ constexpr uint32_t CLR_ALL = 0x1FF;
 
 constexpr uint32_t DRAMINF_DDR4 = 0x2; // DRAM_TYPE[1:0]: DFI decode = DDR4
 
-// CFG0: SEL_EVENTn are 6-bit fields at bit 0/8/16/24 (n = 0..3).
+// CFG0: SEL_EVENTn are 6-bit fields at bit 0/8/16/24 (n = 0..3); CFG1 the
+// same for n = 4..7.
 constexpr uint32_t sel_event(unsigned n, uint32_t code)
 {
-	return (code & 0x3F) << (n * 8);
+	return (code & 0x3F) << (n % 4 * 8);
 }
 
-// SEL_EVENT codes -- RM0457 15.4.1, Table 65 (performance-logging interface,
-// unambiguous per-command totals from the DDRCTRL).
-constexpr uint32_t EV_OP_IS_WR = 34;  // every DRAM write command (one BL8)
-constexpr uint32_t EV_OP_IS_RD = 33;  // every DRAM read command (one BL8)
-constexpr uint32_t EV_OP_IS_ACT = 32; // every row activate
-constexpr uint32_t EV_OP_IS_PRE = 42; // every precharge
-
-// This DDR4 is 2x16-bit (32-bit bus), fixed BL8 => one RD/WR *command* moves
-// 8 beats x 4 B = 32 bytes. So each write-command event == 32 bytes.
-constexpr uint32_t BYTES_PER_EVENT = 32;
-
 // TCNT increments every 4 DFI_CLK. Measured empirically against the 64 MHz ARM
 // generic timer over the same window (tcnt=1972092 vs 827255 ARM ticks @64MHz =
 // 12.93 ms) => TCNT runs at ~150 MHz. (wr+rd)/TCNT stays a valid idle indicator;
 // this constant only scales the absolute MB/s cross-check.
 constexpr uint32_t TCNT_HZ = 150'000'000;
+
+DdrEventSet events_ = kDefaultEvents;
+
+// The trace being sampled, between ddr_sample_start() and ddr_sample_stop().
+struct Sampling {
+	DdrRing *ring = nullptr;
+	std::span<const DdrTap> taps;
+	uint64_t period = 0; // CNTP ticks
+	uint64_t next = 0;	 // CNTP_CVAL
+};
+Sampling sampling;
+
+// The timer condition (CNTPCT >= CVAL) holds the PPI until CVAL moves on.
+void on_sample_irq()
+{
+	Sampling &s = sampling;
+	if (!s.ring)
+		return;
+	s.ring->push(ddr_counts(s.taps));
+	s.next += s.period;
+	const uint64_t now = read_cntpct();
+	if (s.next <= now) // fell behind a period: the next slice covers it
+		s.next = now + s.period;
+	set_cntp_cval(s.next);
+}
 } // namespace
 
-void ddr_init()
+void ddr_init(const DdrEventSet &events)
 {
 	auto *p = DDRPERFM;
+	const DdrEventSet &e = events.valid() ? events : kDefaultEvents;
+	uint32_t cfg[2] = {};
+	for (uint32_t i = 0; i < e.count; i++)
+		cfg[i / 4] |= sel_event(i, e.code[i]);
 	p->CTRL = CTRL_STOP;	   // program only while stopped
 	p->DRAMINF = DRAMINF_DDR4; // DFI decode type
-	p->CFG0 =
-		sel_event(0, EV_OP_IS_WR) | sel_event(1, EV_OP_IS_RD) | sel_event(2, EV_OP_IS_ACT) | sel_event(3, EV_OP_IS_PRE);
-	p->CFG1 = 0;
+	p->CFG0 = cfg[0];
+	p->CFG1 = cfg[1];
 	p->CFG2 = 0; // FILT_POL* = 000 -> no rank/bank filtering (count all)
 	p->CFG3 = 0;
-	p->CFG4 = 0xFFFFFFFF; // TIME_OUT = max (don't auto-stop on a long fill)
-	p->CFG5 = 0x0F;		  // EVCNT_EN: enable counters 0..3 (set while stopped)
+	p->CFG4 = 0xFFFFFFFF;		   // TIME_OUT = max (don't auto-stop on a long fill)
+	p->CFG5 = (1u << e.count) - 1; // EVCNT_EN: enable counters 0..count-1 (set while stopped)
+	events_ = e;
+}
+
+const DdrEventSet &ddr_events()
+{
+	return events_;
 }
 
 void ddr_start()
@@ -64,9 +91,14 @@ void ddr_start()
 }
 
 DdrSample ddr_stop()
+{
+	DDRPERFM->CTRL = CTRL_STOP;
+	return ddr_read();
+}
+
+DdrSample ddr_read()
 {
 	auto *p = DDRPERFM;
-	p->CTRL = CTRL_STOP;
 	return DdrSample{
 		.writes = p->EVCNT0,
 		.reads = p->EVCNT1,
@@ -77,6 +109,21 @@ DdrSample ddr_stop()
 	};
 }
 
+DdrCounts ddr_counts(std::span<const DdrTap> taps)
+{
+	auto *p = DDRPERFM;
+	DdrCounts c;
+	c.t = read_cntpct();
+	volatile uint32_t *const evcnt = &p->EVCNT0;
+	for (uint32_t i = 0; i < events_.count; i++)
+		c.ev[i] = evcnt[i];
+	c.tcnt = p->TCNT;
+	c.status = p->STATUS;
+	for (uint32_t i = 0; i < taps.size() && i < kMaxTaps; i++)
+		c.tap[i] = taps[i].read();
+	return c;
+}
+
 void ddr_report(const char *label, const DdrSample &s, uint64_t expected_bytes)
 {
 	uint64_t wr_bytes = (uint64_t)s.writes * BYTES_PER_EVENT;
@@ -122,4 +169,113 @@ void ddr_report(const char *label, const DdrSample &s, uint64_t expected_bytes)
 	else
 		print("partial -> DDR neither idle nor saturated; look at burst size / outstanding\n");
 }
+
+bool ddr_sample_start(DdrRing &ring, uint32_t period_us, std::span<const DdrTap> taps)
+{
+	if (!period_us || taps.size() > kMaxTaps)
+		return false;
+	ddr_sample_stop();
+	const uint64_t period = uint64_t(period_us) * read_cntfreq() / 1'000'000;
+	ddr_start();
+	ring.start(ddr_counts(taps));
+	sampling = {.ring = &ring, .taps = taps, .period = period, .next = read_cntpct() + period};
+	set_cntp_cval(sampling.next);
+	InterruptManager::register_isr(NonSecurePhysicalTimer_IRQn, on_sample_irq);
+	InterruptControl::set_irq_priority(NonSecurePhysicalTimer_IRQn, 1, 0);
+	InterruptControl::enable_irq(NonSecurePhysicalTimer_IRQn, InterruptControl::LevelTriggered);
+	cntp_irq_enable(true);
+	cntp_enable(true);
+	return true;
+}
+
+void ddr_sample_stop()
+{
+	if (!sampling.ring)
+		return;
+	cntp_irq_enable(false);
+	InterruptControl::disable_irq(NonSecurePhysicalTimer_IRQn);
+	sampling.ring->push(ddr_counts(sampling.taps));
+	sampling.ring = nullptr;
+}
+
+namespace
+{
+constexpr uint32_t kBarWidth = 40;
+
+void print_pct(const char *what, uint32_t pm)
+{
+	print(what, int(pm / 10), ".", int(pm % 10), "%");
+}
+
+// The selected events the metrics don't already show.
+void print_other_events(const DdrSlice &s)
+{
+	for (uint32_t i = 0; i < events_.count; i++) {
+		const uint8_t code = events_.code[i];
+		if (code == EV_OP_IS_RD || code == EV_OP_IS_WR || code == EV_OP_IS_ACT)
+			continue;
+		if (const char *name = event_name(code))
+			print(" ", name, " ", int(s.ev[i]));
+		else
+			print(" ev", int(code), " ", int(s.ev[i]));
+	}
+}
+
+void print_metrics(const DdrMetrics &m, std::span<const DdrTap> taps)
+{
+	if (m.has_rw) {
+		print("rd ", int(m.read_mbps), " wr ", int(m.write_mbps), " MB/s, ");
+		print_pct("util ", m.util_pm);
+		if (m.has_act)
+			print_pct(", row hit ", m.row_hit_pm);
+	}
+	for (uint32_t i = 0; i < taps.size(); i++)
+		print(", ", taps[i].name, " ", int(m.tap_mbps[i]));
+	if (m.has_rw && !taps.empty())
+		print(", other ", int(m.other_mbps));
+}
+} // namespace
+
+void ddr_print_trace(const char *label, const DdrRing &ring, std::span<const DdrTap> taps)
+{
+	const uint64_t hz = read_cntfreq();
+	const uint32_t n = ring.size();
+	print("  [DDRPERFM] ", label, ": ", int(n), " slices");
+	if (ring.merged())
+		print(" (", int(ring.merged()), " merged: ring full)");
+	print("\n");
+	if (!n)
+		return;
+
+	DdrSlice total;
+	uint32_t peak = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		total.add(ring[i]);
+		peak = std::max(peak, ddr_metrics(events_, ring[i], hz, taps).mbps);
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		const DdrSlice &s = ring[i];
+		const DdrMetrics m = ddr_metrics(events_, s, hz, taps);
+		print("    +", int((s.t - ring[0].t) * 1'000'000 / hz), " us (", int(uint64_t(s.ticks) * 1'000'000 / hz));
+		print(" us): ");
+		print_metrics(m, taps);
+		print_other_events(s);
+		if (s.overflow)
+			print(" OVERFLOW(0x", Hex{s.overflow}, ")");
+		print(" |");
+		for (uint32_t b = peak ? m.mbps * kBarWidth / peak : 0; b; b--)
+			print("#");
+		print("\n");
+	}
+
+	const DdrMetrics m = ddr_metrics(events_, total, hz, taps);
+	print("    total ", int(uint64_t(total.ticks) * 1'000'000 / hz), " us: ");
+	if (m.has_rw)
+		print(int(m.read_bytes >> 10), " KiB read, ", int(m.write_bytes >> 10), " KiB written, ");
+	print_metrics(m, taps);
+	print_other_events(total);
+	if (m.has_rw)
+		print(", peak ", int(peak), " MB/s");
+	print("\n");
+}
 } // namespace perfmon
@@ -1,13 +1,116 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <span>
+#include <string_view>
 
 // DDRPERFM probe measures DDR-controller-side traffic so we can tell whether
 // the GPU RS-fill is bandwidth-bound (DDR saturated) or latency/serialization-
 // bound (DDR mostly idle while the fill crawls). DDRPERFM counts all masters,
 // in this example the A35 is parked on WFE during submit_and_wait, so
 // the traffic captured around a fill is effectively the GPU's.
+//
+// Two ways to use it:
+//  - a window: ddr_start() ... ddr_stop() around an op, ddr_report() the
+//    totals. Counts WR/RD/ACT/PRE (kDefaultEvents).
+//  - a trace: ddr_sample_start() has the generic timer interrupt every
+//    period and push the counters' deltas into a DdrRing, ddr_metrics()
+//    turns each slice into bandwidth, utilization and row-hit ratio, and
+//    ddr_print_trace() prints them over time. Any event set (ddr_init()).
+//
+// DDRPERFM can filter by rank and bank, not by bus master: it can't tell
+// the GPU's bursts from the CPU's or the LTDC's. A trace attributes traffic
+// through taps instead, byte counters a master keeps itself (the GPU's
+// HI_PROFILE_*_BYTES8, etna_profile.hh), and what no tap claims is "other".
+//
+// The slice and metric arithmetic is header-only (no registers), so it is
+// host tested (tools/host_tests.cc) on recorded counter values.
 namespace perfmon
 {
+// This DDR4 is 2x16-bit (32-bit bus), fixed BL8 => one RD/WR *command* moves
+// 8 beats x 4 B = 32 bytes. So each write-command event == 32 bytes.
+constexpr uint32_t BYTES_PER_EVENT = 32;
+
+// EVCNT0..7, each counting the event its SEL_EVENTn field selects.
+constexpr uint32_t kNumCounters = 8;
+constexpr uint32_t kNumEventCodes = 64; // SEL_EVENTn is 6 bits
+constexpr uint32_t kNoCounter = ~0u;
+
+// SEL_EVENT codes -- RM0457 15.4.1, Table 65 (performance-logging interface,
+// unambiguous per-command totals from the DDRCTRL).
+constexpr uint8_t EV_OP_IS_WR = 34;	 // every DRAM write command (one BL8)
+constexpr uint8_t EV_OP_IS_RD = 33;	 // every DRAM read command (one BL8)
+constexpr uint8_t EV_OP_IS_ACT = 32; // every row activate
+constexpr uint8_t EV_OP_IS_PRE = 42; // every precharge
+
+// Names for the codes checked on this board (the byte counts match what
+// was moved). Every other code of Table 65 can be selected too, by number:
+// it prints as "evN" until it is checked and given a row here.
+struct DdrEvent {
+	const char *name;
+	uint8_t code;
+};
+
+inline constexpr DdrEvent kDdrEvents[] = {
+	{"wr", EV_OP_IS_WR},
+	{"rd", EV_OP_IS_RD},
+	{"act", EV_OP_IS_ACT},
+	{"pre", EV_OP_IS_PRE},
+};
+
+// The name of event `code`, or nullptr.
+constexpr const char *event_name(uint8_t code)
+{
+	for (const DdrEvent &e : kDdrEvents)
+		if (e.code == code)
+			return e.name;
+	return nullptr;
+}
+
+// The event code called `name` ("wr", or "ev35" for any code), or -1.
+constexpr int find_event(std::string_view name)
+{
+	for (const DdrEvent &e : kDdrEvents)
+		if (name == e.name)
+			return e.code;
+	if (name.size() < 3 || name.size() > 4 || !name.starts_with("ev"))
+		return -1;
+	int code = 0;
+	for (char c : name.substr(2)) {
+		if (c < '0' || c > '9')
+			return -1;
+		code = code * 10 + (c - '0');
+	}
+	return code < int(kNumEventCodes) ? code : -1;
+}
+
+// What EVCNT0..count-1 count, in order.
+struct DdrEventSet {
+	uint8_t code[kNumCounters] = {};
+	uint32_t count = 0;
+
+	constexpr bool valid() const
+	{
+		if (count > kNumCounters)
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+			if (code[i] >= kNumEventCodes)
+				return false;
+		return true;
+	}
+	// The counter counting `ev`, or kNoCounter.
+	constexpr uint32_t find(uint8_t ev) const
+	{
+		for (uint32_t i = 0; i < count && i < kNumCounters; i++)
+			if (code[i] == ev)
+				return i;
+		return kNoCounter;
+	}
+};
+
+// What the window API (DdrSample, ddr_report()) and the GPU profiler read.
+inline constexpr DdrEventSet kDefaultEvents{{EV_OP_IS_WR, EV_OP_IS_RD, EV_OP_IS_ACT, EV_OP_IS_PRE}, 4};
+
 struct DdrSample {
 	uint32_t writes; // EVCNT0 = PERF_OP_IS_WR (one BL8 write command)
 	uint32_t reads;	 // EVCNT1 = PERF_OP_IS_RD (one BL8 read command)
@@ -17,8 +120,190 @@ struct DdrSample {
 	uint32_t status; // STATUS: bits [7:0] = per-counter overflow
 };
 
+// -----------------------------------------------------------------------------
+//  Traces: taps, snapshots, slices and their metrics
+// -----------------------------------------------------------------------------
+
+// A master's own count of the bytes it moved: `read()` returns a free-running
+// (wrapping) count of `bytes_per_unit` units. It is called from the sampling
+// interrupt, so it must be quick and safe there.
+struct DdrTap {
+	const char *name;
+	uint32_t (*read)();
+	uint32_t bytes_per_unit;
+};
+
+constexpr uint32_t kMaxTaps = 4;
+
+// Everything read at one instant.
+struct DdrCounts {
+	uint64_t t = 0;					 // read_cntpct()
+	uint32_t ev[kNumCounters] = {};	 // EVCNTn
+	uint32_t tcnt = 0;				 // TCNT
+	uint32_t status = 0;			 // STATUS
+	uint32_t tap[kMaxTaps] = {};	 // DdrTap::read()
+};
+
+// What happened between two DdrCounts. The counters wrap at 32 bits, so a
+// slice can be up to one wrap long: 28 s of TCNT, the first to wrap.
+struct DdrSlice {
+	uint64_t t = 0;		 // read_cntpct() at its start
+	uint32_t ticks = 0;	 // read_cntpct() ticks long
+	uint32_t tcnt = 0;	 // TCNT ticks (BL8 burst slots)
+	uint32_t ev[kNumCounters] = {};
+	uint32_t tap[kMaxTaps] = {};
+	uint32_t overflow = 0; // STATUS overflow bits [7:0] that came up during it
+
+	static constexpr DdrSlice between(const DdrCounts &a, const DdrCounts &b)
+	{
+		DdrSlice s;
+		s.t = a.t;
+		s.ticks = uint32_t(b.t - a.t);
+		s.tcnt = b.tcnt - a.tcnt;
+		for (uint32_t i = 0; i < kNumCounters; i++)
+			s.ev[i] = b.ev[i] - a.ev[i];
+		for (uint32_t i = 0; i < kMaxTaps; i++)
+			s.tap[i] = b.tap[i] - a.tap[i];
+		s.overflow = b.status & ~a.status & 0xFF;
+		return s;
+	}
+
+	// Append `next` (which starts where this ends): totals over a trace.
+	constexpr void add(const DdrSlice &next)
+	{
+		if (!ticks)
+			t = next.t;
+		ticks += next.ticks;
+		tcnt += next.tcnt;
+		for (uint32_t i = 0; i < kNumCounters; i++)
+			ev[i] += next.ev[i];
+		for (uint32_t i = 0; i < kMaxTaps; i++)
+			tap[i] += next.tap[i];
+		overflow |= next.overflow;
+	}
+};
+
+// A slice in the units it's read in. The RD/WR figures need the set to
+// count EV_OP_IS_RD and EV_OP_IS_WR (has_rw), the row hits EV_OP_IS_ACT too.
+struct DdrMetrics {
+	uint64_t read_bytes = 0;
+	uint64_t write_bytes = 0;
+	uint32_t read_mbps = 0; // MB/s (10^6 bytes) over the slice's ticks
+	uint32_t write_mbps = 0;
+	uint32_t mbps = 0;		 // both
+	uint32_t util_pm = 0;	 // permille of the TCNT burst slots that carried a RD/WR
+	uint32_t row_hit_pm = 0; // permille of the RD/WRs that found their row open
+	uint32_t tap_mbps[kMaxTaps] = {};
+	uint32_t other_mbps = 0; // what none of the taps moved
+	bool has_rw = false;
+	bool has_act = false;
+};
+
+// `hz`: of the ticks (read_cntfreq()).
+constexpr DdrMetrics
+ddr_metrics(const DdrEventSet &set, const DdrSlice &s, uint64_t hz, std::span<const DdrTap> taps = {})
+{
+	auto mbps = [&](uint64_t bytes) { return s.ticks ? uint32_t(bytes * hz / s.ticks / 1'000'000) : 0; };
+	DdrMetrics m;
+	const uint32_t rd = set.find(EV_OP_IS_RD), wr = set.find(EV_OP_IS_WR), act = set.find(EV_OP_IS_ACT);
+	m.has_rw = rd != kNoCounter && wr != kNoCounter;
+	m.has_act = act != kNoCounter;
+	uint64_t tapped = 0;
+	for (uint32_t i = 0; i < taps.size() && i < kMaxTaps; i++) {
+		const uint64_t bytes = uint64_t(s.tap[i]) * taps[i].bytes_per_unit;
+		m.tap_mbps[i] = mbps(bytes);
+		tapped += bytes;
+	}
+	if (!m.has_rw)
+		return m;
+	const uint64_t rw = uint64_t(s.ev[rd]) + s.ev[wr];
+	m.read_bytes = uint64_t(s.ev[rd]) * BYTES_PER_EVENT;
+	m.write_bytes = uint64_t(s.ev[wr]) * BYTES_PER_EVENT;
+	m.read_mbps = mbps(m.read_bytes);
+	m.write_mbps = mbps(m.write_bytes);
+	m.mbps = mbps(m.read_bytes + m.write_bytes);
+	m.util_pm = s.tcnt ? uint32_t(rw * 1000 / s.tcnt) : 0;
+	if (m.has_act && rw)
+		m.row_hit_pm = rw > s.ev[act] ? uint32_t((rw - s.ev[act]) * 1000 / rw) : 0;
+	const uint64_t all = m.read_bytes + m.write_bytes;
+	m.other_mbps = all > tapped ? mbps(all - tapped) : 0;
+	return m;
+}
+
+// The slices of a trace, oldest first. One producer (push(), the sampling
+// interrupt) and one consumer (pop()). A push that finds it full doesn't
+// lose the counts: the next push's slice starts where the last stored one
+// ended, so it covers both periods (merged()).
+class DdrRing {
+public:
+	static constexpr uint32_t kSlices = 256; // a power of 2
+
+	// Forget every slice; the next one starts at `first`. Not while sampling.
+	void start(const DdrCounts &first)
+	{
+		last_ = first;
+		head_.store(0, std::memory_order_relaxed);
+		tail_.store(0, std::memory_order_relaxed);
+		merged_ = 0;
+	}
+
+	// The slice from the last push() (or start()) to `now`. False if full.
+	bool push(const DdrCounts &now)
+	{
+		const uint32_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) == kSlices) {
+			merged_++;
+			return false;
+		}
+		slices_[head % kSlices] = DdrSlice::between(last_, now);
+		last_ = now;
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(DdrSlice &out)
+	{
+		const uint32_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire))
+			return false;
+		out = slices_[tail % kSlices];
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	uint32_t size() const
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+	}
+	// The i-th oldest slice, i < size(), without popping it.
+	const DdrSlice &operator[](uint32_t i) const
+	{
+		return slices_[(tail_.load(std::memory_order_relaxed) + i) % kSlices];
+	}
+	// Pushes that found the ring full (their period is in the next slice).
+	uint32_t merged() const
+	{
+		return merged_;
+	}
+
+private:
+	DdrSlice slices_[kSlices];
+	DdrCounts last_;
+	std::atomic<uint32_t> head_ = 0, tail_ = 0; // free-running
+	uint32_t merged_ = 0;
+};
+
+// -----------------------------------------------------------------------------
+//  On the target (perfmon.cc)
+// -----------------------------------------------------------------------------
+
 // Program events + enable counters, leave stopped. Call once after DDR is up.
-void ddr_init();
+// The window API and the GPU profiler read EVCNT0..3 as kDefaultEvents:
+// select another set for traces only, and ddr_init() back after.
+void ddr_init(const DdrEventSet &events = kDefaultEvents);
+
+// The set ddr_init() selected.
+const DdrEventSet &ddr_events();
 
 // Clear and start counting.
 void ddr_start();
@@ -26,7 +311,28 @@ void ddr_start();
 // Stop and snapshot the counters.
 DdrSample ddr_stop();
 
+// Snapshot the counters and keep counting: for profilers that take deltas
+// (etna_profile.hh) rather than owning a start/stop window.
+DdrSample ddr_read();
+
+// Every selected counter, TCNT, STATUS and the taps, now.
+DdrCounts ddr_counts(std::span<const DdrTap> taps = {});
+
 // Pretty-print one sample with derived busy% / MB/s and a bound-vs-not verdict.
 // expected_bytes: the known transfer size for the bracketed op (0 = unknown).
 void ddr_report(const char *label, const DdrSample &s, uint64_t expected_bytes);
+
+// Start DDRPERFM and push a slice into `ring` every `period_us` from the
+// EL1 physical timer's interrupt (CNTP, PPI 30), until ddr_sample_stop().
+// `taps` (at most kMaxTaps) must outlive the sampling. False if the
+// arguments don't fit.
+bool ddr_sample_start(DdrRing &ring, uint32_t period_us, std::span<const DdrTap> taps = {});
+
+// Stop the timer and push the last, partial slice.
+void ddr_sample_stop();
+
+// One line per slice in `ring` (not popped) -- its start, MB/s read and
+// written, utilization, row hits, the taps' share, the other selected
+// events, and a bar of its bandwidth -- then the totals and the peak.
+void ddr_print_trace(const char *label, const DdrRing &ring, std::span<const DdrTap> taps = {});
 } // namespace perfmon
@@ -1,4 +1,5 @@
 #pragma once
+#include <bit>
 #include <cstdint>
 
 // =============================================================================
@@ -188,12 +189,36 @@ inline void set_tempreg(unsigned where, uint32_t addr, uint32_t swz, uint32_t /*
 	set_source(where, addr, swz, 0x0, false, false, 0, inst);
 }
 
+// Re-point a register operand already encoded: the destination, or source
+// `where` (ProgramBuilder patches in the registers it allocated).
+inline void set_destination_address(uint32_t address, uint32_t *inst)
+{
+	setbits(inst[0], 22, 16, address);
+}
+inline void set_source_address(unsigned where, uint32_t address, uint32_t *inst)
+{
+	switch (where) {
+		case 0: setbits(inst[1], 20, 12, address); break;
+		case 1: setbits(inst[2], 15, 7, address); break;
+		case 2: setbits(inst[3], 12, 4, address); break;
+	}
+}
+
 // gckPPU_GetPixel
 inline uint32_t get_pixel(uint32_t fmt)
 {
 	return (fmt == 0x3 || fmt == 0x6) ? 7 : 15;
 }
 
+// Constants a kernel reads as uniforms: dwords of the c2..c5 block (c2.x is
+// word 0) that the dispatch loads after the image descriptors. Only what the
+// input images leave free can hold them -- all 16 words with one input, from
+// word 4 (c3) with two, from word 8 (c4) with three.
+struct Uniforms {
+	uint32_t first = 0, count = 0;
+	uint32_t words[16] = {};
+};
+
 // A built shader: its size in dwords and how many temp registers it uses.
 // Both feed the dispatch (InstCount / RegCount). A "kernel" is one of these
 // builders; add more to run other computations.
@@ -203,6 +228,90 @@ struct ShaderInfo {
 	unsigned reg_count;	  // temp registers the shader uses
 };
 
+// -----------------------------------------------------------------------------
+//  Element types
+// -----------------------------------------------------------------------------
+// The instruction type field (isa.xml INST_TYPE; the vendor's dataType 0x7 is
+// u8). On an ALU op it selects how the 128-bit register splits into lanes --
+// 16 x 8-bit, 8 x 16-bit (u16/s16/f16, packed) or 4 x 32-bit -- and the
+// arithmetic: integers wrap (IADDSAT clamps to the type's range), floats are
+// IEEE and .sat clamps them to [0, 1].
+//
+// Only the u8 image descriptor (the vendor's, ppu_dispatch.hh) is known for
+// this core, so typed kernels keep img_load/img_store at u8 -- they move 16
+// raw bytes per thread either way -- and put the element type on the ALU ops
+// only. A typed image is then a u8 image of width * elem_bytes() bytes.
+enum : uint32_t {
+	TYPE_F32 = 0x0,
+	TYPE_S32 = 0x1,
+	TYPE_S8 = 0x2,
+	TYPE_U16 = 0x3,
+	TYPE_F16 = 0x4,
+	TYPE_S16 = 0x5,
+	TYPE_U32 = 0x6,
+	TYPE_U8 = 0x7,
+};
+
+constexpr uint32_t elem_bytes(uint32_t type)
+{
+	switch (type) {
+		case TYPE_S8:
+		case TYPE_U8:
+			return 1;
+		case TYPE_U16:
+		case TYPE_F16:
+		case TYPE_S16:
+			return 2;
+		default:
+			return 4;
+	}
+}
+
+constexpr bool is_float_type(uint32_t type)
+{
+	return type == TYPE_F32 || type == TYPE_F16;
+}
+
+// IEEE half <-> float, round to nearest even (for filling and checking f16
+// images on the CPU, which has no half arithmetic of its own here).
+constexpr uint16_t f16_from_float(float f)
+{
+	uint32_t x = std::bit_cast<uint32_t>(f);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mag = x & 0x7FFFFFFF;
+	if (mag >= 0x7F800000) // inf / nan
+		return uint16_t(sign | 0x7C00 | (mag > 0x7F800000 ? 0x200 : 0));
+	if (mag >= 0x477FF000) // rounds past the largest half
+		return uint16_t(sign | 0x7C00);
+	if (mag < 0x38800000) { // half subnormal (or zero)
+		uint32_t shift = 126 - (mag >> 23);
+		if (shift > 24)
+			return uint16_t(sign);
+		uint32_t m = (mag & 0x7FFFFF) | 0x800000;
+		uint32_t h = m >> shift;
+		uint32_t rest = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+		h += rest > half || (rest == half && (h & 1));
+		return uint16_t(sign | h);
+	}
+	uint32_t h = ((mag >> 13) - (112u << 10)); // rebias 127 -> 15
+	uint32_t rest = mag & 0x1FFF;
+	h += rest > 0x1000 || (rest == 0x1000 && (h & 1));
+	return uint16_t(sign | h);
+}
+
+constexpr float float_from_f16(uint16_t h)
+{
+	uint32_t sign = uint32_t(h & 0x8000) << 16;
+	uint32_t e = (h >> 10) & 0x1F, m = h & 0x3FF;
+	if (e == 0x1F)
+		return std::bit_cast<float>(sign | 0x7F800000 | (m << 13));
+	if (e == 0) { // subnormal: m * 2^-24
+		float v = float(m) * (1.0f / 16777216.0f);
+		return sign ? -v : v;
+	}
+	return std::bit_cast<float>(sign | ((e + 112) << 23) | (m << 13));
+}
+
 // -----------------------------------------------------------------------------
 //  Kernel-building helpers
 // -----------------------------------------------------------------------------
@@ -223,6 +332,17 @@ inline void emit_img_load(uint32_t *I, uint32_t dst_reg, uint32_t slot, uint32_t
 	set_tempreg(1, 0, vx_swizzle2(0, 1), 0, I);
 }
 
+// img_load.u8 at coord r0 + (dx, dy), -16..15 each: the 5-bit XY offset the
+// vendor's VX compiler puts in src2 (VXC_5BITOFFSET_XY), so a neighbourhood
+// costs no coordinate arithmetic. Elements past the image edge read whatever
+// the image unit returns there; kernels leave those outputs undefined.
+inline void emit_img_load_at(uint32_t *I, uint32_t dst_reg, uint32_t slot, uint32_t dataType, int dx, int dy)
+{
+	emit_img_load(I, dst_reg, slot, dataType);
+	if (dx || dy)
+		set_immediate(2, (uint32_t(dx) & 0x1F) | ((uint32_t(dy) & 0x1F) << 5), 2, I);
+}
+
 // img_store.u8 output image (descriptor uniform c1) <- src_reg, at coord r0.
 inline void emit_img_store(uint32_t *I, uint32_t src_reg, uint32_t dataType, uint32_t cores)
 {
@@ -252,6 +372,33 @@ inline void emit_mul(uint32_t *I, uint32_t opcode, uint32_t dst, uint32_t src0,
 	set_tempreg(1, src1, VX_SWIZZLE, 0, I);
 }
 
+// Swizzle replicating one component (x=0 .. w=3) of a register.
+constexpr uint32_t vx_broadcast(uint32_t comp)
+{
+	return comp | (comp << 2) | (comp << 4) | (comp << 6);
+}
+
+// The ALU and multiply ops with the second operand a uniform component,
+// broadcast: dst := src0 <op> c<uniform>.<comp>. A component holding the same
+// byte four times (0x40404040) is then a per-byte constant -- what an
+// immediate can't be (see build_and_imm_shader).
+inline void emit_alu_uniform(
+	uint32_t *I, uint32_t opcode, uint32_t dst, uint32_t src0, uint32_t uniform, uint32_t comp, uint32_t dataType)
+{
+	add_opcode(opcode, 0, dataType, I);
+	set_destination(dst, VX_ENABLE, 0, I);
+	set_tempreg(0, src0, VX_SWIZZLE, 0, I);
+	set_uniform(2, uniform, vx_broadcast(comp), 0, I);
+}
+inline void emit_mul_uniform(
+	uint32_t *I, uint32_t opcode, uint32_t dst, uint32_t src0, uint32_t uniform, uint32_t comp, uint32_t dataType)
+{
+	add_opcode(opcode, 0, dataType, I);
+	set_destination(dst, VX_ENABLE, 0, I);
+	set_tempreg(0, src0, VX_SWIZZLE, 0, I);
+	set_uniform(1, uniform, vx_broadcast(comp), 0, I);
+}
+
 // Unary op, dst := ~src2 (NOT 0x5F; ~x == 255 - x for u8).
 inline void emit_not(uint32_t *I, uint32_t dst, uint32_t src2, uint32_t dataType)
 {
@@ -270,6 +417,28 @@ inline void emit_alu_imm(uint32_t *I, uint32_t opcode, uint32_t dst, uint32_t sr
 	set_immediate(2, imm, 2 /* u32: AMODE = type<<1 = 4 */, I);
 }
 
+// Typed add, dst := src0 + src2 as `type` lanes. `saturate`: integers clamp to
+// the type's range (IADDSAT 0x3B), floats to [0, 1] (ADD 0x01 with .sat).
+inline void emit_add_typed(uint32_t *I, uint32_t dst, uint32_t src0, uint32_t src2, uint32_t type, bool saturate)
+{
+	bool f = is_float_type(type);
+	add_opcode(saturate && !f ? 0x3B : 0x01, 0, type, I);
+	set_destination(dst, VX_ENABLE, saturate && f, I);
+	set_tempreg(0, src0, VX_SWIZZLE, 0, I);
+	set_tempreg(2, src2, VX_SWIZZLE, 0, I);
+}
+
+// Typed multiply, dst := src0 * src1: floats MUL 0x03 (.sat clamps to [0, 1]),
+// integers the low half, IMULLO 0x3C (wraps; `saturate` is ignored).
+inline void emit_mul_typed(uint32_t *I, uint32_t dst, uint32_t src0, uint32_t src1, uint32_t type, bool saturate)
+{
+	bool f = is_float_type(type);
+	add_opcode(f ? 0x03 : 0x3C, 0, type, I);
+	set_destination(dst, VX_ENABLE, saturate && f, I);
+	set_tempreg(0, src0, VX_SWIZZLE, 0, I);
+	set_tempreg(1, src1, VX_SWIZZLE, 0, I);
+}
+
 // =============================================================================
 //  Kernels -- each builds a shader program into `inst`, returns its ShaderInfo.
 //  Single-input first, then two-input, three-input, and the vendor dp2x8.
@@ -413,6 +582,58 @@ inline ShaderInfo build_blend_lerp_shader(uint32_t inst[32], uint32_t dataType =
 	return ShaderInfo{32, 5};
 }
 
+// -----------------------------------------------------------------------------
+//  Typed two-input kernels (u8, u16, s16, f16, f32 -- see "Element types")
+// -----------------------------------------------------------------------------
+// `type` goes where the u8 kernels take dataType, so make_kernel(gpu, build,
+// type) builds them; the loads and stores stay u8 moves. At TYPE_U8 they are
+// word-for-word the u8 kernels above (ppu_asm_test.cc checks).
+
+inline ShaderInfo build_typed2(uint32_t inst[16], uint32_t type, uint32_t cores, bool mul, uint32_t op, bool sat)
+{
+	for (unsigned i = 0; i < 16; i++)
+		inst[i] = 0;
+	emit_img_load(&inst[0], 1, 0, TYPE_U8); // r1 <- A (16 bytes)
+	emit_img_load(&inst[4], 2, 2, TYPE_U8); // r2 <- B
+	if (op)
+		emit_mul(&inst[8], op, 1, 1, 2, type);
+	else if (mul)
+		emit_mul_typed(&inst[8], 1, 1, 2, type, sat);
+	else
+		emit_add_typed(&inst[8], 1, 1, 2, type, sat);
+	emit_img_store(&inst[12], 1, TYPE_U8, cores);
+	return ShaderInfo{16, 3};
+}
+
+// out = A + B (integers wrap; floats IEEE).
+inline ShaderInfo build_add2_typed_shader(uint32_t inst[16], uint32_t type = TYPE_U8, uint32_t numShaderCores = 2)
+{
+	return build_typed2(inst, type, numShaderCores, false, 0, false);
+}
+
+// out = saturate(A + B): u16 clamps to 65535, s16 to -32768..32767, floats to
+// [0, 1].
+inline ShaderInfo build_addsat2_typed_shader(uint32_t inst[16], uint32_t type = TYPE_U8, uint32_t numShaderCores = 2)
+{
+	return build_typed2(inst, type, numShaderCores, false, 0, true);
+}
+
+// out = A * B: integers keep the low half (wraps), floats IEEE.
+inline ShaderInfo build_mul2_typed_shader(uint32_t inst[16], uint32_t type = TYPE_U8, uint32_t numShaderCores = 2)
+{
+	return build_typed2(inst, type, numShaderCores, true, 0, false);
+}
+
+// out = mul_hi(A, B) = (A * B) >> (8 * elem_bytes), signed for s16: a
+// fixed-point gain (s16 sample * Q16 gain). Integer types only -- for a float
+// type nothing is built (inst_dwords 0, so make_kernel() fails).
+inline ShaderInfo build_mulhi2_typed_shader(uint32_t inst[16], uint32_t type = TYPE_U8, uint32_t numShaderCores = 2)
+{
+	if (is_float_type(type))
+		return ShaderInfo{0, 0};
+	return build_typed2(inst, type, numShaderCores, true, 0x40, false);
+}
+
 // The vendor flop-reset kernel: img_load x2 -> dp2x8 -> img_store, a faithful
 // copy of _ProgramPPUInstruction. NOTE despite the vendor's comment this is NOT
 // a per-element add: dp2x8 is a dot-product (out[j] = sum of src0[k]*src1[k]
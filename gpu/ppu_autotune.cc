@@ -0,0 +1,146 @@
+#include "ppu_autotune.hh"
+#include "aarch64/system_reg.hh" // read_cntpct / read_cntfreq
+#include "ppu_dispatch.hh"
+#include "print/print.hh"
+#include <cstring>
+
+namespace
+{
+// Bytes past the output image that must still hold the poison after a run:
+// catches a launch whose groups run off the end.
+constexpr uint32_t kGuard = 4096;
+constexpr uint8_t kPoison = 0xEE;
+
+uint32_t elapsed_us(uint64_t dt, uint32_t fq)
+{
+	return dt ? (uint32_t)(dt * 1'000'000 / fq) : 0;
+}
+
+void print_launch(const etna::PpuLaunch &l)
+{
+	print("group ", l.group_x, "x", l.group_y, " scale ", l.scale_x, "x", l.scale_y);
+}
+} // namespace
+
+etna::TuneResult tune_kernel(etna::Gpu &g, const etna::Kernel &k, uint32_t inputs, uint32_t width, uint32_t height,
+							 uint32_t reps)
+{
+	const uint32_t n = width * height;
+	etna::Bo in[3], out = g.alloc(n + kGuard), ref = g.alloc(n);
+	for (uint32_t i = 0; i < inputs && i < 3; i++)
+		in[i] = g.alloc(n);
+	auto release = [&] {
+		for (auto &b : in)
+			if (b)
+				g.free(b);
+		if (out)
+			g.free(out);
+		if (ref)
+			g.free(ref);
+	};
+	if (!k || !out || !ref || !in[0] || (inputs > 1 && !in[1]) || (inputs > 2 && !in[2])) {
+		print("tune: kernel/buffer alloc failed\n");
+		release();
+		return {};
+	}
+	for (uint32_t i = 0; i < inputs; i++) {
+		auto p = in[i].span<uint8_t>();
+		for (uint32_t j = 0; j < n; j++)
+			p[j] = uint8_t(j * (7 + 2 * i) + (j >> 8) * 13 + i * 91);
+		in[i].cpu_fini(etna::RelocWrite);
+	}
+
+	auto run = [&](const etna::Bo &dst, const etna::PpuLaunch &l) -> uint64_t {
+		auto cs = g.new_cmd_stream(256);
+		etna::emit_ppu_dispatch(cs, in[0].gpu_addr(), dst.gpu_addr(), k.binary.gpu_addr(), k.inst_dwords,
+								k.reg_count, width, height, in[1] ? in[1].gpu_addr() : 0,
+								in[2] ? in[2].gpu_addr() : 0, l, &k.uniforms);
+		uint64_t t0 = read_cntpct();
+		if (!g.submit_and_wait(cs))
+			return etna::kTuneAbort; // leak the stream: the FE may still hold it
+		uint64_t dt = read_cntpct() - t0;
+		g.free(cs);
+		return dt ? dt : 1;
+	};
+
+	// The default launch's output is the reference every candidate must match.
+	// On a timeout the images are leaked with the stream: the hung dispatch
+	// may still read and write them.
+	if (run(ref, etna::PpuLaunch{}) == etna::kTuneAbort) {
+		etna::TuneResult r;
+		r.aborted = true;
+		return r;
+	}
+	ref.cpu_prep(etna::RelocRead);
+
+	auto measure = [&](const etna::PpuLaunch &l) -> uint64_t {
+		std::memset(out.span<uint8_t>().data(), kPoison, n + kGuard);
+		out.cpu_fini(etna::RelocWrite);
+		uint64_t t = run(out, l);
+		if (t == etna::kTuneAbort)
+			return t;
+		out.cpu_prep(etna::RelocRead);
+		auto o = out.span<uint8_t>();
+		if (std::memcmp(o.data(), ref.span<uint8_t>().data(), n))
+			return 0;
+		for (uint32_t i = n; i < n + kGuard; i++)
+			if (o[i] != kPoison)
+				return 0;
+		return t;
+	};
+
+	etna::TuneResult r = etna::autotune(width, height, measure, reps);
+	if (r.aborted)
+		return r; // leak the images, as above
+	if (r.best_ticks)
+		etna::tune_table().set({k.id, width, height, r.best, uint32_t(r.best_ticks)});
+	release();
+	return r;
+}
+
+void ppu_autotune(etna::Gpu &g)
+{
+	struct Case {
+		const char *name;
+		etna::ShaderBuilder build;
+		uint32_t inputs;
+	};
+	static const Case kCases[] = {
+		{"copy", ppu::build_copy_shader, 1},
+		{"add", ppu::build_add_shader, 1},
+		{"add2", ppu::build_add2_shader, 2},
+		{"blend_lerp", ppu::build_blend_lerp_shader, 3},
+	};
+	static const uint32_t kSizes[][2] = {{256, 256}, {1024, 64}, {4096, 600}};
+
+	uint32_t fq = read_cntfreq();
+	print("\nPPU autotune -- workgroup size x global scale, best of 3:\n");
+	for (const Case &c : kCases) {
+		etna::Kernel k = etna::make_kernel(g, c.build);
+		for (auto &sz : kSizes) {
+			etna::TuneResult r = tune_kernel(g, k, c.inputs, sz[0], sz[1]);
+			print("  ", c.name, " ", sz[0], "x", sz[1], ": ");
+			if (r.aborted || !r.best_ticks) {
+				print(r.aborted ? "GPU TIMEOUT, sweep stopped\n" : "default launch failed\n");
+				// After a timeout the reference is leaked like tune_kernel()'s
+				// images: put back, the cache could evict the code while the
+				// hung dispatch still fetches it.
+				if (!r.aborted)
+					g.put_shader(k.binary);
+				return;
+			}
+			uint32_t def_us = elapsed_us(r.default_ticks, fq), best_us = elapsed_us(r.best_ticks, fq);
+			print("default ", def_us, " us, best ");
+			print_launch(r.best);
+			print(" ", best_us, " us (", r.measured, " timed, ", r.rejected, " wrong, ", r.skipped,
+				  " don't fit)\n");
+		}
+		g.put_shader(k.binary);
+	}
+
+	static uint32_t blob[etna::TuneTable::blob_dwords(etna::TuneTable::kCapacity)];
+	uint32_t dwords = etna::tune_table().save(blob);
+	print("  tuning table, ", etna::tune_table().size(), " entries -- tune_table().load() this at boot:\n");
+	for (uint32_t i = 0; i < dwords; i++)
+		print(i % 6 ? " " : "    ", "0x", Hex{blob[i]}, ",", (i % 6 == 5 || i + 1 == dwords) ? "\n" : "");
+}
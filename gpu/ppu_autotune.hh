@@ -0,0 +1,18 @@
+#pragma once
+#include "etna.hh"
+#include "etna_tune.hh"
+#include <cstdint>
+
+// Tune the PPU launch shape (workgroup size x global scale) for one kernel
+// over a width x height u8 image with `inputs` input images (1..3): times
+// every candidate with read_cntpct, drops any whose output differs from the
+// default launch's or writes past the image, and records the winner in
+// tune_table(). See etna_tune.hh for the search. On a GPU timeout (`aborted`)
+// the images stay allocated: the hung dispatch may still write them.
+etna::TuneResult tune_kernel(
+	etna::Gpu &g, const etna::Kernel &k, uint32_t inputs, uint32_t width, uint32_t height, uint32_t reps = 3);
+
+// Sweep the stock kernels at a few sizes, print the timings and the tuning
+// table blob to paste into the firmware (tune_table().load() at boot). A GPU
+// timeout stops the sweep and keeps the kernel's shader reference.
+void ppu_autotune(etna::Gpu &g);
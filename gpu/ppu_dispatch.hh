@@ -0,0 +1,210 @@
+#pragma once
+#include "etna.hh"
+#include <cstdint>
+
+// =============================================================================
+//  ppu_dispatch.hh -- the PPU compute dispatch: vendor template + patching
+// =============================================================================
+// Ported from the gcnano vendor driver's flop_reset (_ProgramPPUInstruction +
+// _ProgramPPUCommand, dual MIT/GPL; used under MIT).
+//
+// It runs a shader "OutImage = InImage + InImage" (EVIS img_load x2 -> dp2x8
+// add -> img_store) over a 64x6 u8 image. The dispatch command sequence below
+// was extracted verbatim from _ProgramPPUCommand for OUR exact chip
+// (GCNANOULTRA31_VIP2, model 0x8000 rev 0x6205 customer 0x15), with every
+// parameter resolved (dataType 0x7, NumShaderCores 2, groupSize 1x1, global
+// scale 4x1, groupCount 16x6, RegCount 3, InstCount 16). The three buffer
+// addresses are patched in at record time (dword offsets 7/13/53). 0xBADABEEB at
+// state 0x0248 is the PPU dispatch "kick" (compute's analog of RS_KICKER).
+//
+// Emitting a dispatch is pure command-word arithmetic, so this is header-only:
+// the synchronous compute() calls (etna_compute.cc) and ComputeList
+// (etna_compute_list.hh) share it, and tools/host_tests.cc checks it.
+
+namespace etna
+{
+
+inline constexpr uint32_t kPpuDispatchDwords = 118;
+
+// This is a command stream for the FE that loads and runs a shader over an
+// input image, writing an output image. It is the fixed 64x6 sequence extracted
+// from the vendor's _ProgramPPUCommand; emit_ppu_dispatch() below uses it as a
+// TEMPLATE and patches the size/address/count slots so it works for any shader
+// and image size (the vendor computes the group counts from width/height, so
+// varying size is exactly what the dispatch is built to do).
+
+// clang-format off
+inline constexpr uint32_t kPpuDispatchTemplate[kPpuDispatchDwords] = {
+	0x08010E13, 0x00000002, 0x08010E02, 0x00000701, 0x48000000, 0x00000701, 0x0804D800, 0x00000000, // [7]=IN
+	0x00000040, 0x00060040, 0x444051F0, 0xFFFFFFFF, 0x0804D804, 0x00000000, 0x00000040, 0x00060040, // [13]=OUT
+	0x444051F0, 0xFFFFFFFF, 0x0810D808, 0x55555555, 0x00000000, 0x01234567, 0x89ABCDEF, 0x55555555,
+	0x01234567, 0x89ABCDEF, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0xFFFFFFFF, 0x08010240, 0x02000002, 0x0801022C, 0x0000001F,
+	0x08010420, 0x00000000, 0x08010403, 0x00000003, 0x08010416, 0x00000000, 0x08010409, 0x00000000,
+	0x0801021F, 0x00000000, 0x08010424, 0x00000004, 0x0801040A, 0x00000000, 0x08015580, 0x00000002, // [53]=INST
+	0x0801021A, 0x00000001, 0x08010425, 0x00000003, 0x08010402, 0x00001F01, 0x08010228, 0x00000000,
+	0x080102AA, 0x00000000, 0x08010E07, 0x00000000, 0x0801040C, 0x00000000, 0x08010201, 0x00000001,
+	0x08010E22, 0x00000000, 0x08010412, 0x00000000, 0x08010240, 0x03000002, 0x08010249, 0x00000000,
+	0x08010247, 0x00000001, 0x0801024B, 0x00000000, 0x0801024D, 0x00000000, 0x0801024F, 0x00000000,
+	0x08010256, 0x00000004, 0x08010257, 0x00000001, 0x08010258, 0x00000000, 0x08060250, 0x0000000F,
+	0x00000005, 0xFFFFFFFF, 0x00000000, 0x00000000, 0x000003FF, 0x00000000, 0x08010248, 0xBADABEEB, // kick
+	0x08010E03, 0x00000C20, 0x08010E02, 0x00000701, 0x48000000, 0x00000701, 0x08010E03, 0x00000C23,
+	0x08010E03, 0x00000C23, 0x08010594, 0x00000001, 0x08010E03, 0x00000C23,
+};
+// clang-format on
+
+// Template patch slots (dword offsets), verified against the extracted sequence.
+// The program is fetched through the shader instruction cache -- the same
+// NEWRANGE_LOW / RANGE_HIGH / INST_ADDR / ICACHE_CONTROL / ICACHE_COUNT
+// sequence etna_3d.cc emits for the PS -- so its length is not limited by an
+// on-chip instruction memory (ppu_program.hh).
+enum : unsigned {
+	kInAddr = 7,		// input image base address
+	kInStride = 8,		// input stride (bytes)
+	kInDims = 9,		// (height << 16) | width
+	kOutAddr = 13,		// output image base address
+	kOutStride = 14,	// output stride
+	kOutDims = 15,		// (height << 16) | width
+	kRegCount = 43,		// shader temp register count
+	kInstCount4 = 51,	// PS_HALTI5_RANGE_HIGH: InstCount / 4  (== number of instructions)
+	kInstAddr = 53,		// PS_INST_ADDR: shader binary base address
+	kInstCount4m1 = 59, // PS_ICACHE_COUNT: InstCount / 4 - 1
+	kThreadAlloc = 81,	// 0x0247: (gsx*gsy + cores*4 - 1)/(cores*4)
+	kGroupCountX = 95,	// groupCountX - 1  (== number of WORKGROUPS in X)
+	kGroupCountY = 96,	// groupCountY - 1
+	kGroupSizeX = 98,	// 0x0253: GroupSizeX - 1 (threads per workgroup, X)
+	kGroupSizeY = 99,	// 0x0254: GroupSizeY - 1
+	kGlobalScaleX = 89, // 0x0256: elements per thread, X
+	kGlobalScaleY = 91, // 0x0257: elements per thread, Y
+	// Second input image descriptor -- uniform c2, the first 4 words of the
+	// 0xD808 block (unused by single-input/copy shaders; the dp2x8 coefficients
+	// otherwise). A two-input shader's 2nd img_load reads c2.
+	kInBAddr = 19,	 // input B base address
+	kInBStride = 20, // input B stride
+	kInBDims = 21,	 // input B (height << 16) | width
+	kInBFmt = 22,	 // input B format (same as input A's 0xD803)
+	// Third input image descriptor -- uniform c3, next 4 words of the 0xD808
+	// block (0xD80C..0xD80F). Used by three-input kernels (e.g. alpha blend).
+	kInCAddr = 23,
+	kInCStride = 24,
+	kInCDims = 25,
+	kInCFmt = 26,
+};
+
+inline constexpr uint32_t kImgFormat = 0x444051F0; // u8 image format word (from the template)
+
+// How a dispatch tiles the image: each thread covers scale_x x scale_y
+// elements (the global scale) and threads are packed group_x x group_y per
+// workgroup. The default is the vendor's (1x1 groups, scale 4x1); an
+// autotuned one comes from the tuning table (etna_tune.hh).
+struct PpuLaunch {
+	uint8_t group_x = 1, group_y = 1;
+	uint8_t scale_x = 4, scale_y = 1;
+
+	bool operator==(const PpuLaunch &) const = default;
+
+	// Something the thread allocator takes: non-zero, at most 64 threads
+	// per workgroup.
+	constexpr bool valid() const
+	{
+		return group_x && group_y && scale_x && scale_y && group_x * group_y <= 64;
+	}
+
+	// Tiles a width x height image exactly, so no workgroup runs past the
+	// edge. The default launch fits every legal size (width a multiple of 16).
+	constexpr bool fits(uint32_t width, uint32_t height) const
+	{
+		return valid() && width % (scale_x * group_x) == 0 && height % (scale_y * group_y) == 0;
+	}
+};
+
+// Emit the PPU dispatch for `shader` over a `width` x `height` u8 image. The
+// group counts are derived from the size the way the vendor's _ProgramPPUCommand
+// does (globalScale 4x1 unless `launch` says otherwise), so this handles any
+// size. `uniforms` are a kernel's constants (ppu_kernels.hh), patched into the
+// c2..c5 words the input images leave free. Everything else (USC config,
+// format, kick, drain) is the fixed template.
+inline void emit_ppu_dispatch(CmdStream &cs,
+							  uint32_t in_addr,
+							  uint32_t out_addr,
+							  uint32_t shader_addr,
+							  uint32_t inst_dwords,
+							  uint32_t reg_count,
+							  uint32_t width,
+							  uint32_t height,
+							  uint32_t in_b_addr = 0,
+							  uint32_t in_c_addr = 0,
+							  const PpuLaunch &launch = {},
+							  const ppu::Uniforms *uniforms = nullptr)
+{
+	const uint32_t stride = width; // u8: 1 byte per pixel
+	const uint32_t dims = (height << 16) | width;
+	// groupSize defaults to the vendor's 1x1 (one thread per workgroup, each
+	// doing globalScale=4 pixels), so groupCount == thread count.
+	//
+	// We TRIED packing threads into up-to-8x8 workgroups to cut the 262144
+	// launches (kThreadAlloc/kGroupSizeX/Y are the registers). It verified
+	// correct but ran SLIGHTLY SLOWER: the thread count is unchanged (tiling cuts
+	// launches, not threads), so per-thread DDR latency still dominates; this Nano
+	// core has no cross-thread coalescing to gain; and bigger groups cut occupancy
+	// for register-heavy kernels (blend RegCount 5 -> 11% slower; copy RegCount 2
+	// unchanged). 1x1 maximizes occupancy for latency-hiding, so it wins here --
+	// in general; the autotuner (etna_tune.hh) measures it per kernel and size.
+	constexpr uint32_t cores = 2; // NumShaderCores
+	const uint32_t threads_x = (width + launch.scale_x - 1) / launch.scale_x;
+	const uint32_t threads_y = (height + launch.scale_y - 1) / launch.scale_y;
+	const uint32_t group_x = (threads_x + launch.group_x - 1) / launch.group_x;
+	const uint32_t group_y = (threads_y + launch.group_y - 1) / launch.group_y;
+	const uint32_t group_threads = launch.group_x * launch.group_y;
+
+	for (unsigned i = 0; i < kPpuDispatchDwords; i++) {
+		uint32_t v = kPpuDispatchTemplate[i];
+		// clang-format off
+		switch (i) {
+			case kInAddr:      v = in_addr; break;
+			case kInStride:    v = stride; break;
+			case kInDims:      v = dims; break;
+			case kOutAddr:     v = out_addr; break;
+			case kOutStride:   v = stride; break;
+			case kOutDims:     v = dims; break;
+			case kRegCount:    v = reg_count; break;
+			case kInstCount4:  v = inst_dwords / 4; break;
+			case kInstAddr:    v = shader_addr; break;
+			case kInstCount4m1: v = inst_dwords / 4 - 1; break;
+			case kGroupCountX: v = group_x - 1; break;
+			case kGroupCountY: v = group_y - 1; break;
+			case kThreadAlloc: v = (group_threads + cores * 4 - 1) / (cores * 4); break;
+			case kGroupSizeX:  v = launch.group_x - 1u; break;
+			case kGroupSizeY:  v = launch.group_y - 1u; break;
+			case kGlobalScaleX: v = launch.scale_x; break;
+			case kGlobalScaleY: v = launch.scale_y; break;
+		}
+		// clang-format on
+		if (uniforms && i >= kInBAddr + uniforms->first && i < kInBAddr + uniforms->first + uniforms->count)
+			v = uniforms->words[i - kInBAddr];
+		// Second input image (uniform c2), only for two-input shaders. Patches
+		// the first 4 words of the 0xD808 block into a real image descriptor.
+		if (in_b_addr) {
+			switch (i) {
+			case kInBAddr:   v = in_b_addr; break;
+			case kInBStride: v = stride; break;
+			case kInBDims:   v = dims; break;
+			case kInBFmt:    v = kImgFormat; break;
+			}
+		}
+		// Third input image (uniform c3), only for three-input shaders.
+		if (in_c_addr) {
+			switch (i) {
+			case kInCAddr:   v = in_c_addr; break;
+			case kInCStride: v = stride; break;
+			case kInCDims:   v = dims; break;
+			case kInCFmt:    v = kImgFormat; break;
+			}
+		}
+		cs.emit(v);
+	}
+	// No emit_pe_drain: the template already ends with the vendor's drain;
+	// submit() adds the ring's event + wait + link trailer.
+}
+
+} // namespace etna
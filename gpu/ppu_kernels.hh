@@ -0,0 +1,337 @@
+#pragma once
+#include "ppu_program.hh"
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+// =============================================================================
+//  ppu_kernels.hh -- image-processing kernels and their CPU references
+// =============================================================================
+// Neighbourhood filters (3x3/5x5 convolution, separable box and Gaussian blur,
+// Sobel), threshold and planar YUV <-> RGB, built with ProgramBuilder
+// (ppu_program.hh). All work on u8 images, one byte per pixel (a plane); an ARGB
+// image is four of them only for the pointwise kernels.
+//
+// What the hardware gives us shapes the arithmetic. There are no wide
+// accumulators -- each lane is a byte -- so a weighted sum is a saturating
+// sum of mul_hi terms, floor(p * w / 256) each, weights in 256ths -- which
+// reads dark by up to one per tap, so a separable pair of short passes stays
+// closer to the ideal filter than one wide pass. A
+// difference is a saturating subtract, a (-) b = max(a - b, 0), built as
+// ~sat(~a + b) from NOT and IADDSAT. Constants are per-byte broadcasts held
+// in the uniforms the input images leave free (ppu::Uniforms), so a kernel
+// has at most 16 distinct constants with one input and 8 with three.
+//
+// Neighbours come from img_load's XY offset (emit_img_load_at). Outputs
+// closer than the kernel's radius to an edge read past the image and are
+// undefined on the GPU; the references leave them 0 and only the interior is
+// compared.
+//
+// Each kernel is described by a small spec (ConvSpec, ThresholdSpec,
+// LinearSpec) that three things take: the builder (-> a Program for
+// make_kernel()), the bit-exact reference in ppu::ref, and the NEON version
+// in neon_kernels.hh.
+
+namespace ppu
+{
+
+// -----------------------------------------------------------------------------
+//  Specs
+// -----------------------------------------------------------------------------
+
+// Weighted sum over a (2rx+1) x (2ry+1) window, weights in 256ths, row-major
+// from (-rx, -ry): out = min(255, sum floor(p * w / 256)). Up to 7x7, three
+// instructions a tap; at most 16 distinct weights (the constant words).
+struct ConvSpec {
+	uint32_t rx = 1, ry = 1;
+	uint8_t w[49] = {};
+};
+
+// out = in > t ? 255 : 0 (or the inverse).
+struct ThresholdSpec {
+	uint8_t t = 127;
+	bool invert = false;
+};
+
+// out = clamp(bias + sum coef_i * (in_i - center_i) / 256) over 1..3 planes,
+// coef in 256ths (-511..511), every product floored separately. The running
+// sum is a positive and a negative byte, P and N. Terms go in smallest |coef|
+// first and the bias last, and P and N are netted against each other
+// (P (-) N, N (-) P) between terms, so a partial sum only clamps if it
+// leaves -255..255: Y + chroma adds the chroma up before Y.
+struct LinearSpec {
+	struct Term {
+		int16_t coef = 0;
+		uint8_t center = 0;
+	};
+	uint32_t inputs = 3;
+	Term term[3] = {};
+	int16_t bias = 0; // -255..255
+};
+
+// The order the terms go in: non-zero ones by |coef|, ties in input order.
+// Returns how many.
+constexpr uint32_t linear_order(const LinearSpec &s, uint32_t (&order)[3])
+{
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < s.inputs && i < 3; i++)
+		if (s.term[i].coef)
+			order[n++] = i;
+	auto mag = [&s](uint32_t i) { return s.term[i].coef < 0 ? -s.term[i].coef : s.term[i].coef; };
+	for (uint32_t i = 1; i < n; i++)
+		for (uint32_t j = i; j > 0 && mag(order[j]) < mag(order[j - 1]); j--) {
+			uint32_t t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+	return n;
+}
+
+enum class Axis { X, Y };
+
+// 1-D box blur of radius r (1..3) along one axis: 2r+1 taps of 256/(2r+1).
+constexpr ConvSpec box_blur(uint32_t r, Axis axis)
+{
+	ConvSpec s{axis == Axis::X ? r : 0, axis == Axis::Y ? r : 0, {}};
+	for (uint32_t i = 0; i < 2 * r + 1; i++)
+		s.w[i] = uint8_t(256 / (2 * r + 1));
+	return s;
+}
+
+// 1-D binomial (Gaussian) blur of radius r (1..3) along one axis; the
+// weights sum to 256.
+constexpr ConvSpec gaussian_blur(uint32_t r, Axis axis)
+{
+	constexpr uint8_t k[3][7] = {
+		{64, 128, 64},
+		{16, 64, 96, 64, 16},
+		{4, 24, 60, 80, 60, 24, 4},
+	};
+	ConvSpec s{axis == Axis::X ? r : 0, axis == Axis::Y ? r : 0, {}};
+	for (uint32_t i = 0; i < 2 * r + 1; i++)
+		s.w[i] = k[r - 1][i];
+	return s;
+}
+
+constexpr ConvSpec conv3x3(const uint8_t (&w)[9])
+{
+	ConvSpec s{1, 1, {}};
+	for (unsigned i = 0; i < 9; i++)
+		s.w[i] = w[i];
+	return s;
+}
+
+constexpr ConvSpec conv5x5(const uint8_t (&w)[25])
+{
+	ConvSpec s{2, 2, {}};
+	for (unsigned i = 0; i < 25; i++)
+		s.w[i] = w[i];
+	return s;
+}
+
+// Full-range BT.601 (JFIF) on planar 4:4:4 images. yuv_to_rgb(c) makes
+// channel c (0 R, 1 G, 2 B) from Y, U, V (c0, c2, c3); rgb_to_yuv(c) makes
+// Y, U or V from R, G, B. Coefficients rounded to 256ths.
+constexpr LinearSpec yuv_to_rgb(uint32_t channel)
+{
+	switch (channel) {
+		case 0: return LinearSpec{3, {{256, 0}, {0, 0}, {359, 128}}, 0};		 // Y + 1.402 V'
+		case 1: return LinearSpec{3, {{256, 0}, {-88, 128}, {-183, 128}}, 0}; // Y - 0.344 U' - 0.714 V'
+		default: return LinearSpec{3, {{256, 0}, {454, 128}, {0, 0}}, 0};	 // Y + 1.772 U'
+	}
+}
+
+constexpr LinearSpec rgb_to_yuv(uint32_t channel)
+{
+	switch (channel) {
+		case 0: return LinearSpec{3, {{77, 0}, {150, 0}, {29, 0}}, 1};		   // 0.299 R + 0.587 G + 0.114 B
+		case 1: return LinearSpec{3, {{-43, 0}, {-85, 0}, {128, 0}}, 128};  // -0.169 R - 0.331 G + 0.5 B
+		default: return LinearSpec{3, {{128, 0}, {-107, 0}, {-21, 0}}, 128}; // 0.5 R - 0.419 G - 0.081 B
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  Builders
+// -----------------------------------------------------------------------------
+inline Program &build_conv(Program &p, const ConvSpec &s, uint32_t numShaderCores = 2)
+{
+	ProgramBuilder b{p, 1, numShaderCores};
+	if (s.rx > 3 || s.ry > 3) {
+		b.fail();
+		return b.finish(b.zero());
+	}
+	p.radius_x = s.rx;
+	p.radius_y = s.ry;
+	const int rx = int(s.rx), ry = int(s.ry);
+	Val sum;
+	for (int dy = -ry; dy <= ry; dy++)
+		for (int dx = -rx; dx <= rx; dx++) {
+			uint8_t w = s.w[(dy + ry) * (2 * rx + 1) + dx + rx];
+			if (!w)
+				continue;
+			Val tap = b.mulhi(b.load(0, dx, dy), w);
+			sum = sum ? b.addsat(sum, tap) : tap;
+		}
+	return b.finish(sum ? sum : b.zero());
+}
+
+// The 3x3 Sobel gradient, L1 norm, at quarter scale: out = min(255, |R - L| +
+// |B - T|), where L, R, T, B are the [1 2 1]/4 sums of the left, right, top
+// and bottom neighbours -- about (|Gx| + |Gy|) / 4, so each fits a byte.
+inline Program &build_sobel(Program &p, uint32_t numShaderCores = 2)
+{
+	ProgramBuilder b{p, 1, numShaderCores};
+	p.radius_x = p.radius_y = 1;
+	auto tap = [&](int dx, int dy) { return b.mulhi(b.load(0, dx, dy), dx && dy ? 64 : 128); };
+	const Val tl = tap(-1, -1), t = tap(0, -1), tr = tap(1, -1), l = tap(-1, 0), r = tap(1, 0), bl = tap(-1, 1),
+			  bm = tap(0, 1), br = tap(1, 1);
+	const Val L = b.addsat(b.addsat(tl, l), bl), R = b.addsat(b.addsat(tr, r), br);
+	const Val T = b.addsat(b.addsat(tl, t), tr), B = b.addsat(b.addsat(bl, bm), br);
+	// |x - y| = (x (-) y) + (y (-) x), one of them 0
+	auto absdiff = [&](Val x, Val y) { return b.addsat(b.subsat(x, y), b.subsat(y, x)); };
+	return b.finish(b.addsat(absdiff(R, L), absdiff(B, T)));
+}
+
+inline Program &build_threshold(Program &p, const ThresholdSpec &s, uint32_t numShaderCores = 2)
+{
+	ProgramBuilder b{p, 1, numShaderCores};
+	Val v = b.subsat(b.load(0), s.t); // in (-) t: non-zero iff in > t
+	for (int i = 0; i < 8; i++)
+		v = b.addsat(v, v); // doubling saturates any non-zero to 255
+	return b.finish(s.invert ? b.not_(v) : v);
+}
+
+inline Program &build_linear(Program &p, const LinearSpec &s, uint32_t numShaderCores = 2)
+{
+	ProgramBuilder b{p, s.inputs, numShaderCores};
+	Val P, N; // the positive and negative sums; none yet
+	// acc += d * a / 256: whole multiples as repeated adds, then the 256ths
+	auto add_to = [&](Val &acc, Val d, uint32_t a) {
+		for (uint32_t k = 0; k < (a >> 8); k++)
+			acc = acc ? b.addsat(acc, d) : d;
+		if (a & 0xFF) {
+			Val f = b.mulhi(d, uint8_t(a));
+			acc = acc ? b.addsat(acc, f) : f;
+		}
+	};
+
+	uint32_t order[3];
+	const uint32_t n = linear_order(s, order);
+	for (uint32_t k = 0; k < n && !b.failed(); k++) {
+		const uint32_t i = order[k];
+		const auto &t = s.term[i];
+		const uint32_t a = uint32_t(t.coef < 0 ? -t.coef : t.coef);
+		const bool up = t.coef > 0;
+		const Val in = b.load(i);
+		if (!t.center) {
+			add_to(up ? P : N, in, a);
+		} else {
+			add_to(up ? P : N, b.subsat(in, t.center), a);
+			add_to(up ? N : P, b.subsat(t.center, in), a);
+		}
+		if ((k + 1 < n || s.bias) && P && N) {
+			const Val net = b.subsat(P, N);
+			N = b.subsat(N, P);
+			P = net;
+		}
+	}
+	if (s.bias > 0)
+		P = P ? b.addsat(P, uint8_t(s.bias)) : b.addsat(b.zero(), uint8_t(s.bias));
+	else if (s.bias < 0)
+		N = N ? b.addsat(N, uint8_t(-s.bias)) : b.addsat(b.zero(), uint8_t(-s.bias));
+	if (!P)
+		P = b.zero();
+	return b.finish(N ? b.subsat(P, N) : P);
+}
+
+// -----------------------------------------------------------------------------
+//  References: the bit-exact per-pixel meaning of each kernel
+// -----------------------------------------------------------------------------
+// Planes are w x h, row-major. Border pixels (within the radius) are set to 0.
+namespace ref
+{
+inline uint8_t mulhi(uint32_t p, uint32_t w)
+{
+	return uint8_t((p * w) >> 8);
+}
+inline uint8_t subsat(int a, int b)
+{
+	return uint8_t(a > b ? a - b : 0);
+}
+
+inline void conv(const ConvSpec &s, const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h)
+{
+	const int rx = int(s.rx), ry = int(s.ry);
+	for (int y = 0; y < int(h); y++)
+		for (int x = 0; x < int(w); x++) {
+			if (x < rx || x >= int(w) - rx || y < ry || y >= int(h) - ry) {
+				out[y * w + x] = 0;
+				continue;
+			}
+			uint32_t sum = 0;
+			for (int dy = -ry; dy <= ry; dy++)
+				for (int dx = -rx; dx <= rx; dx++)
+					sum += mulhi(in[(y + dy) * int(w) + x + dx], s.w[(dy + ry) * (2 * rx + 1) + dx + rx]);
+			out[y * w + x] = uint8_t(sum > 255 ? 255 : sum);
+		}
+}
+
+inline void sobel(const uint8_t *in, uint8_t *out, uint32_t w, uint32_t h)
+{
+	for (int y = 0; y < int(h); y++)
+		for (int x = 0; x < int(w); x++) {
+			if (x < 1 || x >= int(w) - 1 || y < 1 || y >= int(h) - 1) {
+				out[y * w + x] = 0;
+				continue;
+			}
+			auto p = [&](int dx, int dy) { return uint32_t(in[(y + dy) * int(w) + x + dx]); };
+			int l = mulhi(p(-1, -1), 64) + mulhi(p(-1, 0), 128) + mulhi(p(-1, 1), 64);
+			int r = mulhi(p(1, -1), 64) + mulhi(p(1, 0), 128) + mulhi(p(1, 1), 64);
+			int t = mulhi(p(-1, -1), 64) + mulhi(p(0, -1), 128) + mulhi(p(1, -1), 64);
+			int b = mulhi(p(-1, 1), 64) + mulhi(p(0, 1), 128) + mulhi(p(1, 1), 64);
+			int g = (r > l ? r - l : l - r) + (b > t ? b - t : t - b);
+			out[y * w + x] = uint8_t(g > 255 ? 255 : g);
+		}
+}
+
+inline void threshold(const ThresholdSpec &s, const uint8_t *in, uint8_t *out, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+		out[i] = (in[i] > s.t) != s.invert ? 255 : 0;
+}
+
+inline uint8_t linear(const LinearSpec &s, const uint8_t *px)
+{
+	int p = 0, n = 0; // as in build_linear: both 0..255, netted between terms
+	auto add = [](int &acc, uint32_t d, uint32_t a) { acc = std::min(255, acc + int((a >> 8) * d + mulhi(d, a & 0xFF))); };
+	uint32_t order[3];
+	const uint32_t count = linear_order(s, order);
+	for (uint32_t k = 0; k < count; k++) {
+		const auto &t = s.term[order[k]];
+		const uint32_t a = uint32_t(t.coef < 0 ? -t.coef : t.coef);
+		const uint8_t v = px[order[k]];
+		add(t.coef > 0 ? p : n, subsat(v, t.center), a);
+		add(t.coef > 0 ? n : p, subsat(t.center, v), a);
+		const int np = subsat(p, n), nn = subsat(n, p);
+		p = np;
+		n = nn;
+	}
+	if (s.bias > 0)
+		p = std::min(255, p + s.bias);
+	else
+		n = std::min(255, n - s.bias);
+	return subsat(p, n);
+}
+
+inline void linear(const LinearSpec &s, const uint8_t *const in[3], uint8_t *out, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		uint8_t px[3] = {};
+		for (uint32_t k = 0; k < s.inputs; k++)
+			px[k] = in[k][i];
+		out[i] = linear(s, px);
+	}
+}
+} // namespace ref
+
+} // namespace ppu
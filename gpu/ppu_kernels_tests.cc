@@ -0,0 +1,161 @@
+#include "ppu_kernels_tests.hh"
+#include "aarch64/system_reg.hh" // read_cntpct / read_cntfreq
+#include "neon_kernels.hh"
+#include "ppu_kernels.hh"
+#include "print/print.hh"
+#include <cstring>
+#include <utility>
+
+namespace
+{
+constexpr uint32_t W = 1024, H = 256, N = W * H; // one u8 plane
+
+struct Planes {
+	etna::Gpu &gpu;
+	etna::Bo in[3], tmp, out, ref, cpu, scratch; // tmp: the GPU's, scratch: the CPU's
+	uint32_t fq;
+};
+
+uint32_t elapsed_us(uint64_t dt, uint32_t fq)
+{
+	return dt ? (uint32_t)(dt * 1'000'000 / fq) : 0;
+}
+
+// Feed the kernel its inputs: one plane, or the three for a colour conversion.
+bool dispatch(Planes &p, const etna::Kernel &k, uint32_t inputs, const etna::Bo &out, const etna::Bo &in0)
+{
+	if (inputs == 3)
+		return etna::compute(p.gpu, k, out, in0, p.in[1], p.in[2], W, H);
+	return etna::compute(p.gpu, k, out, in0, W, H);
+}
+
+// One kernel, or a separable pair (`second` reads what `first` wrote): time
+// it on the GPU and on NEON, check the GPU's interior and all of NEON's
+// output against the reference.
+template<typename Ref, typename Neon>
+bool run_case(Planes &p, const char *name, const ppu::Program &first, const ppu::Program *second, Ref &&ref, Neon &&neon)
+{
+	etna::Kernel k0 = etna::make_kernel(p.gpu, first);
+	etna::Kernel k1 = second ? etna::make_kernel(p.gpu, *second) : etna::Kernel{};
+	if (!k0 || (second && !k1)) {
+		print("ERROR: ", name, ": kernel doesn't fit or alloc failed\n");
+		return false;
+	}
+
+	auto t0 = read_cntpct();
+	bool ok = second ? dispatch(p, k0, first.inputs, p.tmp, p.in[0]) && dispatch(p, k1, second->inputs, p.out, p.tmp)
+				 : dispatch(p, k0, first.inputs, p.out, p.in[0]);
+	auto gpu_ticks = read_cntpct() - t0;
+	p.gpu.put_shader(k0.binary);
+	if (second)
+		p.gpu.put_shader(k1.binary);
+	if (!ok) {
+		print("ERROR: ", name, ": GPU timeout\n");
+		return false;
+	}
+	p.out.cpu_prep(etna::RelocRead);
+
+	auto rp = p.ref.span<uint8_t>().data();
+	auto cp = p.cpu.span<uint8_t>().data();
+	auto op = p.out.span<uint8_t>().data();
+	ref(rp);
+	t0 = read_cntpct();
+	neon(cp);
+	auto cpu_ticks = read_cntpct() - t0;
+
+	if (std::memcmp(cp, rp, N)) {
+		print("ERROR: ", name, ": NEON differs from the reference\n");
+		return false;
+	}
+	// The GPU's border is undefined: compare the interior only.
+	const uint32_t rx = first.radius_x + (second ? second->radius_x : 0);
+	const uint32_t ry = first.radius_y + (second ? second->radius_y : 0);
+	for (uint32_t y = ry; y < H - ry; y++)
+		for (uint32_t x = rx; x < W - rx; x++)
+			if (op[y * W + x] != rp[y * W + x]) {
+				print("ERROR: ", name, " wrong at (", x, ", ", y, ") got ", int(op[y * W + x]), " expected ",
+					  int(rp[y * W + x]), "\n");
+				return false;
+			}
+
+	print("  ", name, ": GPU ", elapsed_us(gpu_ticks, p.fq), " us, NEON ", elapsed_us(cpu_ticks, p.fq), " us");
+	if (gpu_ticks) {
+		int ratio = (cpu_ticks * 10 + 5) / gpu_ticks;
+		print(" (NEON / GPU = ", ratio / 10, ".", ratio % 10, "x)");
+	}
+	print(" -- verified\n");
+	return true;
+}
+} // namespace
+
+bool image_kernels_test(etna::Gpu &gpu)
+{
+	Planes p{gpu, {gpu.alloc(N), gpu.alloc(N), gpu.alloc(N)}, gpu.alloc(N), gpu.alloc(N), gpu.alloc(N), gpu.alloc(N),
+			 gpu.alloc(N), uint32_t(read_cntfreq())};
+	if (!p.in[0] || !p.in[1] || !p.in[2] || !p.tmp || !p.out || !p.ref || !p.cpu || !p.scratch)
+		return false;
+
+	// Plane 0: a luma-like mix of gradients and texture (edges for Sobel,
+	// noise for the blurs); planes 1 and 2: chroma-like ramps around 128.
+	for (uint32_t i = 0; i < 3; i++) {
+		auto s = p.in[i].span<uint8_t>();
+		for (uint32_t y = 0; y < H; y++)
+			for (uint32_t x = 0; x < W; x++) {
+				uint32_t v = i == 0 ? x / 4 + ((x / 64 + y / 32) & 1) * 96 + ((x * 7 + y * 13) ^ (x * y)) % 23
+									: 128 + int(i == 1 ? x % 200 : y % 200) - 100;
+				s[y * W + x] = uint8_t(v > 255 ? 255 : v);
+			}
+		p.in[i].cpu_fini(etna::RelocWrite);
+	}
+	const uint8_t *in0 = p.in[0].span<uint8_t>().data();
+	const uint8_t *const in[3] = {in0, p.in[1].span<uint8_t>().data(), p.in[2].span<uint8_t>().data()};
+
+	static constexpr uint8_t kSmooth3[9] = {16, 32, 16, 32, 64, 32, 16, 32, 16};
+	static constexpr uint8_t kGauss5[25] = {1, 4,  6,  4,  1, 4, 16, 24, 16, 4, 6, 24, 36,
+											24, 6, 4, 16, 24, 16, 4, 1, 4,  6,  4, 1};
+	static ppu::Program a, b; // ~6 KB each: off the stack
+	print("\nImage kernels, ", W, "x", H, " u8 plane(s), GPU vs NEON:\n");
+	bool ok = true;
+
+	auto conv = [&](const char *name, const ppu::ConvSpec &s) {
+		return run_case(p, name, ppu::build_conv(a, s), nullptr,
+						[&](uint8_t *o) { ppu::ref::conv(s, in0, o, W, H); },
+						[&](uint8_t *o) { neon::conv(s, in0, o, W, H); });
+	};
+	auto separable = [&](const char *name, const ppu::ConvSpec &sx, const ppu::ConvSpec &sy) {
+		uint8_t *t = p.scratch.span<uint8_t>().data();
+		return run_case(p, name, ppu::build_conv(a, sx), &ppu::build_conv(b, sy),
+						[&](uint8_t *o) {
+							ppu::ref::conv(sx, in0, t, W, H);
+							ppu::ref::conv(sy, t, o, W, H);
+						},
+						[&](uint8_t *o) {
+							neon::conv(sx, in0, t, W, H);
+							neon::conv(sy, t, o, W, H);
+						});
+	};
+
+	ok = ok && conv("conv 3x3 smooth", ppu::conv3x3(kSmooth3));
+	ok = ok && conv("gaussian 3x3 (x)", ppu::gaussian_blur(1, ppu::Axis::X));
+	ok = ok && conv("box 7 (x)", ppu::box_blur(3, ppu::Axis::X));
+	ok = ok && conv("conv 5x5 gaussian", ppu::conv5x5(kGauss5));
+	ok = ok &&
+		 separable("gaussian 5x5 separable", ppu::gaussian_blur(2, ppu::Axis::X), ppu::gaussian_blur(2, ppu::Axis::Y));
+	ok = ok && run_case(p, "sobel", ppu::build_sobel(a), nullptr, [&](uint8_t *o) { ppu::ref::sobel(in0, o, W, H); },
+						[&](uint8_t *o) { neon::sobel(in0, o, W, H); });
+	const ppu::ThresholdSpec thr{100, false};
+	ok = ok && run_case(p, "threshold", ppu::build_threshold(a, thr), nullptr,
+						[&](uint8_t *o) { ppu::ref::threshold(thr, in0, o, N); },
+						[&](uint8_t *o) { neon::threshold(thr, in0, o, N); });
+	static const char *const kRgb[3] = {"yuv->rgb R", "yuv->rgb G", "yuv->rgb B"};
+	static const char *const kYuv[3] = {"rgb->yuv Y", "rgb->yuv U", "rgb->yuv V"};
+	for (uint32_t c = 0; c < 3; c++)
+		for (const auto &[name, spec] : {std::pair{kRgb[c], ppu::yuv_to_rgb(c)}, std::pair{kYuv[c], ppu::rgb_to_yuv(c)}})
+			ok = ok && run_case(p, name, ppu::build_linear(a, spec), nullptr,
+								[&](uint8_t *o) { ppu::ref::linear(spec, in, o, N); },
+								[&](uint8_t *o) { neon::linear(spec, in, o, N); });
+
+	for (auto *bo : {&p.in[0], &p.in[1], &p.in[2], &p.tmp, &p.out, &p.ref, &p.cpu, &p.scratch})
+		gpu.free(*bo);
+	return ok;
+}
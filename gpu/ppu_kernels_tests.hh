@@ -0,0 +1,6 @@
+#pragma once
+#include "etna.hh"
+
+// Run the ppu_kernels.hh image kernels on the GPU and on NEON over the same
+// planes: check both against the reference, print GPU vs NEON time.
+bool image_kernels_test(etna::Gpu &gpu);
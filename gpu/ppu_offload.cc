@@ -0,0 +1,274 @@
+#include "ppu_offload.hh"
+#include "aarch64/system_reg.hh" // read_cntpct / read_cntfreq
+#include "neon_kernels.hh"
+#include "ppu_asm.hh"
+#include "print/print.hh"
+#include <cstring>
+
+namespace etna
+{
+
+namespace
+{
+// The GPU program for each op but AndImm (its immediate is built in).
+constexpr ShaderBuilder kBuild[kOffloadOps] = {
+	ppu::build_copy_shader,
+	ppu::build_add_shader,
+	ppu::build_addsat_shader,
+	ppu::build_not_shader,
+	nullptr,
+	ppu::build_add2_shader,
+	ppu::build_addsat2_shader,
+	ppu::build_mul2_shader,
+	ppu::build_mulhi2_shader,
+	ppu::build_blend_lerp_shader,
+	ppu::build_dp2x8_shader,
+};
+} // namespace
+
+bool Offload::run(OffloadOp op, const Bo &out, const Bo &in0, uint32_t width, uint32_t height, uint32_t imm)
+{
+	const Bo *const in[3] = {&in0, nullptr, nullptr};
+	return offload_inputs(op) == 1 && dispatch(op, out, in, width, height, imm);
+}
+
+bool Offload::run(OffloadOp op, const Bo &out, const Bo &in0, const Bo &in1, uint32_t width, uint32_t height)
+{
+	const Bo *const in[3] = {&in0, &in1, nullptr};
+	return offload_inputs(op) == 2 && dispatch(op, out, in, width, height, 0);
+}
+
+bool Offload::run(
+	OffloadOp op, const Bo &out, const Bo &in0, const Bo &in1, const Bo &in2, uint32_t width, uint32_t height)
+{
+	const Bo *const in[3] = {&in0, &in1, &in2};
+	return offload_inputs(op) == 3 && dispatch(op, out, in, width, height, 0);
+}
+
+bool Offload::dispatch(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t width, uint32_t height, uint32_t imm)
+{
+	const uint32_t bytes = width * height;
+	const bool gpu = force_ == Where::Model ? model_.use_gpu(op, bytes) : force_ == Where::Gpu;
+	if (gpu) {
+		stats_.gpu++;
+		return on_gpu(op, out, in, width, height, imm);
+	}
+	stats_.cpu++;
+	on_cpu(op, out, in, bytes, imm);
+	return true;
+}
+
+bool Offload::on_gpu(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t width, uint32_t height, uint32_t imm)
+{
+	const Kernel *k = kernel(op, imm);
+	if (!k)
+		return false;
+	for (unsigned i = 0; i < offload_inputs(op); i++)
+		in[i]->cpu_fini(RelocWrite);
+	out.cpu_fini(RelocWrite); // no dirty line of ours may land on the GPU's output later
+	bool ok = in[2]	  ? compute(gpu_, *k, out, *in[0], *in[1], *in[2], width, height)
+			  : in[1] ? compute(gpu_, *k, out, *in[0], *in[1], width, height)
+					  : compute(gpu_, *k, out, *in[0], width, height);
+	if (ok)
+		out.cpu_prep(RelocRead);
+	return ok;
+}
+
+void Offload::on_cpu(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t bytes, uint32_t imm)
+{
+	uint8_t *o = out.span<uint8_t>().data();
+	const uint8_t *a = in[0]->span<const uint8_t>().data();
+	const uint8_t *b = in[1] ? in[1]->span<const uint8_t>().data() : nullptr;
+	const uint8_t *c = in[2] ? in[2]->span<const uint8_t>().data() : nullptr;
+	switch (op) {
+		case OffloadOp::Copy: neon::copy(a, o, bytes); break;
+		case OffloadOp::Add: neon::add(a, o, bytes); break;
+		case OffloadOp::AddSat: neon::addsat(a, o, bytes); break;
+		case OffloadOp::Not: neon::not_(a, o, bytes); break;
+		case OffloadOp::AndImm: neon::and_imm(imm, a, o, bytes); break;
+		case OffloadOp::Add2: neon::add2(a, b, o, bytes); break;
+		case OffloadOp::AddSat2: neon::addsat2(a, b, o, bytes); break;
+		case OffloadOp::Mul2: neon::mul2(a, b, o, bytes); break;
+		case OffloadOp::MulHi2: neon::mulhi2(a, b, o, bytes); break;
+		case OffloadOp::BlendLerp: neon::blend_lerp(a, b, c, o, bytes); break;
+		case OffloadOp::Dp2x8: neon::dp2x8(a, o, bytes); break;
+	}
+}
+
+// Built on first use and kept; AndImm is rebuilt when the immediate changes.
+const Kernel *Offload::kernel(OffloadOp op, uint32_t imm)
+{
+	Kernel &k = kernels_[unsigned(op)];
+	if (op == OffloadOp::AndImm && k && imm != and_imm_)
+		gpu_.put_shader(k.binary);
+	if (!k) {
+		if (op == OffloadOp::AndImm) {
+			uint32_t inst[16];
+			k = make_kernel(gpu_, inst, ppu::build_and_imm_shader(inst, imm));
+			and_imm_ = imm;
+		} else {
+			k = make_kernel(gpu_, kBuild[unsigned(op)]);
+		}
+	}
+	return k ? &k : nullptr;
+}
+
+void Offload::release()
+{
+	for (Kernel &k : kernels_)
+		gpu_.put_shader(k.binary);
+}
+
+bool Offload::calibrate(uint32_t reps)
+{
+	// Small enough that the GPU's fixed cost shows, large enough that the
+	// per-byte cost does.
+	constexpr uint32_t W = 1024, Hs = 2, Hl = 256;
+	Bo in[3] = {gpu_.alloc(W * Hl), gpu_.alloc(W * Hl), gpu_.alloc(W * Hl)}, out = gpu_.alloc(W * Hl);
+	bool ok = in[0] && in[1] && in[2] && out;
+	for (unsigned i = 0; ok && i < 3; i++) {
+		auto s = in[i].span<uint8_t>();
+		for (uint32_t j = 0; j < W * Hl; j++)
+			s[j] = uint8_t(j * (5 + 2 * i) + (j >> 10) * 3);
+	}
+	const Bo *const ins[3] = {&in[0], &in[1], &in[2]};
+	const Where was = force_;
+
+	// Best of `reps` runs of `op` on one side over W x h; 0 on a GPU timeout.
+	auto time = [&](OffloadOp op, Where w, uint32_t h) -> uint64_t {
+		force_ = w;
+		const Bo *const used[3] = {ins[0], offload_inputs(op) > 1 ? ins[1] : nullptr,
+								   offload_inputs(op) > 2 ? ins[2] : nullptr};
+		uint64_t best = ~0ull;
+		for (uint32_t r = 0; r < reps; r++) {
+			uint64_t t0 = read_cntpct();
+			if (!dispatch(op, out, used, W, h, 0xFF))
+				return 0;
+			uint64_t dt = read_cntpct() - t0;
+			best = dt < best ? dt : best;
+		}
+		return best ? best : 1;
+	};
+
+	for (unsigned i = 0; ok && i < kOffloadOps; i++) {
+		const OffloadOp op = OffloadOp(i);
+		const uint64_t cs = time(op, Where::Cpu, Hs), cl = time(op, Where::Cpu, Hl);
+		const uint64_t gs = time(op, Where::Gpu, Hs), gl = time(op, Where::Gpu, Hl);
+		ok = gs && gl;
+		if (ok)
+			model_.set(op, LinearCost::fit(W * Hs, cs, W * Hl, cl), LinearCost::fit(W * Hs, gs, W * Hl, gl));
+	}
+	force_ = was;
+	for (Bo *b : {&in[0], &in[1], &in[2], &out})
+		if (*b)
+			gpu_.free(*b);
+	return ok;
+}
+
+} // namespace etna
+
+// -----------------------------------------------------------------------------
+//  On-target test
+// -----------------------------------------------------------------------------
+namespace
+{
+using etna::OffloadOp;
+
+const char *const kNames[etna::kOffloadOps] = {
+	"copy", "add", "addsat", "not", "and_imm", "add2", "addsat2", "mul2", "mulhi2", "blend_lerp", "dp2x8",
+};
+
+uint32_t elapsed_us(uint64_t dt, uint32_t fq)
+{
+	return dt ? (uint32_t)(dt * 1'000'000 / fq) : 0;
+}
+
+bool run_op(etna::Offload &off, OffloadOp op, const etna::Bo &out, const etna::Bo *in, uint32_t w, uint32_t h)
+{
+	switch (etna::offload_inputs(op)) {
+		case 1: return off.run(op, out, in[0], w, h, 0x5A3C7);
+		case 2: return off.run(op, out, in[0], in[1], w, h);
+		default: return off.run(op, out, in[0], in[1], in[2], w, h);
+	}
+}
+} // namespace
+
+bool offload_test(etna::Gpu &gpu)
+{
+	constexpr uint32_t W = 1024, H = 64, N = W * H;
+	static etna::Offload off{gpu}; // the kernels: off the stack
+	etna::Bo in[3] = {gpu.alloc(N), gpu.alloc(N), gpu.alloc(N)}, cpu = gpu.alloc(N), out = gpu.alloc(N);
+	if (!in[0] || !in[1] || !in[2] || !cpu || !out)
+		return false;
+	const uint32_t fq = read_cntfreq();
+	auto fill = [&](bool constant) {
+		for (uint32_t k = 0; k < 3; k++) {
+			auto s = in[k].span<uint8_t>();
+			for (uint32_t j = 0; j < N; j++)
+				s[j] = constant ? 1 : uint8_t(j * (3 + 4 * k) + (j >> 10) * 29 + k * 77);
+		}
+	};
+
+	// The CPU and GPU agree on every op. dp2x8 only on the constant image
+	// the flop reset feeds it: the one case the hardware confirms.
+	print("\nCPU/GPU offload, ", W, "x", H, " u8:\n");
+	for (unsigned i = 0; i < etna::kOffloadOps; i++) {
+		const OffloadOp op = OffloadOp(i);
+		fill(op == OffloadOp::Dp2x8);
+		off.force(etna::Offload::Where::Cpu);
+		bool ok = run_op(off, op, cpu, in, W, H);
+		off.force(etna::Offload::Where::Gpu);
+		ok = ok && run_op(off, op, out, in, W, H);
+		if (!ok) {
+			print("ERROR: offload ", kNames[i], ": kernel alloc failed or GPU timeout\n");
+			return false;
+		}
+		if (std::memcmp(cpu.span<uint8_t>().data(), out.span<uint8_t>().data(), N)) {
+			print("ERROR: offload ", kNames[i], ": NEON and GPU differ\n");
+			return false;
+		}
+	}
+	print("  NEON == GPU for all ", etna::kOffloadOps, " kernels\n");
+
+	off.force(etna::Offload::Where::Model);
+	if (!off.calibrate()) {
+		print("ERROR: offload calibration failed\n");
+		return false;
+	}
+	for (unsigned i = 0; i < etna::kOffloadOps; i++) {
+		const auto &e = off.model()[OffloadOp(i)];
+		const uint32_t x = off.model().crossover(OffloadOp(i));
+		print("  ", kNames[i], ": NEON ", elapsed_us(e.cpu.fixed, fq), " us + ", elapsed_us(e.cpu.per_mb, fq),
+			  " us/MB, GPU ", elapsed_us(e.gpu.fixed, fq), " us + ", elapsed_us(e.gpu.per_mb, fq), " us/MB: ");
+		if (x == 0 || x == ~0u)
+			print(x ? "CPU" : "GPU", " at every size\n");
+		else
+			print(off.model().use_gpu(OffloadOp(i), 0) ? "GPU below " : "GPU from ", x, " bytes\n");
+	}
+
+	// run() follows the model: a small and a large blend.
+	fill(false);
+	for (uint32_t h : {1u, H}) {
+		const auto before = off.stats();
+		if (!off.run(OffloadOp::BlendLerp, out, in[0], in[1], in[2], W, h))
+			return false;
+		const bool gpu_side = off.stats().gpu != before.gpu;
+		if (gpu_side != off.model().use_gpu(OffloadOp::BlendLerp, W * h)) {
+			print("ERROR: offload ran blend_lerp on the wrong side\n");
+			return false;
+		}
+		neon::blend_lerp(in[0].span<const uint8_t>().data(), in[1].span<const uint8_t>().data(),
+						 in[2].span<const uint8_t>().data(), cpu.span<uint8_t>().data(), W * h);
+		if (std::memcmp(cpu.span<uint8_t>().data(), out.span<uint8_t>().data(), W * h)) {
+			print("ERROR: offload blend_lerp wrong over ", W, "x", h, "\n");
+			return false;
+		}
+		print("  blend_lerp ", W, "x", h, " ran on the ", gpu_side ? "GPU" : "CPU", "\n");
+	}
+
+	off.release();
+	for (etna::Bo *b : {&in[0], &in[1], &in[2], &cpu, &out})
+		gpu.free(*b);
+	print("Offload: both sides bit-exact, model calibrated -- verified. \\o/\n");
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "etna.hh"
+#include "etna_offload.hh"
+#include <cstdint>
+
+// Runs the ppu_asm.hh kernels on whichever of the GPU and the CPU's NEON unit
+// is faster for the image size, by the calibrated model (etna_offload.hh).
+// The result is the same either way: the NEON kernels are bit-exact with the
+// GPU programs (neon_kernels.hh, checked in tools/ppu_asm_test.cc). dp2x8,
+// whose NEON model is only confirmed on constant images, always runs on the
+// GPU (cpu_exact(), etna_offload.hh).
+//
+//   static etna::Offload off{gpu};
+//   off.calibrate();                                  // once, ~1 s
+//   off.run(OffloadOp::BlendLerp, out, a, b, alpha, W, H);
+//
+// run() does the cache bracketing, so the Bos are used like CPU memory:
+// write the inputs, run(), read the output. The GPU path cleans the inputs
+// (and the output's lines) before the dispatch and invalidates the output
+// after; the CPU path needs neither.
+
+namespace etna
+{
+
+class Offload {
+public:
+	enum class Where { Model, Cpu, Gpu };
+
+	struct Stats {
+		uint32_t cpu = 0; // runs on each side
+		uint32_t gpu = 0;
+	};
+
+	explicit Offload(Gpu &gpu)
+		: gpu_{gpu}
+	{}
+
+	// out = op(inputs) over a width x height u8 image (width a multiple of
+	// 16, as compute()), with as many inputs as offload_inputs(op). `imm` is
+	// AndImm's immediate. False if the kernel could not be built or the GPU
+	// timed out.
+	bool run(OffloadOp op, const Bo &out, const Bo &in0, uint32_t width, uint32_t height, uint32_t imm = 0);
+	bool run(OffloadOp op, const Bo &out, const Bo &in0, const Bo &in1, uint32_t width, uint32_t height);
+	bool
+	run(OffloadOp op, const Bo &out, const Bo &in0, const Bo &in1, const Bo &in2, uint32_t width, uint32_t height);
+
+	// Time every op on both sides at two sizes (best of `reps`) and fit the
+	// model. False if a buffer or kernel could not be had or the GPU timed
+	// out; the ops measured so far keep their lines.
+	bool calibrate(uint32_t reps = 3);
+
+	// Pin run() to one side (tests, A/B timing); Where::Model is the default.
+	void force(Where w)
+	{
+		force_ = w;
+	}
+
+	OffloadModel &model()
+	{
+		return model_;
+	}
+	const Stats &stats() const
+	{
+		return stats_;
+	}
+
+	// Hand the GPU kernels back to the shader cache.
+	void release();
+
+private:
+	bool dispatch(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t width, uint32_t height, uint32_t imm);
+	bool on_gpu(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t width, uint32_t height, uint32_t imm);
+	void on_cpu(OffloadOp op, const Bo &out, const Bo *const in[3], uint32_t bytes, uint32_t imm);
+	const Kernel *kernel(OffloadOp op, uint32_t imm);
+
+	Gpu &gpu_;
+	Kernel kernels_[kOffloadOps];
+	uint32_t and_imm_ = 0; // the immediate kernels_[AndImm] was built with
+	OffloadModel model_;
+	Where force_ = Where::Model;
+	Stats stats_;
+};
+
+} // namespace etna
+
+// On target: every op's CPU and GPU results agree byte for byte, then
+// calibrate, print each op's crossover, and check run() follows the model.
+bool offload_test(etna::Gpu &gpu);
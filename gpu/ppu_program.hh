@@ -0,0 +1,287 @@
+#pragma once
+#include "ppu_asm.hh"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+// =============================================================================
+//  ppu_program.hh -- long PPU programs: values, register allocation, encoding
+// =============================================================================
+// The build_*_shader() kernels in ppu_asm.hh write a few instructions with
+// hand-picked registers into the caller's 8-instruction array. ProgramBuilder
+// is for anything longer. Its ops take and return values (Val), not
+// registers, and finish() assigns the registers: a linear scan over the
+// straight-line program, each register free again after its value's last
+// read. A result may reuse the register of an operand read for the last time
+// by the same instruction -- the core reads the sources before it writes the
+// destination, which the stock kernels already rely on (r1 = r1 + r1). r0 is
+// never handed out: it is the pixel coordinate every load and store reads.
+//
+// Each instruction is encoded when it is added, with its register fields 0.
+// Program::vregs keeps the value each field refers to, and finish() patches
+// the registers in. The host tests (tools/ppu_asm_test.cc) decode and run the
+// result, so the allocation is checked without the GPU.
+//
+// Length: the dispatch points the shader instruction cache at the program in
+// memory (PS_INST_ADDR / PS_ICACHE_COUNT, ppu_dispatch.hh), as etna_3d.cc does
+// for the VS/PS, so nothing on the chip limits it short of Program's buffer,
+// kMaxInstructions. Registers: the program's RegCount must fit the 6-bit
+// temp count, and there is nowhere to spill, so a program needing more than
+// kMaxRegCount at once fails to build. Fewer registers also means more
+// threads resident per core, which is why the allocator packs them low.
+
+namespace ppu
+{
+
+constexpr unsigned kMaxInstructions = 256;
+constexpr unsigned kMaxProgramDwords = 4 * kMaxInstructions;
+constexpr unsigned kMaxRegCount = 63; // r0 + 62 temporaries
+
+// A built program: the instructions, the images it reads (c0, then c2 and c3),
+// the constants it needs in the uniforms, and how far it reaches.
+struct Program {
+	uint32_t inst[kMaxProgramDwords] = {};
+	ShaderInfo info{0, 0}; // inst_dwords 0: nothing was built
+	uint32_t inputs = 1;
+	uint32_t radius_x = 0, radius_y = 0;
+	Uniforms uniforms{};
+	// The value in each instruction's dst, src0, src1 and src2 register field
+	// before allocation; 0 where the field is not a temp (or is r0).
+	uint16_t vregs[kMaxInstructions][4] = {};
+
+	explicit operator bool() const
+	{
+		return info.inst_dwords != 0;
+	}
+};
+
+// A value a ProgramBuilder op produced; 0 is none.
+struct Val {
+	uint16_t id = 0;
+
+	explicit operator bool() const
+	{
+		return id != 0;
+	}
+};
+
+// Appends u8 instructions to a Program and keeps its constant pool. Running
+// out of program, constants or registers -- or using a value that was never
+// made -- marks it failed; finish() then builds nothing.
+class ProgramBuilder {
+public:
+	// Starts `p` afresh for a kernel reading `inputs` (1..3) images.
+	ProgramBuilder(Program &p, uint32_t inputs = 1, uint32_t numShaderCores = 2)
+		: p_{p}
+		, cores_{numShaderCores}
+	{
+		// Field by field: a Program{} temporary would be 6 KB of stack.
+		p_.info = ShaderInfo{0, 0};
+		p_.inputs = inputs;
+		p_.radius_x = p_.radius_y = 0;
+		p_.uniforms = Uniforms{};
+		p_.uniforms.first = inputs == 1 ? 0 : inputs == 2 ? 4 : 8;
+		if (inputs < 1 || inputs > 3)
+			failed_ = true;
+	}
+
+	// Input image `input` (0..inputs-1) at this pixel + (dx, dy), -16..15.
+	Val load(uint32_t input, int dx = 0, int dy = 0)
+	{
+		if (input >= p_.inputs || dx < -16 || dx > 15 || dy < -16 || dy > 15)
+			failed_ = true;
+		Val v = fresh();
+		emit_img_load_at(next(v, {}, {}, {}), 0, input == 0 ? 0 : input + 1, TYPE_U8, dx, dy);
+		return v;
+	}
+
+	// dst := a <op> b, the ADD/logic family (operands in src0, src2).
+	Val alu(uint32_t opcode, Val a, Val b)
+	{
+		check(a, b);
+		Val v = fresh();
+		emit_alu(next(v, a, {}, b), opcode, 0, 0, 0, TYPE_U8);
+		return v;
+	}
+	// dst := a <op> c, c the byte broadcast from the uniforms.
+	Val alu(uint32_t opcode, Val a, uint8_t c)
+	{
+		check(a);
+		const uint32_t u = constant(c);
+		Val v = fresh();
+		emit_alu_uniform(next(v, a, {}, {}), opcode, 0, 0, 2 + u / 4, u % 4, TYPE_U8);
+		return v;
+	}
+	// dst := a * b, the multiply family (operands in src0, src1).
+	Val mul(uint32_t opcode, Val a, Val b)
+	{
+		check(a, b);
+		Val v = fresh();
+		emit_mul(next(v, a, b, {}), opcode, 0, 0, 0, TYPE_U8);
+		return v;
+	}
+	Val mul(uint32_t opcode, Val a, uint8_t c)
+	{
+		check(a);
+		const uint32_t u = constant(c);
+		Val v = fresh();
+		emit_mul_uniform(next(v, a, {}, {}), opcode, 0, 0, 2 + u / 4, u % 4, TYPE_U8);
+		return v;
+	}
+	Val not_(Val a)
+	{
+		check(a);
+		Val v = fresh();
+		emit_not(next(v, {}, {}, a), 0, 0, TYPE_U8);
+		return v;
+	}
+	Val zero()
+	{
+		Val v = fresh();
+		emit_alu_imm(next(v, {}, {}, {}), 0x5D, 0, 0, 0, TYPE_U8); // r0 & #0
+		return v;
+	}
+
+	Val addsat(Val a, Val b)
+	{
+		return alu(0x3B, a, b);
+	}
+	Val addsat(Val a, uint8_t c)
+	{
+		return alu(0x3B, a, c);
+	}
+	Val mulhi(Val a, uint8_t c)
+	{
+		return mul(0x40, a, c);
+	}
+	// a (-) b = max(a - b, 0) = ~sat(~a + b)
+	Val subsat(Val a, Val b)
+	{
+		return not_(addsat(not_(a), b));
+	}
+	Val subsat(Val a, uint8_t c)
+	{
+		return not_(addsat(not_(a), c));
+	}
+	// c (-) a = ~sat(a + ~c)
+	Val subsat(uint8_t c, Val a)
+	{
+		return not_(addsat(a, uint8_t(255 - c)));
+	}
+
+	void fail()
+	{
+		failed_ = true;
+	}
+	bool failed() const
+	{
+		return failed_;
+	}
+	// Instructions so far.
+	uint32_t size() const
+	{
+		return n_;
+	}
+
+	// Store `out` to the output image, allocate the registers and set
+	// p.info. On failure p.info is empty.
+	Program &finish(Val out)
+	{
+		check(out);
+		emit_img_store(next({}, {}, {}, out), 0, TYPE_U8, cores_);
+		const uint32_t regs = failed_ ? 0 : allocate();
+		p_.info = regs ? ShaderInfo{4 * n_, regs} : ShaderInfo{0, 0};
+		return p_;
+	}
+
+private:
+	Val fresh()
+	{
+		return Val{uint16_t(++values_)};
+	}
+
+	// A made value, for each operand; anything else fails the build.
+	template<typename... V>
+	void check(V... v)
+	{
+		((failed_ |= !v || v.id > values_), ...);
+	}
+
+	// The next instruction's words, zeroed, its register operands recorded.
+	uint32_t *next(Val dst, Val s0, Val s1, Val s2)
+	{
+		if (n_ == kMaxInstructions) {
+			failed_ = true;
+			scratch_[0] = scratch_[1] = scratch_[2] = scratch_[3] = 0;
+			return scratch_;
+		}
+		const Val ops[4] = {dst, s0, s1, s2};
+		for (unsigned k = 0; k < 4; k++) {
+			p_.inst[4 * n_ + k] = 0;
+			p_.vregs[n_][k] = ops[k].id;
+		}
+		return &p_.inst[4 * n_++];
+	}
+
+	// The uniform word holding byte v in all four lanes, added on first use.
+	// Returns its index in the c2..c5 block.
+	uint32_t constant(uint8_t v)
+	{
+		Uniforms &u = p_.uniforms;
+		const uint32_t word = v * 0x01010101u;
+		for (uint32_t i = 0; i < u.count; i++)
+			if (u.words[u.first + i] == word)
+				return u.first + i;
+		if (u.first + u.count == 16) {
+			failed_ = true;
+			return u.first;
+		}
+		u.words[u.first + u.count] = word;
+		return u.first + u.count++;
+	}
+
+	// Linear scan: registers for every value, patched into the fields.
+	// Returns the RegCount, or 0 if the program needs more than there are.
+	uint32_t allocate()
+	{
+		constexpr uint16_t kUnread = 0xFFFF;
+		uint16_t last[kMaxInstructions + 1]; // the last instruction reading each value
+		uint8_t reg[kMaxInstructions + 1] = {};
+		std::fill_n(last, kMaxInstructions + 1, kUnread);
+		for (uint32_t i = 0; i < n_; i++)
+			for (unsigned k = 1; k < 4; k++)
+				if (uint16_t v = p_.vregs[i][k])
+					last[v] = uint16_t(i); // a value is read after it is made
+		uint64_t busy = 1; // r0
+		uint32_t regs = 1;
+		for (uint32_t i = 0; i < n_; i++) {
+			const uint16_t *f = p_.vregs[i];
+			for (unsigned k = 1; k < 4; k++)
+				if (f[k] && last[f[k]] == i)
+					busy &= ~(uint64_t(1) << reg[f[k]]);
+			if (f[0]) {
+				const uint32_t r = std::countr_one(busy);
+				if (r >= kMaxRegCount)
+					return 0;
+				reg[f[0]] = uint8_t(r);
+				if (last[f[0]] != kUnread) // read later: keep it until its last reader (unread: free at once)
+					busy |= uint64_t(1) << r;
+				regs = std::max(regs, r + 1);
+				set_destination_address(r, &p_.inst[4 * i]);
+			}
+			for (unsigned k = 1; k < 4; k++)
+				if (f[k])
+					set_source_address(k - 1, reg[f[k]], &p_.inst[4 * i]);
+		}
+		return regs;
+	}
+
+	Program &p_;
+	uint32_t cores_;
+	uint32_t n_ = 0;
+	uint32_t values_ = 0;
+	bool failed_ = false;
+	uint32_t scratch_[4] = {};
+};
+
+} // namespace ppu
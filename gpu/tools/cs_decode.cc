@@ -0,0 +1,305 @@
+// =============================================================================
+//  cs_decode.cc -- HOST tool: decode, check and count GPU command streams
+// =============================================================================
+// Compiles on the development machine (clang++ -std=c++20), not the target.
+// The command-line front end of etna_decode.hh: each input is one submission,
+// decoded in order through one register shadow (as the GPU keeps its state
+// between submissions), with its statistics, its most redundant registers
+// and any missing flush or stall.
+//
+//   ./cs_decode [options] <file>...   (- = stdin)
+//   ./cs_decode --demo [options]      streams the host can build itself
+//
+//   -t             print every command, registers by name
+//   --fresh        forget the shadow between submissions
+//   --strict       exit 1 on any missing flush/stall or malformed stream
+//   --max-dwords N exit 1 if a submission is longer than N dwords
+//
+// A file is raw little-endian dwords, a capture (etna_trace.hh: one
+// submission per record, the shadow carried across them), or text: a target
+// log with the output of etna::dump_stream() ("cs <label>: ..." then
+// "cs: <hex words>" lines) or of etna::dump_trace() ("tr: " lines) -- every
+// such stream in it is one submission, everything else is skipped.
+// --demo decodes what emit_mesh() (direct and through a StateTracker, two
+// draws each) and emit_ppu_dispatch() produce, each group from an unknown
+// GPU state; clear()/resolve() are built on the target only (etna.cc), so
+// dump_stream() them there.
+//
+// Build:  clang++ -std=c++20 -O2 -I.. cs_decode.cc ../etna_3d.cc -o cs_decode
+
+#include "cube_scene.hh"
+#include "etna_3d.hh"
+#include "etna_decode.hh"
+#include "etna_state.hh"
+#include "etna_trace.hh"
+#include "ppu_dispatch.hh"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+using namespace etna::decode;
+
+struct Submission {
+	std::string label;
+	std::vector<uint32_t> words;
+	bool reset = false; // runs on a GPU of unknown state: forget the shadow first
+};
+
+std::vector<uint8_t> read_all(FILE *f)
+{
+	std::vector<uint8_t> data;
+	uint8_t buf[4096];
+	for (size_t n; (n = fread(buf, 1, sizeof buf, f)) > 0;)
+		data.insert(data.end(), buf, buf + n);
+	return data;
+}
+
+bool is_text(const std::vector<uint8_t> &data)
+{
+	return std::all_of(
+		data.begin(), data.end(), [](uint8_t c) { return c == '\n' || c == '\r' || c == '\t' || isprint(c); });
+}
+
+// A capture's records, one submission each.
+void add_trace(std::span<const uint32_t> trace, const std::string &name, std::vector<Submission> &out)
+{
+	etna::TraceReader rd{trace};
+	etna::TraceReader::Record r;
+	while (rd.next(r)) {
+		std::string label = name + ": seqno " + std::to_string(r.seqno);
+		if (r.gpu_ticks != etna::kTraceNoTicks && rd.tick_hz())
+			label += ", captured " + std::to_string(uint64_t(r.gpu_ticks) * 1'000'000 / rd.tick_hz()) + " us";
+		out.push_back({label, {r.stream.begin(), r.stream.end()}});
+	}
+	if (!rd.valid())
+		fprintf(stderr, "cs_decode: %s: malformed trace\n", name.c_str());
+}
+
+// Hex words after a 4-character prefix ("cs: ", "tr: ").
+void parse_words(const std::string &line, std::vector<uint32_t> &out)
+{
+	const char *p = line.c_str() + 4;
+	for (char *end; *p; p = end) {
+		const unsigned long v = strtoul(p, &end, 16);
+		if (end == p)
+			break;
+		out.push_back(uint32_t(v));
+	}
+}
+
+// The dump_stream() streams in a log: a "cs <label>: ..." line opens one,
+// "cs: " lines carry its words. "tr: " lines are a dump_trace().
+void parse_text(const std::string &text, const std::string &name, std::vector<Submission> &out)
+{
+	std::vector<uint32_t> trace;
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string::npos)
+			eol = text.size();
+		const std::string line = text.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (line.rfind("cs: ", 0) == 0) {
+			if (out.empty())
+				out.push_back({name, {}});
+			parse_words(line, out.back().words);
+		} else if (line.rfind("tr: ", 0) == 0) {
+			parse_words(line, trace);
+		} else if (line.rfind("cs ", 0) == 0) {
+			const size_t colon = line.find(':');
+			const size_t len = colon == std::string::npos ? std::string::npos : colon - 3;
+			out.push_back({name + ": " + line.substr(3, len), {}});
+		}
+	}
+	if (!trace.empty())
+		add_trace(trace, name, out);
+}
+
+bool load(const char *path, std::vector<Submission> &out)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+	if (!f) {
+		fprintf(stderr, "cs_decode: can't open %s\n", path);
+		return false;
+	}
+	const std::vector<uint8_t> data = read_all(f);
+	if (f != stdin)
+		fclose(f);
+	if (is_text(data)) {
+		const size_t before = out.size();
+		parse_text(std::string(data.begin(), data.end()), path, out);
+		if (out.size() == before)
+			fprintf(stderr, "cs_decode: no dump_stream() output in %s\n", path);
+		return true;
+	}
+	Submission s{path, std::vector<uint32_t>(data.size() / 4)};
+	memcpy(s.words.data(), data.data(), s.words.size() * 4);
+	if (data.size() % 4)
+		fprintf(stderr, "cs_decode: %s: %zu trailing bytes ignored\n", path, data.size() % 4);
+	if (!s.words.empty() && s.words[0] == etna::kTraceMagic)
+		add_trace(s.words, path, out);
+	else
+		out.push_back(std::move(s));
+	return true;
+}
+
+// --- --demo: streams from the host-buildable emitters ------------------------
+// CmdStream writes through the Bo's GPU address, so the streams need host
+// memory mapped at that address (as in host_tests.cc).
+constexpr uint32_t kStreamBase = 0x90000000;
+
+std::vector<uint32_t> words_of(const etna::CmdStream &cs)
+{
+	auto w = cs.bo().span<const uint32_t>().first(cs.offset());
+	return {w.begin(), w.end()};
+}
+
+bool demo(std::vector<Submission> &out)
+{
+	void *hint = reinterpret_cast<void *>(uintptr_t(kStreamBase));
+	if (mmap(hint, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) != hint) {
+		fprintf(stderr, "cs_decode: could not map host memory at 0x%08x\n", kStreamBase);
+		return false;
+	}
+	static const etna::Bo rt{0xA0000000, 1024 * 600 * 4}, depth{0xA0300000, 1024 * 600 * 2};
+	static const etna::Bo vtx{0xA0500000, 1008}, vs{0xA0510000, 256}, ps{0xA0520000, 64};
+	static Mat4 mvp[2];
+	auto draw = [](uint32_t frame) {
+		mvp[frame] = cube_mvp(0.3f + 0.05f * float(frame), 0.2f, 1024.0f / 600.0f, 0.0f, 0.0f, -3.0f);
+		return etna::MeshDraw{
+			.rt = &rt,
+			.rt_stride = 1024 * 4,
+			.vtx = &vtx,
+			.vs = &vs,
+			.vs_words = 64,
+			.ps = &ps,
+			.ps_words = 16,
+			.uniforms = mvp[frame],
+			.width = 1024,
+			.height = 600,
+			.vertex_count = 36,
+			.depth = &depth,
+			.depth_stride = 1024 * 2,
+		};
+	};
+	etna::CmdStream cs{etna::Bo{kStreamBase, 0x10000}, 0x4000};
+	etna::StateTracker st;
+	for (uint32_t frame = 0; frame < 2; frame++) {
+		cs.reset();
+		etna::emit_mesh(cs, draw(frame));
+		out.push_back({"emit_mesh, cube " + std::to_string(frame), words_of(cs), frame == 0});
+	}
+	for (uint32_t frame = 0; frame < 2; frame++) {
+		cs.reset();
+		etna::emit_mesh(cs, st, draw(frame));
+		out.push_back({"emit_mesh + StateTracker, cube " + std::to_string(frame), words_of(cs), frame == 0});
+	}
+	cs.reset();
+	etna::emit_ppu_dispatch(cs, 0xA0600000, 0xA0700000, 0xA0800000, 16, 3, 1024, 600);
+	out.push_back({"emit_ppu_dispatch, 1024x600", words_of(cs), true});
+	return true;
+}
+
+void report(const Submission &s, uint32_t n, const Result &r)
+{
+	const Stats &t = r.stats;
+	printf("== %u: %s\n", n, s.label.c_str());
+	printf("   %u dwords, %u commands%s, %u LOAD_STATE: %u registers, %u changed, %u redundant (%u%%)\n",
+		   t.dwords,
+		   t.commands,
+		   r.ended ? " (END)" : "",
+		   t.headers,
+		   t.states,
+		   t.changes,
+		   t.redundant,
+		   t.states ? t.redundant * 100 / t.states : 0);
+	printf("   %u draws, %u RS / %u PPU kicks, %u stalls, %u flushes, %u events, %u pad dwords\n",
+		   t.draws,
+		   t.rs_kicks,
+		   t.cl_kicks,
+		   t.stalls,
+		   t.flushes,
+		   t.events,
+		   t.pad);
+	if (!r.redundant.empty()) {
+		std::vector<std::pair<uint32_t, uint32_t>> top(r.redundant.begin(), r.redundant.end());
+		std::stable_sort(top.begin(), top.end(), [](auto &a, auto &b) { return a.second > b.second; });
+		printf("   redundant:");
+		for (size_t i = 0; i < top.size() && i < 8; i++)
+			printf(" %s x%u", reg_name(top[i].first).c_str(), top[i].second);
+		printf(top.size() > 8 ? " (+%zu more)\n" : "\n", top.size() - 8);
+	}
+	for (const Finding &f : r.findings)
+		printf("   %s at dword %u: %s\n", issue_name(f.issue), f.offset, f.what);
+}
+
+int usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-t] [--fresh] [--strict] [--max-dwords N] (--demo | <file>...)\n", argv0);
+	return 2;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	bool trace = false, fresh = false, strict = false, use_demo = false;
+	uint32_t max_dwords = 0;
+	std::vector<Submission> subs;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t"))
+			trace = true;
+		else if (!strcmp(argv[i], "--fresh"))
+			fresh = true;
+		else if (!strcmp(argv[i], "--strict"))
+			strict = true;
+		else if (!strcmp(argv[i], "--demo"))
+			use_demo = true;
+		else if (!strcmp(argv[i], "--max-dwords") && i + 1 < argc)
+			max_dwords = uint32_t(strtoul(argv[++i], nullptr, 0));
+		else if (argv[i][0] == '-' && argv[i][1])
+			return usage(argv[0]);
+		else if (!load(argv[i], subs))
+			return 2;
+	}
+	if (use_demo && !demo(subs))
+		return 2;
+	if (subs.empty())
+		return usage(argv[0]);
+
+	Simulator sim{trace ? stdout : nullptr};
+	Stats total{};
+	uint32_t issues = 0, over = 0;
+	for (uint32_t i = 0; i < subs.size(); i++) {
+		if (fresh || subs[i].reset)
+			sim.reset();
+		if (trace)
+			printf("-- %s\n", subs[i].label.c_str());
+		const Result r = sim.run(subs[i].words);
+		report(subs[i], i + 1, r);
+		issues += uint32_t(r.findings.size());
+		if (max_dwords && r.stats.dwords > max_dwords) {
+			printf("   over budget: %u > %u dwords\n", r.stats.dwords, max_dwords);
+			over++;
+		}
+		total.dwords += r.stats.dwords;
+		total.states += r.stats.states;
+		total.redundant += r.stats.redundant;
+	}
+	printf("%zu submissions: %u dwords, %u registers written, %u redundant, %u issues\n",
+		   subs.size(),
+		   total.dwords,
+		   total.states,
+		   total.redundant,
+		   issues);
+	return (strict && issues) || over ? 1 : 0;
+}
@@ -0,0 +1,635 @@
+#pragma once
+#include "etna_ts.hh"
+#include "gpu_regs.hh"
+#include "gpu_regs_3d.hh"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// =============================================================================
+//  etna_decode.hh -- HOST library: decode and simulate a Vivante command stream
+// =============================================================================
+// Compiles on the development machine, not the target. What CmdStream,
+// emit_mesh(), clear()/resolve() and emit_ppu_dispatch() emit is otherwise
+// only ever seen by the FE. A Simulator walks a stream the way the FE does,
+// keeping a shadow of every state register written:
+//
+//   decode   every FE command and its length: LOAD_STATE, END, NOP, DRAW_*,
+//            WAIT, LINK, STALL, CALL/RETURN, CHIP_SELECT. An EVENT is a
+//            LOAD_STATE of GL_EVENT and is counted as one;
+//   name     registers by their gpu_regs.hh / gpu_regs_3d.hh names
+//            (reg_name()), array elements as NAME[i];
+//   flag     redundant writes -- a register set to the value it already
+//            holds. Registers that act when written (kickers, flushes, sync
+//            tokens, icache controls) never are;
+//            missing drains -- the RS touching memory the 3D pipe wrote with
+//            no cache flush and FE<-PE stall in between, a draw touching what
+//            an RS op wrote with no stall, an EVENT or the end of the stream
+//            with 3D-pipe writes unflushed, a STALL without its semaphore;
+//   count    per stream: dwords, commands, headers, registers written and
+//            changed, draws, kicks, stalls, flushes (Stats).
+//
+// Memory is tracked as the surfaces the registers describe: a draw's color
+// and depth targets (base, stride, scissor height) and their TS buffers, an
+// RS op's source (unless it is a clear), destination and source TS. A PPU
+// dispatch finds its images in uniforms, so it counts as touching all of
+// memory. LINK and CALL are reported, not followed: their targets are GPU
+// addresses.
+//
+// The shadow persists across run() calls, as the GPU's state does across
+// submissions (each of which starts with the pipe drained); reset() forgets
+// it. tools/cs_decode.cc is the command-line front end; tools/host_tests.cc
+// checks this against the emitters.
+
+namespace etna::decode
+{
+
+// FE opcodes: header bits [31:27] (cmdstream.xml.h).
+enum Opcode : uint32_t {
+	kLoadState = 1,
+	kEnd = 2,
+	kNop = 3,
+	kDrawPrimitives = 5,
+	kDrawIndexed = 6,
+	kWait = 7,
+	kLink = 8,
+	kStall = 9,
+	kCall = 10,
+	kReturn = 11,
+	kDrawInstanced = 12,
+	kChipSelect = 13,
+};
+inline constexpr uint32_t kOpcodes = 32;
+
+inline const char *opcode_name(uint32_t op)
+{
+	switch (op) {
+	case kLoadState: return "LOAD_STATE";
+	case kEnd: return "END";
+	case kNop: return "NOP";
+	case kDrawPrimitives: return "DRAW_PRIMITIVES";
+	case kDrawIndexed: return "DRAW_INDEXED_PRIMITIVES";
+	case kWait: return "WAIT";
+	case kLink: return "LINK";
+	case kStall: return "STALL";
+	case kCall: return "CALL";
+	case kReturn: return "RETURN";
+	case kDrawInstanced: return "DRAW_INSTANCED";
+	case kChipSelect: return "CHIP_SELECT";
+	}
+	return "?";
+}
+
+// Dwords the command with this header occupies, padding included (every
+// command is a multiple of 64 bits); 0 if it isn't a command.
+constexpr uint32_t command_dwords(uint32_t header)
+{
+	switch (header >> 27) {
+	case kLoadState: {
+		const uint32_t count = (header >> 16) & 0x3FF;
+		return (1 + (count ? count : 1024) + 1) & ~1u;
+	}
+	case kEnd:
+	case kNop:
+	case kWait:
+	case kLink:
+	case kStall:
+	case kReturn:
+	case kChipSelect: return 2;
+	case kDrawPrimitives: // prim, start, count
+	case kCall:			  // address, return prefetch, return address
+	case kDrawInstanced:  // count, start, pad
+		return 4;
+	case kDrawIndexed: return 6; // prim, start, count, offset, pad
+	}
+	return 0;
+}
+
+inline constexpr uint32_t kLoadStateFixp = 1u << 26;
+
+// ---- register names ---------------------------------------------------------
+
+struct RegInfo {
+	uint32_t addr;	// byte address of element 0
+	uint32_t count; // consecutive dword registers (1 = not an array)
+	const char *name;
+	bool trigger = false; // acts when written: never redundant
+};
+
+// clang-format off
+inline constexpr RegInfo kRegs[] = {
+	// gpu_regs.hh
+	{VivanteGpu::MMUv2_PTA_CONFIG, 1, "MMUv2_PTA_CONFIG", true},
+	{VivanteGpu::GL_EVENT, 1, "GL_EVENT", true},
+	{VivanteGpu::GL_SEMAPHORE_TOKEN, 1, "GL_SEMAPHORE_TOKEN", true},
+	{VivanteGpu::GL_FLUSH_CACHE, 1, "GL_FLUSH_CACHE", true},
+	{VivanteGpu::CL_CONFIG, 1, "CL_CONFIG"},
+	{VivanteGpu::CL_THREAD_ALLOCATION, 1, "CL_THREAD_ALLOCATION"},
+	{VivanteGpu::CL_KICKER, 1, "CL_KICKER", true},
+	{VivanteGpu::RS_KICKER, 1, "RS_KICKER", true},
+	{VivanteGpu::RS_CONFIG, 1, "RS_CONFIG"},
+	{VivanteGpu::RS_SOURCE_STRIDE, 1, "RS_SOURCE_STRIDE"},
+	{VivanteGpu::RS_DEST_STRIDE, 1, "RS_DEST_STRIDE"},
+	{VivanteGpu::RS_WINDOW_SIZE, 1, "RS_WINDOW_SIZE"},
+	{VivanteGpu::RS_DITHER0, 1, "RS_DITHER0"},
+	{VivanteGpu::RS_DITHER1, 1, "RS_DITHER1"},
+	{VivanteGpu::RS_CLEAR_CONTROL, 1, "RS_CLEAR_CONTROL"},
+	{VivanteGpu::RS_FILL_VALUE0, 4, "RS_FILL_VALUE"},
+	{VivanteGpu::RS_EXTRA_CONFIG, 1, "RS_EXTRA_CONFIG"},
+	{VivanteGpu::RS_SINGLE_BUFFER, 1, "RS_SINGLE_BUFFER"},
+	{VivanteGpu::RS_PIPE_SOURCE_ADDR0, 8, "RS_PIPE_SOURCE_ADDR"},
+	{VivanteGpu::RS_PIPE_DEST_ADDR0, 8, "RS_PIPE_DEST_ADDR"},
+	{VivanteGpu::RS_PIPE_OFFSET0, 8, "RS_PIPE_OFFSET"},
+	{VivanteGpu::TS_FLUSH_CACHE, 1, "TS_FLUSH_CACHE", true},
+	{VivanteGpu::TS_MEM_CONFIG, 1, "TS_MEM_CONFIG"},
+	{VivanteGpu::TS_COLOR_STATUS_BASE, 1, "TS_COLOR_STATUS_BASE"},
+	{VivanteGpu::TS_COLOR_SURFACE_BASE, 1, "TS_COLOR_SURFACE_BASE"},
+	{VivanteGpu::TS_COLOR_CLEAR_VALUE, 1, "TS_COLOR_CLEAR_VALUE"},
+	{VivanteGpu::TS_DEPTH_STATUS_BASE, 1, "TS_DEPTH_STATUS_BASE"},
+	{VivanteGpu::TS_DEPTH_SURFACE_BASE, 1, "TS_DEPTH_SURFACE_BASE"},
+	{VivanteGpu::TS_DEPTH_CLEAR_VALUE, 1, "TS_DEPTH_CLEAR_VALUE"},
+	// gpu_regs_3d.hh
+	{VivanteGpu::FE_INDEX_STREAM_BASE_ADDR, 1, "FE_INDEX_STREAM_BASE_ADDR"},
+	{VivanteGpu::FE_INDEX_STREAM_CONTROL, 1, "FE_INDEX_STREAM_CONTROL"},
+	{VivanteGpu::FE_PRIMITIVE_RESTART_INDEX, 1, "FE_PRIMITIVE_RESTART_INDEX"},
+	{VivanteGpu::FE_HALTI5_ID_CONFIG, 1, "FE_HALTI5_ID_CONFIG"},
+	{VivanteGpu::FE_HALTI5_UNK007D8, 1, "FE_HALTI5_UNK007D8"},
+	{VivanteGpu::GL_MULTI_SAMPLE_CONFIG, 1, "GL_MULTI_SAMPLE_CONFIG"},
+	{VivanteGpu::GL_VARYING_TOTAL_COMPONENTS, 1, "GL_VARYING_TOTAL_COMPONENTS"},
+	{VivanteGpu::GL_API_MODE, 1, "GL_API_MODE"},
+	{VivanteGpu::GL_HALTI5_SH_SPECIALS, 1, "GL_HALTI5_SH_SPECIALS"},
+	{VivanteGpu::GL_HALTI5_SHADER_ATTRIBUTES0, 16, "GL_HALTI5_SHADER_ATTRIBUTES"},
+	{VivanteGpu::GL_STALL_TOKEN, 1, "GL_STALL_TOKEN", true},
+	{VivanteGpu::NFE_ATTRIB_CONFIG0_0, 32, "NFE_ATTRIB_CONFIG0"},
+	{VivanteGpu::NFE_ATTRIB_SCALE0, 32, "NFE_ATTRIB_SCALE"},
+	{VivanteGpu::NFE_ATTRIB_CONFIG1_0, 32, "NFE_ATTRIB_CONFIG1"},
+	{VivanteGpu::NFE_VERTEX_STREAM_BASE0, 16, "NFE_VERTEX_STREAM_BASE"},
+	{VivanteGpu::NFE_VERTEX_STREAM_CONTROL0, 16, "NFE_VERTEX_STREAM_CONTROL"},
+	{VivanteGpu::NFE_VERTEX_STREAM_DIVISOR0, 16, "NFE_VERTEX_STREAM_DIVISOR"},
+	{VivanteGpu::VS_OUTPUT_COUNT, 1, "VS_OUTPUT_COUNT"},
+	{VivanteGpu::VS_INPUT_COUNT, 1, "VS_INPUT_COUNT"},
+	{VivanteGpu::VS_TEMP_REGISTER_CONTROL, 1, "VS_TEMP_REGISTER_CONTROL"},
+	{VivanteGpu::VS_LOAD_BALANCING, 1, "VS_LOAD_BALANCING"},
+	{VivanteGpu::VS_UNIFORM_BASE, 1, "VS_UNIFORM_BASE"},
+	{VivanteGpu::SH_ICACHE_CONTROL, 1, "SH_ICACHE_CONTROL", true},
+	{VivanteGpu::VS_INST_ADDR, 1, "VS_INST_ADDR"},
+	{VivanteGpu::VS_HALTI5_OUTPUT_COUNT, 1, "VS_HALTI5_OUTPUT_COUNT"},
+	{VivanteGpu::VS_NEWRANGE_LOW, 1, "VS_NEWRANGE_LOW"},
+	{VivanteGpu::PS_NEWRANGE_LOW, 1, "PS_NEWRANGE_LOW"},
+	{VivanteGpu::VS_HALTI1_UNK00884, 1, "VS_HALTI1_UNK00884"},
+	{VivanteGpu::VS_ICACHE_PREFETCH, 1, "VS_ICACHE_PREFETCH", true},
+	{VivanteGpu::VS_HALTI5_UNK008A0, 1, "VS_HALTI5_UNK008A0"},
+	{VivanteGpu::VS_SAMPLER_BASE, 1, "VS_SAMPLER_BASE"},
+	{VivanteGpu::VS_ICACHE_INVALIDATE, 1, "VS_ICACHE_INVALIDATE", true},
+	{VivanteGpu::VS_HALTI5_RANGE_HIGH, 1, "VS_HALTI5_RANGE_HIGH"},
+	{VivanteGpu::VS_HALTI5_INPUT0, 8, "VS_HALTI5_INPUT"},
+	{VivanteGpu::VS_HALTI5_OUTPUT0, 8, "VS_HALTI5_OUTPUT"},
+	{VivanteGpu::PA_VIEWPORT_SCALE_X, 1, "PA_VIEWPORT_SCALE_X"},
+	{VivanteGpu::PA_VIEWPORT_SCALE_Y, 1, "PA_VIEWPORT_SCALE_Y"},
+	{VivanteGpu::PA_VIEWPORT_SCALE_Z, 1, "PA_VIEWPORT_SCALE_Z"},
+	{VivanteGpu::PA_VIEWPORT_OFFSET_X, 1, "PA_VIEWPORT_OFFSET_X"},
+	{VivanteGpu::PA_VIEWPORT_OFFSET_Y, 1, "PA_VIEWPORT_OFFSET_Y"},
+	{VivanteGpu::PA_VIEWPORT_OFFSET_Z, 1, "PA_VIEWPORT_OFFSET_Z"},
+	{VivanteGpu::PA_LINE_WIDTH, 1, "PA_LINE_WIDTH"},
+	{VivanteGpu::PA_POINT_SIZE, 1, "PA_POINT_SIZE"},
+	{VivanteGpu::PA_SYSTEM_MODE, 1, "PA_SYSTEM_MODE"},
+	{VivanteGpu::PA_W_CLIP_LIMIT, 1, "PA_W_CLIP_LIMIT"},
+	{VivanteGpu::PA_ATTRIBUTE_ELEMENT_COUNT, 1, "PA_ATTRIBUTE_ELEMENT_COUNT"},
+	{VivanteGpu::PA_CONFIG, 1, "PA_CONFIG"},
+	{VivanteGpu::PA_WIDE_LINE_WIDTH0, 1, "PA_WIDE_LINE_WIDTH0"},
+	{VivanteGpu::PA_WIDE_LINE_WIDTH1, 1, "PA_WIDE_LINE_WIDTH1"},
+	{VivanteGpu::PA_VIEWPORT_UNK00A80, 1, "PA_VIEWPORT_UNK00A80"},
+	{VivanteGpu::PA_VIEWPORT_UNK00A84, 1, "PA_VIEWPORT_UNK00A84"},
+	{VivanteGpu::PA_FLAGS, 1, "PA_FLAGS"},
+	{VivanteGpu::PA_ZFARCLIPPING, 1, "PA_ZFARCLIPPING"},
+	{VivanteGpu::PA_VARYING_NUM_COMPONENTS0, 1, "PA_VARYING_NUM_COMPONENTS0"},
+	{VivanteGpu::PA_VARYING_NUM_COMPONENTS1, 1, "PA_VARYING_NUM_COMPONENTS1"},
+	{VivanteGpu::PA_VS_OUTPUT_COUNT, 1, "PA_VS_OUTPUT_COUNT"},
+	{VivanteGpu::SE_SCISSOR_LEFT, 1, "SE_SCISSOR_LEFT"},
+	{VivanteGpu::SE_SCISSOR_TOP, 1, "SE_SCISSOR_TOP"},
+	{VivanteGpu::SE_SCISSOR_RIGHT, 1, "SE_SCISSOR_RIGHT"},
+	{VivanteGpu::SE_SCISSOR_BOTTOM, 1, "SE_SCISSOR_BOTTOM"},
+	{VivanteGpu::SE_DEPTH_SCALE, 1, "SE_DEPTH_SCALE"},
+	{VivanteGpu::SE_DEPTH_BIAS, 1, "SE_DEPTH_BIAS"},
+	{VivanteGpu::SE_CONFIG, 1, "SE_CONFIG"},
+	{VivanteGpu::SE_CLIP_RIGHT, 1, "SE_CLIP_RIGHT"},
+	{VivanteGpu::SE_CLIP_BOTTOM, 1, "SE_CLIP_BOTTOM"},
+	{VivanteGpu::RA_CONTROL, 1, "RA_CONTROL"},
+	{VivanteGpu::RA_EARLY_DEPTH, 1, "RA_EARLY_DEPTH"},
+	{VivanteGpu::RA_HDEPTH_CONTROL, 1, "RA_HDEPTH_CONTROL"},
+	{VivanteGpu::PS_OUTPUT_REG, 1, "PS_OUTPUT_REG"},
+	{VivanteGpu::PS_INPUT_COUNT, 1, "PS_INPUT_COUNT"},
+	{VivanteGpu::PS_TEMP_REGISTER_CONTROL, 1, "PS_TEMP_REGISTER_CONTROL"},
+	{VivanteGpu::PS_CONTROL, 1, "PS_CONTROL"},
+	{VivanteGpu::PS_UNIFORM_BASE, 1, "PS_UNIFORM_BASE"},
+	{VivanteGpu::PS_INST_ADDR, 1, "PS_INST_ADDR"},
+	{VivanteGpu::PS_CONTROL_EXT, 1, "PS_CONTROL_EXT"},
+	{VivanteGpu::PS_HALTI3_UNK0103C, 1, "PS_HALTI3_UNK0103C"},
+	{VivanteGpu::PS_ICACHE_PREFETCH, 1, "PS_ICACHE_PREFETCH", true},
+	{VivanteGpu::PS_SAMPLER_BASE, 1, "PS_SAMPLER_BASE"},
+	{VivanteGpu::PS_VARYING_NUM_COMPONENTS0, 1, "PS_VARYING_NUM_COMPONENTS0"},
+	{VivanteGpu::PS_VARYING_NUM_COMPONENTS1, 1, "PS_VARYING_NUM_COMPONENTS1"},
+	{VivanteGpu::PS_HALTI5_RANGE_HIGH, 1, "PS_HALTI5_RANGE_HIGH"},
+	{VivanteGpu::PS_ICACHE_COUNT, 1, "PS_ICACHE_COUNT"},
+	{VivanteGpu::PE_DEPTH_CONFIG, 1, "PE_DEPTH_CONFIG"},
+	{VivanteGpu::PE_DEPTH_NEAR, 1, "PE_DEPTH_NEAR"},
+	{VivanteGpu::PE_DEPTH_FAR, 1, "PE_DEPTH_FAR"},
+	{VivanteGpu::PE_DEPTH_NORMALIZE, 1, "PE_DEPTH_NORMALIZE"},
+	{VivanteGpu::PE_DEPTH_STRIDE, 1, "PE_DEPTH_STRIDE"},
+	{VivanteGpu::PE_STENCIL_OP, 1, "PE_STENCIL_OP"},
+	{VivanteGpu::PE_STENCIL_CONFIG, 1, "PE_STENCIL_CONFIG"},
+	{VivanteGpu::PE_ALPHA_OP, 1, "PE_ALPHA_OP"},
+	{VivanteGpu::PE_ALPHA_BLEND_COLOR, 1, "PE_ALPHA_BLEND_COLOR"},
+	{VivanteGpu::PE_ALPHA_CONFIG, 1, "PE_ALPHA_CONFIG"},
+	{VivanteGpu::PE_COLOR_FORMAT, 1, "PE_COLOR_FORMAT"},
+	{VivanteGpu::PE_COLOR_STRIDE, 1, "PE_COLOR_STRIDE"},
+	{VivanteGpu::PE_HDEPTH_CONTROL, 1, "PE_HDEPTH_CONTROL"},
+	{VivanteGpu::PE_PIPE_COLOR_ADDR0, 8, "PE_PIPE_COLOR_ADDR"},
+	{VivanteGpu::PE_PIPE_DEPTH_ADDR0, 8, "PE_PIPE_DEPTH_ADDR"},
+	{VivanteGpu::PE_STENCIL_CONFIG_EXT, 1, "PE_STENCIL_CONFIG_EXT"},
+	{VivanteGpu::PE_LOGIC_OP, 1, "PE_LOGIC_OP"},
+	{VivanteGpu::PE_DITHER0, 1, "PE_DITHER0"},
+	{VivanteGpu::PE_DITHER1, 1, "PE_DITHER1"},
+	{VivanteGpu::PE_STENCIL_CONFIG_EXT2, 1, "PE_STENCIL_CONFIG_EXT2"},
+	{VivanteGpu::PE_MEM_CONFIG, 1, "PE_MEM_CONFIG"},
+	{VivanteGpu::PE_HALTI4_UNK014C0, 1, "PE_HALTI4_UNK014C0"},
+	{VivanteGpu::SH_CONFIG, 1, "SH_CONFIG"},
+	{VivanteGpu::VS_ICACHE_COUNT, 1, "VS_ICACHE_COUNT"},
+	{VivanteGpu::SH_HALTI5_UNIFORMS_MIRROR0, 2048, "SH_HALTI5_UNIFORMS_MIRROR"},
+	{VivanteGpu::SH_HALTI5_UNIFORMS0, 2048, "SH_HALTI5_UNIFORMS"},
+	{VivanteGpu::NTE_DESCRIPTOR_CONTROL, 1, "NTE_DESCRIPTOR_CONTROL"},
+	{VivanteGpu::NTE_DESCRIPTOR_FLUSH, 1, "NTE_DESCRIPTOR_FLUSH", true},
+	{VivanteGpu::NTE_DESCRIPTOR_INVALIDATE, 1, "NTE_DESCRIPTOR_INVALIDATE", true},
+	{VivanteGpu::NTE_DESCRIPTOR_ADDR0, 32, "NTE_DESCRIPTOR_ADDR"},
+	{VivanteGpu::NTE_DESCRIPTOR_TX_CTRL0, 32, "NTE_DESCRIPTOR_TX_CTRL"},
+	{VivanteGpu::NTE_DESCRIPTOR_SAMP_CTRL0_0, 32, "NTE_DESCRIPTOR_SAMP_CTRL0"},
+	{VivanteGpu::NTE_DESCRIPTOR_SAMP_CTRL1_0, 32, "NTE_DESCRIPTOR_SAMP_CTRL1"},
+	{VivanteGpu::NTE_DESCRIPTOR_SAMP_LOD_MINMAX0, 32, "NTE_DESCRIPTOR_SAMP_LOD_MINMAX"},
+	{VivanteGpu::NTE_DESCRIPTOR_SAMP_LOD_BIAS0, 32, "NTE_DESCRIPTOR_SAMP_LOD_BIAS"},
+	{VivanteGpu::NTE_DESCRIPTOR_SAMP_ANISOTROPY0, 32, "NTE_DESCRIPTOR_SAMP_ANISOTROPY"},
+};
+// clang-format on
+
+inline const RegInfo *reg_info(uint32_t addr)
+{
+	for (const RegInfo &r : kRegs)
+		if (addr >= r.addr && addr < r.addr + r.count * 4)
+			return &r;
+	return nullptr;
+}
+
+// "RS_CONFIG", "NFE_VERTEX_STREAM_BASE[2]", or the address for a register
+// this map doesn't know ("0x0924").
+inline std::string reg_name(uint32_t addr)
+{
+	char buf[64];
+	if (const RegInfo *r = reg_info(addr)) {
+		if (r->count == 1)
+			return r->name;
+		snprintf(buf, sizeof buf, "%s[%u]", r->name, (addr - r->addr) / 4);
+		return buf;
+	}
+	snprintf(buf, sizeof buf, "0x%04X", addr);
+	return buf;
+}
+
+// The units a STALL token names (SYNC_RECIPIENT_*).
+inline const char *recipient_name(uint32_t r)
+{
+	switch (r) {
+	case VivanteGpu::SYNC_RECIPIENT_FE: return "FE";
+	case 0x05: return "RA";
+	case VivanteGpu::SYNC_RECIPIENT_PE: return "PE";
+	case VivanteGpu::SYNC_RECIPIENT_BLT: return "BLT";
+	}
+	return "?";
+}
+
+inline bool is_trigger(uint32_t addr)
+{
+	const RegInfo *r = reg_info(addr);
+	return r && r->trigger;
+}
+
+// ---- simulation -------------------------------------------------------------
+
+struct Stats {
+	uint32_t dwords = 0;	// decoded, END included
+	uint32_t commands = 0;
+	uint32_t headers = 0;	// LOAD_STATE commands
+	uint32_t states = 0;	// registers written
+	uint32_t changes = 0;	// ... to a new value, or a trigger
+	uint32_t redundant = 0; // ... to the value they held
+	uint32_t draws = 0;
+	uint32_t rs_kicks = 0;
+	uint32_t cl_kicks = 0; // PPU dispatches
+	uint32_t stalls = 0;
+	uint32_t flushes = 0; // GL_FLUSH_CACHE writes
+	uint32_t events = 0;
+	uint32_t pad = 0; // NOP and LOAD_STATE alignment dwords
+	uint32_t by_opcode[kOpcodes] = {};
+};
+
+enum class Issue : uint8_t {
+	MissingFlush, // memory the 3D pipe wrote used before a GL_FLUSH_CACHE
+	MissingStall, // memory another engine may still be writing, no FE<-PE stall
+	NoSemaphore,  // STALL not preceded by its GL_SEMAPHORE_TOKEN
+	Malformed,	  // not a command, or a command running past the stream
+};
+
+inline const char *issue_name(Issue i)
+{
+	switch (i) {
+	case Issue::MissingFlush: return "missing flush";
+	case Issue::MissingStall: return "missing stall";
+	case Issue::NoSemaphore: return "no semaphore";
+	case Issue::Malformed: return "malformed";
+	}
+	return "?";
+}
+
+struct Finding {
+	Issue issue;
+	uint32_t offset; // dword offset of the command
+	const char *what;
+};
+
+struct Result {
+	Stats stats;
+	std::vector<Finding> findings;
+	std::map<uint32_t, uint32_t> redundant; // register -> redundant writes
+	bool ended = false;						// stopped at an END
+};
+
+class Simulator {
+public:
+	// With `trace`, every command is printed there as it is decoded.
+	explicit Simulator(FILE *trace = nullptr)
+		: trace_{trace}
+	{}
+
+	// Decode one submission, up to the first END or the end of `words`.
+	Result run(std::span<const uint32_t> words)
+	{
+		Result res;
+		pe_dirty_.clear();
+		pe_busy_.clear();
+		rs_busy_.clear();
+		semaphore_ = kNone;
+		uint32_t pc = 0;
+		while (pc < words.size()) {
+			const uint32_t header = words[pc];
+			const uint32_t op = header >> 27;
+			const uint32_t n = command_dwords(header);
+			if (!n || pc + n > words.size()) {
+				finding(res, Issue::Malformed, pc, n ? "command runs past the stream" : "not an FE command");
+				res.stats.dwords += uint32_t(words.size()) - pc;
+				return res;
+			}
+			res.stats.dwords += n;
+			res.stats.commands++;
+			res.stats.by_opcode[op]++;
+			if (trace_)
+				fprintf(trace_, "%5u  %08X  %s", pc, header, opcode_name(op));
+			const uint32_t *w = &words[pc];
+			switch (op) {
+			case kLoadState: load_state(res, pc, w); break;
+			case kNop:
+				res.stats.pad += 2;
+				trace("\n");
+				break;
+			case kDrawPrimitives:
+			case kDrawIndexed:
+			case kDrawInstanced: draw(res, pc, w); break;
+			case kWait: trace(" %u cycles\n", header & 0xFFFF); break;
+			case kLink: trace(" -> 0x%08X, %u qwords\n", w[1], header & 0xFFFF); break;
+			case kCall: trace(" -> 0x%08X, return 0x%08X\n", w[1], w[3]); break;
+			case kStall: stall(res, pc, w[1]); break;
+			case kChipSelect: trace(" 0x%04X\n", header & 0xFFFF); break;
+			default: trace("\n"); break;
+			}
+			pc += n;
+			if (op == kEnd) {
+				res.ended = true;
+				break;
+			}
+		}
+		if (!pe_dirty_.empty())
+			finding(res, Issue::MissingFlush, pc, "stream ends with 3D-pipe writes unflushed");
+		else if (!pe_busy_.empty() || !rs_busy_.empty())
+			finding(res, Issue::MissingStall, pc, "stream ends with the pipe not drained");
+		return res;
+	}
+
+	// Forget the shadow (a GPU reset, or a stream that may run first).
+	void reset()
+	{
+		regs_.clear();
+	}
+
+	bool known(uint32_t addr) const
+	{
+		return regs_.contains(addr);
+	}
+
+	// The register's value as the stream left it (0 if never written).
+	uint32_t value(uint32_t addr) const
+	{
+		auto it = regs_.find(addr);
+		return it == regs_.end() ? 0 : it->second.value;
+	}
+
+private:
+	static constexpr uint32_t kNone = ~0u;
+
+	struct Shadow {
+		uint32_t value;
+		bool fixp;
+	};
+
+	// Bytes [lo, hi) of GPU memory.
+	struct Span {
+		uint64_t lo, hi;
+	};
+	using Spans = std::vector<Span>;
+
+	static bool overlaps(const Spans &a, const Spans &b)
+	{
+		for (const Span &x : a)
+			for (const Span &y : b)
+				if (x.lo < y.hi && y.lo < x.hi)
+					return true;
+		return false;
+	}
+
+	template<typename... Args>
+	void trace(const char *fmt, Args... args)
+	{
+		if (trace_)
+			fprintf(trace_, fmt, args...);
+	}
+
+	void finding(Result &res, Issue i, uint32_t pc, const char *what)
+	{
+		res.findings.push_back({i, pc, what});
+		trace("       ^^^ %s: %s\n", issue_name(i), what);
+	}
+
+	void load_state(Result &res, uint32_t pc, const uint32_t *w)
+	{
+		const uint32_t count = ((w[0] >> 16) & 0x3FF) ? (w[0] >> 16) & 0x3FF : 1024;
+		const uint32_t base = (w[0] & 0xFFFF) << 2;
+		const bool fixp = w[0] & kLoadStateFixp;
+		res.stats.headers++;
+		res.stats.pad += command_dwords(w[0]) - 1 - count;
+		trace(count > 1 ? " x%u\n" : "", count);
+		for (uint32_t k = 0; k < count; k++) {
+			const uint32_t addr = base + 4 * k, v = w[1 + k];
+			auto it = regs_.find(addr);
+			const bool same = it != regs_.end() && it->second.value == v && it->second.fixp == fixp;
+			const bool redundant = same && !is_trigger(addr);
+			res.stats.states++;
+			if (redundant) {
+				res.stats.redundant++;
+				res.redundant[addr]++;
+			} else {
+				res.stats.changes++;
+			}
+			regs_[addr] = {v, fixp};
+			if (trace_)
+				fprintf(trace_,
+						"%s%s = 0x%08X%s%s\n",
+						count > 1 ? "                             " : " ",
+						reg_name(addr).c_str(),
+						v,
+						fixp ? " (fixp)" : "",
+						redundant ? "  (redundant)" : "");
+			written(res, pc, addr, v);
+		}
+	}
+
+	// A register write that makes something happen.
+	void written(Result &res, uint32_t pc, uint32_t addr, uint32_t v)
+	{
+		using namespace VivanteGpu;
+		switch (addr) {
+		case GL_SEMAPHORE_TOKEN: semaphore_ = v; break;
+		case GL_FLUSH_CACHE:
+			res.stats.flushes++;
+			if (v)
+				pe_dirty_.clear();
+			break;
+		case GL_EVENT:
+			res.stats.events++;
+			if (!pe_dirty_.empty())
+				finding(res, Issue::MissingFlush, pc, "EVENT with 3D-pipe writes unflushed");
+			break;
+		case RS_KICKER:
+			if (v == RS_KICK)
+				rs_kick(res, pc);
+			break;
+		case CL_KICKER:
+			if (v == CL_KICK) {
+				res.stats.cl_kicks++;
+				pe_work(res, pc, {{0, ~0ull}}); // images in uniforms: all of memory
+			}
+			break;
+		}
+	}
+
+	// `bytes` at the address register `base` holds, if it was ever written.
+	void surface(Spans &s, uint32_t base, uint64_t bytes) const
+	{
+		if (known(base))
+			s.push_back({value(base), value(base) + (bytes ? bytes : 1)});
+	}
+
+	void draw(Result &res, uint32_t pc, const uint32_t *w)
+	{
+		using namespace VivanteGpu;
+		res.stats.draws++;
+		if ((w[0] >> 27) == kDrawInstanced)
+			trace(" prim %u, %u vertices, %u instances, start %u\n",
+				  (w[0] >> 16) & 0xF,
+				  w[1] & 0xFFFFFF,
+				  (w[0] & 0xFFFF) | ((w[1] >> 24) << 16),
+				  w[2]);
+		else
+			trace(" prim %u, start %u, count %u\n", w[1], w[2], w[3]);
+
+		// The targets: scissor height rounded up to a tile row.
+		const uint64_t rows = ((value(SE_SCISSOR_BOTTOM) >> 16) + 3) & ~3u;
+		const uint64_t color = value(PE_COLOR_STRIDE) * rows, depth = value(PE_DEPTH_STRIDE) * rows;
+		const bool has_depth = value(PE_DEPTH_CONFIG) != PE_DEPTH_CONFIG_DISABLED;
+		const uint32_t ts = value(TS_MEM_CONFIG);
+		Spans s;
+		surface(s, PE_PIPE_COLOR_ADDR0, color);
+		if (has_depth)
+			surface(s, PE_PIPE_DEPTH_ADDR0, depth);
+		if (ts & TS_MEM_CONFIG_COLOR_FAST_CLEAR)
+			surface(s, TS_COLOR_STATUS_BASE, etna::ts_bytes(uint32_t(color)));
+		if (has_depth && (ts & TS_MEM_CONFIG_DEPTH_FAST_CLEAR))
+			surface(s, TS_DEPTH_STATUS_BASE, etna::ts_bytes(uint32_t(depth)));
+		pe_work(res, pc, s);
+	}
+
+	void pe_work(Result &res, uint32_t pc, const Spans &s)
+	{
+		if (overlaps(s, rs_busy_))
+			finding(res, Issue::MissingStall, pc, "3D pipe uses memory an RS op may still be writing");
+		pe_dirty_.insert(pe_dirty_.end(), s.begin(), s.end());
+		pe_busy_.insert(pe_busy_.end(), s.begin(), s.end());
+	}
+
+	void rs_kick(Result &res, uint32_t pc)
+	{
+		using namespace VivanteGpu;
+		res.stats.rs_kicks++;
+		const uint32_t config = value(RS_CONFIG), window = value(RS_WINDOW_SIZE);
+		const uint32_t height = window >> 16;
+		const bool clear = value(RS_CLEAR_CONTROL) & RS_CLEAR_CONTROL_ENABLED1;
+		const uint64_t src_rows = config & RS_CONFIG_SOURCE_TILED ? (height + 3) / 4 : height;
+		const uint64_t dst_rows = config & RS_CONFIG_DOWNSAMPLE_Y ? height / 2 : height;
+		const uint64_t src = value(RS_SOURCE_STRIDE) * src_rows;
+		Spans s;
+		if (!clear) {
+			surface(s, RS_PIPE_SOURCE_ADDR0, src);
+			if (value(TS_MEM_CONFIG) & TS_MEM_CONFIG_COLOR_FAST_CLEAR)
+				surface(s, TS_COLOR_STATUS_BASE, (src + 255) / 256);
+		}
+		surface(s, RS_PIPE_DEST_ADDR0, value(RS_DEST_STRIDE) * dst_rows);
+		if (overlaps(s, pe_dirty_))
+			finding(res, Issue::MissingFlush, pc, "RS op on memory the 3D pipe wrote, not flushed");
+		else if (overlaps(s, pe_busy_))
+			finding(res, Issue::MissingStall, pc, "RS op on memory the 3D pipe may still be writing");
+		rs_busy_.insert(rs_busy_.end(), s.begin(), s.end());
+	}
+
+	void stall(Result &res, uint32_t pc, uint32_t token)
+	{
+		using namespace VivanteGpu;
+		res.stats.stalls++;
+		const uint32_t from = token & 0x1F, to = (token >> 8) & 0x1F;
+		trace(" %s <- %s\n", recipient_name(from), recipient_name(to));
+		if (token != semaphore_)
+			finding(res, Issue::NoSemaphore, pc, "STALL without a matching GL_SEMAPHORE_TOKEN");
+		semaphore_ = kNone;
+		if (from == SYNC_RECIPIENT_FE && to == SYNC_RECIPIENT_PE) {
+			pe_busy_.clear();
+			rs_busy_.clear();
+		}
+	}
+
+	FILE *trace_;
+	std::unordered_map<uint32_t, Shadow> regs_;
+	Spans pe_dirty_; // written by the 3D pipe since the last GL_FLUSH_CACHE
+	Spans pe_busy_;	 // touched by the 3D pipe since the last FE<-PE stall
+	Spans rs_busy_;	 // touched by the RS since the last FE<-PE stall
+	uint32_t semaphore_ = kNone;
+};
+
+} // namespace etna::decode
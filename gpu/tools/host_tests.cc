@@ -0,0 +1,3370 @@
+// =============================================================================
+//  host_tests.cc -- HOST tool: unit tests for the hardware-independent GPU code
+// =============================================================================
+// Compiles on the development machine (clang++ -std=c++20), not the target.
+// Everything under test here is pure logic (address arithmetic, command-word
+// encoding, bookkeeping) that the on-target tests can only exercise through
+// the GPU; off-target we can hammer the edge cases and randomize.
+//
+//   ./host_tests          (exit status 0 = all passed)
+//
+// Build:  clang++ -std=c++20 -O2 -I.. host_tests.cc ../etna_3d.cc -o host_tests
+//
+// etna_3d.cc is built in so recorded bundles can be compared word-for-word
+// with what emit_mesh() produces fresh.
+
+#include "cube_cpu_render.hh"
+#include "cube_scene.hh"
+#include "etna_3d.hh"
+#include "etna_bundle.hh"
+#include "etna_compute_list.hh"
+#include "etna_decode.hh"
+#include "etna_damage.hh"
+#include "etna_format.hh"
+#include "etna_frame.hh"
+#include "etna_heap.hh"
+#include "etna_mesh.hh"
+#include "etna_offload.hh"
+#include "etna_profile.hh"
+#include "etna_ring.hh"
+#include "etna_shader_cache.hh"
+#include "etna_state.hh"
+#include "etna_swapchain.hh"
+#include "etna_timeline.hh"
+#include "etna_ts.hh"
+#include "etna_trace.hh"
+#include "etna_tune.hh"
+#include "gpu_regs_3d.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <sys/mman.h>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+	do {                                                                                                               \
+		if (!(cond)) {                                                                                                 \
+			fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);                                  \
+			failures++;                                                                                                \
+		}                                                                                                              \
+	} while (0)
+
+// Deterministic xorshift so a failure reproduces run-to-run.
+struct Rng {
+	uint32_t s = 0x12345678;
+	uint32_t next()
+	{
+		s ^= s << 13;
+		s ^= s >> 17;
+		s ^= s << 5;
+		return s;
+	}
+	uint32_t below(uint32_t n)
+	{
+		return next() % n;
+	}
+};
+
+// -----------------------------------------------------------------------------
+//  etna_heap.hh
+// -----------------------------------------------------------------------------
+constexpr uint32_t PoolBase = 0x90000000;
+constexpr uint32_t PoolSize = 64 * 1024 * 1024;
+
+void test_heap_basics()
+{
+	static etna::Heap h{PoolBase, PoolSize};
+
+	// Small allocations land in slabs, aligned to their class.
+	uint32_t a = h.alloc(100);
+	uint32_t b = h.alloc(100);
+	CHECK(a && b && a != b);
+	CHECK(a % 128 == 0 && b % 128 == 0);
+	CHECK(h.stats().slabs == 1);
+	CHECK(h.stats().used == 256);
+
+	// Explicit alignment above the size class bumps the class.
+	uint32_t c = h.alloc(64, 1024);
+	CHECK(c % 1024 == 0);
+
+	// Large allocations honour big alignments.
+	uint32_t d = h.alloc(3 * 1024 * 1024, 1024 * 1024);
+	CHECK(d % (1024 * 1024) == 0);
+
+	// Double free and stray pointers are refused without damage.
+	CHECK(h.free(a));
+	CHECK(!h.free(a));
+	CHECK(!h.free(b + 4));
+	CHECK(!h.free(PoolBase + PoolSize - 64));
+	CHECK(h.free(b) && h.free(c) && h.free(d));
+
+	// Everything back: the one warm slab per used class stays carved out.
+	auto st = h.stats();
+	CHECK(st.used == 0 && st.live == 0);
+	CHECK(st.reserved == st.slabs * etna::Heap::kSlabBytes);
+
+	// Exhaustion fails cleanly and is counted.
+	CHECK(h.alloc(PoolSize) == 0);
+	CHECK(h.stats().failed == 1);
+	CHECK(h.alloc(0) == 0 && h.alloc(64, 48) == 0);
+
+	// Sizes whose 64 B rounding wraps past 2^32 are refused, not turned into
+	// a zero-size block.
+	const uint32_t before = h.stats().failed;
+	CHECK(h.alloc(0xFFFFFFC1) == 0 && h.alloc(0xFFFFFFFF) == 0 && h.alloc(PoolSize + 1) == 0);
+	CHECK(h.stats().failed == before + 3 && h.stats().live == 0 && h.stats().used == 0);
+}
+
+// Randomized alloc/free against a shadow map: no two live allocations may
+// overlap, all stay inside the pool and aligned, accounting matches, and once
+// everything is freed the large tier coalesces back into a single block.
+void test_heap_stress()
+{
+	static etna::Heap h{PoolBase, PoolSize};
+	std::map<uint32_t, uint32_t> live; // addr -> footprint
+	Rng rng;
+	uint32_t expect_used = 0;
+
+	for (int iter = 0; iter < 200000; iter++) {
+		bool do_alloc = live.empty() || rng.below(100) < 55;
+		if (do_alloc) {
+			// Mostly small (command/vertex buffers), sometimes render-target sized.
+			uint32_t r = rng.below(100);
+			uint32_t bytes = r < 70 ? 1 + rng.below(4096) : r < 95 ? 4097 + rng.below(256 * 1024)
+																	: 1 + rng.below(4 * 1024 * 1024);
+			uint32_t align = 64u << rng.below(r < 95 ? 3 : 8);
+			uint32_t addr = h.alloc(bytes, align);
+			if (!addr)
+				continue; // full is legal; the invariants below still must hold
+			uint32_t fp = etna::Heap::footprint(bytes, align);
+			CHECK(addr % align == 0);
+			CHECK(addr >= PoolBase && uint64_t(addr) + fp <= uint64_t(PoolBase) + PoolSize);
+			auto next = live.lower_bound(addr);
+			if (next != live.end())
+				CHECK(addr + fp <= next->first);
+			if (next != live.begin()) {
+				auto prev = std::prev(next);
+				CHECK(prev->first + prev->second <= addr);
+			}
+			live[addr] = fp;
+			expect_used += fp;
+		} else {
+			auto it = live.begin();
+			std::advance(it, rng.below(live.size()));
+			CHECK(h.free(it->first));
+			expect_used -= it->second;
+			live.erase(it);
+		}
+
+		if ((iter & 1023) == 0) {
+			auto st = h.stats();
+			CHECK(st.used == expect_used);
+			CHECK(st.live == live.size());
+			CHECK(st.reserved >= st.used && st.peak >= st.reserved);
+			CHECK(st.reserved + st.free == PoolSize);
+		}
+	}
+
+	auto mid = h.stats();
+	printf("heap stress: peak %u KB, failed %u, frag %u%%\n", mid.peak / 1024, mid.failed, mid.fragmentation_pct());
+
+	for (auto [addr, fp] : live)
+		CHECK(h.free(addr));
+	auto st = h.stats();
+	CHECK(st.used == 0 && st.live == 0);
+	// Only the warm slabs remain, so the free space is at most slabs+1 pieces.
+	CHECK(st.free_blocks <= st.slabs + 1);
+	CHECK(st.reserved == st.slabs * etna::Heap::kSlabBytes);
+}
+
+// The per-frame transient pattern must reuse the same space forever.
+void test_heap_transient_reuse()
+{
+	static etna::Heap h{PoolBase, PoolSize};
+	uint32_t keep = h.alloc(8 * 1024 * 1024); // a long-lived render target
+	uint32_t peak = 0;
+	for (int frame = 0; frame < 10000; frame++) {
+		uint32_t cs = h.alloc(4096);
+		uint32_t vtx = h.alloc(36 * 7 * 4);
+		uint32_t tmp = h.alloc(1024 * 1024);
+		CHECK(cs && vtx && tmp);
+		if (frame == 0)
+			peak = h.stats().peak;
+		h.free(tmp);
+		h.free(vtx);
+		h.free(cs);
+	}
+	CHECK(h.stats().peak == peak);
+	CHECK(h.free(keep));
+}
+
+// -----------------------------------------------------------------------------
+//  etna_ring.hh -- simulated FE consuming the ring
+// -----------------------------------------------------------------------------
+// The model GPU executes committed blocks in order, one per `step()`, firing the
+// block's event bit (if any) into an accumulator like the ISR does. The FE may
+// still be reading every block it hasn't finished plus the idle WAIT/LINK of
+// the last one it finished -- placement must never overlap those or the home.
+struct RingSim {
+	static constexpr uint32_t Dwords = 4096;
+	struct Block {
+		uint32_t start, dwords, event_id, seqno;
+	};
+	etna::RingTracker t;
+	std::deque<Block> queued;  // committed, not yet executed by the FE
+	Block last_done{0, 4, etna::RingTracker::kNoEvent, 0}; // home WAIT/LINK
+	uint32_t acc = 0;		   // fired event bits not yet reaped
+	uint32_t wraps = 0, markers = 0, no_event = 0;
+	uint32_t last_start = 0;
+
+	RingSim()
+	{
+		t.init(Dwords);
+	}
+
+	static bool overlaps(uint32_t a, uint32_t an, uint32_t b, uint32_t bn)
+	{
+		return a < b + bn && b < a + an;
+	}
+
+	bool commit(const etna::RingTracker::Slot &s)
+	{
+		bool ok = s.start >= etna::RingTracker::kHomeDwords && s.start + s.dwords <= Dwords && !(s.start & 1);
+		uint32_t idle = last_done.start + last_done.dwords - etna::RingTracker::kIdleDwords;
+		ok &= !overlaps(s.start, s.dwords, idle, etna::RingTracker::kIdleDwords);
+		for (auto &b : queued) {
+			ok &= !overlaps(s.start, s.dwords, b.start, b.dwords);
+			ok &= s.event_id == etna::RingTracker::kNoEvent || s.event_id != b.event_id;
+		}
+		wraps += s.start < last_start;
+		last_start = s.start;
+		no_event += s.event_id == etna::RingTracker::kNoEvent;
+		uint32_t seq = t.commit(s);
+		queued.push_back(Block{s.start, s.dwords, s.event_id, seq});
+		return ok;
+	}
+
+	void step()
+	{
+		if (queued.empty())
+			return;
+		last_done = queued.front();
+		queued.pop_front();
+		if (last_done.event_id != etna::RingTracker::kNoEvent)
+			acc |= 1u << last_done.event_id;
+	}
+
+	void reap()
+	{
+		acc &= ~t.retire(acc);
+	}
+};
+
+void test_ring_queue_without_waits()
+{
+	// Hundreds of small blocks with the GPU stalled: every one is placed until
+	// the ring itself is full; only 30 carry events.
+	RingSim sim;
+	int placed = 0;
+	while (auto s = sim.t.place(40)) {
+		CHECK(sim.commit(s));
+		placed++;
+	}
+	uint32_t blocks_fit = (RingSim::Dwords - etna::RingTracker::kHomeDwords - etna::RingTracker::kMarkerDwords) / 46;
+	CHECK(placed >= int(blocks_fit) - 1);
+	CHECK(sim.t.events_in_flight() == etna::RingTracker::kNumEvents);
+	CHECK(sim.no_event == uint32_t(placed) - etna::RingTracker::kNumEvents);
+
+	// The trailing eventless blocks need a marker; one always fits.
+	CHECK(sim.t.needs_marker(sim.t.submitted()));
+	while (sim.t.needs_marker(sim.t.submitted())) {
+		sim.step(); // GPU makes progress, frees an event slot
+		sim.reap();
+		if (auto m = sim.t.place_marker())
+			CHECK(sim.commit(m));
+	}
+	while (!sim.queued.empty()) {
+		sim.step();
+		sim.reap();
+	}
+	CHECK(sim.t.completed() == sim.t.submitted());
+	CHECK(sim.t.pending() == 0 && sim.t.events_in_flight() == 0);
+}
+
+// Ids lent out (timestamps) leave the pool: fewer blocks carry events, and
+// a lent id firing retires nothing. Given back, they are used again.
+void test_ring_lent_events()
+{
+	etna::RingTracker t;
+	t.init(RingSim::Dwords);
+	uint32_t lent = 0;
+	for (uint32_t i = 0; i < 12; i++)
+		lent |= 1u << t.take_event();
+	CHECK(__builtin_popcount(lent) == 12);
+	uint32_t evented = 0;
+	for (uint32_t i = 0; i < etna::RingTracker::kNumEvents; i++) {
+		auto s = t.place(8);
+		CHECK(s && !(s.event_id != etna::RingTracker::kNoEvent && (lent & (1u << s.event_id))));
+		evented += s.event_id != etna::RingTracker::kNoEvent;
+		t.commit(s);
+	}
+	CHECK(evented == etna::RingTracker::kNumEvents - 12);
+	CHECK(t.retire(lent) == 0 && t.completed() == 0);
+	CHECK(t.take_event() == etna::RingTracker::kNoEvent); // 18 in blocks, 12 lent
+	for (uint32_t m = lent; m; m &= m - 1)
+		t.put_event(__builtin_ctz(m));
+	t.retire((1u << etna::RingTracker::kNumEvents) - 1);
+	CHECK(t.completed() == evented && t.events_in_flight() == 0); // the rest wait for a marker
+	auto s = t.place(8);
+	CHECK(s && s.event_id == 0);
+}
+
+// Random block sizes, random GPU speed, reaping every `reap_one_in` steps (1 =
+// lockstep, so the retired idle WAIT/LINK really is where the FE sits): the CPU
+// side follows Gpu::submit()'s policy (place; if full, marker-if-needed + wait).
+void test_ring_random(uint32_t reap_one_in)
+{
+	RingSim sim;
+	Rng rng;
+	std::vector<uint32_t> fences;
+	uint32_t prev_completed = 0;
+	for (int i = 0; i < 100000; i++) {
+		uint32_t op = 2 * (rng.below(8) ? rng.below(32) : rng.below(800)); // dwords, mostly small
+		etna::RingTracker::Slot s;
+		while (!(s = sim.t.place(op))) {
+			if (sim.t.needs_marker(sim.t.completed() + 1))
+				if (auto m = sim.t.place_marker()) {
+					CHECK(sim.commit(m));
+					sim.markers++;
+				}
+			sim.step(); // "wait for the IRQ"
+			sim.reap();
+		}
+		CHECK(sim.commit(s));
+		fences.push_back(sim.t.submitted());
+
+		for (uint32_t k = rng.below(3); k; k--) {
+			sim.step();
+			if (rng.below(reap_one_in) == 0)
+				sim.reap();
+		}
+		CHECK(sim.t.completed() >= prev_completed);
+		prev_completed = sim.t.completed();
+		CHECK(sim.t.busy_dwords() < RingSim::Dwords);
+	}
+	// Drain like Gpu::wait(last): markers where needed, until complete.
+	uint32_t last = fences.back();
+	while (!sim.t.is_complete(last)) {
+		if (sim.t.needs_marker(last))
+			if (auto m = sim.t.place_marker())
+				CHECK(sim.commit(m));
+		sim.step();
+		sim.reap();
+	}
+	for (uint32_t f : fences)
+		CHECK(sim.t.is_complete(f));
+	CHECK(sim.wraps > 100);
+	printf("ring sim (reap 1/%u): %u submits, %u wraps, %u without event, %u markers\n", reap_one_in,
+		   uint32_t(fences.size()), sim.wraps, sim.no_event, sim.markers);
+}
+
+// -----------------------------------------------------------------------------
+//  etna_ring.hh -- ring words, walked by a model FE
+// -----------------------------------------------------------------------------
+// A minimal front-end: follows LOAD_STATE / NOP / STALL / LINK from `pc` until
+// it reaches a WAIT (the new idle point), recording every state write.
+constexpr uint32_t RingBase = 0x8A000000;
+constexpr uint32_t StreamBase = 0x90000000;
+
+struct FeModel {
+	uint32_t *ring;
+	uint32_t *stream; // one command-stream Bo at StreamBase
+	uint32_t stream_dwords;
+	std::vector<std::pair<uint32_t, uint32_t>> states; // (addr, value), events included
+	std::vector<uint32_t> events;
+	uint32_t idle = 0; // address of the WAIT it stopped on
+	uint32_t draws = 0;
+	bool ok = true;
+
+	FeModel(uint32_t *ring, uint32_t *stream, uint32_t stream_dwords)
+		: ring{ring}
+		, stream{stream}
+		, stream_dwords{stream_dwords}
+	{}
+
+	uint32_t &mem(uint32_t addr)
+	{
+		if (addr >= RingBase && addr < RingBase + 4 * 4096)
+			return ring[(addr - RingBase) / 4];
+		if (addr >= StreamBase && addr < StreamBase + 4 * stream_dwords)
+			return stream[(addr - StreamBase) / 4];
+		ok = false;
+		static uint32_t bad = VivanteGpu::CMD_END;
+		return bad;
+	}
+
+	void run(uint32_t pc)
+	{
+		for (int n = 0; n < 100000 && ok; n++) {
+			if (pc & 7) {
+				ok = false; // commands are 64-bit aligned
+				return;
+			}
+			uint32_t w = mem(pc);
+			switch (w >> 27) {
+			case 1: { // LOAD_STATE
+				uint32_t count = (w >> 16) & 0x3FF, addr = (w & 0xFFFF) << 2;
+				count = count ? count : 1024;
+				for (uint32_t k = 0; k < count; k++) {
+					uint32_t v = mem(pc + 4 + 4 * k);
+					states.push_back({addr + 4 * k, v});
+					if (addr + 4 * k == VivanteGpu::GL_EVENT)
+						events.push_back(v & 0x1F);
+				}
+				pc += ((1 + count + 1) & ~1u) * 4;
+				break;
+			}
+			case 3: // NOP
+			case 9: // STALL
+				pc += 8;
+				break;
+			case 12: // DRAW_INSTANCED: header + 3 parameter dwords
+				draws++;
+				pc += 16;
+				break;
+			case 7: // WAIT: idle here; must loop on itself through the next LINK
+				idle = pc;
+				ok &= mem(pc + 8) >> 27 == 8 && mem(pc + 12) == pc;
+				return;
+			case 8: // LINK
+				pc = mem(pc + 4);
+				break;
+			default: // END or anything unexpected
+				ok = false;
+				return;
+			}
+		}
+		ok = false; // ran away
+	}
+};
+
+// Three RS-style state writes, the shape of a real op.
+constexpr uint32_t kOps[] = {
+	VivanteGpu::cmd_load_state(VivanteGpu::RS_CONFIG),	 6,
+	VivanteGpu::cmd_load_state(VivanteGpu::RS_DEST_STRIDE), 256,
+	VivanteGpu::cmd_load_state(VivanteGpu::RS_KICKER),	 VivanteGpu::RS_KICK,
+};
+constexpr uint32_t kOpDwords = sizeof(kOps) / 4;
+
+void test_ring_words()
+{
+	static uint32_t ring[4096], stream[64];
+	auto nop = [] {};
+
+	// Home idle loop, as ring_init() writes it.
+	ring[0] = VivanteGpu::cmd_wait(200);
+	ring[1] = 0;
+	ring[2] = VivanteGpu::cmd_link(2);
+	ring[3] = RingBase;
+	etna::RingTracker t;
+	t.init(4096);
+
+	// Copy-submit: ops land in the ring, tail diverted to them.
+	auto s1 = t.place(kOpDwords);
+	CHECK(s1.start == 4 && s1.dwords == kOpDwords + 6 && s1.event_id == 0);
+	etna::write_copy_block(ring, RingBase, t.tail(), s1, kOps, kOpDwords, nop);
+	CHECK(ring[0] == VivanteGpu::cmd_link(s1.dwords / 2) && ring[1] == RingBase + 4 * 4);
+	CHECK(ring[4] == kOps[0] && ring[4 + kOpDwords] == VivanteGpu::cmd_load_state(VivanteGpu::GL_EVENT));
+	CHECK(ring[4 + kOpDwords + 1] == (0 | VivanteGpu::GL_EVENT_FROM_PE));
+	FeModel fe{ring, stream, 64};
+	fe.run(RingBase + t.tail() * 4);
+	t.commit(s1);
+	CHECK(fe.ok && fe.states.size() == 4 && fe.events.size() == 1 && fe.events[0] == s1.event_id);
+	CHECK(fe.idle == RingBase + t.tail() * 4);
+
+	// Link-submit: only the trailer in the ring; the stream runs in place and
+	// LINKs back to it.
+	uint32_t ring_before[4096];
+	for (uint32_t i = 0; i < 4096; i++)
+		ring_before[i] = ring[i];
+	auto s2 = t.place(0);
+	CHECK(s2.dwords == 6 && s2.event_id == 1);
+	for (uint32_t i = 0; i < kOpDwords; i++)
+		stream[i] = kOps[i];
+	auto ret = etna::return_link(RingBase, s2);
+	stream[kOpDwords] = ret.header;
+	stream[kOpDwords + 1] = ret.target;
+	uint32_t old_tail = t.tail();
+	etna::write_link_block(ring, RingBase, old_tail, s2, StreamBase, kOpDwords + 2, nop);
+	CHECK(ring[old_tail] == VivanteGpu::cmd_link((kOpDwords + 2) / 2) && ring[old_tail + 1] == StreamBase);
+	CHECK(ret.target == RingBase + s2.start * 4);
+	for (uint32_t i = 0; i < 4096; i++) // nothing else in the ring was touched
+		if (i != old_tail && i != old_tail + 1 && (i < s2.start || i >= s2.start + s2.dwords))
+			CHECK(ring[i] == ring_before[i]);
+	FeModel fe2{ring, stream, 64};
+	fe2.run(RingBase + old_tail * 4);
+	t.commit(s2);
+	CHECK(fe2.ok && fe2.states.size() == 4 && fe2.events.size() == 1 && fe2.events[0] == s2.event_id);
+	CHECK(fe2.states[0].first == VivanteGpu::RS_CONFIG && fe2.idle == RingBase + t.tail() * 4);
+}
+
+// The FE may fetch between any two stores: at every barrier the tail must be
+// either still the idle WAIT or a complete LINK to the new target -- never a
+// LINK header with a stale address.
+void test_ring_divert_order()
+{
+	static uint32_t ring[4096];
+	ring[0] = VivanteGpu::cmd_wait(200);
+	ring[1] = 0;
+	ring[2] = VivanteGpu::cmd_link(2);
+	ring[3] = RingBase;
+	etna::RingTracker t;
+	t.init(4096);
+	auto s = t.place(kOpDwords);
+	uint32_t target = RingBase + s.start * 4;
+	int barriers = 0;
+	bool block_ready_at_divert = true;
+	auto check = [&] {
+		barriers++;
+		bool is_link = ring[0] >> 27 == 8;
+		CHECK(!is_link || ring[1] == target);
+		if (ring[1] == target) // the divert has begun: the block must be complete
+			block_ready_at_divert &= ring[s.start + s.dwords - 2] >> 27 == 8;
+	};
+	etna::write_copy_block(ring, RingBase, 0, s, kOps, kOpDwords, check);
+	CHECK(barriers == 3 && block_ready_at_divert);
+	CHECK(ring[0] == VivanteGpu::cmd_link(s.dwords / 2));
+}
+
+// Mixed copy/link submissions through many wraps: after each one the model FE,
+// resumed from its previous idle point, must run exactly that submission's
+// states and event and park on the new tail.
+void test_ring_words_chain()
+{
+	static uint32_t ring[4096];
+	static uint32_t streams[8][64]; // link-submitted streams, reused round-robin
+	ring[0] = VivanteGpu::cmd_wait(200);
+	ring[1] = 0;
+	ring[2] = VivanteGpu::cmd_link(2);
+	ring[3] = RingBase;
+	etna::RingTracker t;
+	t.init(4096);
+	Rng rng;
+	uint32_t fe_idle = RingBase;
+	uint32_t wraps = 0, prev_start = 0;
+
+	for (int i = 0; i < 5000; i++) {
+		// Retire everything the model FE has run (it is always caught up here).
+		t.retire((1u << etna::RingTracker::kNumEvents) - 1);
+		bool link = rng.below(2);
+		uint32_t *stream = streams[i % 8];
+		uint32_t n = 2 * (1 + rng.below(20));
+		uint32_t ops[64];
+		for (uint32_t k = 0; k < n; k += 2) {
+			ops[k] = VivanteGpu::cmd_load_state(VivanteGpu::RS_FILL_VALUE0);
+			ops[k + 1] = uint32_t(i * 100 + k);
+		}
+		etna::RingTracker::Slot s = t.place(link ? 0 : n);
+		CHECK(bool(s));
+		wraps += s.start < prev_start;
+		prev_start = s.start;
+		if (link) {
+			for (uint32_t k = 0; k < n; k++)
+				stream[k] = ops[k];
+			auto ret = etna::return_link(RingBase, s);
+			stream[n] = ret.header;
+			stream[n + 1] = ret.target;
+			etna::write_link_block(ring, RingBase, t.tail(), s, StreamBase, n + 2, [] {});
+		} else
+			etna::write_copy_block(ring, RingBase, t.tail(), s, ops, n, [] {});
+		t.commit(s);
+
+		FeModel fe{ring, stream, 64};
+		fe.run(fe_idle);
+		CHECK(fe.ok && fe.states.size() == n / 2 + (s.event_id != etna::RingTracker::kNoEvent));
+		CHECK(fe.states.size() && fe.states[0].second == ops[1]);
+		CHECK(fe.idle == RingBase + t.tail() * 4);
+		fe_idle = fe.idle;
+	}
+	CHECK(wraps > 10);
+}
+
+
+// -----------------------------------------------------------------------------
+//  etna_bundle.hh -- record once, patch, chain
+// -----------------------------------------------------------------------------
+// CmdStream writes through Bo::map(), i.e. at the Bo's 32-bit "physical"
+// address, so the bundles need real host memory at StreamBase (which is also
+// where FeModel looks for streams).
+constexpr uint32_t BundleArenaBytes = 64 * 1024;
+
+uint32_t *bundle_arena()
+{
+	static void *p = [] {
+		void *hint = reinterpret_cast<void *>(uintptr_t(StreamBase));
+		void *m = mmap(hint, BundleArenaBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return m == hint ? m : nullptr;
+	}();
+	return static_cast<uint32_t *>(p);
+}
+
+// The demo's cube draw; the Bos are only addresses here, nothing is touched.
+const etna::Bo kRt{0xA0000000, 1024 * 600 * 4}, kDepth{0xA0300000, 1024 * 600 * 2};
+const etna::Bo kVtx{0xA0500000, 1008}, kVs{0xA0510000, 256}, kPs{0xA0520000, 64};
+
+etna::MeshDraw cube_draw(std::span<const float> mvp)
+{
+	return etna::MeshDraw{
+		.rt = &kRt,
+		.rt_stride = 1024 * 4,
+		.vtx = &kVtx,
+		.vs = &kVs,
+		.vs_words = 64,
+		.ps = &kPs,
+		.ps_words = 16,
+		.uniforms = mvp,
+		.width = 1024,
+		.height = 600,
+		.vertex_count = 36,
+		.depth = &kDepth,
+		.depth_stride = 1024 * 2,
+	};
+}
+
+// Bundle/stream number `i` of the arena (4 KB each).
+etna::CmdStream arena_stream(uint32_t i)
+{
+	return etna::CmdStream{etna::Bo{StreamBase + i * 4096, 4096}, 1024};
+}
+
+Mat4 frame_mvp(uint32_t frame, uint32_t cube)
+{
+	float a = 0.05f * float(frame) + float(cube);
+	return cube_mvp(a, 0.3f * tsin(a), 1024.0f / 600.0f, 0.1f * float(cube), -0.2f, -3.0f - float(cube));
+}
+
+// A recorded-and-patched bundle must be word-for-word what emit_mesh() emits
+// fresh with the same MVP, plus only the tail, and a patch must dirty exactly
+// its slot.
+void test_bundle_patch()
+{
+	if (!bundle_arena()) {
+		printf("bundle tests skipped: could not map host memory at 0x%08x\n", StreamBase);
+		return;
+	}
+	Mat4 m0 = frame_mvp(0, 0);
+	etna::Bundle b{arena_stream(0)};
+	uint32_t at = etna::emit_mesh(b.cs(), cube_draw(m0));
+	CHECK(at != 0);
+	etna::Bundle::Slot mvp = b.slot(at, 16);
+	CHECK(bool(mvp) && !b.slot(at, b.cs().offset()) && !b.slot(at, 0));
+	CHECK(b.end() && b.ended());
+	auto first = b.take_dirty();
+	CHECK(first.lo == 0 && first.hi == b.dwords()); // the whole recording, once
+	CHECK(b.take_dirty().lo == b.take_dirty().hi);
+
+	const uint32_t *bw = b.cs().bo().span<const uint32_t>().data();
+	CHECK(bw[b.dwords() - 2] == VivanteGpu::CMD_END); // unchained: halts
+
+	etna::CmdStream fresh = arena_stream(1);
+	for (uint32_t frame = 1; frame <= 200; frame++) {
+		Mat4 m = frame_mvp(frame, 0);
+		CHECK(b.patch(mvp, std::span<const float>{m}));
+		auto d = b.take_dirty();
+		CHECK(d.lo == mvp.offset && d.hi == mvp.offset + 16);
+
+		fresh.reset();
+		uint32_t fresh_at = etna::emit_mesh(fresh, cube_draw(m));
+		fresh.align();
+		CHECK(fresh_at == at && fresh.offset() + 2 == b.dwords());
+		const uint32_t *fw = fresh.bo().span<const uint32_t>().data();
+		uint32_t diffs = 0;
+		for (uint32_t i = 0; i < fresh.offset(); i++)
+			diffs += bw[i] != fw[i];
+		CHECK(diffs == 0);
+	}
+
+	// Mis-sized patches are refused and leave the bundle alone.
+	const uint32_t three[3] = {1, 2, 3};
+	CHECK(!b.patch(mvp, std::span<const uint32_t>{three}));
+	CHECK(!b.patch(etna::Bundle::Slot{}, std::span<const uint32_t>{three, 0}));
+	CHECK(b.take_dirty().lo == 0);
+	printf("bundle: %u dwords recorded, %u patched per frame\n", b.dwords(), mvp.dwords);
+}
+
+// Chain three cube bundles into one submission and walk it with the model
+// FE: every draw must see its own patched MVP, in chain order, and the FE must
+// come back through the trailer to the new idle WAIT. Re-chaining only
+// rewrites the tails that changed.
+void test_bundle_chain()
+{
+	if (!bundle_arena())
+		return;
+	static uint32_t ring[4096];
+	ring[0] = VivanteGpu::cmd_wait(200);
+	ring[1] = 0;
+	ring[2] = VivanteGpu::cmd_link(2);
+	ring[3] = RingBase;
+	etna::RingTracker t;
+	t.init(4096);
+
+	etna::Bundle b[3];
+	etna::Bundle::Slot mvp[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		b[i] = etna::Bundle{arena_stream(2 + i)};
+		Mat4 m{};
+		mvp[i] = b[i].slot(etna::emit_mesh(b[i].cs(), cube_draw(m)), 16);
+		CHECK(b[i].end());
+		b[i].take_dirty();
+	}
+
+	uint32_t fe_idle = RingBase;
+	auto submit = [&](std::initializer_list<uint32_t> order, uint32_t frame) {
+		std::vector<etna::Bundle *> chain;
+		std::vector<float> expect;
+		for (uint32_t i : order) {
+			Mat4 m = frame_mvp(frame, i);
+			CHECK(b[i].patch(mvp[i], std::span<const float>{m}));
+			chain.push_back(&b[i]);
+			expect.insert(expect.end(), m.begin(), m.end());
+		}
+		auto s = t.place(0);
+		CHECK(bool(s) && etna::link_chain(chain, etna::return_link(RingBase, s)));
+		etna::write_link_block(ring, RingBase, t.tail(), s, chain[0]->gpu_addr(), chain[0]->dwords(), [] {});
+		t.commit(s);
+
+		FeModel fe{ring, bundle_arena(), BundleArenaBytes / 4};
+		fe.run(fe_idle);
+		CHECK(fe.ok && fe.draws == order.size() && fe.idle == RingBase + t.tail() * 4);
+		CHECK(fe.events.size() == (s.event_id != etna::RingTracker::kNoEvent));
+		std::vector<float> seen;
+		for (auto [addr, v] : fe.states)
+			if (addr >= VivanteGpu::SH_HALTI5_UNIFORMS_MIRROR0 && addr < VivanteGpu::SH_HALTI5_UNIFORMS_MIRROR0 + 64) {
+				float f;
+				memcpy(&f, &v, 4);
+				seen.push_back(f);
+			}
+		CHECK(seen == expect);
+		fe_idle = fe.idle;
+		t.retire((1u << etna::RingTracker::kNumEvents) - 1);
+	};
+
+	submit({0, 1, 2}, 1);
+	for (auto &x : b)
+		x.take_dirty();
+
+	// Same order: only the last bundle's tail moves (to the new trailer).
+	submit({0, 1, 2}, 2);
+	auto d0 = b[0].take_dirty(), d2 = b[2].take_dirty();
+	CHECK(d0.lo == mvp[0].offset && d0.hi == mvp[0].offset + 16);
+	CHECK(d2.lo == mvp[2].offset && d2.hi == b[2].dwords());
+	b[1].take_dirty();
+
+	// Reordered and shortened, many times over (wrapping the ring).
+	for (uint32_t frame = 3; frame < 600; frame++) {
+		if (frame % 3 == 0)
+			submit({2, 0}, frame);
+		else if (frame % 3 == 1)
+			submit({1}, frame);
+		else
+			submit({0, 2, 1}, frame);
+	}
+
+	// Refused chains write nothing.
+	etna::Bundle open{arena_stream(6)};
+	etna::Bundle *dup[] = {&b[0], &b[1], &b[0]};
+	etna::Bundle *unended[] = {&b[0], &open};
+	for (auto &x : b)
+		x.take_dirty();
+	CHECK(!etna::link_chain(dup, etna::ReturnLink{VivanteGpu::cmd_link(3), RingBase}));
+	CHECK(!etna::link_chain(unended, etna::ReturnLink{VivanteGpu::cmd_link(3), RingBase}));
+	CHECK(!etna::link_chain({}, etna::ReturnLink{VivanteGpu::cmd_link(3), RingBase}));
+	for (auto &x : b) {
+		auto d = x.take_dirty();
+		CHECK(d.lo == d.hi);
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  etna_state.hh -- shadow state + coalesced LOAD_STATE
+// -----------------------------------------------------------------------------
+// The register file a linear stream leaves behind, as (value, FIXP) per
+// address, snapshotted at every DRAW.
+struct RegFile {
+	std::map<uint32_t, std::pair<uint32_t, bool>> regs;
+	std::vector<std::map<uint32_t, std::pair<uint32_t, bool>>> at_draw;
+	uint32_t headers = 0;
+	bool ok = true;
+
+	void run(const uint32_t *w, uint32_t n)
+	{
+		for (uint32_t pc = 0; pc < n && ok;) {
+			switch (w[pc] >> 27) {
+			case 1: { // LOAD_STATE
+				uint32_t count = (w[pc] >> 16) & 0x3FF, addr = (w[pc] & 0xFFFF) << 2;
+				bool fixp = w[pc] & etna::StateTracker::kFixp;
+				count = count ? count : 1024;
+				for (uint32_t k = 0; k < count; k++)
+					regs[addr + 4 * k] = {w[pc + 1 + k], fixp};
+				headers++;
+				pc += (1 + count + 1) & ~1u;
+				break;
+			}
+			case 3: // NOP
+			case 9: // STALL
+				pc += 2;
+				break;
+			case 12: // DRAW_INSTANCED
+				at_draw.push_back(regs);
+				pc += 4;
+				break;
+			default:
+				ok = false;
+			}
+		}
+	}
+};
+
+void test_state_basics()
+{
+	if (!bundle_arena())
+		return;
+	etna::CmdStream cs = arena_stream(8);
+	const uint32_t *w = cs.bo().span<const uint32_t>().data();
+	etna::StateTracker st;
+
+	// Three adjacent registers -> one header (4 dwords instead of 6).
+	st.set(cs, 0x1000, 1);
+	st.set(cs, 0x1008, 3); // out of order: flush sorts
+	st.set(cs, 0x1004, 2);
+	CHECK(st.flush(cs) == 4);
+	CHECK(w[0] == VivanteGpu::cmd_load_state(0x1000, 3) && w[1] == 1 && w[2] == 2 && w[3] == 3);
+
+	// Nothing changed -> nothing emitted; one change -> one register.
+	st.set(cs, 0x1000, 1);
+	st.set(cs, 0x1004, 2);
+	CHECK(st.flush(cs) == 0);
+	st.set(cs, 0x1004, 7);
+	CHECK(st.flush(cs) == 2 && w[4] == VivanteGpu::cmd_load_state(0x1004) && w[5] == 7);
+
+	// A staged change reverted before the flush is dropped.
+	st.set(cs, 0x1004, 8);
+	st.set(cs, 0x1004, 7);
+	CHECK(st.flush(cs) == 0);
+
+	// FIXP and non-FIXP neighbours don't share a header; same value with a
+	// different FIXP flag is a change.
+	st.set(cs, 0x2000, 5, true);
+	st.set(cs, 0x2004, 6);
+	CHECK(st.flush(cs) == 4 && w[6] == (VivanteGpu::cmd_load_state(0x2000) | etna::StateTracker::kFixp));
+	st.set(cs, 0x2004, 6, true);
+	CHECK(st.flush(cs) == 2);
+
+	// invalidate(): everything goes out again.
+	st.invalidate();
+	st.set(cs, 0x1000, 1);
+	st.set(cs, 0x1004, 7);
+	CHECK(st.flush(cs) == 4);
+	CHECK(st.program_changed({1, 2, 3, 4}) && !st.program_changed({1, 2, 3, 4}) && st.program_changed({1, 2, 3, 5}));
+	st.invalidate();
+	CHECK(st.program_changed({1, 2, 3, 5}));
+
+	// More registers than the table holds: the overflow is written through,
+	// never lost.
+	etna::CmdStream big = arena_stream(10);
+	etna::StateTracker st2;
+	for (uint32_t r = 0; r < 300; r++)
+		st2.set(big, 0x4000 + 4 * r, r + 1);
+	st2.flush(big);
+	RegFile rf;
+	rf.run(big.bo().span<const uint32_t>().data(), big.offset());
+	CHECK(rf.ok && rf.regs.size() == 300);
+	for (uint32_t r = 0; r < 300; r++)
+		CHECK(rf.regs[0x4000 + 4 * r].first == r + 1);
+}
+
+// Random sets and flushes: whatever the tracker skips or merges, the stream
+// must leave exactly the last value set in every register.
+void test_state_random()
+{
+	if (!bundle_arena())
+		return;
+	Rng rng;
+	for (int round = 0; round < 50; round++) {
+		etna::CmdStream cs{etna::Bo{StreamBase + 0x6000, 0x8000}, 0x2000};
+		etna::StateTracker st;
+		std::map<uint32_t, std::pair<uint32_t, bool>> want;
+		RegFile rf;
+		uint32_t naive = 0, ran = 0;
+		for (int i = 0; i < 400 && cs.avail() > 512; i++) {
+			uint32_t addr = 0x800 + 4 * rng.below(96);
+			uint32_t v = rng.below(4);
+			bool fixp = addr >= 0x900 && rng.below(2);
+			st.set(cs, addr, v, fixp);
+			want[addr] = {v, fixp};
+			naive += 2;
+			if (rng.below(8) == 0) {
+				st.flush(cs);
+				rf.run(cs.bo().span<const uint32_t>().data() + ran, cs.offset() - ran);
+				ran = cs.offset();
+				CHECK(rf.ok && rf.regs == want);
+			}
+		}
+		st.flush(cs);
+		rf.run(cs.bo().span<const uint32_t>().data() + ran, cs.offset() - ran);
+		CHECK(rf.ok && rf.regs == want);
+		CHECK(cs.offset() <= naive);
+	}
+}
+
+// The demo's frame: 12 cubes sharing shaders, targets and depth, differing in
+// vertex buffer and MVP. Tracked emission must leave the same register file
+// at every draw as the full per-draw emission, in fewer dwords.
+void test_state_cube_scene()
+{
+	if (!bundle_arena())
+		return;
+	constexpr uint32_t NCubes = 12;
+	static const etna::Bo vtx[NCubes] = {
+		{0xA0600000, 1008}, {0xA0601000, 1008}, {0xA0602000, 1008}, {0xA0603000, 1008},
+		{0xA0604000, 1008}, {0xA0605000, 1008}, {0xA0606000, 1008}, {0xA0607000, 1008},
+		{0xA0608000, 1008}, {0xA0609000, 1008}, {0xA060A000, 1008}, {0xA060B000, 1008},
+	};
+	etna::CmdStream full{etna::Bo{StreamBase, 0x4000}, 0x1000};
+	etna::CmdStream tracked{etna::Bo{StreamBase + 0x4000, 0x4000}, 0x1000};
+	etna::StateTracker st;
+	std::vector<Mat4> mvps(NCubes);
+
+	uint32_t full_dw = 0, tracked_dw = 0;
+	for (uint32_t frame = 0; frame < 3; frame++) {
+		full.reset();
+		tracked.reset();
+		st.invalidate(); // a frame starts after RS clears: no state carried in
+		for (uint32_t i = 0; i < NCubes; i++) {
+			mvps[i] = frame_mvp(frame, i);
+			etna::MeshDraw d = cube_draw(mvps[i]);
+			d.vtx = &vtx[i];
+			uint32_t a = etna::emit_mesh(full, d);
+			uint32_t b = etna::emit_mesh(tracked, st, d);
+			CHECK(a && b); // both have a uniform patch point
+		}
+		RegFile ref, got;
+		ref.run(full.bo().span<const uint32_t>().data(), full.offset());
+		got.run(tracked.bo().span<const uint32_t>().data(), tracked.offset());
+		CHECK(ref.ok && got.ok && ref.at_draw.size() == NCubes && got.at_draw.size() == NCubes);
+		for (uint32_t i = 0; i < NCubes && i < got.at_draw.size(); i++)
+			CHECK(ref.at_draw[i] == got.at_draw[i]);
+		full_dw = full.offset();
+		tracked_dw = tracked.offset();
+		if (frame == 0)
+			printf("12-cube frame: %u dwords, %u LOAD_STATE headers per-draw emission; %u dwords, %u headers tracked "
+				   "(%u%%)\n",
+				   full_dw, ref.headers, tracked_dw, got.headers, tracked_dw * 100 / full_dw);
+	}
+	CHECK(tracked_dw * 2 < full_dw);
+	auto &s = st.stats();
+	printf("  shadow: %u staged, %u skipped, %u written in %u headers\n", s.staged, s.skipped, s.written, s.headers);
+}
+
+// -----------------------------------------------------------------------------
+//  etna_frame.hh -- hazard tracking, undrained draws
+// -----------------------------------------------------------------------------
+void test_hazards()
+{
+	using etna::Engine;
+	constexpr uint32_t rt = 0xA0000000, depth = 0xA0100000, fb = 0xA0200000, vtx = 0xA0300000;
+	etna::HazardTracker hz;
+
+	// The demo frame: drains before the first draw and before the resolve.
+	CHECK(!hz.conflicts(Engine::RS, {}, {rt}));
+	hz.record(Engine::RS, {}, {rt});
+	CHECK(!hz.conflicts(Engine::RS, {}, {depth})); // RS -> RS
+	hz.record(Engine::RS, {}, {depth});
+	CHECK(hz.conflicts(Engine::PE, {vtx}, {rt, depth})); // RAW/WAW across engines
+	hz.drained();
+	CHECK(hz.tracked() == 0);
+	hz.record(Engine::PE, {vtx}, {rt, depth});
+	CHECK(!hz.conflicts(Engine::PE, {vtx}, {rt, depth})); // PE -> PE
+	hz.record(Engine::PE, {vtx}, {rt, depth});
+	CHECK(hz.tracked() == 3);
+	CHECK(hz.conflicts(Engine::RS, {rt}, {fb}));
+	hz.drained();
+
+	// WAR: the RS may not overwrite what the PE is still reading; a buffer
+	// nobody wrote can be read by both.
+	hz.record(Engine::PE, {vtx}, {rt});
+	CHECK(hz.conflicts(Engine::RS, {}, {vtx}));
+	CHECK(!hz.conflicts(Engine::RS, {vtx}, {fb}));
+	hz.drained();
+
+	// Address 0 (an absent depth buffer) is not a buffer.
+	hz.record(Engine::PE, {}, {rt, 0});
+	CHECK(hz.tracked() == 1 && !hz.conflicts(Engine::RS, {}, {0}));
+	hz.drained();
+
+	// A full table refuses the op (nothing recorded) rather than forgetting.
+	for (uint32_t i = 0; i < etna::HazardTracker::kMaxBuffers; i++)
+		CHECK(hz.record(Engine::PE, {0xB0000000 + i * 0x1000}, {}));
+	CHECK(!hz.record(Engine::PE, {}, {rt}));
+	CHECK(hz.tracked() == etna::HazardTracker::kMaxBuffers);
+	CHECK(hz.record(Engine::PE, {0xB0000000}, {})); // already tracked: fits
+}
+
+// Draws recorded back to back with sync = false (as a Frame does) must leave
+// the same register file at every draw as the self-draining draws, with the
+// per-draw flushes and stalls gone.
+void test_unsynced_draws()
+{
+	if (!bundle_arena())
+		return;
+	constexpr uint32_t NCubes = 12;
+	etna::CmdStream synced{etna::Bo{StreamBase, 0x4000}, 0x1000};
+	etna::CmdStream frame{etna::Bo{StreamBase + 0x4000, 0x4000}, 0x1000};
+	etna::StateTracker st;
+	for (uint32_t i = 0; i < NCubes; i++) {
+		const Mat4 m = frame_mvp(0, i); // the draw's uniforms point at it
+		etna::MeshDraw d = cube_draw(m);
+		CHECK(etna::emit_mesh(synced, d));
+		d.sync = false;
+		CHECK(etna::emit_mesh(frame, st, d));
+	}
+
+	auto count = [](const etna::CmdStream &cs, uint32_t &stalls, uint32_t &flushes) {
+		const uint32_t *w = cs.bo().span<const uint32_t>().data();
+		stalls = flushes = 0;
+		for (uint32_t pc = 0; pc < cs.offset();) {
+			uint32_t op = w[pc] >> 27;
+			if (op == 1) {
+				uint32_t n = (w[pc] >> 16) & 0x3FF;
+				n = n ? n : 1024;
+				flushes += (w[pc] & 0xFFFF) == (VivanteGpu::GL_FLUSH_CACHE >> 2);
+				pc += (1 + n + 1) & ~1u;
+			} else {
+				stalls += op == 9;
+				pc += op == 12 ? 4 : 2;
+			}
+		}
+	};
+	RegFile ref, got;
+	ref.run(synced.bo().span<const uint32_t>().data(), synced.offset());
+	got.run(frame.bo().span<const uint32_t>().data(), frame.offset());
+	CHECK(ref.ok && got.ok && got.at_draw.size() == NCubes);
+	for (uint32_t i = 0; i < NCubes && i < got.at_draw.size(); i++) {
+		// GL_FLUSH_CACHE is a command, not state: it only differs in when it ran.
+		ref.at_draw[i].erase(VivanteGpu::GL_FLUSH_CACHE);
+		got.at_draw[i].erase(VivanteGpu::GL_FLUSH_CACHE);
+		CHECK(ref.at_draw[i] == got.at_draw[i]);
+	}
+	uint32_t s0, f0, s1, f1;
+	count(synced, s0, f0);
+	count(frame, s1, f1);
+	CHECK(f1 == 0 && s1 * 4 < s0 && frame.offset() < synced.offset());
+	printf("12 draws: %u dwords, %u stalls, %u flushes self-draining; %u dwords, %u stalls, %u flushes in a Frame\n",
+		   synced.offset(),
+		   s0,
+		   f0,
+		   frame.offset(),
+		   s1,
+		   f1);
+}
+
+// -----------------------------------------------------------------------------
+//  etna_swapchain.hh -- frame pacing against a model of panel, CPU and GPU
+// -----------------------------------------------------------------------------
+// Discrete-event model in microseconds. The panel raises a vblank every
+// period. The CPU acquires a buffer (or sleeps until the next vblank), records
+// for `cpu_us` and presents. The GPU runs submissions in order, `gpu_us`
+// each; a fence signals when its frame is done. Each frame's times come from
+// the callbacks, so a scenario can add jitter or spikes.
+struct PacingModel {
+	static constexpr uint32_t Period = 16667; // 60 Hz
+
+	uint32_t (*cpu_us)(uint32_t frame, Rng &);
+	uint32_t (*gpu_us)(uint32_t frame, Rng &);
+	uint32_t nbuffers;
+
+	etna::Swapchain::Stats run(uint32_t nvblanks, const char *name)
+	{
+		Rng rng;
+		constexpr uint32_t Fb[3] = {0xA1000000, 0xA2000000, 0xA3000000};
+		etna::Swapchain sc = nbuffers == 3 ? etna::Swapchain{{Fb[0], Fb[1], Fb[2]}} : etna::Swapchain{{Fb[0], Fb[1]}};
+		CHECK(sc.size() == nbuffers);
+
+		std::vector<uint64_t> done{0}; // by seqno: when the GPU finishes it
+		std::vector<uint32_t> buffer_of{0};
+		uint64_t gpu_free = 0;
+		int recording = -1;		  // buffer the CPU is recording into
+		uint64_t cpu_done = 0;	  // ... until
+		uint32_t frame = 0;		  // frames presented
+		uint32_t shown = 0;		  // seqno of the last frame flipped to
+		int screen = 0, armed = -1; // what the panel may be scanning
+
+		auto cpu_step = [&](uint64_t now) {
+			if (recording >= 0 && cpu_done <= now) {
+				uint64_t start = std::max(gpu_free, cpu_done);
+				gpu_free = start + gpu_us(frame, rng);
+				done.push_back(gpu_free);
+				buffer_of.push_back(uint32_t(recording));
+				frame++;
+				sc.present(uint32_t(recording), etna::Fence{.event_id = 0, .seqno = frame});
+				recording = -1;
+			}
+			if (recording < 0) {
+				recording = sc.acquire();
+				if (recording >= 0) {
+					// Never the buffer on screen or about to be.
+					CHECK(recording != screen && recording != armed);
+					cpu_done = now + cpu_us(frame, rng);
+				}
+			}
+		};
+
+		cpu_step(0);
+		for (uint32_t v = 1; v <= nvblanks; v++) {
+			uint64_t t = uint64_t(v) * Period;
+			// CPU events before this vblank (it may present several frames
+			// back to back when buffers are free).
+			while (recording >= 0 && cpu_done < t)
+				cpu_step(cpu_done);
+
+			if (armed >= 0) {
+				screen = armed;
+				armed = -1;
+			}
+			uint32_t a = sc.vblank([&](etna::Fence f) { return f.seqno < done.size() && done[f.seqno] <= t; });
+			if (a) {
+				shown++;
+				CHECK(shown < done.size() && done[shown] <= t); // in order, and finished
+				CHECK(a == Fb[buffer_of[shown]]);
+				armed = int(buffer_of[shown]);
+			}
+			cpu_step(t); // woken by the vblank IRQ
+		}
+
+		auto s = sc.stats();
+		CHECK(s.vblanks == s.flips + s.missed_gpu + s.missed_cpu);
+		CHECK(s.flips == shown && s.presented == frame);
+		CHECK(s.presented - s.flips <= nbuffers);
+		printf("  %-28s %u buffers: %4u frames in %u vblanks, missed %3u (GPU late) + %3u (CPU late)\n",
+			   name,
+			   nbuffers,
+			   s.flips,
+			   s.vblanks,
+			   s.missed_gpu,
+			   s.missed_cpu);
+		return s;
+	}
+};
+
+void test_swapchain()
+{
+	// Buffer lifecycle by hand: 2 buffers, buffer 0 on screen.
+	{
+		etna::Swapchain sc{{0x100, 0x200}};
+		bool gpu_done = false;
+		auto sig = [&](etna::Fence) { return gpu_done; };
+		CHECK(sc.vblank(sig) == 0 && sc.stats().vblanks == 0); // not started
+		CHECK(sc.acquire() == 1 && sc.acquire() == -1);
+		sc.present(1, etna::Fence{.event_id = 0, .seqno = 1});
+		CHECK(sc.vblank(sig) == 0 && sc.stats().missed_gpu == 1); // still rendering
+		gpu_done = true;
+		CHECK(sc.vblank(sig) == 0x200);
+		CHECK(sc.acquire() == -1);	 // buffer 0 may still be scanned out
+		CHECK(sc.vblank(sig) == 0); // flip latched; nothing queued
+		CHECK(sc.stats().missed_cpu == 1);
+		CHECK(sc.acquire() == 0 && sc.acquire() == -1);
+		sc.present(0, etna::Fence{.event_id = 0, .seqno = 2});
+		sc.present(0, etna::Fence{.event_id = 0, .seqno = 3}); // not acquired: ignored
+		CHECK(sc.vblank(sig) == 0x100 && sc.stats().presented == 2 && sc.stats().flips == 2);
+	}
+
+	// FIFO order with 3 buffers: the older queued frame goes first.
+	{
+		etna::Swapchain sc{{0x100, 0x200, 0x300}};
+		auto sig = [](etna::Fence) { return true; };
+		int a = sc.acquire(), b = sc.acquire();
+		CHECK(a == 1 && b == 2);
+		sc.present(uint32_t(b), etna::Fence{.event_id = 0, .seqno = 1});
+		sc.present(uint32_t(a), etna::Fence{.event_id = 0, .seqno = 2});
+		CHECK(sc.vblank(sig) == 0x300);
+		CHECK(sc.vblank(sig) == 0x200);
+	}
+
+	printf("swapchain model (60 Hz):\n");
+	// A light frame: 2 buffers show every other refresh (the flip armed at a
+	// vblank latches at the next), 3 buffers every refresh.
+	auto cpu3 = [](uint32_t, Rng &) { return 3000u; };
+	auto gpu5 = [](uint32_t, Rng &) { return 5000u; };
+	PacingModel fast2{cpu3, gpu5, 2}, fast3{cpu3, gpu5, 3};
+	auto s = fast2.run(600, "cpu 3 ms, gpu 5 ms");
+	CHECK(s.flips == 300 && s.missed_gpu == 0);
+	s = fast3.run(600, "cpu 3 ms, gpu 5 ms");
+	CHECK(s.flips == 600);
+
+	// Jitter: only the frames whose cpu + gpu time exceeds the period miss a
+	// refresh (~1 in 30 here), and the misses never cascade.
+	auto cpu5 = [](uint32_t, Rng &r) { return 3000u + r.below(4000); };
+	auto gpu8 = [](uint32_t, Rng &r) { return 5000u + r.below(6000); };
+	PacingModel jitter{cpu5, gpu8, 3};
+	s = jitter.run(600, "cpu 3-7 ms, gpu 5-11 ms");
+	CHECK(s.flips >= 570 && s.missed_cpu == 0);
+
+	// Each fits in a period but the sum doesn't: frames are in flight for
+	// more vblanks than 3 buffers cover, and the misses show up as GPU-late.
+	auto cpu10 = [](uint32_t, Rng &r) { return 9000u + r.below(2000); };
+	auto gpu12 = [](uint32_t, Rng &r) { return 11000u + r.below(2000); };
+	PacingModel split{cpu10, gpu12, 3};
+	s = split.run(600, "cpu ~10 ms, gpu ~12 ms");
+	CHECK(s.flips >= 400 && s.missed_cpu == 0);
+
+	// Occasional GPU spikes: misses are charged to the GPU, nothing is dropped.
+	auto spiky = [](uint32_t f, Rng &r) { return f % 10 == 9 ? 25000u : 8000u + r.below(3000); };
+	PacingModel spikes{[](uint32_t, Rng &) { return 4000u; }, spiky, 3};
+	auto s4 = spikes.run(600, "gpu ~9 ms, every 10th 25 ms");
+	CHECK(s4.missed_gpu > 0 && s4.missed_gpu > s4.missed_cpu);
+
+	// A slow CPU: misses are the CPU's.
+	PacingModel slow_cpu{[](uint32_t, Rng &) { return 20000u; }, [](uint32_t, Rng &) { return 4000u; }, 3};
+	auto s5 = slow_cpu.run(600, "cpu 20 ms, gpu 4 ms");
+	CHECK(s5.missed_cpu > s5.missed_gpu && s5.flips > 250);
+}
+
+// -----------------------------------------------------------------------------
+//  Indexed draws: DRAW_INSTANCED encoding, index stream state, etna_mesh.hh
+// -----------------------------------------------------------------------------
+void test_draw_encoding()
+{
+	using namespace VivanteGpu;
+	// The words emit_mesh() always emitted for a plain draw.
+	CHECK((cmd_draw_instanced(PRIM_TRIANGLES, 36) == std::array<uint32_t, 4>{0x60040001, 36, 0, 0}));
+	CHECK((cmd_draw_instanced(PRIM_TRIANGLES, 36, 1, true) == std::array<uint32_t, 4>{0x60140001, 36, 0, 0}));
+	// Instance count split 16 + 8 bits, vertex count 24 bits, start verbatim.
+	CHECK((cmd_draw_instanced(PRIM_TRIANGLE_STRIP, 0x1234567, 0x123456, false, 7) ==
+		   std::array<uint32_t, 4>{0x60053456, 0x12234567, 7, 0}));
+
+	// An indexed draw points the index stream at buffer + offset, with its type.
+	if (!bundle_arena())
+		return;
+	static const etna::Bo ib{0xA0700000, 4096};
+	for (auto type : {etna::IndexType::U16, etna::IndexType::U32}) {
+		etna::CmdStream cs = arena_stream(8);
+		const Mat4 m = frame_mvp(0, 0);
+		etna::MeshDraw d = cube_draw(m);
+		d.index = &ib;
+		d.index_type = type;
+		d.index_offset = 64;
+		etna::emit_mesh(cs, d);
+		RegFile rf;
+		const uint32_t *w = cs.bo().span<const uint32_t>().data();
+		rf.run(w, cs.offset());
+		CHECK(rf.ok && rf.at_draw.size() == 1);
+		if (rf.at_draw.size() == 1) {
+			CHECK(rf.at_draw[0][FE_INDEX_STREAM_BASE_ADDR].first == ib.gpu_addr() + 64);
+			CHECK(rf.at_draw[0][FE_INDEX_STREAM_CONTROL].first == uint32_t(type));
+		}
+		uint32_t draws = 0;
+		for (uint32_t i = 0; i < cs.offset(); i++)
+			if ((w[i] >> 27) == 12 && w[i + 1] == 36) // header + count
+				draws += (w[i] & FE_DRAW_INSTANCED_INDEXED) != 0;
+		CHECK(draws == 1);
+	}
+}
+
+void test_mesh_dedup()
+{
+	// Per-face colors: 8 corners x 3 faces each.
+	static constexpr auto cube = etna::dedup_mesh<7>(kCubeVerts);
+	static_assert(cube.vertex_count == 24 && cube.index_count == 36);
+	// One color: the 8 corners.
+	static constexpr auto plain = etna::dedup_mesh<7>(cube_verts({{{1, 1, 1, 1}, {1, 1, 1, 1}, {1, 1, 1, 1},
+																	{1, 1, 1, 1}, {1, 1, 1, 1}, {1, 1, 1, 1}}}));
+	static_assert(plain.vertex_count == 8);
+	auto u32 = etna::dedup_mesh<7, uint32_t>(kCubeVerts);
+	CHECK(u32.vertex_count == 24 && u32.index_bytes() == 36 * 4);
+
+	// vertices[indices[i]] is expanded vertex i, bit for bit.
+	for (uint32_t i = 0; i < 36; i++) {
+		CHECK(cube.indices[i] < cube.vertex_count && u32.indices[i] == cube.indices[i]);
+		CHECK(memcmp(&cube.vertices[cube.indices[i] * 7], &kCubeVerts[i * 7], 28) == 0);
+	}
+
+	// Random meshes with many repeats (vertices from a small pool).
+	Rng rng;
+	for (int round = 0; round < 20; round++) {
+		static std::array<float, 600 * 5> ex;
+		std::array<std::array<float, 5>, 40> pool;
+		for (auto &p : pool)
+			for (auto &f : p)
+				f = float(rng.below(1000)) / 8.0f;
+		for (uint32_t v = 0; v < 600; v++) {
+			const auto &p = pool[rng.below(40)];
+			std::copy(p.begin(), p.end(), &ex[v * 5]);
+		}
+		auto m = etna::dedup_mesh<5>(ex);
+		CHECK(m.vertex_count <= 40);
+		for (uint32_t v = 0; v < 600; v++)
+			CHECK(memcmp(&m.vertices[m.indices[v] * 5], &ex[v * 5], 20) == 0);
+	}
+
+	// What the vertex fetch reads per cube, expanded vs indexed.
+	uint32_t expanded = 36 * 28, indexed = cube.vertex_bytes() + cube.index_bytes();
+	printf("cube: 36 expanded vertices = %u bytes fetched; %u unique + 36 u16 indices = %u bytes (%u%%)\n",
+		   expanded,
+		   cube.vertex_count,
+		   indexed,
+		   indexed * 100 / expanded);
+	CHECK(indexed < expanded);
+}
+
+// -----------------------------------------------------------------------------
+//  Instancing: per-instance stream setup, DRAW_INSTANCED count, instanced VS
+// -----------------------------------------------------------------------------
+// Just enough of the shader ALU to run cube_scene.hh's programs: MUL, MAD
+// and MOV on vec4 temps/uniforms, fields as alu_inst() packs them.
+struct MiniAlu {
+	std::array<std::array<float, 4>, 16> t{}, u{};
+
+	std::array<float, 4> src(uint32_t reg, uint32_t swiz, uint32_t rgroup) const
+	{
+		const auto &r = rgroup == 2 ? u[reg] : t[reg];
+		return {r[swiz & 3], r[(swiz >> 2) & 3], r[(swiz >> 4) & 3], r[(swiz >> 6) & 3]};
+	}
+
+	void run(std::span<const uint32_t> code)
+	{
+		for (size_t i = 0; i + 3 < code.size(); i += 4) {
+			const uint32_t *w = &code[i];
+			auto s0 = src((w[1] >> 12) & 0x1FF, (w[1] >> 22) & 0xFF, (w[2] >> 3) & 7);
+			auto s1 = src((w[2] >> 7) & 0x1FF, (w[2] >> 17) & 0xFF, w[3] & 7);
+			auto s2 = src((w[3] >> 4) & 0x1FF, (w[3] >> 14) & 0xFF, (w[3] >> 28) & 7);
+			auto &dst = t[(w[0] >> 16) & 0x7F];
+			for (int k = 0; k < 4; k++) {
+				switch (w[0] & 0x3F) {
+				case 0x03: dst[k] = s0[k] * s1[k]; break;
+				case 0x02: dst[k] = s0[k] * s1[k] + s2[k]; break;
+				case 0x09: dst[k] = s2[k]; break;
+				default: CHECK(!"unexpected opcode");
+				}
+			}
+		}
+	}
+};
+
+void test_instancing()
+{
+	using namespace VivanteGpu;
+	// The instanced VS computes what kCubeVs computes from uniforms, and
+	// tints the color.
+	Rng rng;
+	for (int round = 0; round < 20; round++) {
+		Mat4 m = frame_mvp(round, rng.below(12));
+		std::array<float, 4> pos{float(rng.below(3)) - 1, 0.5f, -0.5f, 1.0f}, color{0.5f, 0.25f, 1.0f, 1.0f};
+		std::array<float, 4> tint{0.25f, 2.0f, 0.5f, 1.0f};
+		MiniAlu a, b;
+		a.t[0] = b.t[0] = pos;
+		a.t[1] = b.t[1] = color;
+		for (int c = 0; c < 4; c++) {
+			std::copy_n(&m[c * 4], 4, a.u[c].begin());
+			std::copy_n(&m[c * 4], 4, b.t[2 + c].begin());
+		}
+		b.t[6] = tint;
+		a.run(kCubeVs);
+		b.run(kCubeInstancedVs);
+		CHECK(a.t[2] == b.t[2]); // clip position, bit for bit
+		for (int k = 0; k < 4; k++) {
+			float want = 0;
+			for (int c = 0; c < 4; c++)
+				want += m[c * 4 + k] * pos[c];
+			CHECK(std::fabs(b.t[2][k] - want) < 1e-4f);
+			CHECK(b.t[3][k] == color[k] * tint[k]);
+		}
+	}
+
+	if (!bundle_arena())
+		return;
+	static const etna::Bo inst{0xA0800000, 12 * sizeof(CubeInstance)};
+	static const etna::Bo ib{0xA0700000, 4096};
+	etna::MeshDraw d = cube_draw({});
+	d.vs_words = kCubeInstancedVs.size();
+	d.index = &ib;
+	d.vertex_count = 36;
+	d.instances = 12;
+	d.inst = &inst;
+	d.inst_stride = sizeof(CubeInstance);
+	d.inst_vec4s = kCubeInstanceVec4s;
+
+	etna::CmdStream direct = arena_stream(8), tracked = arena_stream(9);
+	etna::StateTracker st;
+	etna::emit_mesh(direct, d);
+	etna::emit_mesh(tracked, st, d);
+	RegFile rf, rt;
+	rf.run(direct.bo().span<const uint32_t>().data(), direct.offset());
+	rt.run(tracked.bo().span<const uint32_t>().data(), tracked.offset());
+	CHECK(rf.ok && rt.ok && rf.at_draw.size() == 1 && rt.at_draw.size() == 1);
+	if (rf.at_draw.size() != 1 || rt.at_draw.size() != 1)
+		return;
+	CHECK(rf.at_draw[0] == rt.at_draw[0]);
+	auto &r = rf.at_draw[0];
+	CHECK(r[NFE_VERTEX_STREAM_DIVISOR0].first == 0); // per vertex
+	CHECK(r[NFE_VERTEX_STREAM_BASE0 + 4].first == inst.gpu_addr());
+	CHECK(r[NFE_VERTEX_STREAM_CONTROL0 + 4].first == 80);
+	CHECK(r[NFE_VERTEX_STREAM_DIVISOR0 + 4].first == 1); // per instance
+	for (uint32_t j = 0; j < kCubeInstanceVec4s; j++) {
+		uint32_t a = 4 * (2 + j);
+		CHECK(r[NFE_ATTRIB_CONFIG0_0 + a].first == (NFE_TYPE_FLOAT | (4u << 12) | (1u << 8) | (16 * j << 16)));
+		CHECK(r[NFE_ATTRIB_CONFIG1_0 + a].first == ((j == 4 ? 0x800u : 0) | (16 * j + 16)));
+	}
+	CHECK(r[VS_INPUT_COUNT].first == 0x107);
+	CHECK(r[VS_HALTI5_INPUT0].first == 0x03020100 && r[VS_HALTI5_INPUT0 + 4].first == 0x00060504);
+
+	// One indexed draw of 12 instances.
+	const uint32_t *w = direct.bo().span<const uint32_t>().data();
+	uint32_t draws = 0;
+	for (uint32_t i = 0; i + 1 < direct.offset(); i++)
+		if ((w[i] >> 27) == 12) {
+			CHECK(w[i] == (FE_DRAW_INSTANCED | FE_DRAW_INSTANCED_INDEXED | (PRIM_TRIANGLES << 16) | 12));
+			CHECK(w[i + 1] == 36);
+			draws++;
+		}
+	CHECK(draws == 1);
+
+	// A plain draw after it (same tracker) goes back to 2 inputs.
+	etna::emit_mesh(tracked, st, cube_draw(frame_mvp(0, 0)));
+	RegFile rp;
+	rp.run(tracked.bo().span<const uint32_t>().data(), tracked.offset());
+	CHECK(rp.ok && rp.at_draw.size() == 2);
+	if (rp.at_draw.size() == 2)
+		CHECK(rp.at_draw[1][VS_INPUT_COUNT].first == 0x102 && rp.at_draw[1][VS_HALTI5_INPUT0].first == 0x0100);
+}
+
+// -----------------------------------------------------------------------------
+//  ComputeList: recorded dispatches == kPpuDispatchTemplate, patched
+// -----------------------------------------------------------------------------
+// What one dispatch should be, patched here from the slot offsets documented in
+// ppu_dispatch.hh rather than through its enum.
+std::array<uint32_t, etna::kPpuDispatchDwords> expected_dispatch(
+	uint32_t in, uint32_t out, uint32_t shader, uint32_t inst_dwords, uint32_t regs, uint32_t w, uint32_t h,
+	uint32_t in_b = 0, uint32_t in_c = 0)
+{
+	std::array<uint32_t, etna::kPpuDispatchDwords> e;
+	std::copy(std::begin(etna::kPpuDispatchTemplate), std::end(etna::kPpuDispatchTemplate), e.begin());
+	e[7] = in;
+	e[8] = e[14] = w;
+	e[9] = e[15] = (h << 16) | w;
+	e[13] = out;
+	e[43] = regs;
+	e[51] = inst_dwords / 4;
+	e[53] = shader;
+	e[59] = inst_dwords / 4 - 1;
+	e[95] = (w + 3) / 4 - 1;
+	e[96] = h - 1;
+	for (auto [base, addr] : {std::pair{19u, in_b}, std::pair{23u, in_c}})
+		if (addr) {
+			e[base] = addr;
+			e[base + 1] = w;
+			e[base + 2] = (h << 16) | w;
+			e[base + 3] = 0x444051F0;
+		}
+	return e;
+}
+
+void test_compute_list()
+{
+	if (!bundle_arena())
+		return;
+	using etna::Bo;
+	const etna::Kernel add{Bo{0xA1000000, 64}, 16, 3}, inv{Bo{0xA1000040, 64}, 12, 2},
+		blend{Bo{0xA1000080, 128}, 32, 5};
+	const Bo src{0xA2000000, 16384}, t1{0xA2004000, 16384}, t2{0xA2008000, 16384}, alpha{0xA200C000, 16384},
+		dst{0xA2010000, 16384};
+
+	etna::CmdStream cs = arena_stream(10);
+	cs.emit(0x12345678); // appends after what is already there
+	cs.emit(0x9ABCDEF0);
+	etna::ComputeList cl{cs};
+	CHECK(cl.dispatch(add, t1, src, 256, 64));
+	CHECK(cl.dispatch(inv, t2, t1, 256, 64));
+	CHECK(cl.dispatch(blend, dst, src, t2, alpha, 128, 6));
+	CHECK(cl.stats().dispatches == 3 && cl.stats().dwords == 3 * etna::kPpuDispatchDwords);
+	CHECK(cs.offset() == 2 + 3 * etna::kPpuDispatchDwords);
+
+	const uint32_t *w = cs.bo().span<const uint32_t>().data() + 2;
+	const std::array<uint32_t, etna::kPpuDispatchDwords> want[3] = {
+		expected_dispatch(src.gpu_addr(), t1.gpu_addr(), add.binary.gpu_addr(), 16, 3, 256, 64),
+		expected_dispatch(t1.gpu_addr(), t2.gpu_addr(), inv.binary.gpu_addr(), 12, 2, 256, 64),
+		expected_dispatch(
+			src.gpu_addr(), dst.gpu_addr(), blend.binary.gpu_addr(), 32, 5, 128, 6, t2.gpu_addr(), alpha.gpu_addr()),
+	};
+	for (uint32_t d = 0; d < 3; d++) {
+		uint32_t diff = 0;
+		for (uint32_t i = 0; i < etna::kPpuDispatchDwords; i++)
+			diff += w[d * etna::kPpuDispatchDwords + i] != want[d][i];
+		CHECK(diff == 0);
+	}
+	// Stage 2 reads what stage 1 wrote, and the dispatch between them ends in
+	// the template's flush + FE<-PE stall (the barrier).
+	CHECK(w[etna::kPpuDispatchDwords + 7] == w[13]);
+	CHECK(w[104] == 0x08010E03 && w[105] == 0x00000C20 && w[108] == 0x48000000 && w[109] == 0x00000701);
+
+	// Patched with the vendor's own parameters (64x6, 16 dwords, RegCount 3,
+	// the template's zero addresses), the slots reproduce the template: the
+	// offsets above are the right ones.
+	auto vendor = expected_dispatch(0, 0, 0, 16, 3, 64, 6);
+	CHECK(std::equal(vendor.begin(), vendor.end(), std::begin(etna::kPpuDispatchTemplate)));
+	etna::CmdStream plain = arena_stream(13);
+	etna::emit_ppu_dispatch(plain, 0, 0, 0, 16, 3, 64, 6);
+	CHECK(std::equal(vendor.begin(), vendor.end(), plain.bo().span<const uint32_t>().data()));
+
+	// Same words as the synchronous path's emit_ppu_dispatch().
+	etna::CmdStream direct = arena_stream(11);
+	etna::emit_ppu_dispatch(direct, t1.gpu_addr(), t2.gpu_addr(), inv.binary.gpu_addr(), 12, 2, 256, 64);
+	CHECK(std::equal(w + etna::kPpuDispatchDwords, w + 2 * etna::kPpuDispatchDwords,
+					 direct.bo().span<const uint32_t>().data()));
+
+	// A full stream refuses the dispatch (keeping room for the return LINK)
+	// and records nothing.
+	etna::CmdStream small{Bo{StreamBase + 12 * 4096, 4096}, etna::ComputeList::dwords_for(2) - 1};
+	etna::ComputeList full{small};
+	CHECK(full.dispatch(add, t1, src, 64, 6));
+	CHECK(!full.dispatch(add, t2, t1, 64, 6));
+	CHECK(small.offset() == etna::kPpuDispatchDwords && full.stats().dispatches == 1);
+}
+
+// Submitted twice (Gpu::submit_link()'s stream side, below), a list ends in
+// one LINK, to the latest trailer: the FE would follow a stale first LINK
+// into ring space reused since. A dispatch after the submit is refused, not
+// recorded behind the LINK where it would never run.
+void test_compute_list_resubmit()
+{
+	if (!bundle_arena())
+		return;
+	using etna::Bo;
+	const etna::Kernel add{Bo{0xA1000000, 64}, 16, 3};
+	const Bo src{0xA2000000, 16384}, dst{0xA2004000, 16384};
+	auto submit_link = [](etna::CmdStream &cs, uint32_t trailer) {
+		if (!cs.unlink())
+			return false;
+		cs.align();
+		if (cs.avail() < 2)
+			return false;
+		cs.end_with_link(VivanteGpu::cmd_link(4), trailer);
+		return true;
+	};
+
+	etna::CmdStream cs = arena_stream(9);
+	etna::ComputeList cl{cs};
+	CHECK(cl.dispatch(add, dst, src, 256, 64));
+	const uint32_t ops = cs.offset();
+	CHECK(submit_link(cs, 0x1000) && cs.linked() && cs.offset() == ops + 2);
+	CHECK(!cl.dispatch(add, src, dst, 256, 64) && cs.offset() == ops + 2);
+	CHECK(submit_link(cs, 0x2000) && cs.offset() == ops + 2);
+	const uint32_t *w = cs.bo().span<const uint32_t>().data();
+	CHECK(w[ops] == VivanteGpu::cmd_link(4) && w[ops + 1] == 0x2000);
+	uint32_t links = 0;
+	for (uint32_t i = 0; i < cs.offset(); i += 2)
+		links += w[i] == VivanteGpu::cmd_link(4);
+	CHECK(links == 1);
+
+	// Recorded into behind the LINK some other way: refused until reset().
+	cs.emit(VivanteGpu::CMD_NOP);
+	cs.emit(0);
+	CHECK(!submit_link(cs, 0x3000) && !cs.unlink());
+	cs.reset();
+	CHECK(!cs.linked() && cl.dispatch(add, dst, src, 256, 64) && submit_link(cs, 0x3000));
+}
+
+// -----------------------------------------------------------------------------
+//  etna_tune.hh: launch patching, the search (fake timer), the table
+// -----------------------------------------------------------------------------
+void test_launch_patch()
+{
+	if (!bundle_arena())
+		return;
+	using etna::PpuLaunch;
+	CHECK(PpuLaunch{}.fits(64, 6) && PpuLaunch{}.fits(16, 1) && PpuLaunch{}.fits(4096, 600));
+	CHECK(!(PpuLaunch{8, 8, 4, 1}).fits(256, 6) && (PpuLaunch{8, 8, 4, 1}).fits(256, 64));
+	CHECK(!(PpuLaunch{16, 8, 4, 1}).valid() && !(PpuLaunch{1, 1, 0, 1}).valid());
+
+	// A launch only touches the thread-allocation, scale, group-count and
+	// group-size slots; the rest is the default dispatch.
+	struct {
+		PpuLaunch l;
+		uint32_t alloc, sx, sy, cx, cy;
+	} const cases[] = {
+		{{8, 1, 8, 1}, 1, 8, 1, 256 / 8 / 8, 64},
+		{{4, 4, 4, 2}, 2, 4, 2, 256 / 4 / 4, 64 / 2 / 4},
+		{{8, 8, 16, 1}, 8, 16, 1, 256 / 16 / 8, 64 / 8},
+	};
+	const auto def = expected_dispatch(0xA2000000, 0xA2004000, 0xA1000000, 16, 3, 256, 64);
+	for (auto &c : cases) {
+		etna::CmdStream cs = arena_stream(14);
+		etna::emit_ppu_dispatch(cs, 0xA2000000, 0xA2004000, 0xA1000000, 16, 3, 256, 64, 0, 0, c.l);
+		auto want = def;
+		want[81] = c.alloc;
+		want[89] = c.sx;
+		want[91] = c.sy;
+		want[95] = c.cx - 1;
+		want[96] = c.cy - 1;
+		want[98] = c.l.group_x - 1u;
+		want[99] = c.l.group_y - 1u;
+		CHECK(std::equal(want.begin(), want.end(), cs.bo().span<const uint32_t>().data()));
+	}
+
+	// A kernel's constants (ppu_kernels.hh) go into the c2..c5 words from
+	// words[first]; the words before them still hold the second input image.
+	ppu::Uniforms u;
+	u.first = 4;
+	u.count = 12;
+	for (uint32_t i = 0; i < 16; i++)
+		u.words[i] = 0x01010101u * (i + 1);
+	etna::CmdStream cs = arena_stream(14);
+	etna::emit_ppu_dispatch(cs, 0xA2000000, 0xA2004000, 0xA1000000, 16, 3, 256, 64, 0xA2008000, 0, {}, &u);
+	auto want = expected_dispatch(0xA2000000, 0xA2004000, 0xA1000000, 16, 3, 256, 64, 0xA2008000);
+	for (uint32_t i = u.first; i < 16; i++)
+		want[19 + i] = u.words[i];
+	CHECK(std::equal(want.begin(), want.end(), cs.bo().span<const uint32_t>().data()));
+}
+
+// Fake timing backend: a cost model with a planted optimum, +-1% noise, and
+// launches that "compute the wrong thing" (scale_y 2) or hang.
+struct FakeTimer {
+	Rng rng;
+	etna::PpuLaunch fastest{4, 1, 8, 1};
+	uint32_t calls = 0, hang_at = 0;
+	bool default_fails = false, flat = false;
+
+	uint64_t operator()(const etna::PpuLaunch &l)
+	{
+		if (++calls == hang_at)
+			return etna::kTuneAbort;
+		if (l.scale_y == 2 || (default_fails && l == etna::PpuLaunch{}))
+			return 0;
+		uint64_t t = 100000;
+		if (flat)
+			t -= l == etna::PpuLaunch{} ? 0 : 1000; // 1% better: within the margin
+		else if (l == fastest)
+			t = 60000;
+		else
+			t += (l.group_x * l.group_y + l.scale_x) * 500;
+		return t + rng.below(t / 100);
+	}
+};
+
+void test_autotune_search()
+{
+	const uint32_t n = etna::kTuneCandidates.size();
+	uint32_t fit = 0, fit_y2 = 0;
+	for (auto &l : etna::kTuneCandidates)
+		if (l.fits(256, 64)) {
+			fit++;
+			fit_y2 += l.scale_y == 2;
+		}
+
+	FakeTimer ft;
+	etna::TuneResult r = etna::autotune(256, 64, ft);
+	CHECK(!r.aborted && r.best == ft.fastest && r.best_ticks >= 60000 && r.best_ticks < 60600);
+	CHECK(r.default_ticks >= 102500 && r.default_ticks < 103525); // (1*1 + 4) * 500 over the base
+	CHECK(r.measured == fit && r.skipped == n - fit && r.rejected == fit_y2);
+	// Wrong candidates are dropped on their first run; the rest run 3 times.
+	CHECK(ft.calls == (fit - fit_y2) * 3 + fit_y2);
+
+	// Size decides what is tried: at 64x6 nothing with a taller group fits.
+	FakeTimer small;
+	etna::TuneResult rs = etna::autotune(64, 6, small);
+	CHECK(rs.best == small.fastest && rs.skipped > r.skipped);
+
+	// No candidate clearly better: keep the default.
+	FakeTimer flat;
+	flat.flat = true;
+	etna::TuneResult rf = etna::autotune(256, 64, flat);
+	CHECK(rf.best == etna::PpuLaunch{} && rf.best_ticks == rf.default_ticks);
+
+	// No baseline: nothing tuned.
+	FakeTimer broken;
+	broken.default_fails = true;
+	etna::TuneResult rb = etna::autotune(256, 64, broken);
+	CHECK(rb.best_ticks == 0 && rb.measured == 1 && rb.rejected == 1 && broken.calls == 1);
+
+	// A hang ends the sweep.
+	FakeTimer hang;
+	hang.hang_at = 5;
+	etna::TuneResult rh = etna::autotune(256, 64, hang);
+	CHECK(rh.aborted && hang.calls == 5);
+
+	// Program ids key the table: any change to the words or the register
+	// count gives a different one.
+	uint32_t add[32], inv[32];
+	auto sa = ppu::build_add_shader(add, 7, 2), si = ppu::build_not_shader(inv, 7, 2);
+	const uint32_t id = etna::ppu_program_id(add, sa.inst_dwords, sa.reg_count);
+	CHECK(id == etna::ppu_program_id(add, sa.inst_dwords, sa.reg_count));
+	CHECK(id != etna::ppu_program_id(inv, si.inst_dwords, si.reg_count));
+	CHECK(id != etna::ppu_program_id(add, sa.inst_dwords, sa.reg_count + 1));
+}
+
+void test_tune_table()
+{
+	using etna::PpuLaunch;
+	using etna::TuneTable;
+	TuneTable t;
+	CHECK(!t.find(1, 256, 64));
+	CHECK(t.set({1, 256, 64, {4, 1, 8, 1}, 500}) && t.set({1, 1024, 64, {2, 2, 4, 1}, 900}));
+	CHECK(t.set({2, 256, 64, {1, 1, 16, 1}, 400}));
+	CHECK(!t.set({3, 256, 64, {0, 1, 4, 1}, 1}) && t.size() == 3);
+	CHECK(t.find(1, 256, 64) && *t.find(1, 256, 64) == (PpuLaunch{4, 1, 8, 1}));
+	CHECK(t.find(1, 1024, 64) && *t.find(1, 1024, 64) == (PpuLaunch{2, 2, 4, 1}));
+	CHECK(!t.find(1, 256, 32) && !t.find(3, 256, 64));
+	// Same key: replaced, not added.
+	CHECK(t.set({1, 256, 64, {8, 1, 4, 1}, 450}) && t.size() == 3 && *t.find(1, 256, 64) == (PpuLaunch{8, 1, 4, 1}));
+
+	// Round trip through the blob.
+	uint32_t blob[TuneTable::blob_dwords(TuneTable::kCapacity)];
+	const uint32_t n = t.save(blob);
+	CHECK(n == TuneTable::blob_dwords(3) && blob[0] == TuneTable::kMagic);
+	CHECK(t.save(std::span{blob, n - 1}) == 0);
+	TuneTable u;
+	CHECK(u.load(std::span<const uint32_t>{blob, n}) && u.size() == 3);
+	for (uint32_t i = 0; i < 3; i++)
+		CHECK(u[i].kernel == t[i].kernel && u[i].width == t[i].width && u[i].height == t[i].height &&
+			  u[i].launch == t[i].launch && u[i].ticks == t[i].ticks);
+
+	// Every bad blob is refused and leaves the table as it was.
+	Rng rng;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t bad[std::size(blob)];
+		std::copy_n(blob, n, bad);
+		bad[i] ^= 1u << rng.below(32);
+		CHECK(!u.load(std::span<const uint32_t>{bad, n}));
+	}
+	CHECK(!u.load(std::span<const uint32_t>{blob, n - 1}));
+	CHECK(!u.load(std::span<const uint32_t>{blob, 2}));
+	// A well-formed blob (good checksum) with an invalid launch in it.
+	uint32_t inv[std::size(blob)];
+	std::copy_n(blob, n, inv);
+	inv[3 + 3] = 0x00010400; // group 0x4 scale 1x0
+	inv[n - 1] = etna::ppu_program_id(inv, n - 1, 0);
+	CHECK(!u.load(std::span<const uint32_t>{inv, n}));
+	CHECK(u.size() == 3 && *u.find(1, 256, 64) == (PpuLaunch{8, 1, 4, 1}));
+
+	// Full.
+	TuneTable f;
+	for (uint32_t i = 0; i < TuneTable::kCapacity; i++)
+		CHECK(f.set({i, 256, 64, {}, 1}));
+	CHECK(!f.set({99, 256, 64, {}, 1}) && f.set({5, 256, 64, {2, 1, 4, 1}, 1}));
+	CHECK(f.save(blob) == TuneTable::blob_dwords(TuneTable::kCapacity) && u.load(blob) && u.size() == 32);
+
+	// compute()/ComputeList take the launch from tune_table().
+	if (!bundle_arena())
+		return;
+	using etna::Bo;
+	etna::Kernel add{Bo{0xA1000000, 64}, 16, 3};
+	add.id = 0x1234;
+	const Bo src{0xA2000000, 16384}, dst{0xA2004000, 16384};
+	CHECK(etna::tune_table().set({add.id, 256, 64, {4, 4, 4, 2}, 1}));
+	etna::CmdStream cs = arena_stream(15);
+	etna::ComputeList cl{cs};
+	CHECK(cl.dispatch(add, dst, src, 256, 64) && cl.dispatch(add, dst, src, 128, 64));
+	const uint32_t *w = cs.bo().span<const uint32_t>().data();
+	CHECK(w[98] == 3 && w[99] == 3 && w[91] == 2 && w[95] == 256 / 16 - 1 && w[96] == 64 / 8 - 1);
+	auto other = expected_dispatch(src.gpu_addr(), dst.gpu_addr(), 0xA1000000, 16, 3, 128, 64);
+	CHECK(std::equal(other.begin(), other.end(), w + etna::kPpuDispatchDwords)); // untuned size: default
+	etna::tune_table().clear();
+}
+
+// -----------------------------------------------------------------------------
+//  etna_shader_cache.hh
+// -----------------------------------------------------------------------------
+// Stands in for the pool: "uploads" are copies kept by fake address, and it
+// can run out of memory or claim every resident copy differs (a collision).
+struct FakeCodeMemory {
+	std::map<uint32_t, std::vector<uint32_t>> live;
+	uint32_t next = 0xB0000000;
+	uint32_t uploads = 0, releases = 0;
+	uint32_t room = ~0u; // uploads left before "out of memory"
+	bool collide = false;
+
+	uint32_t upload(std::span<const uint32_t> words)
+	{
+		if (live.size() >= room)
+			return 0;
+		uploads++;
+		live[next].assign(words.begin(), words.end());
+		next += 0x1000;
+		return next - 0x1000;
+	}
+	void release(uint32_t addr)
+	{
+		CHECK(live.erase(addr) == 1);
+		releases++;
+	}
+	bool matches(uint32_t addr, std::span<const uint32_t> words) const
+	{
+		auto it = live.find(addr);
+		CHECK(it != live.end());
+		return !collide && it != live.end() && std::ranges::equal(it->second, words);
+	}
+};
+
+void test_shader_cache()
+{
+	using etna::ShaderCache;
+	const uint32_t a[4] = {0x07811009, 0, 0, 0x20390008};
+	const uint32_t b[4] = {0x07811009, 0, 0, 0x20390018};
+	const uint32_t a8[8] = {0x07811009, 0, 0, 0x20390008};
+
+	// Hashing: deterministic, sees every word and the length.
+	static_assert(ShaderCache::hash(std::span<const uint32_t>{}) == 2166136261u);
+	CHECK(ShaderCache::hash(a) == ShaderCache::hash(std::vector<uint32_t>(a, a + 4)));
+	CHECK(ShaderCache::hash(a) != ShaderCache::hash(b));
+	CHECK(ShaderCache::hash(a) != ShaderCache::hash(a8));
+	CHECK(ShaderCache::hash(std::span{a, 3}) != ShaderCache::hash(a));
+
+	// Hit/miss: the same words share one upload, each get() a reference.
+	{
+		FakeCodeMemory m;
+		ShaderCache c;
+		const uint32_t pa = c.get(m, a);
+		CHECK(pa && m.uploads == 1 && m.live[pa] == std::vector<uint32_t>(a, a + 4));
+		CHECK(c.get(m, a) == pa && m.uploads == 1 && c.refs(pa) == 2);
+		const uint32_t pb = c.get(m, b), p8 = c.get(m, a8);
+		CHECK(pb && p8 && pb != pa && p8 != pa && m.uploads == 3);
+		auto s = c.stats();
+		CHECK(s.hits == 1 && s.misses == 3 && s.resident == 3 && s.bytes == 64 && s.evictions == 0);
+		// Idle code stays resident: the next get() is still a hit.
+		CHECK(c.put(pa) && c.put(pa) && c.refs(pa) == 0);
+		CHECK(c.get(m, a) == pa && m.uploads == 3 && m.releases == 0);
+		CHECK(!c.put(0x1234)); // not cached
+		// A hash match whose words differ is a miss, never the wrong code.
+		m.collide = true;
+		const uint32_t pc = c.get(m, a);
+		CHECK(pc && pc != pa && m.uploads == 4 && c.stats().resident == 4);
+		// trim() drops only the idle entries.
+		CHECK(c.put(pb) && c.put(p8));
+		c.trim(m);
+		CHECK(m.releases == 2 && c.stats().resident == 2 && c.refs(pa) == 1 && c.refs(pc) == 1);
+		CHECK(!m.live.contains(pb) && !m.live.contains(p8));
+	}
+
+	// Eviction: full, a miss drops the least recently used idle entry.
+	{
+		FakeCodeMemory m;
+		ShaderCache c;
+		uint32_t addr[ShaderCache::kCapacity];
+		for (uint32_t i = 0; i < ShaderCache::kCapacity; i++) {
+			const uint32_t w[4] = {i, 0, 0, 0};
+			addr[i] = c.get(m, w);
+		}
+		CHECK(c.stats().resident == ShaderCache::kCapacity);
+		for (uint32_t i = 0; i < ShaderCache::kCapacity; i++)
+			CHECK(c.put(addr[i]));
+		const uint32_t w0[4] = {0, 0, 0, 0}, w1[4] = {1, 0, 0, 0};
+		CHECK(c.get(m, w0) == addr[0] && c.put(addr[0])); // 0 used recently: 1 is oldest
+		const uint32_t n1[4] = {100, 0, 0, 0};
+		const uint32_t x = c.get(m, n1);
+		CHECK(x && m.releases == 1 && !m.live.contains(addr[1]) && m.live.contains(addr[0]));
+		CHECK(c.stats().evictions == 1 && c.stats().resident == ShaderCache::kCapacity);
+		CHECK(c.get(m, w1) != addr[1] && m.releases == 2 && !m.live.contains(addr[2]));
+
+		// Every entry referenced: the upload goes ahead uncached.
+		for (uint32_t i = 3; i < ShaderCache::kCapacity; i++) {
+			const uint32_t w[4] = {i, 0, 0, 0};
+			CHECK(c.get(m, w) == addr[i]);
+		}
+		CHECK(c.get(m, w0) == addr[0]);
+		const uint32_t n2[4] = {200, 0, 0, 0};
+		const uint32_t y = c.get(m, n2);
+		CHECK(y && m.live.contains(y) && c.stats().uncached == 1 && c.stats().resident == ShaderCache::kCapacity);
+		CHECK(!c.put(y)); // the caller frees it
+		CHECK(c.get(m, n2) != y && c.stats().uncached == 2);
+	}
+
+	// Out of memory: idle entries are evicted one at a time until it fits.
+	{
+		FakeCodeMemory m;
+		ShaderCache c;
+		m.room = 3;
+		const uint32_t w[4][4] = {{1}, {2}, {3}, {4}};
+		uint32_t p[4];
+		for (int i = 0; i < 3; i++)
+			p[i] = c.get(m, w[i]);
+		CHECK(c.put(p[1]));
+		p[3] = c.get(m, w[3]);
+		CHECK(p[3] && m.releases == 1 && !m.live.contains(p[1]) && c.stats().evictions == 1);
+		// Nothing idle: it fails, with nothing added.
+		CHECK(c.get(m, w[1]) == 0 && c.stats().resident == 3 && m.releases == 1);
+		CHECK(c.stats().misses == 5);
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  etna_offload.hh
+// -----------------------------------------------------------------------------
+void test_offload_model()
+{
+	using etna::LinearCost;
+	using etna::OffloadModel;
+	using etna::OffloadOp;
+	constexpr uint32_t MB = 1u << 20;
+
+	// Two points define the line; noise clamps instead of going negative.
+	static_assert(LinearCost::fit(1024, 1100, 1024 + MB, 1100 + 4000).fixed == 1097); // 1100 - 4000 * 1024 / MB
+	static_assert(LinearCost::fit(1024, 1100, 1024 + MB, 1100 + 4000).per_mb == 4000);
+	static_assert(LinearCost::fit(4096, 900, 65536, 800).per_mb == 0);
+	static_assert(LinearCost::fit(0, 10, MB, 10 + 3000).at(MB / 2) == 10 + 1500);
+	static_assert(LinearCost::fit(MB, 50, MB, 70).fixed == 50); // one size: a flat line
+	CHECK(LinearCost::fit(2048, 10, 4096, 10000).fixed == 0);	   // would be negative
+	CHECK((LinearCost{7, ~0u}.at(~0u) == 7 + ((uint64_t(~0u) * ~0u) >> 20)));
+
+	CHECK(etna::offload_inputs(OffloadOp::Copy) == 1 && etna::offload_inputs(OffloadOp::AndImm) == 1 &&
+		  etna::offload_inputs(OffloadOp::Add2) == 2 && etna::offload_inputs(OffloadOp::MulHi2) == 2 &&
+		  etna::offload_inputs(OffloadOp::BlendLerp) == 3 && etna::offload_inputs(OffloadOp::Dp2x8) == 1);
+
+	OffloadModel m;
+	// Uncalibrated: the GPU, as compute().
+	CHECK(m.use_gpu(OffloadOp::Add, 16) && m.crossover(OffloadOp::Add) == 0);
+	// GPU: 150 us fixed, cheap per byte; CPU: free to start, dear per byte.
+	m.set(OffloadOp::Add, LinearCost{0, 8000}, LinearCost{150, 1000});
+	const uint32_t x = m.crossover(OffloadOp::Add);
+	CHECK(x > 0 && x < ~0u);
+	CHECK(!m.use_gpu(OffloadOp::Add, 4096) && m.use_gpu(OffloadOp::Add, MB));
+	CHECK(!m.use_gpu(OffloadOp::Add, x - 1) && m.use_gpu(OffloadOp::Add, x));
+	CHECK(x / 1024 == 150 * 1024 / 7000); // 150 = 7000 per MB * x
+	// Never: the CPU starts ahead and stays ahead.
+	m.set(OffloadOp::Not, LinearCost{0, 500}, LinearCost{150, 1000});
+	CHECK(m.crossover(OffloadOp::Not) == ~0u && !m.use_gpu(OffloadOp::Not, ~0u));
+	// dp2x8's NEON model isn't confirmed on general input: the GPU, however
+	// cheap the CPU line.
+	m.set(OffloadOp::Dp2x8, LinearCost{0, 500}, LinearCost{150, 1000});
+	CHECK(!etna::cpu_exact(OffloadOp::Dp2x8) && etna::cpu_exact(OffloadOp::BlendLerp));
+	CHECK(m.use_gpu(OffloadOp::Dp2x8, 16) && m.crossover(OffloadOp::Dp2x8) == 0);
+	// Always: the GPU is ahead from the start (ties go to it).
+	m.set(OffloadOp::Copy, LinearCost{20, 900}, LinearCost{20, 900});
+	CHECK(m.crossover(OffloadOp::Copy) == 0 && m.use_gpu(OffloadOp::Copy, 1));
+	CHECK(m[OffloadOp::Add].calibrated && !m[OffloadOp::Mul2].calibrated);
+
+	// GPU ahead for small images only (a line that starts lower but climbs
+	// faster): the answer flips the other way.
+	m.set(OffloadOp::Add2, LinearCost{200, 1000}, LinearCost{100, 2000});
+	const uint32_t y = m.crossover(OffloadOp::Add2);
+	CHECK(y > 100 * MB / 1000 && y < 102 * MB / 1000); // the floors move it by a tick's worth
+	CHECK(m.use_gpu(OffloadOp::Add2, y - 1) && !m.use_gpu(OffloadOp::Add2, y));
+
+	// Random lines: use_gpu() changes its answer at crossover() and nowhere
+	// else.
+	Rng rng;
+	for (int i = 0; i < 2000; i++) {
+		m.set(OffloadOp::Mul2, LinearCost{rng.below(5000), rng.below(100000)},
+			  LinearCost{rng.below(5000), rng.below(100000)});
+		const uint32_t c = m.crossover(OffloadOp::Mul2);
+		const bool small = m.use_gpu(OffloadOp::Mul2, 0);
+		CHECK(c != 0 || small);
+		if (c != 0 && c != ~0u)
+			CHECK(m.use_gpu(OffloadOp::Mul2, c - 1) == small && m.use_gpu(OffloadOp::Mul2, c) != small);
+		for (int k = 0; k < 8; k++) {
+			const uint32_t b = rng.next();
+			// Away from the crossing rounding cannot flip it.
+			if (uint64_t(b) + 2048 < c || b > uint64_t(c) + 2048)
+				CHECK(m.use_gpu(OffloadOp::Mul2, b) == (c == 0 || b < c ? small : !small));
+		}
+	}
+	m.clear();
+	CHECK(!m[OffloadOp::Add].calibrated && m.use_gpu(OffloadOp::Not, 16));
+}
+
+// -----------------------------------------------------------------------------
+//  etna_format.hh
+// -----------------------------------------------------------------------------
+void test_rs_formats()
+{
+	using etna::Format;
+	constexpr Format all[] = {Format::X4R4G4B4,
+							  Format::A4R4G4B4,
+							  Format::X1R5G5B5,
+							  Format::A1R5G5B5,
+							  Format::R5G6B5,
+							  Format::X8R8G8B8,
+							  Format::A8R8G8B8};
+	static_assert(std::size(all) == etna::kFormats);
+
+	// The table: the channels and padding fill the pixel exactly.
+	for (Format f : all) {
+		const etna::FormatInfo i = etna::format_info(f);
+		CHECK(i.x + i.a + i.r + i.g + i.b == i.bytes * 8);
+		CHECK(i.x == 0 || i.a == 0);
+		CHECK(uint32_t(f) < etna::kFormats);
+		CHECK(etna::format_stride(f, 1024) == 1024u * i.bytes);
+	}
+	static_assert(etna::format_bytes(Format::R5G6B5) == 2 && etna::format_bytes(Format::X8R8G8B8) == 4);
+	static_assert(etna::format_mask(Format::R5G6B5) == 0xFFFF && etna::format_mask(Format::X1R5G5B5) == 0x7FFF);
+	static_assert(etna::format_mask(Format::X8R8G8B8) == 0xFFFFFF && etna::format_mask(Format::A8R8G8B8) == ~0u);
+
+	// RS_CONFIG: what the emitters wrote before formats were parameters.
+	using namespace VivanteGpu;
+	static_assert(etna::rs_config(Format::A8R8G8B8, Format::A8R8G8B8) == 0x606);
+	static_assert(etna::rs_config(Format::A8R8G8B8, Format::A8R8G8B8, etna::BlitSwapRB) ==
+				  (0x606 | RS_CONFIG_SWAP_RB));
+	static_assert(etna::rs_config(Format::A8R8G8B8, Format::A8R8G8B8, etna::BlitNone, true) ==
+				  (RS_FORMAT_A8R8G8B8 | RS_CONFIG_SOURCE_TILED | (RS_FORMAT_A8R8G8B8 << 8)));
+	static_assert(etna::rs_config(Format::A8R8G8B8, Format::R5G6B5, etna::BlitFlipY) == (0x406 | RS_CONFIG_FLIP));
+	static_assert(etna::rs_config(Format::X4R4G4B4, Format::A1R5G5B5) == 0x300);
+
+	// Reference values.
+	static_assert(etna::pack_pixel(Format::R5G6B5, 0xFFFF8040) == ((0x1Fu << 11) | (0x20u << 5) | 0x08));
+	static_assert(etna::pack_pixel(Format::A1R5G5B5, 0x80FF0000) == 0xFC00);
+	static_assert(etna::pack_pixel(Format::A1R5G5B5, 0x7FFF0000) == 0x7C00);
+	static_assert(etna::pack_pixel(Format::X1R5G5B5, 0xFF0000FF) == 0x001F);
+	static_assert(etna::pack_pixel(Format::A4R4G4B4, 0x12345678) == 0x1357);
+	static_assert(etna::pack_pixel(Format::X8R8G8B8, 0x12345678) == 0x345678);
+	static_assert(etna::unpack_pixel(Format::R5G6B5, 0xF800) == 0xFFFF0000);
+	static_assert(etna::unpack_pixel(Format::R5G6B5, 0x8410) == 0xFF848284); // 10000 100000 10000
+	static_assert(etna::unpack_pixel(Format::A4R4G4B4, 0x1357) == 0x11335577);
+	static_assert(etna::unpack_pixel(Format::X4R4G4B4, 0x0357) == 0xFF335577);
+	static_assert(etna::widen_channel(1, 1) == 0xFF && etna::widen_channel(0x15, 5) == 0xAD);
+	static_assert(etna::rs_clear_value(Format::R5G6B5, 0xFFFF0000) == 0xF800F800);
+	static_assert(etna::rs_clear_value(Format::A8R8G8B8, 0x4D5A11AC) == 0x4D5A11AC);
+	CHECK(etna::convert_pixel(Format::A8R8G8B8, Format::A8R8G8B8, 0x11223344, etna::BlitSwapRB) == 0x11443322);
+
+	// Every 16-bit pixel survives widening and narrowing again, and the
+	// widened channels stay within one step of the narrowed ones.
+	for (Format f : all) {
+		const uint32_t mask = etna::format_mask(f);
+		const uint32_t n = etna::format_bytes(f) == 2 ? 0x10000 : 0;
+		for (uint32_t px = 0; px < n; px++) {
+			const uint32_t argb = etna::unpack_pixel(f, px);
+			CHECK(etna::pack_pixel(f, argb) == (px & mask));
+			CHECK(etna::convert_pixel(Format::A8R8G8B8, f, etna::convert_pixel(f, Format::A8R8G8B8, px)) ==
+				  (px & mask));
+		}
+	}
+	Rng rng;
+	for (int k = 0; k < 20000; k++) {
+		const uint32_t argb = rng.next();
+		for (Format f : all) {
+			const etna::FormatInfo i = etna::format_info(f);
+			const uint32_t back = etna::unpack_pixel(f, etna::pack_pixel(f, argb));
+			const uint8_t bits[4] = {i.b, i.g, i.r, i.a};
+			for (unsigned c = 0; c < 4; c++) {
+				const int in = (argb >> (c * 8)) & 0xFF, out = (back >> (c * 8)) & 0xFF;
+				if (bits[c] == 0)
+					CHECK(out == 0xFF);
+				else
+					CHECK(in - out < (1 << (8 - bits[c])) && out - in < (1 << (8 - bits[c])));
+			}
+			// A 16-bit clear value is the pixel in both halves.
+			const uint32_t v = etna::rs_clear_value(f, argb);
+			CHECK(i.bytes == 4 ? v == etna::pack_pixel(f, argb) : (v >> 16) == (v & 0xFFFF));
+		}
+	}
+}
+
+void test_rs_downsample()
+{
+	using etna::Format;
+	using namespace VivanteGpu;
+
+	// Register values: the window stays the source size, the destination
+	// stride is the halved width in the destination's format.
+	static_assert(etna::rs_blit_state(Format::A8R8G8B8, Format::A8R8G8B8, 1024, 600) ==
+				  etna::RsCopy{0x606, 4096, 4096, 1024 | (600 << 16)});
+	constexpr uint32_t ds2x = RS_CONFIG_DOWNSAMPLE_X | RS_CONFIG_DOWNSAMPLE_Y;
+	static_assert(etna::rs_blit_state(Format::A8R8G8B8, Format::A8R8G8B8, 1024, 600, etna::BlitDownsample2x) ==
+				  etna::RsCopy{0x606 | ds2x, 4096, 2048, 1024 | (600 << 16)});
+	static_assert(etna::rs_blit_state(Format::A8R8G8B8, Format::R5G6B5, 256, 64, etna::BlitDownsampleX) ==
+				  etna::RsCopy{0x406 | RS_CONFIG_DOWNSAMPLE_X, 1024, 256, 256 | (64 << 16)});
+	static_assert(etna::rs_blit_state(Format::R5G6B5, Format::R5G6B5, 64, 64, etna::BlitDownsampleY).dest_stride ==
+				  128);
+	static_assert(etna::rs_resolve_state(Format::R5G6B5, 2048, 1200, 2048 * 4, 1024 * 2, etna::BlitDownsample2x) ==
+				  etna::RsCopy{0x406 | RS_CONFIG_SOURCE_TILED | ds2x, 2048 * 4 << 2, 1024 * 2, 2048 | (1200 << 16)});
+	// Without downsampling, what resolve() always programmed.
+	static_assert(etna::rs_resolve_state(Format::A8R8G8B8, 64, 64, 256, 256).config ==
+				  (RS_FORMAT_A8R8G8B8 | RS_CONFIG_SOURCE_TILED | (RS_FORMAT_A8R8G8B8 << 8)));
+	static_assert(etna::rs_dest_width(1024, etna::BlitDownsampleY) == 1024 &&
+				  etna::rs_dest_height(1024, etna::BlitDownsampleY) == 512);
+
+	// The box filter, by hand: each channel the rounded mean.
+	const uint32_t quad[4] = {0x00000000, 0x04040404, 0x08080808, 0x0C0C0C0D};
+	uint32_t one = 0;
+	etna::rs_blit_reference(&one, Format::A8R8G8B8, quad, Format::A8R8G8B8, 2, 2, etna::BlitDownsample2x);
+	CHECK(one == 0x06060606); // 25 / 4 rounds down, 24 / 4 exact
+	const uint32_t low[4] = {0, 0, 1, 1};
+	etna::rs_blit_reference(&one, Format::A8R8G8B8, low, Format::A8R8G8B8, 2, 2, etna::BlitDownsample2x);
+	CHECK(one == 1); // 2 / 4 rounds up
+	uint32_t pair[2] = {};
+	etna::rs_blit_reference(pair, Format::A8R8G8B8, quad, Format::A8R8G8B8, 2, 2, etna::BlitDownsampleX);
+	CHECK(pair[0] == 0x02020202 && pair[1] == 0x0A0A0A0B); // 0x0D + 0x08 = 21, / 2 rounds up
+	etna::rs_blit_reference(pair, Format::A8R8G8B8, quad, Format::A8R8G8B8, 2, 2, etna::BlitDownsampleY);
+	CHECK(pair[0] == 0x04040404 && pair[1] == 0x08080809);
+	// quad as a 1x4 column, halved and flipped: the bottom pair comes first.
+	const uint32_t flip = etna::BlitDownsampleY | etna::BlitFlipY;
+	etna::rs_blit_reference(pair, Format::A8R8G8B8, quad, Format::A8R8G8B8, 1, 4, flip);
+	CHECK(pair[0] == 0x0A0A0A0B && pair[1] == 0x02020202);
+	uint16_t px565 = 0;
+	etna::rs_blit_reference(&px565, Format::R5G6B5, quad, Format::A8R8G8B8, 2, 2, etna::BlitDownsample2x);
+	CHECK(px565 == etna::pack_pixel(Format::R5G6B5, 0x06060606));
+
+	// Random images: a 2x nearest-neighbour upscale downsamples back to the
+	// original exactly (every 2x2 block is one colour), in any format.
+	Rng rng;
+	constexpr uint32_t W = 32, H = 16;
+	std::vector<uint32_t> img(W * H), big(4 * W * H), back(W * H);
+	std::vector<uint16_t> img16(W * H), big16(4 * W * H), back16(W * H);
+	for (int round = 0; round < 50; round++) {
+		for (uint32_t i = 0; i < W * H; i++) {
+			img[i] = rng.next();
+			img16[i] = uint16_t(rng.next());
+		}
+		for (uint32_t y = 0; y < 2 * H; y++)
+			for (uint32_t x = 0; x < 2 * W; x++) {
+				big[y * 2 * W + x] = img[(y / 2) * W + x / 2];
+				big16[y * 2 * W + x] = img16[(y / 2) * W + x / 2];
+			}
+		etna::rs_blit_reference(
+			back.data(), Format::A8R8G8B8, big.data(), Format::A8R8G8B8, 2 * W, 2 * H, etna::BlitDownsample2x);
+		CHECK(back == img);
+		etna::rs_blit_reference(
+			back16.data(), Format::R5G6B5, big16.data(), Format::R5G6B5, 2 * W, 2 * H, etna::BlitDownsample2x);
+		CHECK(back16 == img16);
+		// So does halving X, then Y, in two passes.
+		std::vector<uint32_t> half(W * 2 * H), xy(W * H);
+		etna::rs_blit_reference(
+			half.data(), Format::A8R8G8B8, big.data(), Format::A8R8G8B8, 2 * W, 2 * H, etna::BlitDownsampleX);
+		etna::rs_blit_reference(
+			xy.data(), Format::A8R8G8B8, half.data(), Format::A8R8G8B8, W, 2 * H, etna::BlitDownsampleY);
+		CHECK(xy == img);
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  etna_ts.hh -- tile status sizing and the draw's TS state
+// -----------------------------------------------------------------------------
+void test_tile_status()
+{
+	using namespace VivanteGpu;
+
+	// The demo's targets: 2.4 MB of A8R8G8B8 and 1.2 MB of D16.
+	static_assert(etna::ts_bytes(1024 * 600 * 4) == 9728);
+	static_assert(etna::ts_bytes(1024 * 600 * 2) == 4864);
+	static_assert(etna::ts_fill_height(9728) == 152);
+	static_assert(etna::ts_bytes(0) == 0 && etna::ts_bytes(1) == 0x100);
+	static_assert(etna::ts_bytes(0x10000) == 0x100 && etna::ts_bytes(0x10001) == 0x200);
+	// Every size: 2 bits per 64-byte tile, no more than one alignment unit
+	// over, and an RS fill a whole number of 4-row blocks high.
+	Rng rng;
+	for (int i = 0; i < 10000; i++) {
+		const uint32_t n = rng.below(16 << 20);
+		const uint32_t t = etna::ts_bytes(n);
+		CHECK(t % etna::kTsAlign == 0);
+		CHECK(uint64_t(t) * 4 * etna::kTsTileBytes >= n);
+		CHECK(t < etna::kTsAlign || uint64_t(t - etna::kTsAlign) * 4 * etna::kTsTileBytes < n);
+		CHECK(etna::ts_fill_height(t) % 4 == 0 && etna::ts_fill_height(t) * etna::kTsFillWidth * 4 == t);
+	}
+
+	static_assert(etna::ts_mem_config(false, false) == 0);
+	static_assert(etna::ts_mem_config(true, false) == 0x2);
+	static_assert(etna::ts_mem_config(false, true) == 0x9);
+	static_assert(etna::ts_mem_config(true, true) == 0xB);
+	static_assert(etna::ts_depth_clear_value(0xFFFF) == 0xFFFFFFFF);
+	static_assert(etna::ts_depth_clear_value(0x1234) == 0x12341234);
+
+	// The draw programs the TS of each target it has one for, and turns the
+	// TS off for a draw without.
+	if (!bundle_arena())
+		return;
+	static const etna::Bo rt_ts{0xA0900000, etna::ts_bytes(kRt.size())};
+	static const etna::Bo depth_ts{0xA0910000, etna::ts_bytes(kDepth.size())};
+	const Mat4 m = frame_mvp(0, 0);
+	etna::MeshDraw d = cube_draw(m);
+	d.rt_ts = {&rt_ts, 0xFF101828};
+	d.depth_ts = {&depth_ts, etna::ts_depth_clear_value(0xFFFF)};
+	etna::MeshDraw color_only = d;
+	color_only.depth_ts = {};
+	etna::MeshDraw no_depth = d; // a depth TS without a depth buffer is ignored
+	no_depth.depth = nullptr;
+	const etna::MeshDraw draws[] = {d, color_only, cube_draw(m), no_depth};
+	const uint32_t mem_config[] = {0xB, 0x2, 0, 0x2};
+
+	// One draw after another through one tracker, each against the same
+	// draw emitted in full. (The tracked register file keeps an earlier
+	// draw's TS addresses; TS_MEM_CONFIG 0 is what turns them off.)
+	etna::CmdStream tracked = arena_stream(9);
+	etna::StateTracker st;
+	for (uint32_t i = 0; i < 4; i++) {
+		etna::CmdStream direct = arena_stream(8);
+		etna::emit_mesh(direct, draws[i]);
+		etna::emit_mesh(tracked, st, draws[i]);
+		RegFile rf;
+		rf.run(direct.bo().span<const uint32_t>().data(), direct.offset());
+		CHECK(rf.ok && rf.at_draw.size() == 1);
+		if (rf.at_draw.size() != 1)
+			return;
+		CHECK(rf.at_draw[0][TS_MEM_CONFIG].first == mem_config[i]);
+		if (i == 0) {
+			auto &r = rf.at_draw[0];
+			CHECK(r[TS_COLOR_STATUS_BASE].first == rt_ts.gpu_addr());
+			CHECK(r[TS_COLOR_SURFACE_BASE].first == kRt.gpu_addr());
+			CHECK(r[TS_COLOR_CLEAR_VALUE].first == 0xFF101828);
+			CHECK(r[TS_DEPTH_STATUS_BASE].first == depth_ts.gpu_addr());
+			CHECK(r[TS_DEPTH_SURFACE_BASE].first == kDepth.gpu_addr());
+			CHECK(r[TS_DEPTH_CLEAR_VALUE].first == 0xFFFFFFFF);
+		}
+		if (i == 2)
+			CHECK(!rf.at_draw[0].contains(TS_COLOR_STATUS_BASE));
+		RegFile rt;
+		rt.run(tracked.bo().span<const uint32_t>().data(), tracked.offset());
+		CHECK(rt.ok && rt.at_draw.size() == i + 1);
+		if (rt.at_draw.size() != i + 1)
+			return;
+		CHECK(rt.at_draw[i][TS_MEM_CONFIG] == rf.at_draw[0][TS_MEM_CONFIG]);
+		if (i == 0)
+			CHECK(rt.at_draw[0] == rf.at_draw[0]);
+	}
+	// The TS registers are plain state: unchanged, the tracker drops them.
+	etna::CmdStream again = arena_stream(10);
+	etna::StateTracker st2;
+	etna::emit_mesh(again, st2, d);
+	const uint32_t first = again.offset();
+	etna::emit_mesh(again, st2, d);
+	RegFile second;
+	second.run(again.bo().span<const uint32_t>().data() + first, again.offset() - first);
+	CHECK(second.ok && second.at_draw.size() == 1);
+	for (uint32_t a = TS_MEM_CONFIG; a <= TS_DEPTH_CLEAR_VALUE; a += 4)
+		CHECK(!second.regs.contains(a));
+}
+
+// -----------------------------------------------------------------------------
+//  etna_damage.hh -- projected bounds, region merging, per-buffer damage
+// -----------------------------------------------------------------------------
+void test_damage_rects()
+{
+	using etna::Rect;
+	static_assert(Rect{0, 0, 0, 5}.empty() && Rect{3, 3, 2, 5}.area() == 0 && Rect{1, 2, 4, 6}.area() == 12);
+	static_assert(etna::rect_union(Rect{}, Rect{1, 2, 3, 4}) == Rect{1, 2, 3, 4});
+	static_assert(etna::rect_union(Rect{0, 0, 4, 4}, Rect{8, 2, 10, 9}) == Rect{0, 0, 10, 9});
+	static_assert(etna::rect_overlaps(Rect{0, 0, 4, 4}, Rect{3, 3, 5, 5}));
+	static_assert(!etna::rect_overlaps(Rect{0, 0, 4, 4}, Rect{4, 0, 8, 4})); // touching is not overlapping
+	static_assert(etna::rs_align(Rect{17, 5, 18, 6}, 1024, 600) == Rect{16, 4, 32, 8});
+	static_assert(etna::rs_align(Rect{1000, 597, 1030, 700}, 1024, 600) == Rect{992, 596, 1024, 600});
+	static_assert(etna::rs_align(Rect{16, 4, 32, 8}, 1024, 600) == Rect{16, 4, 32, 8});
+
+	// The registers: a full resolve's, with a smaller window and both
+	// addresses moved to the rectangle's start.
+	constexpr auto s = etna::rs_resolve_rect_state(etna::Format::A8R8G8B8, Rect{16, 4, 48, 12}, 4096, 4096);
+	static_assert(s.copy == etna::rs_resolve_state(etna::Format::A8R8G8B8, 32, 8, 4096, 4096));
+	static_assert(s.src_offset == 4096 * 4 + 16 * 16 && s.dst_offset == 4 * 4096 + 16 * 4);
+	static_assert(etna::ts_offset(s.src_offset) == 65);
+	static_assert(etna::rs_resolve_rect_state(etna::Format::R5G6B5, Rect{0, 0, 1024, 600}, 4096, 2048) ==
+				  etna::RsRect{etna::rs_resolve_state(etna::Format::R5G6B5, 1024, 600, 4096, 2048), 0, 0});
+	// Walking a window from the moved source address reaches the rectangle's
+	// pixels of the 4x4-tiled surface; the TS entry moves with them.
+	auto tiled = [](uint32_t x, uint32_t y, uint32_t stride) {
+		return (y / 4) * stride * 4 + (x / 4) * 64 + (y % 4) * 16 + (x % 4) * 4;
+	};
+	Rng rng;
+	for (int i = 0; i < 1000; i++) {
+		const Rect r = etna::rs_align(
+			Rect{rng.below(1024), rng.below(600), rng.below(1024) + 1, rng.below(600) + 1}, 1024, 600);
+		if (r.empty())
+			continue;
+		const auto rs = etna::rs_resolve_rect_state(etna::Format::A8R8G8B8, r, 4096, 4096);
+		const uint32_t x = rng.below(r.width()), y = rng.below(r.height());
+		CHECK(rs.src_offset + tiled(x, y, 4096) == tiled(r.x0 + x, r.y0 + y, 4096));
+		CHECK(rs.dst_offset + y * 4096 + x * 4 == (r.y0 + y) * 4096 + (r.x0 + x) * 4);
+		CHECK(rs.src_offset % 256 == 0 &&
+			  etna::ts_offset(rs.src_offset) + tiled(x, y, 4096) / 256 ==
+				  etna::ts_offset(tiled(r.x0 + x, r.y0 + y, 4096)));
+	}
+}
+
+void test_damage_projection()
+{
+	// Identity: NDC is the model box itself.
+	const Mat4 id = {1, 0, 0, 0, /**/ 0, 1, 0, 0, /**/ 0, 0, 1, 0, /**/ 0, 0, 0, 1};
+	const float lo[3] = {-0.5f, -0.5f, -0.5f}, hi[3] = {0.5f, 0.5f, 0.5f};
+	CHECK((etna::project_box(id, lo, hi, 100, 60) == etna::Rect{24, 14, 77, 47}));
+	// Off to the side: clipped to the viewport; behind the eye: all of it.
+	Mat4 side = id;
+	side[12] = 1.5f;
+	CHECK((etna::project_box(side, lo, hi, 100, 60) == etna::Rect{99, 14, 100, 47}));
+	side[12] = 5.0f;
+	CHECK(etna::project_box(side, lo, hi, 100, 60).empty());
+	Mat4 behind = id;
+	behind[15] = -1.0f;
+	CHECK((etna::project_box(behind, lo, hi, 100, 60) == etna::Rect{0, 0, 100, 60}));
+
+	// Every pixel the CPU reference rasterizes for a cube lies inside its
+	// bounds, and the bounds of a cube on screen are tight: each edge within
+	// 3 px of a drawn pixel.
+	constexpr uint32_t W = 160, H = 96;
+	std::vector<uint32_t> img(W * H);
+	std::vector<uint8_t> band(W * H);
+	std::vector<float> zbuf(W * H);
+	Rng rng;
+	uint32_t outside = 0, loose = 0;
+	for (int i = 0; i < 200; i++) {
+		auto f = [&](float lo_, float hi_) { return lo_ + (hi_ - lo_) * float(rng.below(1000)) / 1000.0f; };
+		const Mat4 m =
+			cube_mvp(f(0, 6.28f), f(-0.6f, 0.6f), float(W) / H, f(-2.5f, 2.5f), f(-1.5f, 1.5f), f(-8.0f, -2.0f));
+		cpu_render_cube(m, W, H, img, band, zbuf, 0);
+		const etna::Rect b = cube_bounds(m, W, H);
+		etna::Rect drawn{W, H, 0, 0};
+		for (uint32_t y = 0; y < H; y++)
+			for (uint32_t x = 0; x < W; x++)
+				if (img[y * W + x]) {
+					outside += !b.contains(x, y);
+					drawn = {std::min(drawn.x0, x), std::min(drawn.y0, y), std::max(drawn.x1, x + 1),
+							 std::max(drawn.y1, y + 1)};
+				}
+		// (Clipped, the bounds of the part on screen can be smaller.)
+		if (drawn.empty() || b.x0 == 0 || b.y0 == 0 || b.x1 == W || b.y1 == H)
+			continue;
+		loose += (drawn.x0 - b.x0 > 3) || (drawn.y0 - b.y0 > 3) || (b.x1 - drawn.x1 > 3) || (b.y1 - drawn.y1 > 3);
+	}
+	CHECK(outside == 0);
+	CHECK(loose == 0);
+}
+
+void test_damage_region()
+{
+	constexpr uint32_t W = 1024, H = 600;
+	Rng rng;
+	for (int round = 0; round < 500; round++) {
+		etna::DamageRegion d{W, H};
+		std::vector<etna::Rect> added;
+		const uint32_t n = 1 + rng.below(12);
+		for (uint32_t i = 0; i < n; i++) {
+			const uint32_t x = rng.below(W), y = rng.below(H);
+			const etna::Rect r{x, y, x + 1 + rng.below(200), y + 1 + rng.below(150)};
+			d.add(r);
+			added.push_back(etna::rs_align(r, W, H));
+		}
+		auto rects = d.rects();
+		CHECK(rects.size() <= etna::DamageRegion::kMaxRects && !d.empty());
+		uint32_t area = 0;
+		for (size_t i = 0; i < rects.size(); i++) {
+			const etna::Rect &r = rects[i];
+			CHECK(r == etna::rs_align(r, W, H) && !r.empty());
+			for (size_t j = i + 1; j < rects.size(); j++)
+				CHECK(!etna::rect_overlaps(r, rects[j]));
+			area += r.area();
+		}
+		CHECK(area == d.area() && area <= W * H);
+		// Every added pixel is covered (corners and a few inside).
+		for (const etna::Rect &a : added)
+			for (int k = 0; k < 8; k++) {
+				const uint32_t x = k < 4 ? (k & 1 ? a.x1 - 1 : a.x0) : a.x0 + rng.below(a.width());
+				const uint32_t y = k < 4 ? (k & 2 ? a.y1 - 1 : a.y0) : a.y0 + rng.below(a.height());
+				CHECK(std::ranges::any_of(rects, [&](const etna::Rect &r) { return r.contains(x, y); }));
+			}
+	}
+
+	// Two far-apart objects stay two rectangles; overlapping ones become one.
+	etna::DamageRegion d{W, H};
+	d.add({10, 10, 50, 50});
+	d.add({900, 500, 950, 550});
+	CHECK(d.rects().size() == 2);
+	d.add({40, 40, 100, 100});
+	CHECK(d.rects().size() == 2 && d.rects()[1] == (etna::Rect{0, 8, 112, 100}));
+	d.fill();
+	CHECK(d.rects().size() == 1 && d.area() == W * H);
+}
+
+// A swapchain of 3 buffers showing a scene of moving rectangles: resolving
+// only each frame's DamageTracker region keeps every buffer identical to a
+// full resolve, whatever order the buffers come round in.
+void test_damage_tracker()
+{
+	constexpr uint32_t W = 256, H = 128, Buffers = 3, Objects = 5;
+	constexpr uint32_t Background = 0xFF101828;
+	Rng rng;
+	std::vector<uint32_t> rt(W * H);
+	std::vector<std::vector<uint32_t>> fb(Buffers, std::vector<uint32_t>(W * H));
+	for (auto &b : fb)
+		for (uint32_t &p : b)
+			p = rng.next(); // whatever was in memory
+	etna::DamageTracker tracker{Buffers, W, H};
+	etna::Rect obj[Objects];
+	uint32_t resolved = 0, frames = 0;
+	for (uint32_t frame = 0; frame < 300; frame++) {
+		// Move (or sometimes drop) each object, then draw the scene.
+		std::ranges::fill(rt, Background);
+		etna::DamageRegion drawn = tracker.region();
+		for (etna::Rect &o : obj) {
+			const uint32_t x = rng.below(W - 32), y = rng.below(H - 16);
+			const bool gone = frame % 7 == 3 && rng.below(2);
+			o = gone ? etna::Rect{} : etna::Rect{x, y, x + 1 + rng.below(32), y + 1 + rng.below(16)};
+			const uint32_t color = rng.next() | 0xFF000000;
+			for (uint32_t py = o.y0; py < o.y1; py++)
+				for (uint32_t px = o.x0; px < o.x1; px++)
+					rt[py * W + px] = color;
+			drawn.add(o);
+		}
+		const uint32_t b = frame % 5 == 4 ? rng.below(Buffers) : frame % Buffers;
+		const etna::DamageRegion region = tracker.update(b, drawn);
+		for (const etna::Rect &r : region.rects())
+			for (uint32_t py = r.y0; py < r.y1; py++)
+				for (uint32_t px = r.x0; px < r.x1; px++)
+					fb[b][py * W + px] = rt[py * W + px];
+		CHECK(fb[b] == rt);
+		resolved += region.area();
+		frames++;
+	}
+	// A handful of small objects: far less than the full screen.
+	CHECK(resolved < frames * W * H / 2);
+	printf("damage: %u%% of the pixels of full resolves, %u frames\n", resolved * 100 / (frames * W * H), frames);
+
+	// After invalidate() the next frame into each buffer is a full resolve.
+	tracker.invalidate();
+	CHECK(tracker.update(0, tracker.region()).area() == W * H);
+	CHECK(tracker.update(0, tracker.region()).area() == 0);
+}
+
+
+// -----------------------------------------------------------------------------
+//  etna_decode.hh -- command stream decoder, register shadow, hazard checks
+// -----------------------------------------------------------------------------
+void test_decode_commands()
+{
+	using namespace etna::decode;
+	using namespace VivanteGpu;
+	CHECK(command_dwords(cmd_load_state(RS_CONFIG)) == 2);
+	CHECK(command_dwords(cmd_load_state(RS_FILL_VALUE0, 4)) == 6);
+	CHECK(command_dwords(cmd_load_state(RS_FILL_VALUE0, 3)) == 4);
+	CHECK(command_dwords(0x08000000) == 1026); // count 0 = 1024
+	CHECK(command_dwords(CMD_END) == 2 && command_dwords(CMD_NOP) == 2 && command_dwords(CMD_STALL) == 2);
+	CHECK(command_dwords(cmd_wait(200)) == 2 && command_dwords(cmd_link(4)) == 2);
+	CHECK(command_dwords(cmd_draw_instanced(PRIM_TRIANGLES, 36)[0]) == 4);
+	CHECK(command_dwords(kDrawIndexed << 27) == 6 && command_dwords(kChipSelect << 27) == 2);
+	CHECK(command_dwords(0) == 0 && command_dwords(0xF8000000) == 0);
+
+	CHECK(reg_name(RS_CONFIG) == "RS_CONFIG");
+	CHECK(reg_name(RS_FILL_VALUE0 + 8) == "RS_FILL_VALUE[2]");
+	CHECK(reg_name(NFE_VERTEX_STREAM_BASE0 + 4) == "NFE_VERTEX_STREAM_BASE[1]");
+	CHECK(reg_name(SH_HALTI5_UNIFORMS0 + 4 * 17) == "SH_HALTI5_UNIFORMS[17]");
+	CHECK(reg_name(0x0924) == "0x0924");
+	CHECK(is_trigger(RS_KICKER) && is_trigger(GL_FLUSH_CACHE) && !is_trigger(RS_CONFIG));
+	// Every entry is named once: no two ranges overlap.
+	for (const RegInfo &a : kRegs)
+		for (const RegInfo &b : kRegs)
+			CHECK((&a == &b || a.addr + 4 * a.count <= b.addr || b.addr + 4 * b.count <= a.addr));
+
+	// One of each command; the shadow holds what LOAD_STATE wrote, FIXP and
+	// all, and the same value again is redundant unless it is a trigger.
+	const uint32_t w[] = {
+		cmd_load_state(RS_FILL_VALUE0, 3), 1, 2, 3,
+		cmd_load_state(RS_FILL_VALUE0 + 4), 2,
+		cmd_load_state(RS_FILL_VALUE0 + 4) | kLoadStateFixp, 2,
+		cmd_load_state(GL_FLUSH_CACHE), 3,
+		cmd_load_state(GL_FLUSH_CACHE), 3,
+		CMD_NOP, 0,
+		cmd_wait(16), 0,
+		cmd_link(8), 0x90000000,
+		cmd_load_state(GL_SEMAPHORE_TOKEN), sync_token(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE),
+		CMD_STALL, sync_token(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE),
+		kChipSelect << 27, 0,
+		CMD_END, 0,
+		CMD_NOP, 0, // never reached
+	};
+	Simulator sim;
+	Result r = sim.run(w);
+	CHECK(r.ended && r.findings.empty());
+	CHECK(r.stats.dwords == std::size(w) - 2 && r.stats.commands == 12 && r.stats.headers == 6);
+	CHECK(r.stats.states == 8 && r.stats.redundant == 1 && r.redundant.size() == 1);
+	CHECK(r.redundant.count(RS_FILL_VALUE0 + 4) == 1 && r.stats.flushes == 2 && r.stats.stalls == 1);
+	CHECK(r.stats.pad == 2 && r.stats.by_opcode[kLoadState] == 6 && r.stats.by_opcode[kChipSelect] == 1);
+	CHECK(sim.value(RS_FILL_VALUE0 + 8) == 3 && sim.known(RS_FILL_VALUE0) && !sim.known(RS_CONFIG));
+
+	// Garbage, and a LOAD_STATE longer than the stream, stop the decode.
+	const uint32_t bad[] = {CMD_NOP, 0, 0xF8000000, 0};
+	r = sim.run(bad);
+	CHECK(!r.ended && r.findings.size() == 1 && r.findings[0].issue == Issue::Malformed);
+	CHECK(r.findings[0].offset == 2 && r.stats.commands == 1 && r.stats.dwords == 4);
+	const uint32_t cut[] = {cmd_load_state(RS_FILL_VALUE0, 4), 1, 2};
+	r = sim.run(cut);
+	CHECK(r.findings.size() == 1 && r.findings[0].issue == Issue::Malformed && r.stats.states == 0);
+}
+
+// A hand-rolled RS op (the emitters are in etna.cc, which needs the target):
+// a clear of `dst`, or a resolve of the tiled `src` into it, w x h pixels.
+void rs_op(etna::CmdStream &cs, uint32_t dst, uint32_t src, uint32_t w, uint32_t h, uint32_t ts = 0)
+{
+	using namespace VivanteGpu;
+	cs.set_state(TS_MEM_CONFIG, ts ? TS_MEM_CONFIG_COLOR_FAST_CLEAR : 0);
+	if (ts)
+		cs.set_state(TS_COLOR_STATUS_BASE, ts);
+	cs.set_state(RS_CONFIG, etna::rs_config(etna::Format::A8R8G8B8, etna::Format::A8R8G8B8, 0, src != 0));
+	cs.set_state(RS_SOURCE_STRIDE, src ? w * 4 * 4 : 0);
+	cs.set_state(RS_DEST_STRIDE, w * 4);
+	cs.set_state(RS_PIPE_SOURCE_ADDR0, src ? src : dst);
+	cs.set_state(RS_PIPE_DEST_ADDR0, dst);
+	cs.set_state(RS_WINDOW_SIZE, w | (h << 16));
+	cs.set_state(RS_CLEAR_CONTROL, src ? 0 : RS_CLEAR_CONTROL_ENABLED1 | 0xFFFF);
+	cs.set_state(RS_KICKER, RS_KICK);
+}
+
+// A copy of the stream's words, for run().
+std::vector<uint32_t> words_of(const etna::CmdStream &cs)
+{
+	auto w = cs.bo().span<const uint32_t>().first(cs.offset());
+	return {w.begin(), w.end()};
+}
+
+// The emitters' streams decode cleanly; the register shadow is the state
+// they leave; redundancy is what the StateTracker removes.
+void test_decode_emitters()
+{
+	if (!bundle_arena())
+		return;
+	using namespace etna::decode;
+	using namespace VivanteGpu;
+	Mat4 m0 = frame_mvp(0, 0), m1 = frame_mvp(1, 0);
+
+	etna::CmdStream cs = arena_stream(8);
+	etna::emit_mesh(cs, cube_draw(m0));
+	Simulator sim;
+	Result first = sim.run(words_of(cs));
+	CHECK(first.findings.empty() && !first.ended && first.stats.dwords == cs.offset());
+	CHECK(first.stats.draws == 1 && first.stats.stalls == 5); // RA<-PE x2, FE<-PE before the upload, the drain
+	// The reset state and the two icache loads each set SH_CONFIG, as Mesa does.
+	CHECK(first.stats.redundant == 2 && first.redundant.size() == 1 && first.redundant[SH_CONFIG] == 2);
+	CHECK(sim.value(PE_PIPE_COLOR_ADDR0) == kRt.gpu_addr() && sim.value(PE_COLOR_STRIDE) == 1024 * 4);
+	CHECK(sim.value(SE_SCISSOR_BOTTOM) >> 16 == 600 && sim.value(NFE_VERTEX_STREAM_BASE0) == kVtx.gpu_addr());
+	// Every register emit_mesh() writes has a name.
+	for (uint32_t pc = 0; pc < cs.offset(); pc += command_dwords(words_of(cs)[pc]))
+		if (words_of(cs)[pc] >> 27 == kLoadState)
+			CHECK(reg_info((words_of(cs)[pc] & 0xFFFF) << 2) != nullptr);
+
+	// The same draw again, another MVP: all but the uniforms is redundant.
+	cs.reset();
+	etna::emit_mesh(cs, cube_draw(m1));
+	Result again = sim.run(words_of(cs));
+	CHECK(again.findings.empty() && again.stats.changes + again.stats.redundant == again.stats.states);
+	CHECK(again.stats.redundant > 100 && again.redundant.count(PE_COLOR_STRIDE) && !again.redundant.count(RS_KICKER));
+
+	// Tracked, the second draw writes only what changed.
+	etna::StateTracker st;
+	Simulator tsim;
+	cs.reset();
+	etna::emit_mesh(cs, st, cube_draw(m0));
+	tsim.run(words_of(cs));
+	cs.reset();
+	etna::emit_mesh(cs, st, cube_draw(m1));
+	Result tracked = tsim.run(words_of(cs));
+	CHECK(tracked.findings.empty() && tracked.stats.draws == 1 && tracked.stats.redundant <= 16);
+	for (auto [addr, n] : tracked.redundant) // only the uniforms, always written (the patch point)
+		CHECK(addr >= SH_HALTI5_UNIFORMS_MIRROR0 && addr < SH_HALTI5_UNIFORMS_MIRROR0 + 16 * 4);
+	CHECK(tracked.stats.dwords * 4 < again.stats.dwords);
+	printf("decode: 2nd cube draw %u dwords, %u of %u registers redundant; tracked %u dwords, %u redundant\n",
+		   again.stats.dwords, again.stats.redundant, again.stats.states, tracked.stats.dwords,
+		   tracked.stats.redundant);
+
+	// The PPU dispatch drains itself.
+	cs.reset();
+	etna::emit_ppu_dispatch(cs, 0xA0000000, 0xA0100000, 0xA0200000, 16, 3, 64, 6);
+	Result ppu = Simulator{}.run(words_of(cs));
+	CHECK(ppu.findings.empty() && ppu.stats.cl_kicks == 1 && ppu.stats.dwords == etna::kPpuDispatchDwords);
+}
+
+void test_decode_hazards()
+{
+	if (!bundle_arena())
+		return;
+	using namespace etna::decode;
+	using namespace VivanteGpu;
+	Mat4 m = frame_mvp(0, 0);
+	etna::MeshDraw d = cube_draw(m);
+	d.sync = false;
+	const uint32_t rt = kRt.gpu_addr(), fb = 0xB0000000, other = 0xB1000000;
+	auto drain = [](etna::CmdStream &cs, bool stall1, bool flush, bool stall2) {
+		if (stall1)
+			cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+		if (flush)
+			cs.flush_cache();
+		if (stall2)
+			cs.stall(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE);
+	};
+	// The issues a stream has, in order.
+	auto issues = [](const etna::CmdStream &cs) {
+		std::vector<Issue> v;
+		for (const Finding &f : Simulator{}.run(words_of(cs)).findings)
+			v.push_back(f.issue);
+		return v;
+	};
+	using V = std::vector<Issue>;
+	etna::CmdStream cs = arena_stream(9);
+
+	// clear rt -> draw -> resolve rt, drained in between: clean.
+	rs_op(cs, rt, 0, 1024, 600);
+	drain(cs, true, true, true);
+	etna::emit_mesh(cs, d);
+	drain(cs, true, true, true);
+	rs_op(cs, fb, rt, 1024, 600);
+	drain(cs, true, true, true);
+	CHECK(issues(cs).empty());
+
+	// The resolve with no drain, a stall only, a flush only.
+	for (uint32_t k = 0; k < 3; k++) {
+		cs.reset();
+		etna::emit_mesh(cs, d);
+		drain(cs, k == 1, k == 2, false);
+		rs_op(cs, fb, rt, 1024, 600);
+		drain(cs, true, true, true);
+		CHECK((issues(cs) == V{k == 2 ? Issue::MissingStall : Issue::MissingFlush}));
+	}
+
+	// A draw straight after the RS clears its target (emit_mesh() stalls
+	// before its shader upload, so just the DRAW, on the state it left); after
+	// a stall it's fine.
+	for (bool stall : {false, true}) {
+		cs.reset();
+		etna::emit_mesh(cs, d);
+		drain(cs, true, true, true);
+		rs_op(cs, rt, 0, 1024, 600);
+		drain(cs, stall, false, false);
+		for (uint32_t x : cmd_draw_instanced(PRIM_TRIANGLES, 36))
+			cs.emit(x);
+		drain(cs, true, true, true);
+		CHECK((issues(cs) == (stall ? V{} : V{Issue::MissingStall})));
+	}
+
+	// Unrelated buffers need no drain between the engines (a Frame's
+	// HazardTracker elides those): RS -> RS, a draw -> an RS clear elsewhere,
+	// a resolve of a part of the target the draw doesn't cover.
+	cs.reset();
+	rs_op(cs, rt, 0, 1024, 600);
+	rs_op(cs, kDepth.gpu_addr(), 0, 512, 600);
+	drain(cs, true, true, true);
+	etna::emit_mesh(cs, d);
+	rs_op(cs, other, 0, 1024, 600);
+	drain(cs, true, true, true);
+	CHECK(issues(cs).empty());
+	cs.reset();
+	etna::emit_mesh(cs, d);
+	rs_op(cs, fb, rt + 1024 * 600 * 4, 1024, 8); // the rows past the target
+	drain(cs, true, true, true);
+	CHECK(issues(cs).empty());
+
+	// The TS buffers count: a draw through them writes them, a resolve reads
+	// its source's (even of a surface the draw didn't write), a fast clear
+	// writes one.
+	static const etna::Bo ts{0xB2000000, etna::ts_bytes(1024 * 600 * 4)};
+	etna::MeshDraw dts = d;
+	dts.rt_ts = etna::TileStatus{&ts};
+	cs.reset();
+	etna::emit_mesh(cs, dts);
+	rs_op(cs, other, fb, 1024, 600, ts.gpu_addr());
+	drain(cs, true, true, true);
+	CHECK((issues(cs) == V{Issue::MissingFlush}));
+	cs.reset();
+	etna::emit_mesh(cs, dts);
+	rs_op(cs, ts.gpu_addr(), 0, 16, etna::ts_fill_height(ts.size()));
+	drain(cs, true, true, true);
+	CHECK((issues(cs) == V{Issue::MissingFlush}));
+	cs.reset();
+	etna::emit_mesh(cs, d); // no TS
+	rs_op(cs, other, fb, 1024, 600, ts.gpu_addr());
+	drain(cs, true, true, true);
+	CHECK(issues(cs).empty());
+
+	// Ends, events and stalls.
+	cs.reset();
+	etna::emit_mesh(cs, d);
+	CHECK((issues(cs) == V{Issue::MissingFlush}));
+	cs.flush_cache();
+	CHECK((issues(cs) == V{Issue::MissingStall}));
+	cs.reset();
+	etna::emit_mesh(cs, d);
+	cs.event(3, GL_EVENT_FROM_PE);
+	drain(cs, true, true, true);
+	CHECK((issues(cs) == V{Issue::MissingFlush}));
+	cs.reset();
+	cs.emit(CMD_STALL);
+	cs.emit(sync_token(SYNC_RECIPIENT_FE, SYNC_RECIPIENT_PE));
+	CHECK((issues(cs) == V{Issue::NoSemaphore}));
+}
+
+// -----------------------------------------------------------------------------
+//  etna_trace.hh -- capture format: Bo lists, writer/reader round trip
+// -----------------------------------------------------------------------------
+// The Bo list a stream collects for a capture: every reloc once, intents
+// merged, whether written directly or through the shadow.
+void test_trace_bo_list()
+{
+	if (!bundle_arena())
+		return;
+	using etna::RelocRead;
+	using etna::RelocWrite;
+	auto flags_of = [](const etna::CmdStream &cs, const etna::Bo &bo) {
+		for (const auto &r : cs.bos())
+			if (r.addr == bo.gpu_addr())
+				return r.bytes == bo.size() ? r.flags : 0xFFu;
+		return 0u;
+	};
+	etna::CmdStream cs = arena_stream(8);
+	etna::emit_mesh(cs, cube_draw(frame_mvp(0, 0)));
+	CHECK(cs.bos().size() == 5 && cs.bos_complete());
+	CHECK(flags_of(cs, kRt) == (RelocRead | RelocWrite) && flags_of(cs, kDepth) == (RelocRead | RelocWrite));
+	CHECK(flags_of(cs, kVtx) == RelocRead && flags_of(cs, kVs) == RelocRead && flags_of(cs, kPs) == RelocRead);
+
+	// Tracked: the second draw writes no address (the shadow has them all),
+	// yet it still references the buffers it draws with.
+	etna::StateTracker st;
+	cs.reset();
+	CHECK(cs.bos().empty());
+	etna::emit_mesh(cs, st, cube_draw(frame_mvp(0, 0)));
+	cs.reset();
+	etna::emit_mesh(cs, st, cube_draw(frame_mvp(1, 0)));
+	CHECK(cs.bos().size() == 3 && flags_of(cs, kRt) == (RelocRead | RelocWrite) && flags_of(cs, kVtx) == RelocRead);
+	CHECK(flags_of(cs, kVs) == 0); // no upload: the code is in the icache
+
+	// Past kMaxBos: the list says it is incomplete until reset.
+	cs.reset();
+	for (uint32_t i = 0; i <= etna::CmdStream::kMaxBos; i++)
+		cs.add_bo(etna::Bo{0xB0000000 + i * 0x1000, 0x1000}, RelocRead);
+	CHECK(cs.bos().size() == etna::CmdStream::kMaxBos && !cs.bos_complete());
+	cs.reset();
+	CHECK(cs.bos_complete());
+}
+
+void test_trace_roundtrip()
+{
+	using etna::RelocRead;
+	using etna::RelocWrite;
+	using etna::TraceBo;
+	using etna::TraceReader;
+	using etna::TraceWriter;
+	std::vector<uint32_t> buf(4096);
+	std::vector<uint32_t> vtx(250), tex(64), rt(1024);
+	Rng rng{7};
+	for (auto *v : {&vtx, &tex, &rt})
+		for (uint32_t &w : *v)
+			w = rng.next();
+	const std::vector<uint32_t> s0{0x08010E03, 1, 0x08010E02, 2}, s1{0x40000000, 5, 6, 7, 0x48000000, 0, 0, 0};
+	auto bos = [&](uint32_t rt_flags) {
+		return std::vector<TraceBo>{{0xA0000000, 1000, RelocRead, vtx.data()},
+									{0xA0001000, 255, RelocRead, tex.data()}, // not whole dwords
+									{0xA0010000, 4096, rt_flags, rt.data()}};
+	};
+
+	TraceWriter w{buf, 64'000'000};
+	CHECK(TraceReader{w.trace()}.valid() && w.trace().size() == etna::kTraceHeaderDwords + 1);
+	const uint32_t r0 = w.submission(1, 100, s0, bos(RelocRead | RelocWrite));
+	// Nothing changed: only the commands go in again.
+	const uint32_t r1 = w.submission(2, 250, s1, bos(RelocRead | RelocWrite));
+	// The CPU rewrote the vertices; the render target, now read, is the GPU's.
+	const std::vector<uint32_t> vtx0 = vtx;
+	vtx[3] ^= 1;
+	const std::span<const uint32_t> chain[] = {s0, s1};
+	const uint32_t r2 = w.submission(3, 400, chain, bos(RelocRead));
+	CHECK(r0 == etna::kTraceHeaderDwords && r1 > r0 && r2 > r1);
+	CHECK(w.stats().records == 3 && w.stats().dropped == 0 && w.stats().bo_copies == 3);
+	CHECK(w.stats().data_bytes == 1000 + 255 + 1000 && w.stats().bo_skipped == 6);
+	w.retire(2, 900); // 1 and 2 seen done; 3 not yet
+
+	TraceReader rd{w.trace()};
+	TraceReader::Record r;
+	CHECK(rd.valid() && rd.tick_hz() == 64'000'000);
+	CHECK(rd.next(r) && r.offset == r0 && r.seqno == 1 && r.submit_tick == 100 && r.gpu_ticks == 800);
+	CHECK(std::ranges::equal(r.stream, s0) && r.bo_count == 3);
+	CHECK(r.bo(0).addr == 0xA0000000 && r.bo(0).bytes == 1000 && r.bo(0).flags == (RelocRead | etna::kTraceBoData));
+	CHECK(r.bo(0).data && std::equal(vtx0.begin(), vtx0.end(), r.bo(0).data));
+	CHECK(r.bo(1).data && std::memcmp(r.bo(1).data, tex.data(), 255) == 0 && (r.bo(1).data[63] >> 24) == 0);
+	CHECK(r.bo(2).flags == (RelocRead | RelocWrite) && !r.bo(2).data);
+	CHECK(rd.next(r) && r.seqno == 2 && r.gpu_ticks == 650 && std::ranges::equal(r.stream, s1));
+	CHECK(!r.bo(0).data && !r.bo(1).data && !r.bo(2).data);
+	CHECK(rd.next(r) && r.seqno == 3 && r.gpu_ticks == etna::kTraceNoTicks && r.stream.size() == 12);
+	CHECK(std::equal(s1.begin(), s1.end(), r.stream.begin() + 4));
+	CHECK(r.bo(0).data && std::equal(vtx.begin(), vtx.end(), r.bo(0).data) && !r.bo(1).data && !r.bo(2).data);
+	CHECK(!rd.next(r) && rd.valid());
+	w.retire(3, 1000);
+	rd = TraceReader{w.trace()};
+	CHECK(rd.next(r) && rd.next(r) && rd.next(r) && r.gpu_ticks == 600);
+
+	// A record that does not fit is dropped whole; the trace stays valid.
+	const size_t before = w.trace().size();
+	const std::vector<uint32_t> big(buf.size());
+	CHECK(w.submission(4, 500, big, {}) == TraceWriter::kNoRecord && w.stats().dropped == 1);
+	CHECK(w.trace().size() == before);
+	rd = TraceReader{w.trace()};
+	uint32_t n = 0;
+	while (rd.next(r))
+		n++;
+	CHECK(n == 3 && rd.valid());
+
+	// `outputs`: a written Bo's contents the first time only.
+	std::vector<uint32_t> buf2(2048);
+	TraceWriter wo{buf2, 0, true};
+	wo.submission(1, 0, s0, bos(RelocWrite));
+	wo.submission(2, 0, s0, bos(RelocWrite));
+	CHECK(wo.stats().bo_copies == 3 && wo.stats().data_bytes == 1000 + 255 + 4096);
+
+	// Malformed: truncated, a bad tag, a wrong version.
+	std::vector<uint32_t> t(w.trace().begin(), w.trace().end());
+	for (size_t cut : {t.size() - 2, size_t(r1 + 3), size_t(etna::kTraceHeaderDwords + 1)}) {
+		rd = TraceReader{std::span<const uint32_t>{t}.first(cut)};
+		n = 0;
+		while (rd.next(r))
+			n++;
+		CHECK(n < 3);
+	}
+	t[r1] = 0x12345678;
+	rd = TraceReader{t};
+	CHECK(rd.next(r) && !rd.next(r) && !rd.valid());
+	t[1] = etna::kTraceVersion + 1;
+	CHECK(!TraceReader{t}.valid());
+	CHECK(!TraceWriter{std::span<uint32_t>{buf}.first(4)}.trace().data());
+}
+
+// -----------------------------------------------------------------------------
+//  etna_profile.hh -- counter map, range deltas, busy polls
+// -----------------------------------------------------------------------------
+// The profiler's registers, as the core behaves: each per-unit read register
+// answers with the counter its field of MC_PROFILE_CONFIGn selects. The
+// fields are spelled out here again, as literals from etnaviv's
+// state_hi.xml.h, so a table entry whose config or select doesn't belong to
+// its read register -- or a wrong constant in gpu_regs.hh -- reads the wrong
+// counter.
+struct MockProfileGpu {
+	std::map<uint32_t, uint32_t> regs;					   // everything addressed directly
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t> sel; // (read register, select) -> counter
+	uint32_t cycles_per_read = 0;						   // HI_TOTAL_CYCLES advances as it is read
+	uint64_t t = 0;
+	etna::ProfileDdr ddr;
+	uint32_t ddr_starts = 0;
+
+	struct Field {
+		uint32_t reg, config, shift, mask;
+	};
+	static constexpr Field kFields[] = {
+		{0x448, 0x474, 16, 0xF}, // RA
+		{0x44C, 0x474, 24, 0xF}, // TX
+		{0x450, 0x470, 0, 0xF},	 // FE
+		{0x454, 0x470, 16, 0xF}, // PE
+		{0x458, 0x470, 8, 0xF},	 // DE
+		{0x45C, 0x470, 24, 0xF}, // SH
+		{0x460, 0x474, 0, 0xF},	 // PA
+		{0x464, 0x474, 8, 0xF},	 // SE
+		{0x468, 0x478, 0, 0xFF}, // MC
+		{0x46C, 0x478, 8, 0xFF}, // HI
+	};
+
+	static const Field *field(uint32_t read_reg)
+	{
+		for (const Field &f : kFields)
+			if (read_reg == f.reg)
+				return &f;
+		return nullptr;
+	}
+
+	// What `offset` reads: a per-unit counter as its config selects it now.
+	uint32_t &reg(uint32_t offset)
+	{
+		if (const Field *f = field(offset))
+			return sel[{offset, (regs[f->config] >> f->shift) & f->mask}];
+		return regs[offset];
+	}
+
+	// Counter `i` of kGpuCounters.
+	uint32_t &counter(uint32_t i)
+	{
+		const etna::GpuCounter &c = etna::kGpuCounters[i];
+		if (c.config)
+			regs[c.config] = c.select;
+		return reg(c.reg);
+	}
+};
+
+struct MockProfileIo {
+	MockProfileGpu *m = nullptr;
+
+	uint32_t read(uint32_t offset)
+	{
+		if (offset == VivanteGpu::HI_TOTAL_CYCLES)
+			m->regs[offset] += m->cycles_per_read;
+		return m->reg(offset);
+	}
+	void write(uint32_t offset, uint32_t value)
+	{
+		m->regs[offset] = value;
+	}
+	uint64_t now()
+	{
+		return m->t;
+	}
+	etna::ProfileDdr ddr()
+	{
+		return m->ddr;
+	}
+	void ddr_start()
+	{
+		m->ddr_starts++;
+	}
+};
+
+using MockProfiler = etna::Profiler<MockProfileIo>;
+
+// gpu_regs.hh's profile registers against etnaviv's state_hi.xml.h: the
+// read registers run without a gap from RA to HI, DE included.
+void test_profile_register_map()
+{
+	using namespace VivanteGpu;
+	CHECK(HI_PROFILE_READ_BYTES8 == 0x040 && HI_PROFILE_WRITE_BYTES8 == 0x044);
+	CHECK(MC_PROFILE_RA_READ == 0x448 && MC_PROFILE_TX_READ == 0x44C && MC_PROFILE_FE_READ == 0x450);
+	CHECK(MC_PROFILE_PE_READ == 0x454 && MC_PROFILE_DE_READ == 0x458 && MC_PROFILE_SH_READ == 0x45C);
+	CHECK(MC_PROFILE_PA_READ == 0x460 && MC_PROFILE_SE_READ == 0x464 && MC_PROFILE_MC_READ == 0x468);
+	CHECK(MC_PROFILE_HI_READ == 0x46C);
+	CHECK(MC_PROFILE_CONFIG0 == 0x470 && MC_PROFILE_CONFIG1 == 0x474 && MC_PROFILE_CONFIG2 == 0x478);
+	CHECK(PROFILE_FE(0xF) == 0xF && PROFILE_DE(0xF) == 0xF00 && PROFILE_PE(0xF) == 0xF0000);
+	CHECK(PROFILE_SH(0xF) == 0xF000000);
+	CHECK(PROFILE_PA(0xF) == 0xF && PROFILE_SE(0xF) == 0xF00 && PROFILE_RA(0xF) == 0xF0000);
+	CHECK(PROFILE_TX(0xF) == 0xF000000);
+	CHECK(PROFILE_MC(0xFF) == 0xFF && PROFILE_HI(0xFF) == 0xFF00);
+}
+
+// Every counter of the table reads through the register and field its unit
+// has, and finds itself by name; selecting more than fit, or an unknown
+// name, changes nothing.
+void test_profile_counter_map()
+{
+	const uint32_t n = etna::kGpuCounters.size();
+	for (uint32_t i = 0; i < n; i++) {
+		CHECK(etna::find_gpu_counter(etna::kGpuCounters[i].name) == i);
+		// A select sits in its read register's field of that field's config.
+		const etna::GpuCounter &c = etna::kGpuCounters[i];
+		const MockProfileGpu::Field *f = MockProfileGpu::field(c.reg);
+		CHECK(!c.config == !f);
+		CHECK(!f || (c.config == f->config && !(c.select & ~(f->mask << f->shift))));
+	}
+	CHECK(etna::find_gpu_counter("SH.NOPE") == etna::kNoCounter);
+
+	MockProfileGpu m;
+	MockProfiler prof{MockProfileIo{&m}};
+	for (uint32_t first = 0; first < n; first += etna::kMaxProfileCounters) {
+		const uint32_t count = std::min<uint32_t>(n - first, etna::kMaxProfileCounters);
+		const char *names[etna::kMaxProfileCounters];
+		for (uint32_t j = 0; j < count; j++)
+			names[j] = etna::kGpuCounters[first + j].name;
+		CHECK(prof.select(std::span<const char *const>{names, count}));
+		prof.begin("all");
+		for (uint32_t j = 0; j < count; j++)
+			m.counter(first + j) += 1000 + first + j;
+		prof.end();
+		const etna::ProfileRange *r = prof.range("all");
+		CHECK(r && r->runs == 1);
+		for (uint32_t j = 0; r && j < count; j++)
+			if (r->counters[j] != 1000 + first + j) {
+				fprintf(stderr, "  %s read %llu\n", names[j], (unsigned long long)r->counters[j]);
+				CHECK(r->counters[j] == 1000 + first + j);
+			}
+	}
+	// Every select lands in a distinct place: no two counters alias.
+	CHECK(m.sel.size() + 4 == n);
+
+	const char *too_many[etna::kMaxProfileCounters + 1];
+	std::fill_n(too_many, std::size(too_many), "HI.TOTAL_CYCLES");
+	const auto before = std::vector<uint32_t>(prof.counters().begin(), prof.counters().end());
+	CHECK(!prof.select(too_many));
+	const char *unknown[] = {"HI.TOTAL_CYCLES", "XX.NOPE"};
+	CHECK(!prof.select(unknown));
+	CHECK(std::ranges::equal(prof.counters(), before));
+	CHECK(MockProfiler{MockProfileIo{&m}}.counters().size() == std::size(MockProfiler::kDefaultCounters));
+}
+
+// Ranges: wrapping deltas, accumulation over runs, nesting (an outer range
+// gets what its inner ones saw), the DDR side, and what happens past the
+// limits.
+void test_profile_ranges()
+{
+	MockProfileGpu m;
+	MockProfiler prof{MockProfileIo{&m}};
+	const char *names[] = {"HI.TOTAL_CYCLES", "SH.PS_INST", "RA.TOTAL_QUADS"};
+	CHECK(prof.select(names));
+	uint32_t &cycles = m.counter(etna::find_gpu_counter("HI.TOTAL_CYCLES"));
+	uint32_t &ps = m.counter(etna::find_gpu_counter("SH.PS_INST"));
+	uint32_t &quads = m.counter(etna::find_gpu_counter("RA.TOTAL_QUADS"));
+	cycles = 0xFFFFFF00;
+	ps = 0xFFFFFFF0;
+	m.ddr = {.reads = 0xFFFFFFFE, .writes = 10, .tcnt = 0xFFFFFF00};
+
+	for (uint32_t frame = 0; frame < 3; frame++) {
+		prof.begin("frame");
+		for (uint32_t draw = 0; draw < 2; draw++) {
+			prof.begin("draw");
+			cycles += 1000;
+			ps += 0x20;
+			quads += 7;
+			m.t += 50;
+			m.ddr.reads += 4;
+			m.ddr.writes += 8;
+			m.ddr.tcnt += 0x200;
+			prof.end();
+		}
+		cycles += 100; // between the draws' ranges: the frame's only
+		m.t += 10;
+		prof.end();
+	}
+	const etna::ProfileRange *f = prof.range("frame");
+	const etna::ProfileRange *d = prof.range("draw");
+	CHECK(prof.ranges().size() == 2 && f == &prof.ranges()[0] && d == &prof.ranges()[1]);
+	CHECK(f && d && f->runs == 3 && d->runs == 6);
+	if (f && d) {
+		CHECK(d->counters[0] == 6000 && f->counters[0] == 6300);
+		CHECK(d->counters[1] == 6 * 0x20 && f->counters[1] == 6 * 0x20);
+		CHECK(d->counters[2] == 42 && f->counters[2] == 42);
+		CHECK(d->ticks == 300 && f->ticks == 330);
+		CHECK(d->ddr_reads == 24 && d->ddr_writes == 48 && d->ddr_tcnt == 6 * 0x200);
+		CHECK(f->ddr_reads == 24 && f->ddr_tcnt == 6 * 0x200);
+	}
+	CHECK(!prof.range("nope"));
+
+	// Deeper than kMaxDepth: the innermost go uncounted, the rest still pair.
+	for (uint32_t i = 0; i <= MockProfiler::kMaxDepth; i++)
+		prof.begin(i == MockProfiler::kMaxDepth ? "too deep" : "nest");
+	quads += 1;
+	for (uint32_t i = 0; i <= MockProfiler::kMaxDepth; i++)
+		prof.end();
+	prof.end(); // unmatched: ignored
+	CHECK(!prof.range("too deep"));
+	const etna::ProfileRange *nest = prof.range("nest");
+	CHECK(nest && nest->runs == MockProfiler::kMaxDepth && nest->counters[2] == MockProfiler::kMaxDepth);
+
+	// Past kMaxRanges distinct labels: the rest go uncounted.
+	static const char *labels[] = {"l0", "l1", "l2", "l3", "l4", "l5", "l6", "l7", "l8", "l9",
+								   "l10", "l11", "l12", "l13", "l14", "l15", "l16"};
+	for (const char *l : labels) {
+		prof.begin(l);
+		prof.end();
+	}
+	CHECK(prof.ranges().size() == MockProfiler::kMaxRanges && !prof.range("l16"));
+
+	// Labels match by contents, not by pointer.
+	char copy[] = "frame";
+	prof.begin(copy);
+	prof.end();
+	CHECK(prof.range("frame")->runs == 4);
+
+	// reset() forgets the totals; a range open across it counts from zero.
+	prof.begin("open");
+	prof.reset();
+	CHECK(prof.ranges().empty());
+	quads += 5;
+	prof.end();
+	CHECK(prof.ranges().empty());
+	prof.begin("after");
+	quads += 5;
+	prof.end();
+	CHECK(prof.ranges().size() == 1 && prof.range("after")->counters[2] == 5);
+}
+
+// start() turns the debug registers on and back off in stop(), starts the
+// DDR counters, and tells stuck counters from live ones; poll() credits
+// every open range with the units HI_IDLE_STATE shows busy.
+void test_profile_busy_polls()
+{
+	using namespace VivanteGpu;
+	MockProfileGpu m;
+	MockProfiler prof{MockProfileIo{&m}};
+	m.regs[HI_CLOCK_CONTROL] = CLK_DISABLE_DEBUG_REGISTERS | CLK_FSCALE_VAL(0x40);
+	CHECK(!prof.start()); // HI_TOTAL_CYCLES stuck
+	CHECK(!prof.available() && m.ddr_starts == 1);
+	CHECK(m.regs[HI_CLOCK_CONTROL] == CLK_FSCALE_VAL(0x40));
+	m.cycles_per_read = 3;
+	CHECK(prof.start() && prof.available() && m.ddr_starts == 1);
+	m.regs[HI_CLOCK_CONTROL] |= CLK_IDLE_3D; // changed meanwhile: kept
+	prof.stop();
+	CHECK(m.regs[HI_CLOCK_CONTROL] == (CLK_DISABLE_DEBUG_REGISTERS | CLK_FSCALE_VAL(0x40) | CLK_IDLE_3D));
+	m.regs[HI_CLOCK_CONTROL] = 0;
+	prof.start();
+	prof.stop();
+	CHECK(m.regs[HI_CLOCK_CONTROL] == 0);
+
+	auto unit = [](const char *name) {
+		for (uint32_t u = 0; u < etna::kNumGpuUnits; u++)
+			if (std::string_view{name} == etna::kGpuUnits[u].name)
+				return u;
+		return etna::kNumGpuUnits;
+	};
+	const uint32_t all_idle = 0x7FFFFFFF;
+	prof.begin("frame");
+	m.regs[HI_IDLE_STATE] = all_idle;
+	prof.poll();
+	prof.begin("draw");
+	for (uint32_t i = 0; i < 4; i++) {
+		m.regs[HI_IDLE_STATE] = all_idle & ~IDLE_FE & ~(i < 3 ? IDLE_SH : 0) & ~(i < 1 ? IDLE_TX : 0);
+		prof.poll();
+	}
+	prof.end();
+	m.regs[HI_IDLE_STATE] = all_idle & ~IDLE_PE;
+	prof.poll();
+	prof.end();
+	const etna::ProfileRange *f = prof.range("frame");
+	const etna::ProfileRange *d = prof.range("draw");
+	CHECK(f && d && f->polls == 6 && d->polls == 4);
+	if (f && d) {
+		CHECK(d->busy[unit("FE")] == 4 && d->busy[unit("SH")] == 3 && d->busy[unit("TX")] == 1);
+		CHECK(d->busy[unit("PE")] == 0 && f->busy[unit("PE")] == 1 && f->busy[unit("SH")] == 3);
+		CHECK(d->busy_pct(unit("FE")) == 100 && d->busy_pct(unit("SH")) == 75 && d->busy_pct(unit("TX")) == 25);
+		CHECK(f->busy_pct(unit("SH")) == 50 && f->busy_pct(unit("RA")) == 0);
+	}
+	prof.poll(); // nothing open: credited to nobody
+	CHECK(f && f->polls == 6);
+	CHECK(etna::ProfileRange{}.busy_pct(0) == 0);
+}
+
+// -----------------------------------------------------------------------------
+//  etna_timeline.hh -- marks to event ids, stamps back to passes
+// -----------------------------------------------------------------------------
+// The GL_EVENT ids a stream carries, in order.
+std::vector<uint32_t> stream_events(const etna::CmdStream &cs)
+{
+	std::vector<uint32_t> ids;
+	auto w = cs.bo().span<const uint32_t>().first(cs.offset());
+	for (size_t i = 0; i + 1 < w.size(); i += 2)
+		if (w[i] == VivanteGpu::cmd_load_state(VivanteGpu::GL_EVENT)) {
+			CHECK(w[i + 1] & VivanteGpu::GL_EVENT_FROM_PE);
+			ids.push_back(w[i + 1] & 0x1F);
+		}
+	return ids;
+}
+
+// Each mark is an EVENT with one of the lent ids; a frame pops once all its
+// marks fired, with each pass's time from the stamps. Running out of ids
+// folds a pass into the next; frames beyond kMaxFrames are dropped whole.
+void test_timeline_marks()
+{
+	if (!bundle_arena())
+		return;
+	using etna::Timeline;
+	Timeline tl;
+	tl.set_events(0xF << 4); // ids 4..7
+	uint64_t stamps[32] = {};
+	etna::CmdStream cs = arena_stream(8);
+	tl.begin_frame(cs);
+	CHECK(tl.mark(cs, "clear") && tl.mark(cs, "draw"));
+	tl.end_frame();
+	const std::vector<uint32_t> ids = stream_events(cs);
+	CHECK(ids == (std::vector<uint32_t>{4, 5, 6}));
+	CHECK(tl.in_flight() == 3);
+
+	Timeline::FrameTimes ft;
+	CHECK(!tl.pop(ft));
+	stamps[4] = 1000;
+	stamps[5] = 1300;
+	stamps[0] = 1; // a completion event: not the timeline's
+	tl.fired(1u << 4 | 1u << 5 | 1u << 0, stamps);
+	CHECK(!tl.pop(ft) && tl.in_flight() == 1);
+	stamps[6] = 1700;
+	tl.fired(1u << 6, stamps);
+	CHECK(tl.pop(ft) && !tl.pop(ft));
+	CHECK(ft.frame == 0 && ft.passes == 2 && ft.missed == 0 && ft.start == 1000 && ft.end() == 1700);
+	CHECK(ft.ticks(0) == 300 && ft.ticks(1) == 400);
+	CHECK(std::string_view{ft.pass[0].label} == "clear" && std::string_view{ft.pass[1].label} == "draw");
+
+	// Pipelined: frame 1's marks take the free ids; the 5th mark finds none.
+	cs.reset();
+	tl.begin_frame(cs);
+	CHECK(tl.mark(cs, "a") && tl.mark(cs, "b") && tl.mark(cs, "c"));
+	CHECK(!tl.mark(cs, "d"));
+	tl.begin_frame(cs); // closes frame 1; no id for frame 2's start
+	CHECK(!tl.mark(cs, "x") && tl.dropped() == 1);
+	CHECK(stream_events(cs) == (std::vector<uint32_t>{4, 5, 6, 7}));
+	for (uint32_t ev = 4, t = 2000; ev < 8; ev++, t += 100)
+		stamps[ev] = t;
+	tl.fired(0x3 << 4, stamps);
+	CHECK(!tl.pop(ft));
+	tl.fired(0xF << 4, stamps); // 4 and 5 again: not in flight, ignored
+	CHECK(tl.pop(ft) && ft.frame == 1 && ft.passes == 3 && ft.missed == 1);
+	CHECK(ft.start == 2000 && ft.ticks(0) == 100 && ft.ticks(2) == 100 && ft.end() == 2300);
+
+	// An open frame never pops; kMaxFrames waiting, the next is dropped.
+	cs.reset();
+	tl.begin_frame(cs);
+	CHECK(!tl.pop(ft));
+	tl.end_frame();
+	tl.fired(0xF << 4, stamps);
+	for (uint32_t i = 1; i < Timeline::kMaxFrames; i++) {
+		tl.begin_frame(cs);
+		tl.end_frame();
+		tl.fired(0xF << 4, stamps);
+	}
+	tl.begin_frame(cs);
+	CHECK(!tl.mark(cs, "dropped") && tl.dropped() == 2);
+	uint32_t n = 0, last = 0;
+	while (tl.pop(ft)) {
+		n++;
+		last = ft.frame;
+	}
+	CHECK(n == Timeline::kMaxFrames && last == 3 + Timeline::kMaxFrames - 1 && tl.in_flight() == 0);
+	CHECK(tl.events() == 0xF << 4);
+}
+
+// -----------------------------------------------------------------------------
+//  perfmon.hh -- DDR trace slices, the sample ring, derived metrics
+// -----------------------------------------------------------------------------
+// Three snapshots as the sampling interrupt read them 100 us apart (64 MHz
+// CNTPCT, TCNT ~150 MHz): WR, TCNT and the GPU's read tap wrap on the way.
+constexpr perfmon::DdrCounts kDdrSnaps[] = {
+	{.t = 1'000'000, .ev = {0xFFFF'FF00, 100, 50, 48}, .tcnt = 0xFFFF'F000, .tap = {0xFFFF'FFF0, 10}},
+	{.t = 1'006'400,
+	 .ev = {0x0000'0F00, 6100, 350, 338},
+	 .tcnt = 0x0000'2A98,
+	 .status = 0x1,
+	 .tap = {0x0000'1F30, 2010}},
+	{.t = 1'012'800,
+	 .ev = {0x0000'1000, 6200, 360, 350},
+	 .tcnt = 0x0000'6530,
+	 .status = 0x1,
+	 .tap = {0x0000'1F40, 2020}},
+};
+
+// Deltas wrap at 32 bits; a full ring merges the next periods into one
+// slice instead of losing them.
+void test_ddr_ring()
+{
+	using namespace perfmon;
+	const DdrSlice a = DdrSlice::between(kDdrSnaps[0], kDdrSnaps[1]);
+	CHECK(a.t == 1'000'000 && a.ticks == 6400 && a.tcnt == 15000);
+	CHECK(a.ev[0] == 4096 && a.ev[1] == 6000 && a.ev[2] == 300 && a.ev[3] == 290);
+	CHECK(a.tap[0] == 8000 && a.tap[1] == 2000 && a.overflow == 0x1);
+	const DdrSlice b = DdrSlice::between(kDdrSnaps[1], kDdrSnaps[2]);
+	CHECK(b.ev[0] == 256 && b.tcnt == 15000 && b.overflow == 0); // STATUS already up: not new
+
+	DdrSlice total;
+	total.add(a);
+	total.add(b);
+	CHECK(total.t == a.t && total.ticks == 12800 && total.ev[0] == 4352 && total.tap[0] == 8016);
+	CHECK(total.overflow == 0x1);
+
+	static DdrRing ring;
+	ring.start(kDdrSnaps[0]);
+	CHECK(ring.size() == 0);
+	CHECK(ring.push(kDdrSnaps[1]) && ring.push(kDdrSnaps[2]) && ring.size() == 2);
+	CHECK(ring[0].ticks == 6400 && ring[1].t == 1'006'400);
+	DdrSlice s;
+	CHECK(ring.pop(s) && s.ev[1] == 6000 && ring.size() == 1);
+	CHECK(ring.pop(s) && s.ev[1] == 100 && !ring.pop(s));
+
+	DdrCounts c = kDdrSnaps[2];
+	for (uint32_t i = 0; i < DdrRing::kSlices; i++) {
+		c.t += 6400;
+		c.ev[1] += 10;
+		CHECK(ring.push(c));
+	}
+	c.t += 6400;
+	c.ev[1] += 10;
+	CHECK(!ring.push(c) && ring.merged() == 1 && ring.size() == DdrRing::kSlices);
+	CHECK(ring.pop(s) && s.ev[1] == 10);
+	c.t += 6400;
+	c.ev[1] += 10;
+	CHECK(ring.push(c)); // both periods
+	CHECK(ring[DdrRing::kSlices - 1].ticks == 12800 && ring[DdrRing::kSlices - 1].ev[1] == 20);
+	uint32_t n = 0;
+	while (ring.pop(s))
+		n++;
+	CHECK(n == DdrRing::kSlices);
+}
+
+// Bandwidth from the RD/WR commands over the slice's time, utilization
+// from TCNT, row hits from ACT, and the traffic the taps don't account for.
+void test_ddr_metrics()
+{
+	using namespace perfmon;
+	const DdrSlice s = DdrSlice::between(kDdrSnaps[0], kDdrSnaps[1]);
+	const DdrTap taps[] = {{"gpu rd", nullptr, 8}, {"gpu wr", nullptr, 8}};
+	DdrMetrics m = ddr_metrics(kDefaultEvents, s, 64'000'000, taps);
+	CHECK(m.has_rw && m.has_act);
+	CHECK(m.read_bytes == 6000 * 32 && m.write_bytes == 4096 * 32);
+	CHECK(m.read_mbps == 1920 && m.write_mbps == 1310 && m.mbps == 3230);
+	CHECK(m.util_pm == 673);	// 10096 bursts in 15000 slots
+	CHECK(m.row_hit_pm == 970); // 300 activates for 10096 bursts
+	CHECK(m.tap_mbps[0] == 640 && m.tap_mbps[1] == 160 && m.other_mbps == 2430);
+
+	// Only what the set counts: no RD/WR, no bandwidth (the taps still read).
+	const DdrEventSet act_pre{{EV_OP_IS_ACT, EV_OP_IS_PRE}, 2};
+	m = ddr_metrics(act_pre, s, 64'000'000, taps);
+	CHECK(!m.has_rw && m.has_act && m.mbps == 0 && m.util_pm == 0 && m.tap_mbps[0] == 640);
+	const DdrEventSet rw_only{{EV_OP_IS_RD, EV_OP_IS_WR}, 2}; // RD in counter 0 now
+	m = ddr_metrics(rw_only, s, 64'000'000);
+	CHECK(m.has_rw && !m.has_act && m.read_bytes == s.ev[0] * 32u && m.row_hit_pm == 0);
+
+	DdrSlice thrash{};
+	thrash.ticks = 6400;
+	thrash.ev[0] = 10; // WR
+	thrash.ev[2] = 40; // ACT: more than the bursts (refreshes reopen rows)
+	m = ddr_metrics(kDefaultEvents, thrash, 64'000'000);
+	CHECK(m.row_hit_pm == 0 && m.util_pm == 0); // TCNT 0: no division
+	CHECK(ddr_metrics(kDefaultEvents, DdrSlice{}, 64'000'000).mbps == 0);
+
+	CHECK(find_event("rd") == EV_OP_IS_RD && find_event("ev35") == 35);
+	CHECK(find_event("ev64") == -1 && find_event("ev") == -1 && find_event("evx") == -1 && find_event("x") == -1);
+	CHECK(std::string_view{event_name(EV_OP_IS_PRE)} == "pre" && !event_name(35));
+	CHECK(kDefaultEvents.find(EV_OP_IS_PRE) == 3 && kDefaultEvents.find(35) == kNoCounter);
+	constexpr DdrEventSet bad_code{{70}, 1}, too_many{{}, 9};
+	CHECK(kDefaultEvents.valid() && !bad_code.valid() && !too_many.valid());
+}
+
+} // namespace
+
+int main()
+{
+	test_heap_basics();
+	test_heap_stress();
+	test_heap_transient_reuse();
+	test_ring_queue_without_waits();
+	test_ring_lent_events();
+	test_ring_random(1);
+	test_ring_random(4);
+	test_ring_words();
+	test_ring_divert_order();
+	test_ring_words_chain();
+	test_bundle_patch();
+	test_bundle_chain();
+	test_state_basics();
+	test_state_random();
+	test_state_cube_scene();
+	test_hazards();
+	test_unsynced_draws();
+	test_swapchain();
+	test_draw_encoding();
+	test_mesh_dedup();
+	test_instancing();
+	test_compute_list();
+	test_compute_list_resubmit();
+	test_launch_patch();
+	test_autotune_search();
+	test_tune_table();
+	test_shader_cache();
+	test_offload_model();
+	test_rs_formats();
+	test_rs_downsample();
+	test_tile_status();
+	test_damage_rects();
+	test_damage_projection();
+	test_damage_region();
+	test_damage_tracker();
+	test_decode_commands();
+	test_decode_emitters();
+	test_decode_hazards();
+	test_trace_bo_list();
+	test_trace_roundtrip();
+	test_profile_register_map();
+	test_profile_counter_map();
+	test_profile_ranges();
+	test_profile_busy_polls();
+	test_timeline_marks();
+	test_ddr_ring();
+	test_ddr_metrics();
+
+	if (failures) {
+		printf("FAILED: %d check(s)\n", failures);
+		return 1;
+	}
+	printf("all host tests passed\n");
+	return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+// =============================================================================
+//  neon_emu/arm_neon.h -- the NEON intrinsics neon_kernels.cc uses, for hosts
+//  without NEON
+// =============================================================================
+// The host tests build neon_kernels.cc with -Ineon_emu so the CPU kernels are
+// checked on the development machine as well. On an Arm host this defers to
+// the compiler's own <arm_neon.h>. Elsewhere each intrinsic is written with
+// the compiler's generic vectors (GCC/clang vector_size), which x86 lowers to
+// SSE2 -- same lane semantics, none of the NEON types' other properties.
+// Only what neon_kernels.cc calls is here; add to it alongside new kernels.
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include_next <arm_neon.h>
+#else
+
+#include <cstdint>
+#include <cstring>
+
+typedef uint8_t uint8x8_t __attribute__((vector_size(8)));
+typedef uint8_t uint8x16_t __attribute__((vector_size(16)));
+typedef uint16_t uint16x8_t __attribute__((vector_size(16)));
+typedef uint32_t uint32x4_t __attribute__((vector_size(16)));
+
+inline uint8x16_t vld1q_u8(const uint8_t *p)
+{
+	uint8x16_t v;
+	std::memcpy(&v, p, 16);
+	return v;
+}
+inline void vst1q_u8(uint8_t *p, uint8x16_t v)
+{
+	std::memcpy(p, &v, 16);
+}
+
+inline uint8x8_t vdup_n_u8(uint8_t x)
+{
+	return uint8x8_t{} + x;
+}
+inline uint8x16_t vdupq_n_u8(uint8_t x)
+{
+	return uint8x16_t{} + x;
+}
+inline uint32x4_t vdupq_n_u32(uint32_t x)
+{
+	return uint32x4_t{} + x;
+}
+inline uint8x16_t vreinterpretq_u8_u32(uint32x4_t v)
+{
+	return (uint8x16_t)v;
+}
+
+inline uint8x8_t vget_low_u8(uint8x16_t v)
+{
+	return __builtin_shufflevector(v, v, 0, 1, 2, 3, 4, 5, 6, 7);
+}
+inline uint8x8_t vget_high_u8(uint8x16_t v)
+{
+	return __builtin_shufflevector(v, v, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+inline uint8x16_t vcombine_u8(uint8x8_t lo, uint8x8_t hi)
+{
+	return __builtin_shufflevector(lo, hi, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+
+inline uint8x16_t vaddq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return a + b;
+}
+inline uint8x16_t vmulq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return a * b;
+}
+inline uint8x16_t vandq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return a & b;
+}
+inline uint8x16_t vmvnq_u8(uint8x16_t a)
+{
+	return ~a;
+}
+inline uint8x16_t vcgtq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return (uint8x16_t)(a > b);
+}
+inline uint8x16_t vqaddq_u8(uint8x16_t a, uint8x16_t b)
+{
+	const uint8x16_t s = a + b;
+	return s | (uint8x16_t)(s < a); // carried: 255
+}
+inline uint8x16_t vqsubq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return (a - b) & (uint8x16_t)(a > b);
+}
+inline uint8x16_t vabdq_u8(uint8x16_t a, uint8x16_t b)
+{
+	return vqsubq_u8(a, b) | vqsubq_u8(b, a);
+}
+
+inline uint16x8_t vmull_u8(uint8x8_t a, uint8x8_t b)
+{
+	return __builtin_convertvector(a, uint16x8_t) * __builtin_convertvector(b, uint16x8_t);
+}
+#define vshrn_n_u16(a, n) __builtin_convertvector((uint16x8_t)(a) >> (n), uint8x8_t)
+
+#endif
@@ -0,0 +1,1071 @@
+// =============================================================================
+//  ppu_asm_test.cc -- HOST tool: the PPU kernels against reference implementations
+// =============================================================================
+// Compiles on the development machine (clang++ -std=c++20), not the target.
+// ppu_asm.hh is pure bit-packing, so its kernels can be checked without the
+// GPU: a small model decodes the instruction words the builders emit --
+// opcode, element type, destination, operand slots, .sat -- and runs them
+// over images 16 bytes (one thread) at a time, with the lane semantics
+// described under "Element types" in ppu_asm.hh. Each kernel's output must
+// equal a plain per-element C++ reference on random images. An encoding bug
+// (a type in the wrong field, an operand in the wrong slot, a missing .sat)
+// fails here before it reaches the hardware; the lane semantics themselves
+// are what compute_test() confirms on target.
+//
+// The NEON kernels (neon_kernels.cc) are built in and checked against the
+// same model and references, byte for byte: they stand in for the GPU when
+// it would be slower (ppu_offload.hh). tools/neon_emu supplies <arm_neon.h>
+// on hosts without NEON.
+//
+//   ./ppu_asm_test        (exit status 0 = all passed)
+//
+// Build:  clang++ -std=c++20 -O2 -I.. -Ineon_emu ppu_asm_test.cc ../neon_kernels.cc -o ppu_asm_test
+
+#include "neon_kernels.hh"
+#include "ppu_asm.hh"
+#include "ppu_kernels.hh"
+#include "ppu_program.hh"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(cond)                                                                                                    \
+	do {                                                                                                               \
+		if (!(cond)) {                                                                                                 \
+			fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);                                  \
+			failures++;                                                                                                \
+		}                                                                                                              \
+	} while (0)
+
+// Deterministic xorshift so a failure reproduces run-to-run.
+struct Rng {
+	uint32_t s = 0x12345678;
+	uint32_t next()
+	{
+		s ^= s << 13;
+		s ^= s >> 17;
+		s ^= s << 5;
+		return s;
+	}
+	uint32_t below(uint32_t n)
+	{
+		return next() % n;
+	}
+};
+
+using ppu::getbit;
+using ppu::getbits;
+
+// -----------------------------------------------------------------------------
+//  Instruction decoding (the inverse of set_destination/set_source/...)
+// -----------------------------------------------------------------------------
+struct Operand {
+	bool use;
+	uint32_t addr;	// register / uniform number
+	uint32_t group; // 0 = temp, 2 = uniform, 7 = immediate
+	uint32_t imm;	// when group == 7 (20 bits)
+	uint32_t swz;	// component select, 2 bits each (not for immediates)
+};
+
+struct Decoded {
+	uint32_t opcode, type, dst;
+	bool sat;
+	Operand src[3];
+};
+
+Decoded decode(const uint32_t *w)
+{
+	Decoded d{};
+	d.opcode = getbits(w[0], 5, 0) | (getbit(w[2], 16) << 6);
+	d.type = getbit(w[1], 21) | (getbits(w[2], 31, 30) << 1);
+	d.dst = getbits(w[0], 22, 16);
+	d.sat = getbit(w[0], 11);
+	d.src[0] = {bool(getbit(w[1], 11)), getbits(w[1], 20, 12), getbits(w[2], 5, 3), 0, getbits(w[1], 29, 22)};
+	d.src[1] = {bool(getbit(w[2], 6)), getbits(w[2], 15, 7), getbits(w[3], 2, 0), 0, getbits(w[2], 24, 17)};
+	d.src[2] = {bool(getbit(w[3], 3)), getbits(w[3], 12, 4), getbits(w[3], 30, 28), 0, getbits(w[3], 21, 14)};
+	d.src[2].imm = getbits(w[3], 12, 4) | (getbits(w[3], 21, 14) << 9) | (getbit(w[3], 22) << 17) |
+				   (getbit(w[3], 23) << 18) | (getbit(w[3], 25) << 19);
+	return d;
+}
+
+// -----------------------------------------------------------------------------
+//  Lane arithmetic, per element type
+// -----------------------------------------------------------------------------
+bool is_signed(uint32_t type)
+{
+	return type == ppu::TYPE_S8 || type == ppu::TYPE_S16 || type == ppu::TYPE_S32;
+}
+
+int64_t as_int(uint32_t type, uint32_t bits)
+{
+	uint32_t eb = ppu::elem_bytes(type);
+	if (!is_signed(type))
+		return eb == 4 ? int64_t(bits) : int64_t(bits & ((1u << (8 * eb)) - 1));
+	return eb == 1 ? int64_t(int8_t(bits)) : eb == 2 ? int64_t(int16_t(bits)) : int64_t(int32_t(bits));
+}
+
+float as_float(uint32_t type, uint32_t bits)
+{
+	return type == ppu::TYPE_F16 ? ppu::float_from_f16(uint16_t(bits)) : std::bit_cast<float>(bits);
+}
+
+uint32_t from_float(uint32_t type, float f)
+{
+	return type == ppu::TYPE_F16 ? ppu::f16_from_float(f) : std::bit_cast<uint32_t>(f);
+}
+
+struct LaneOp {
+	uint32_t bits;
+	bool ok; // false: the op has no meaning for this type
+};
+
+LaneOp alu(uint32_t op, uint32_t type, bool sat, uint32_t a, uint32_t b)
+{
+	const uint32_t eb = ppu::elem_bytes(type), bitsz = 8 * eb;
+	const uint64_t mask = (uint64_t(1) << bitsz) - 1;
+	if (ppu::is_float_type(type)) {
+		float x = as_float(type, a), y = as_float(type, b), r;
+		switch (op) {
+			case 0x01: r = x + y; break;
+			case 0x03: r = x * y; break;
+			default: return {0, false};
+		}
+		if (sat)
+			r = std::clamp(r, 0.0f, 1.0f);
+		return {from_float(type, r), true};
+	}
+	if (sat)
+		return {0, false}; // integers saturate by opcode, not .sat
+	int64_t x = as_int(type, a), y = as_int(type, b);
+	int64_t lo = is_signed(type) ? -(int64_t(1) << (bitsz - 1)) : 0;
+	int64_t hi = is_signed(type) ? (int64_t(1) << (bitsz - 1)) - 1 : int64_t(mask);
+	switch (op) {
+		case 0x01: return {uint32_t((x + y) & mask), true};
+		case 0x3B: return {uint32_t(std::clamp(x + y, lo, hi) & mask), true};
+		case 0x3C: return {uint32_t((x * y) & mask), true};
+		case 0x40: return {uint32_t(((x * y) >> bitsz) & mask), true};
+		case 0x5D: return {uint32_t((x & y) & mask), true};
+		case 0x5F: return {uint32_t(~y & mask), true};
+		default: return {0, false};
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  The model: run a kernel over 16-byte threads
+// -----------------------------------------------------------------------------
+// Images by descriptor uniform: c0 = input 0, c1 = output, c2/c3 = inputs 1/2.
+// Threads are 16-byte runs of `width`-byte rows (one row by default); a load
+// with an XY offset reads `border` for every byte past the image edge.
+// Uniform operands read the c2..c5 words the kernel's Uniforms supply.
+using Reg = std::array<uint8_t, 16>;
+
+struct Machine {
+	std::array<std::vector<uint8_t> *, 4> image{};
+	uint32_t width = 0;
+	uint8_t border = 0xCD;
+	ppu::Uniforms uniforms{};
+	uint32_t regs = 16; // the program's RegCount: registers at or past it don't exist
+	bool ok = true;
+	const char *why = "";
+
+	void fail(const char *w)
+	{
+		if (ok)
+			why = w;
+		ok = false;
+	}
+
+	void run(const uint32_t *inst, uint32_t dwords)
+	{
+		const size_t threads = image[1]->size() / 16;
+		for (size_t t = 0; t < threads && ok; t++) {
+			std::array<Reg, 64> r{};
+			for (uint32_t i = 0; i + 3 < dwords && ok; i += 4)
+				step(decode(&inst[i]), r, t);
+		}
+	}
+
+	static Reg swizzle(const Reg &v, uint32_t swz)
+	{
+		Reg out;
+		for (unsigned c = 0; c < 4; c++)
+			std::memcpy(&out[c * 4], &v[((swz >> (2 * c)) & 3) * 4], 4);
+		return out;
+	}
+
+	void step(const Decoded &d, std::array<Reg, 64> &r, size_t t)
+	{
+		auto temp = [&](const Operand &o) -> const Reg * {
+			if (!o.use || o.group != 0 || o.addr >= regs) {
+				fail("operand is not a temp register");
+				return nullptr;
+			}
+			return &r[o.addr];
+		};
+		// A temp or a loaded constant uniform, swizzled.
+		auto value = [&](const Operand &o, Reg &v) {
+			if (o.use && o.group == 2) {
+				const uint32_t base = (o.addr - 2) * 4;
+				for (unsigned c = 0; c < 4; c++) {
+					const uint32_t word = base + ((o.swz >> (2 * c)) & 3);
+					if (o.addr < 2 || o.addr > 5 || word < uniforms.first || word >= uniforms.first + uniforms.count) {
+						fail("uniform operand is not one of the kernel's constants");
+						return;
+					}
+				}
+				Reg u;
+				std::memcpy(u.data(), &uniforms.words[base], 16);
+				v = swizzle(u, o.swz);
+			} else if (const Reg *p = temp(o)) {
+				v = swizzle(*p, o.swz);
+			}
+		};
+		auto image_at = [&](const Operand &o) -> std::vector<uint8_t> * {
+			if (!o.use || o.group != 2 || o.addr >= 4 || !image[o.addr]) {
+				fail("image operand is not a bound descriptor uniform");
+				return nullptr;
+			}
+			if (d.src[1].group != 0 || d.src[1].addr != 0)
+				fail("image coordinate is not r0");
+			return image[o.addr];
+		};
+		if (d.dst >= regs) {
+			fail("destination register out of range");
+			return;
+		}
+		if (d.dst == 0 && d.opcode != 0x7A) {
+			fail("destination is r0, the pixel coordinate");
+			return;
+		}
+
+		const uint32_t w = width ? width : uint32_t(image[1]->size());
+		const int x0 = int(t * 16 % w), y0 = int(t * 16 / w);
+		switch (d.opcode) {
+			case 0x79: // img_load dst <- 16 bytes of image src0 at this thread (+ offset)
+				if (d.type != ppu::TYPE_U8)
+					fail("load is not a u8 move");
+				if (auto *im = image_at(d.src[0])) {
+					int dx = 0, dy = 0;
+					if (d.src[2].use) {
+						if (d.src[2].group != 7)
+							fail("load offset is not an immediate");
+						dx = int(d.src[2].imm << 27) >> 27; // 5-bit signed
+						dy = int(d.src[2].imm << 22) >> 27;
+					}
+					const int h = int(im->size() / w);
+					for (int j = 0; j < 16; j++) {
+						int x = x0 + j + dx, y = y0 + dy;
+						bool in = x >= 0 && x < int(w) && y >= 0 && y < h;
+						r[d.dst][j] = in ? (*im)[y * w + x] : border;
+					}
+				}
+				return;
+			case 0x7A: // img_store image c1 <- src2
+				if (d.type != ppu::TYPE_U8)
+					fail("store is not a u8 move");
+				if (d.src[0].addr != 1)
+					fail("store is not to the output descriptor c1");
+				image_at(d.src[0]);
+				if (auto *v = temp(d.src[2]))
+					std::memcpy(image[1]->data() + t * 16, v->data(), 16);
+				return;
+		}
+
+		// ALU: which slots carry the operands (see emit_alu/emit_mul)
+		const bool mul_family = d.opcode == 0x03 || d.opcode == 0x3C || d.opcode == 0x40;
+		const bool unary = d.opcode == 0x5F;
+		Reg a{}, b{};
+		if (!unary)
+			value(d.src[0], a);
+		const Operand &second = mul_family ? d.src[1] : d.src[2];
+		if (mul_family && d.src[2].use)
+			fail("multiply with a stray src2");
+		if (!mul_family && d.src[1].use)
+			fail("add/logic with a stray src1");
+		if (second.use && second.group == 7) { // immediate: 20 bits to each 32-bit component
+			for (unsigned c = 0; c < 4; c++)
+				std::memcpy(&b[c * 4], &second.imm, 4);
+		} else {
+			value(second, b);
+		}
+
+		const uint32_t eb = ppu::elem_bytes(d.type);
+		std::array<uint8_t, 16> out{};
+		for (uint32_t lane = 0; lane < 16 / eb; lane++) {
+			uint32_t x = 0, y = 0;
+			std::memcpy(&x, &a[lane * eb], eb);
+			std::memcpy(&y, &b[lane * eb], eb);
+			LaneOp res = alu(d.opcode, d.type, d.sat, x, y);
+			if (!res.ok) {
+				fail("opcode has no meaning for the instruction type");
+				return;
+			}
+			std::memcpy(&out[lane * eb], &res.bits, eb);
+		}
+		r[d.dst] = out;
+	}
+};
+
+// Run `build` at `type` over inputs a/b/c (null = unbound), into a fresh output.
+std::vector<uint8_t> run_kernel(ppu::ShaderInfo (*build)(uint32_t *, uint32_t, uint32_t),
+								uint32_t type,
+								std::vector<uint8_t> *a,
+								std::vector<uint8_t> *b = nullptr,
+								std::vector<uint8_t> *c = nullptr)
+{
+	uint32_t inst[32]{};
+	auto si = build(inst, type, 2);
+	std::vector<uint8_t> out(a->size(), 0xEE);
+	Machine m;
+	m.image = {a, &out, b, c};
+	m.run(inst, si.inst_dwords);
+	if (!m.ok)
+		fprintf(stderr, "model: %s\n", m.why);
+	CHECK(m.ok);
+	return out;
+}
+
+std::vector<uint8_t> random_image(Rng &rng, size_t bytes)
+{
+	std::vector<uint8_t> v(bytes);
+	for (auto &x : v)
+		x = uint8_t(rng.next());
+	return v;
+}
+
+// -----------------------------------------------------------------------------
+//  The u8 kernels (the hardware-verified set) against their per-byte meaning
+// -----------------------------------------------------------------------------
+void test_u8_kernels()
+{
+	using namespace ppu;
+	Rng rng;
+	auto a = random_image(rng, 64 * 6), b = random_image(rng, 64 * 6), c = random_image(rng, 64 * 6);
+
+	auto each = [&](const std::vector<uint8_t> &out, auto expect) {
+		uint32_t bad = 0;
+		for (size_t i = 0; i < out.size(); i++)
+			bad += out[i] != uint8_t(expect(i));
+		return bad;
+	};
+	CHECK(each(run_kernel(build_copy_shader, TYPE_U8, &a), [&](size_t i) { return a[i]; }) == 0);
+	CHECK(each(run_kernel(build_add_shader, TYPE_U8, &a), [&](size_t i) { return a[i] * 2; }) == 0);
+	CHECK(each(run_kernel(build_addsat_shader, TYPE_U8, &a), [&](size_t i) { return std::min(a[i] * 2, 255); }) == 0);
+	CHECK(each(run_kernel(build_not_shader, TYPE_U8, &a), [&](size_t i) { return 255 - a[i]; }) == 0);
+	// The immediate reaches only the (i%4)==0 byte-lane (compute_test's finding).
+	CHECK(each(run_kernel(build_and_shader, TYPE_U8, &a), [&](size_t i) { return i % 4 ? 0 : a[i] & 0x0F; }) == 0);
+	CHECK(each(run_kernel(build_add2_shader, TYPE_U8, &a, &b), [&](size_t i) { return a[i] + b[i]; }) == 0);
+	CHECK(each(run_kernel(build_addsat2_shader, TYPE_U8, &a, &b),
+			   [&](size_t i) { return std::min(a[i] + b[i], 255); }) == 0);
+	CHECK(each(run_kernel(build_mul2_shader, TYPE_U8, &a, &b), [&](size_t i) { return a[i] * b[i]; }) == 0);
+	CHECK(each(run_kernel(build_mulhi2_shader, TYPE_U8, &a, &b), [&](size_t i) { return (a[i] * b[i]) >> 8; }) == 0);
+	CHECK(each(run_kernel(build_blend_lerp_shader, TYPE_U8, &a, &b, &c), [&](size_t i) {
+			  return ((a[i] * c[i]) >> 8) + ((b[i] * (255 - c[i])) >> 8);
+		  }) == 0);
+}
+
+// -----------------------------------------------------------------------------
+//  Typed kernels
+// -----------------------------------------------------------------------------
+// At TYPE_U8 the typed builders are the u8 ones, word for word.
+void test_typed_u8_identical()
+{
+	using namespace ppu;
+	using Build = ShaderInfo (*)(uint32_t *, uint32_t, uint32_t);
+	const std::pair<Build, Build> pairs[] = {
+		{build_add2_typed_shader, build_add2_shader},
+		{build_addsat2_typed_shader, build_addsat2_shader},
+		{build_mul2_typed_shader, build_mul2_shader},
+		{build_mulhi2_typed_shader, build_mulhi2_shader},
+	};
+	for (auto [typed, plain] : pairs) {
+		uint32_t x[32]{}, y[32]{};
+		auto sx = typed(x, TYPE_U8, 2), sy = plain(y, TYPE_U8, 2);
+		CHECK(sx.inst_dwords == sy.inst_dwords && sx.reg_count == sy.reg_count);
+		CHECK(std::equal(x, x + 32, y));
+	}
+}
+
+// The fields each typed kernel's ALU op must carry.
+void test_typed_encoding()
+{
+	using namespace ppu;
+	struct {
+		uint32_t type;
+		ShaderInfo (*build)(uint32_t *, uint32_t, uint32_t);
+		uint32_t opcode;
+		bool sat;
+	} cases[] = {
+		{TYPE_U16, build_add2_typed_shader, 0x01, false},
+		{TYPE_U16, build_addsat2_typed_shader, 0x3B, false}, // integers: IADDSAT, no .sat
+		{TYPE_S16, build_mul2_typed_shader, 0x3C, false},
+		{TYPE_S16, build_mulhi2_typed_shader, 0x40, false},
+		{TYPE_F16, build_add2_typed_shader, 0x01, false},
+		{TYPE_F16, build_addsat2_typed_shader, 0x01, true}, // floats: ADD.sat
+		{TYPE_F32, build_mul2_typed_shader, 0x03, false},	// float MUL, not IMULLO
+		{TYPE_F32, build_addsat2_typed_shader, 0x01, true},
+	};
+	for (auto &k : cases) {
+		uint32_t inst[32]{};
+		auto si = k.build(inst, k.type, 2);
+		CHECK(si.inst_dwords == 16);
+		Decoded load = decode(&inst[0]), op = decode(&inst[8]), store = decode(&inst[12]);
+		CHECK(load.opcode == 0x79 && load.type == TYPE_U8);
+		CHECK(store.opcode == 0x7A && store.type == TYPE_U8);
+		CHECK(op.opcode == k.opcode && op.type == k.type && op.sat == k.sat);
+	}
+	uint32_t inst[32]{};
+	CHECK(build_mulhi2_typed_shader(inst, TYPE_F32, 2).inst_dwords == 0);
+	CHECK(build_mulhi2_typed_shader(inst, TYPE_F16, 2).inst_dwords == 0);
+}
+
+// Element i of an image, as a bit pattern.
+uint32_t elem(const std::vector<uint8_t> &v, uint32_t type, size_t i)
+{
+	uint32_t x = 0;
+	std::memcpy(&x, v.data() + i * ppu::elem_bytes(type), ppu::elem_bytes(type));
+	return x;
+}
+
+// Random finite values of a float type, spread over a few binades around 1
+// (and some negatives) so that .sat clamps both ways.
+std::vector<uint8_t> random_floats(Rng &rng, uint32_t type, size_t n)
+{
+	std::vector<uint8_t> v(n * ppu::elem_bytes(type));
+	for (size_t i = 0; i < n; i++) {
+		float f = (float(rng.below(20001)) - 10000.0f) / 4096.0f;
+		uint32_t bits = from_float(type, f);
+		std::memcpy(v.data() + i * ppu::elem_bytes(type), &bits, ppu::elem_bytes(type));
+	}
+	return v;
+}
+
+void test_typed_kernels()
+{
+	using namespace ppu;
+	Rng rng;
+	for (uint32_t type : {TYPE_U8, TYPE_U16, TYPE_S16, TYPE_F16, TYPE_F32}) {
+		const uint32_t eb = elem_bytes(type);
+		const size_t n = 256 / eb * 4; // 1 KB images
+		const bool f = is_float_type(type);
+		for (int round = 0; round < 8; round++) {
+			auto a = f ? random_floats(rng, type, n) : random_image(rng, n * eb);
+			auto b = f ? random_floats(rng, type, n) : random_image(rng, n * eb);
+
+			auto add = run_kernel(build_add2_typed_shader, type, &a, &b);
+			auto sat = run_kernel(build_addsat2_typed_shader, type, &a, &b);
+			auto mul = run_kernel(build_mul2_typed_shader, type, &a, &b);
+			uint32_t bad = 0;
+			for (size_t i = 0; i < n; i++) {
+				uint32_t x = elem(a, type, i), y = elem(b, type, i);
+				if (f) {
+					float fx = as_float(type, x), fy = as_float(type, y);
+					bad += elem(add, type, i) != from_float(type, fx + fy);
+					bad += elem(sat, type, i) != from_float(type, std::clamp(fx + fy, 0.0f, 1.0f));
+					bad += elem(mul, type, i) != from_float(type, fx * fy);
+				} else {
+					const int64_t bits = 8 * eb, m = (int64_t(1) << bits) - 1;
+					const bool s = is_signed(type);
+					int64_t ix = as_int(type, x), iy = as_int(type, y);
+					int64_t lo = s ? -(int64_t(1) << (bits - 1)) : 0, hi = s ? (int64_t(1) << (bits - 1)) - 1 : m;
+					bad += elem(add, type, i) != uint32_t((ix + iy) & m);
+					bad += elem(sat, type, i) != uint32_t(std::clamp(ix + iy, lo, hi) & m);
+					bad += elem(mul, type, i) != uint32_t((ix * iy) & m);
+				}
+			}
+			CHECK(bad == 0);
+
+			if (!f) {
+				auto hi = run_kernel(build_mulhi2_typed_shader, type, &a, &b);
+				uint32_t badhi = 0;
+				for (size_t i = 0; i < n; i++) {
+					int64_t p = as_int(type, elem(a, type, i)) * as_int(type, elem(b, type, i));
+					badhi += elem(hi, type, i) != uint32_t((p >> (8 * eb)) & ((int64_t(1) << (8 * eb)) - 1));
+				}
+				CHECK(badhi == 0);
+			}
+		}
+	}
+
+	// Spot values: s16 saturates at both ends, u16 at the top.
+	std::vector<uint8_t> a(32), b(32);
+	const int16_t sa[] = {32000, -32000, 100, -1, 32767, -32768, 0, 12345};
+	const int16_t sb[] = {1000, -1000, -200, 1, 1, -1, 0, -12345};
+	std::memcpy(a.data(), sa, 16);
+	std::memcpy(b.data(), sb, 16);
+	auto s = run_kernel(build_addsat2_typed_shader, TYPE_S16, &a, &b);
+	const int16_t want[] = {32767, -32768, -100, 0, 32767, -32768, 0, 0};
+	CHECK(std::memcmp(s.data(), want, 16) == 0);
+	const uint16_t ua[] = {65535, 65000, 1, 0, 40000, 30000, 65535, 2};
+	const uint16_t ub[] = {1, 1000, 1, 0, 30000, 30000, 0, 65534};
+	std::memcpy(a.data(), ua, 16);
+	std::memcpy(b.data(), ub, 16);
+	auto u = run_kernel(build_addsat2_typed_shader, TYPE_U16, &a, &b);
+	const uint16_t uwant[] = {65535, 65535, 2, 0, 65535, 60000, 65535, 65535};
+	CHECK(std::memcmp(u.data(), uwant, 16) == 0);
+}
+
+// -----------------------------------------------------------------------------
+//  The image-processing library (ppu_kernels.hh) against ppu::ref
+// -----------------------------------------------------------------------------
+// Run a Program over w-byte rows of its inputs, into a fresh output.
+std::vector<uint8_t> run_program(const ppu::Program &p,
+								 uint32_t w,
+								 std::vector<uint8_t> *a,
+								 std::vector<uint8_t> *b = nullptr,
+								 std::vector<uint8_t> *c = nullptr)
+{
+	std::vector<uint8_t> out(a->size(), 0xEE);
+	Machine m;
+	m.image = {a, &out, b, c};
+	m.width = w;
+	m.uniforms = p.uniforms;
+	m.regs = p.info.reg_count;
+	m.run(p.inst, p.info.inst_dwords);
+	if (!m.ok)
+		fprintf(stderr, "model: %s\n", m.why);
+	CHECK(m.ok);
+	return out;
+}
+
+// Bytes that differ, away from the border the kernel doesn't define.
+uint32_t interior_diff(const std::vector<uint8_t> &x, const std::vector<uint8_t> &y, uint32_t w, uint32_t rx, uint32_t ry)
+{
+	const uint32_t h = uint32_t(x.size() / w);
+	uint32_t bad = 0;
+	for (uint32_t yy = ry; yy < h - ry; yy++)
+		for (uint32_t xx = rx; xx < w - rx; xx++)
+			bad += x[yy * w + xx] != y[yy * w + xx];
+	return bad;
+}
+
+void test_load_offsets()
+{
+	using namespace ppu;
+	// The offset is two 5-bit fields in src2's immediate; no offset, no src2.
+	uint32_t I[4]{};
+	emit_img_load_at(I, 3, 0, TYPE_U8, -2, 1);
+	Decoded d = decode(I);
+	CHECK(d.opcode == 0x79 && d.dst == 3 && d.src[2].use && d.src[2].group == 7);
+	CHECK(d.src[2].imm == (0x1Eu | (1u << 5)));
+	uint32_t J[4]{}, K[4]{};
+	emit_img_load_at(J, 3, 0, TYPE_U8, 0, 0);
+	emit_img_load(K, 3, 0, TYPE_U8);
+	CHECK(std::equal(J, J + 4, K));
+	// A uniform operand: group 2, the component replicated.
+	uint32_t M[4]{};
+	emit_mul_uniform(M, 0x40, 1, 2, 4, 3, TYPE_U8);
+	Decoded m = decode(M);
+	CHECK(m.src[1].use && m.src[1].group == 2 && m.src[1].addr == 4 && m.src[1].swz == 0xFF && !m.src[2].use);
+
+	// Each offset reads the shifted neighbourhood: a 1-tap conv at (dx, dy)
+	// with weight 255 is floor(p * 255 / 256) of the neighbour.
+	Rng rng;
+	const uint32_t w = 48;
+	auto a = random_image(rng, w * 8);
+	for (int dy = -2; dy <= 2; dy++)
+		for (int dx = -3; dx <= 3; dx++) {
+			ConvSpec s{3, 2, {}};
+			s.w[(dy + 2) * 7 + dx + 3] = 255;
+			Program p;
+			build_conv(p, s);
+			CHECK(p && p.info.inst_dwords == 12 && p.uniforms.count == 1);
+			auto out = run_program(p, w, &a);
+			std::vector<uint8_t> want(a.size());
+			ref::conv(s, a.data(), want.data(), w, 8);
+			CHECK(interior_diff(out, want, w, 3, 2) == 0);
+		}
+}
+
+void test_filter_kernels()
+{
+	using namespace ppu;
+	Rng rng;
+	const uint32_t w = 64, h = 12;
+	const uint8_t sharpen[9] = {0, 0, 0, 0, 255, 0, 0, 0, 0};
+	const uint8_t gauss3[9] = {16, 32, 16, 32, 64, 32, 16, 32, 16};
+	const uint8_t heavy[9] = {200, 255, 90, 7, 255, 128, 1, 64, 250}; // sums past 255: clamps
+	uint8_t gauss5[25];
+	const uint8_t g5[5] = {1, 4, 6, 4, 1};
+	for (unsigned i = 0; i < 25; i++)
+		gauss5[i] = uint8_t(g5[i / 5] * g5[i % 5]); // /256
+	const ConvSpec specs[] = {
+		conv3x3(sharpen),
+		conv3x3(gauss3),
+		conv3x3(heavy),
+		conv5x5(gauss5),
+		box_blur(1, Axis::X),
+		box_blur(3, Axis::Y),
+		gaussian_blur(1, Axis::Y),
+		gaussian_blur(2, Axis::X),
+		gaussian_blur(3, Axis::Y),
+	};
+	for (int round = 0; round < 4; round++) {
+		auto a = random_image(rng, w * h);
+		for (const ConvSpec &s : specs) {
+			Program p;
+			build_conv(p, s);
+			CHECK(p && p.radius_x == s.rx && p.radius_y == s.ry);
+			std::vector<uint8_t> want(a.size());
+			ref::conv(s, a.data(), want.data(), w, h);
+			CHECK(interior_diff(run_program(p, w, &a), want, w, s.rx, s.ry) == 0);
+		}
+
+		Program sob;
+		build_sobel(sob);
+		std::vector<uint8_t> want(a.size());
+		ref::sobel(a.data(), want.data(), w, h);
+		CHECK(sob && interior_diff(run_program(sob, w, &a), want, w, 1, 1) == 0);
+
+		for (ThresholdSpec t : {ThresholdSpec{0, false}, ThresholdSpec{127, false}, ThresholdSpec{200, true},
+								ThresholdSpec{255, false}}) {
+			Program p;
+			build_threshold(p, t);
+			ref::threshold(t, a.data(), want.data(), uint32_t(a.size()));
+			CHECK(p && run_program(p, w, &a) == want);
+		}
+	}
+
+	// Separable: X then Y gaussian approximates the 5x5 outer product, and
+	// better than the one-pass 5x5 does: its small weights floor to nothing.
+	auto a = random_image(rng, w * h);
+	Program px, py;
+	build_conv(px, gaussian_blur(2, Axis::X));
+	build_conv(py, gaussian_blur(2, Axis::Y));
+	auto tmp = run_program(px, w, &a);
+	auto sep = run_program(py, w, &tmp);
+	std::vector<uint8_t> full(a.size());
+	ref::conv(conv5x5(gauss5), a.data(), full.data(), w, h);
+	double sep_err = 0, full_err = 0;
+	for (uint32_t y = 2; y < h - 2; y++)
+		for (uint32_t x = 2; x < w - 2; x++) {
+			double exact = 0;
+			for (int dy = -2; dy <= 2; dy++)
+				for (int dx = -2; dx <= 2; dx++)
+					exact += a[(y + dy) * w + x + dx] * gauss5[(dy + 2) * 5 + dx + 2] / 256.0;
+			sep_err = std::max(sep_err, std::fabs(sep[y * w + x] - exact));
+			full_err = std::max(full_err, std::fabs(full[y * w + x] - exact));
+		}
+	CHECK(sep_err < 7 && sep_err < full_err);
+
+	// A flat image has no edges; a vertical step is a full-strength one.
+	std::vector<uint8_t> step(w * h);
+	for (uint32_t i = 0; i < step.size(); i++)
+		step[i] = (i % w) < w / 2 ? 0 : 255;
+	Program sob;
+	build_sobel(sob);
+	auto edges = run_program(sob, w, &step);
+	CHECK(edges[5 * w + 10] == 0 && edges[5 * w + w / 2] == 253 && edges[5 * w + w / 2 - 1] == 253);
+
+	// A full 7x7 is 147 instructions; 17 distinct weights are too many
+	// constants, and past 7x7 there is no spec.
+	ConvSpec big{3, 3, {}};
+	for (uint32_t i = 0; i < 49; i++)
+		big.w[i] = uint8_t(3 + i % 5);
+	Program p;
+	CHECK(build_conv(p, big) && p.info.inst_dwords == 4 * (49 * 3 - 1 + 1) && p.info.reg_count == 3);
+	auto noisy = random_image(rng, w * h);
+	std::vector<uint8_t> want(noisy.size());
+	ref::conv(big, noisy.data(), want.data(), w, h);
+	CHECK(interior_diff(run_program(p, w, &noisy), want, w, 3, 3) == 0);
+	CHECK(!build_conv(p, ConvSpec{4, 0, {}}));
+	ConvSpec many{2, 2, {}};
+	for (unsigned i = 0; i < 25; i++)
+		many.w[i] = uint8_t(1 + i);
+	CHECK(!build_conv(p, many));
+	many.w[16] = many.w[17] = many.w[18] = many.w[19] = many.w[20] = many.w[21] = many.w[22] = many.w[23] =
+		many.w[24] = 1;
+	CHECK(build_conv(p, many) && p.uniforms.count == 16);
+}
+
+void test_color_kernels()
+{
+	using namespace ppu;
+	Rng rng;
+	const uint32_t n = 1024;
+	auto x = random_image(rng, n), y = random_image(rng, n), z = random_image(rng, n);
+	std::vector<uint8_t> out[3], want(n);
+	for (uint32_t c = 0; c < 3; c++)
+		for (LinearSpec s : {yuv_to_rgb(c), rgb_to_yuv(c)}) {
+			Program p;
+			build_linear(p, s);
+			CHECK(p && p.inputs == 3 && p.uniforms.first == 8 && p.uniforms.count <= 8);
+			const uint8_t *in[3] = {x.data(), y.data(), z.data()};
+			ref::linear(s, in, want.data(), n);
+			CHECK(run_program(p, n, &x, &y, &z) == want);
+		}
+
+	// Against the float formulas: off by the 256ths and the floors only.
+	uint32_t worst = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		float Y = x[i], U = y[i] - 128.0f, V = z[i] - 128.0f;
+		const float rgb[3] = {Y + 1.402f * V, Y - 0.344136f * U - 0.714136f * V, Y + 1.772f * U};
+		float R = x[i], G = y[i], B = z[i];
+		const float yuv[3] = {0.299f * R + 0.587f * G + 0.114f * B, -0.168736f * R - 0.331264f * G + 0.5f * B + 128,
+							  0.5f * R - 0.418688f * G - 0.081312f * B + 128};
+		const uint8_t px[3] = {x[i], y[i], z[i]};
+		for (uint32_t c = 0; c < 3; c++) {
+			auto clamp = [](float f) { return std::clamp(f, 0.0f, 255.0f); };
+			worst = std::max(worst, uint32_t(std::fabs(ref::linear(yuv_to_rgb(c), px) - clamp(rgb[c]))));
+			worst = std::max(worst, uint32_t(std::fabs(ref::linear(rgb_to_yuv(c), px) - clamp(yuv[c]))));
+		}
+	}
+	CHECK(worst <= 3);
+
+	// Grey stays grey through RGB -> YUV -> RGB.
+	for (uint32_t v = 0; v < 256; v += 15) {
+		const uint8_t grey[3] = {uint8_t(v), uint8_t(v), uint8_t(v)};
+		const uint8_t yuv[3] = {ref::linear(rgb_to_yuv(0), grey), ref::linear(rgb_to_yuv(1), grey),
+								ref::linear(rgb_to_yuv(2), grey)};
+		for (uint32_t c = 0; c < 3; c++)
+			CHECK(std::abs(int(ref::linear(yuv_to_rgb(c), yuv)) - int(v)) <= 3);
+	}
+
+	// A single-input linear map gets all 16 constant words.
+	LinearSpec one{1, {{-300, 100}}, 50};
+	Program p;
+	build_linear(p, one);
+	const uint8_t *in[3] = {x.data()};
+	ref::linear(one, in, want.data(), n);
+	CHECK(p && p.uniforms.first == 0 && run_program(p, n, &x) == want);
+}
+
+// -----------------------------------------------------------------------------
+//  ProgramBuilder (ppu_program.hh): register allocation and encoding
+// -----------------------------------------------------------------------------
+void test_program_encoding()
+{
+	using namespace ppu;
+	// a + b: a -> r1, b -> r2, the sum back in r1 (both die there).
+	Program p;
+	ProgramBuilder b{p};
+	Val x = b.load(0), y = b.load(0, 1, 0);
+	b.finish(b.addsat(x, y));
+	CHECK(p && p.info.inst_dwords == 16 && p.info.reg_count == 3);
+	Decoded d[4];
+	for (unsigned i = 0; i < 4; i++)
+		d[i] = decode(&p.inst[4 * i]);
+	CHECK(d[0].opcode == 0x79 && d[0].dst == 1 && d[1].opcode == 0x79 && d[1].dst == 2);
+	CHECK(d[2].opcode == 0x3B && d[2].dst == 1 && d[2].src[0].addr == 1 && d[2].src[2].addr == 2);
+	CHECK(d[3].opcode == 0x7A && d[3].src[2].addr == 1);
+	// Patching only moves the register: the same instruction with the
+	// register given up front is the same words.
+	uint32_t I[4]{};
+	emit_alu(I, 0x3B, 1, 1, 2, TYPE_U8);
+	CHECK(std::equal(I, I + 4, &p.inst[8]));
+	CHECK(p.vregs[2][0] == 3 && p.vregs[2][1] == 1 && p.vregs[2][2] == 0 && p.vregs[2][3] == 2);
+
+	// A value nobody reads still gets a register, but gives it back at once.
+	ProgramBuilder c{p};
+	Val in = c.load(0);
+	c.not_(in);
+	c.finish(c.addsat(in, uint8_t(7)));
+	CHECK(p && p.info.reg_count == 3);
+	// The same for the very first instruction: its dead load's r1 is free
+	// again for the next one, so a + b still needs only r1 and r2.
+	ProgramBuilder z{p};
+	z.load(0, 1, 1);
+	Val za = z.load(0), zb = z.load(0, 1, 0);
+	z.finish(z.addsat(za, zb));
+	CHECK(p && p.info.reg_count == 3);
+	CHECK(decode(&p.inst[0]).dst == 1 && decode(&p.inst[4]).dst == 1 && decode(&p.inst[8]).dst == 2);
+
+	// Misuse builds nothing: a value from nowhere, none, a missing input.
+	ProgramBuilder e{p};
+	e.finish(e.addsat(e.load(0), Val{9}));
+	CHECK(!p);
+	ProgramBuilder f{p};
+	f.finish(Val{});
+	CHECK(!p);
+	ProgramBuilder g{p, 2};
+	g.finish(g.load(2));
+	CHECK(!p);
+}
+
+void test_program_limits()
+{
+	using namespace ppu;
+	// Registers: 62 values live at once fit (RegCount 63), 63 don't.
+	for (uint32_t live : {62u, 63u}) {
+		Program p;
+		ProgramBuilder b{p};
+		Val v[63];
+		for (uint32_t i = 0; i < live; i++)
+			v[i] = b.load(0, int(i % 32) - 16, int(i / 32));
+		Val sum = v[0];
+		for (uint32_t i = 1; i < live; i++)
+			sum = b.addsat(sum, v[i]);
+		b.finish(sum);
+		CHECK(bool(p) == (live == 62));
+		if (p)
+			CHECK(p.info.reg_count == kMaxRegCount);
+	}
+	// Length: kMaxInstructions, store included, and not one more.
+	for (uint32_t n : {kMaxInstructions, kMaxInstructions + 1}) {
+		Program p;
+		ProgramBuilder b{p};
+		Val v = b.load(0);
+		while (b.size() < n - 1)
+			v = b.addsat(v, uint8_t(1));
+		b.finish(v);
+		CHECK(bool(p) == (n == kMaxInstructions));
+		if (p) {
+			CHECK(p.info.inst_dwords == kMaxProgramDwords && p.info.reg_count == 2);
+			Rng rng;
+			auto a = random_image(rng, 256);
+			auto out = run_program(p, 256, &a);
+			bool same = true;
+			for (size_t i = 0; i < a.size(); i++)
+				same &= out[i] == std::min(255, a[i] + int(n - 2));
+			CHECK(same);
+		}
+	}
+}
+
+// Random straight-line programs, long and with tangled lifetimes, against a
+// per-pixel evaluation of the same ops; the register count must be the most
+// values ever live at once (+ r0), which a linear scan over one basic block
+// achieves.
+void test_program_random()
+{
+	using namespace ppu;
+	struct Op {
+		uint8_t kind, a, b, c; // kind: 0 load, 1 addsat, 2 addsat #c, 3 mulhi #c, 4 not, 5 subsat, 6 and
+		int8_t dx, dy;
+	};
+	Rng rng;
+	const uint32_t w = 48, h = 10;
+	for (int round = 0; round < 40; round++) {
+		const uint32_t inputs = 1 + rng.below(3);
+		Op ops[200];
+		const uint32_t n = 20 + rng.below(150);
+		for (uint32_t i = 0; i < n; i++) {
+			Op &o = ops[i];
+			o = Op{uint8_t(i < 2 ? 0 : rng.below(7)), 0, 0, uint8_t(rng.below(6) * 51), 0, 0};
+			// Mostly recent operands, now and then an old one: long lifetimes.
+			auto pick = [&] { return uint8_t(rng.below(4) ? i - 1 - rng.below(std::min(i, 4u)) : rng.below(i)); };
+			if (o.kind == 0) {
+				o.a = uint8_t(rng.below(inputs));
+				o.dx = int8_t(rng.below(5)) - 2;
+				o.dy = int8_t(rng.below(5)) - 2;
+			} else {
+				o.a = pick();
+				o.b = pick();
+			}
+		}
+
+		Program p;
+		ProgramBuilder b{p, inputs};
+		Val v[200];
+		for (uint32_t i = 0; i < n; i++) {
+			const Op &o = ops[i];
+			switch (o.kind) {
+				case 0: v[i] = b.load(o.a, o.dx, o.dy); break;
+				case 1: v[i] = b.addsat(v[o.a], v[o.b]); break;
+				case 2: v[i] = b.addsat(v[o.a], o.c); break;
+				case 3: v[i] = b.mulhi(v[o.a], o.c); break;
+				case 4: v[i] = b.not_(v[o.a]); break;
+				case 5: v[i] = b.subsat(v[o.a], v[o.b]); break;
+				case 6: v[i] = b.alu(0x5D, v[o.a], v[o.b]); break;
+			}
+		}
+		b.finish(v[n - 1]);
+		CHECK(p);
+
+		// Most values live at once, on the builder's own instruction list
+		uint32_t last[kMaxInstructions + 1] = {}, def[kMaxInstructions + 1] = {};
+		const uint32_t count = p.info.inst_dwords / 4;
+		for (uint32_t i = 0; i < count; i++)
+			for (unsigned k = 0; k < 4; k++)
+				if (uint16_t id = p.vregs[i][k])
+					(k ? last : def)[id] = i;
+		uint32_t most = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t live = 0;
+			for (uint32_t id = 1; id <= kMaxInstructions; id++)
+				if (def[id] || last[id])
+					live += (def[id] <= i && last[id] > i) || (def[id] == i && last[id] < i);
+			most = std::max(most, live);
+		}
+		CHECK(p.info.reg_count == most + 1);
+
+		std::vector<uint8_t> in[3];
+		for (uint32_t k = 0; k < 3; k++)
+			in[k] = random_image(rng, w * h);
+		auto out = run_program(p, w, &in[0], inputs > 1 ? &in[1] : nullptr, inputs > 2 ? &in[2] : nullptr);
+		uint32_t bad = 0;
+		for (uint32_t y = 2; y < h - 2; y++)
+			for (uint32_t x = 2; x < w - 2; x++) {
+				uint8_t r[200];
+				for (uint32_t i = 0; i < n; i++) {
+					const Op &o = ops[i];
+					const int A = r[o.a], B = r[o.b];
+					switch (o.kind) {
+						case 0: r[i] = in[o.a][(y + o.dy) * w + x + o.dx]; break;
+						case 1: r[i] = uint8_t(std::min(255, A + B)); break;
+						case 2: r[i] = uint8_t(std::min(255, A + o.c)); break;
+						case 3: r[i] = uint8_t((A * o.c) >> 8); break;
+						case 4: r[i] = uint8_t(~A); break;
+						case 5: r[i] = uint8_t(std::max(0, A - B)); break;
+						case 6: r[i] = uint8_t(A & B); break;
+					}
+				}
+				bad += out[y * w + x] != r[n - 1];
+			}
+		CHECK(bad == 0);
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  f16 conversions
+// -----------------------------------------------------------------------------
+void test_f16()
+{
+	using ppu::f16_from_float;
+	using ppu::float_from_f16;
+	// Every finite half survives the round trip (incl. subnormals and -0).
+	uint32_t bad = 0;
+	for (uint32_t h = 0; h < 0x10000; h++)
+		if ((h & 0x7C00) != 0x7C00)
+			bad += f16_from_float(float_from_f16(uint16_t(h))) != h;
+	CHECK(bad == 0);
+	// Halfway between two halves rounds to the even one.
+	for (uint32_t h = 0; h < 0x7BFF; h++) {
+		float lo = float_from_f16(uint16_t(h)), hi = float_from_f16(uint16_t(h + 1));
+		float mid = lo + (hi - lo) / 2; // exact: halves have 11-bit mantissas
+		if (f16_from_float(mid) != ((h & 1) ? h + 1 : h))
+			bad++;
+	}
+	CHECK(bad == 0);
+	CHECK(f16_from_float(1.0f) == 0x3C00 && f16_from_float(-2.0f) == 0xC000);
+	CHECK(f16_from_float(65504.0f) == 0x7BFF && f16_from_float(65519.0f) == 0x7BFF);
+	CHECK(f16_from_float(65520.0f) == 0x7C00 && f16_from_float(1e9f) == 0x7C00);
+	CHECK(f16_from_float(1e-9f) == 0 && f16_from_float(5.9604645e-8f) == 1); // smallest subnormal
+}
+
+// -----------------------------------------------------------------------------
+//  NEON kernels
+// -----------------------------------------------------------------------------
+// The CPU versions of the ppu_asm.hh kernels against the model running the
+// GPU program, and of the image kernels against ppu::ref, at sizes that
+// leave a ragged end for the scalar tail.
+void test_neon_kernels()
+{
+	using namespace ppu;
+	Rng rng;
+	const uint32_t n = 64 * 6;
+	auto a = random_image(rng, n), b = random_image(rng, n), c = random_image(rng, n);
+	using Build = ShaderInfo (*)(uint32_t *, uint32_t, uint32_t);
+	using One = void (*)(const uint8_t *, uint8_t *, uint32_t);
+	using Two = void (*)(const uint8_t *, const uint8_t *, uint8_t *, uint32_t);
+	const std::pair<Build, One> ones[] = {
+		{build_copy_shader, neon::copy},
+		{build_add_shader, neon::add},
+		{build_addsat_shader, neon::addsat},
+		{build_not_shader, neon::not_},
+	};
+	const std::pair<Build, Two> twos[] = {
+		{build_add2_shader, neon::add2},
+		{build_addsat2_shader, neon::addsat2},
+		{build_mul2_shader, neon::mul2},
+		{build_mulhi2_shader, neon::mulhi2},
+	};
+	for (uint32_t len : {n, n - 1, n - 15, 7u}) {
+		std::vector<uint8_t> out(n, 0xEE);
+		for (auto [build, cpu] : ones) {
+			auto gpu = run_kernel(build, TYPE_U8, &a);
+			cpu(a.data(), out.data(), len);
+			CHECK(std::equal(out.begin(), out.begin() + len, gpu.begin()));
+		}
+		for (auto [build, cpu] : twos) {
+			auto gpu = run_kernel(build, TYPE_U8, &a, &b);
+			cpu(a.data(), b.data(), out.data(), len);
+			CHECK(std::equal(out.begin(), out.begin() + len, gpu.begin()));
+		}
+		auto gpu = run_kernel(build_blend_lerp_shader, TYPE_U8, &a, &b, &c);
+		neon::blend_lerp(a.data(), b.data(), c.data(), out.data(), len);
+		CHECK(std::equal(out.begin(), out.begin() + len, gpu.begin()));
+
+		// The immediate reaches each byte-lane through its 32-bit component.
+		for (uint32_t imm : {0x0Fu, 0xFFFFFu, 0x5A3C7u, 0xFFFFFFFFu}) {
+			uint32_t inst[16]{};
+			auto si = build_and_imm_shader(inst, imm, TYPE_U8, 2);
+			std::vector<uint8_t> want(n, 0xEE);
+			Machine m;
+			m.image = {&a, &want, nullptr, nullptr};
+			m.run(inst, si.inst_dwords);
+			CHECK(m.ok);
+			neon::and_imm(imm, a.data(), out.data(), len);
+			CHECK(std::equal(out.begin(), out.begin() + len, want.begin()));
+		}
+	}
+	// dp2x8: the case the hardware confirms (compute_test), then the model.
+	std::vector<uint8_t> ones1(n, 1), out(n);
+	neon::dp2x8(ones1.data(), out.data(), n);
+	CHECK(std::all_of(out.begin(), out.end(), [](uint8_t v) { return v == 2; }));
+	neon::dp2x8(a.data(), out.data(), n - 3);
+	for (uint32_t i = 0; i < n - 3; i++)
+		CHECK(out[i] == uint8_t(2 * a[i] * a[i]));
+
+	// Image kernels, with zeroed borders, widths off the 16-byte grid.
+	const uint8_t heavy[9] = {200, 255, 90, 7, 255, 128, 1, 64, 250};
+	const ConvSpec specs[] = {conv3x3(heavy), box_blur(3, Axis::X), gaussian_blur(2, Axis::Y)};
+	for (uint32_t w : {64u, 45u, 19u}) {
+		const uint32_t h = 9;
+		auto img = random_image(rng, w * h);
+		std::vector<uint8_t> got(w * h, 0xEE), want(w * h);
+		for (const ConvSpec &s : specs) {
+			ref::conv(s, img.data(), want.data(), w, h);
+			neon::conv(s, img.data(), got.data(), w, h);
+			CHECK(got == want);
+		}
+		ref::sobel(img.data(), want.data(), w, h);
+		neon::sobel(img.data(), got.data(), w, h);
+		CHECK(got == want);
+		for (ThresholdSpec t : {ThresholdSpec{0, false}, ThresholdSpec{200, true}}) {
+			ref::threshold(t, img.data(), want.data(), w * h);
+			neon::threshold(t, img.data(), got.data(), w * h);
+			CHECK(got == want);
+		}
+	}
+	const uint8_t *planes[3] = {a.data(), b.data(), c.data()};
+	std::vector<uint8_t> got(n), want(n);
+	for (uint32_t ch = 0; ch < 3; ch++)
+		for (LinearSpec s : {yuv_to_rgb(ch), rgb_to_yuv(ch)}) {
+			ref::linear(s, planes, want.data(), n - 5);
+			neon::linear(s, planes, got.data(), n - 5);
+			CHECK(std::equal(got.begin(), got.end() - 5, want.begin()));
+		}
+}
+
+} // namespace
+
+int main()
+{
+	test_f16();
+	test_u8_kernels();
+	test_typed_u8_identical();
+	test_typed_encoding();
+	test_typed_kernels();
+	test_load_offsets();
+	test_filter_kernels();
+	test_color_kernels();
+	test_program_encoding();
+	test_program_limits();
+	test_program_random();
+	test_neon_kernels();
+
+	if (failures) {
+		printf("FAILED: %d check(s)\n", failures);
+		return 1;
+	}
+	printf("all ppu_asm tests passed\n");
+	return 0;
+}